@@ -0,0 +1,473 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "array.h"
+#include "vm.h"
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Every kernel keeps ARRAY_LANES partial results and works through the array that many values at a time. Each step is a loop
+// over the lanes with no branches in it, which the compiler turns into vector instructions (as in lockstep.c); the lanes
+// are only combined at the end, and the values left over after the last full step go into lane 0.
+#define ARRAY_LANES 16
+// Runs the statement after it for every lane, with l the lane.
+#define EACH_LANE for (l = 0; l < ARRAY_LANES; l++)
+// A value as its top half, signed, and its bottom 32 bits. Sums of each half in 64 bits are exact for any number of values
+// an array can hold, which is what makes checking a whole sum for overflow at the end cheap (see exactSum).
+#define HIGH_HALF(x) ((long long) (x) >> 32)
+#define LOW_HALF(x) ((unsigned long long) (x) & 0xffffffffULL)
+
+// Function: exactSum
+// Description: Puts back together a sum kept as the sum of its values' top halves and the sum of their bottom halves.
+// Params: Sum of the top halves, sum of the bottom halves, where to put the sum wrapped to a wicInt.
+// Returns: 1 if the sum does not fit in a wicInt, 0 if it is exact.
+// Modifies: Sum.
+static int exactSum(long long high, unsigned long long low, wicInt* sum)
+{
+	// The sum is top * 2^32 plus the bottom 32 bits of low.
+	long long top = high + (long long) (low >> 32);
+	long long value = (long long) (((unsigned long long) top << 32) + LOW_HALF(low));
+	*sum = (wicInt) (wicUnsigned) value;
+	return top < -2147483647LL - 1 || top > 2147483647LL || value < WIC_INT_MIN || value > WIC_INT_MAX;
+}
+
+// Function: releaseArray
+// Description: Frees or unmaps an array's values, leaving it empty.
+// Params: Array.
+// Returns: None.
+// Modifies: Array.
+static void releaseArray(arrayType* array)
+{
+#if !defined(_WIN32)
+	if (array -> mappedBytes > 0)
+		munmap(array -> values, array -> mappedBytes);
+	else
+#endif
+		free(array -> values);
+	array -> values = NULL;
+	array -> length = 0;
+	array -> mappedBytes = 0;
+}
+
+// Function: resizeArray
+// Description: Runtime side of 'array' - makes an array the given number of zeros, in place of whatever it held.
+// Params: Array number, length, source line.
+// Returns: 0, or -1 with an error printed if the length is negative or too large.
+// Modifies: The array.
+int resizeArray(int array, wicInt length, int line)
+{
+	arrayType* target = &currentVm -> arrays[array];
+	// An array's length is an int, which only a 64 bit wicInt can be too large for.
+#if defined(WIC_INT64)
+	if (length < 0 || length > INT_MAX)
+#else
+	if (length < 0)
+#endif
+	{
+		vmPrintf("\nAn array cannot hold " WIC_INT_FORMAT " values, on line %d!\n", length, line);
+		return -1;
+	}
+	releaseArray(target);
+	// Always at least one value, so the values are never NULL.
+	target -> values = (wicInt*) calloc(length > 0 ? (size_t) length : 1, sizeof(wicInt));
+	if (target -> values == NULL)
+	{
+		printf("Out of memory making an array of " WIC_INT_FORMAT " values!\n", length);
+		exit(5);
+	}
+	target -> length = (int) length;
+	return 0;
+}
+
+// Function: mapArrayFile
+// Description: Gives an array the values in a file, raw wicInts in this build's byte order and width, as the program starts.
+//                Regular files are mapped copy-on-write, so the values are only read in as the program gets to them and
+//                'astore' never writes to the file; anything else (or any file, where there is no mmap) is read in whole.
+//                Must follow resolveProgram.
+// Params: Array name, file name.
+// Returns: 0 on success, 1 if the program has no such array, 2 if the file could not be read, 3 if it does not hold whole
+//            values or holds too many.
+// Modifies: The array.
+int mapArrayFile(char* name, char* fileName)
+{
+	int array = retrieve(&vmArrayTable, name);
+	FILE* file;
+	arrayType* target;
+	size_t bytes = 0;
+	size_t got;
+	if (array < 0)
+	{
+		printf("The program has no array called %s!\n", name);
+		return 1;
+	}
+	file = fopen(fileName, "rb");
+	if (file == NULL)
+	{
+		printf("The array file %s could not be opened!\n", fileName);
+		return 2;
+	}
+	target = &currentVm -> arrays[array];
+	releaseArray(target);
+#if !defined(_WIN32)
+	{
+		struct stat info;
+		if (fstat(fileno(file), &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+		{
+			void* mapped = mmap(NULL, (size_t) info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fileno(file), 0);
+			if (mapped != MAP_FAILED)
+			{
+				madvise(mapped, (size_t) info.st_size, MADV_SEQUENTIAL);
+				target -> values = (wicInt*) mapped;
+				target -> mappedBytes = bytes = (size_t) info.st_size;
+			}
+		}
+	}
+#endif
+	if (target -> mappedBytes == 0)
+	{
+		size_t capacity = 1 << 16;
+		target -> values = (wicInt*) malloc(capacity);
+		while (target -> values != NULL && (got = fread((char*) target -> values + bytes, 1, capacity - bytes, file)) > 0)
+		{
+			bytes += got;
+			if (bytes == capacity)
+			{
+				wicInt* grown = (wicInt*) realloc(target -> values, capacity * 2);
+				if (grown == NULL)
+					free(target -> values);
+				target -> values = grown;
+				capacity *= 2;
+			}
+		}
+		if (target -> values == NULL)
+		{
+			printf("Out of memory reading the array file %s!\n", fileName);
+			exit(5);
+		}
+	}
+	fclose(file);
+	if (bytes % sizeof(wicInt) != 0 || bytes / sizeof(wicInt) > 2147483647U)
+	{
+		printf("The array file %s does not hold a whole number of %d byte values, or holds too many!\n", fileName,
+			(int) sizeof(wicInt));
+		releaseArray(target);
+		return 3;
+	}
+	target -> length = (int) (bytes / sizeof(wicInt));
+	return 0;
+}
+
+// Function: releaseArrays
+// Description: Frees every array of the current VM, and the arrays themselves. The array table is left alone. The arrays
+//                may not have been made yet - a program that ran out of memory loading has a count but no arrays.
+// Params: None.
+// Returns: None.
+// Modifies: Arrays.
+void releaseArrays()
+{
+	int i;
+	for (i = 0; currentVm -> arrays != NULL && i < currentVm -> arrayCount; i++)
+		releaseArray(&currentVm -> arrays[i]);
+	free(currentVm -> arrays);
+	currentVm -> arrays = NULL;
+	currentVm -> arrayCount = 0;
+}
+
+// Function: emptyArrays
+// Description: Empties every array of the current VM, as a program finds them when it starts, but keeps the arrays.
+// Params: None.
+// Returns: None.
+// Modifies: Arrays.
+void emptyArrays()
+{
+	int i;
+	for (i = 0; i < currentVm -> arrayCount; i++)
+		releaseArray(&currentVm -> arrays[i]);
+}
+
+// Function: printArrays
+// Description: Prints the array table - each array's name and length - after the symbol table, if the program has arrays.
+// Params: None.
+// Returns: None.
+// Modifies: None.
+void printArrays()
+{
+	int i;
+	if (vmArrayTable.size == 0)
+		return;
+	vmPrintf("\nArray Table Values: \n");
+	for (i = 0; i < vmArrayTable.size; i++)
+	{
+		vmPrintf("Array: <%s>, Length: <%d>\n", vmArrayTable.entries[i].key,
+			currentVm -> arrays[vmArrayTable.entries[i].value].length);
+	}
+}
+
+// Function: arraySum
+// Description: Runtime side of 'asum' - adds up every value in an array. The sum is exact however the values are grouped, so
+//                it only overflows if the whole sum does not fit, never part way through.
+// Params: Array, where to put the sum (wrapped around if it does not fit).
+// Returns: 1 if the sum does not fit in a wicInt, 0 if it is exact.
+// Modifies: Sum.
+int arraySum(arrayType* array, wicInt* sum)
+{
+	long long high[ARRAY_LANES];
+	unsigned long long low[ARRAY_LANES];
+	wicInt* values = array -> values;
+	int n = array -> length;
+	int i, l;
+	EACH_LANE
+	{
+		high[l] = 0;
+		low[l] = 0;
+	}
+	for (i = 0; i + ARRAY_LANES <= n; i += ARRAY_LANES)
+	{
+		EACH_LANE
+		{
+			high[l] += HIGH_HALF(values[i + l]);
+			low[l] += LOW_HALF(values[i + l]);
+		}
+	}
+	for (; i < n; i++)
+	{
+		high[0] += HIGH_HALF(values[i]);
+		low[0] += LOW_HALF(values[i]);
+	}
+	for (l = 1; l < ARRAY_LANES; l++)
+	{
+		high[0] += high[l];
+		low[0] += low[l];
+	}
+	return exactSum(high[0], low[0], sum);
+}
+
+// Function: arrayDot
+// Description: Runtime side of 'adot' - multiplies two arrays of the same length value by value and adds up the products.
+//                Each product is checked as 'mult' checks it, and the sum as arraySum does.
+// Params: Arrays, where to put the sum of the products (wrapped around if anything overflowed).
+// Returns: 1 if a product or the sum does not fit in a wicInt, 0 if it is exact.
+// Modifies: Dot.
+int arrayDot(arrayType* a, arrayType* b, wicInt* dot)
+{
+	long long high[ARRAY_LANES];
+	unsigned long long low[ARRAY_LANES];
+	long long overflowed[ARRAY_LANES];
+	wicInt* x = a -> values;
+	wicInt* y = b -> values;
+	int n = a -> length;
+	int i, l;
+	EACH_LANE
+	{
+		high[l] = 0;
+		low[l] = 0;
+		overflowed[l] = 0;
+	}
+#if defined(WIC_INT64)
+	// 64 bit products have to be checked one at a time.
+	for (i = 0; i < n; i++)
+	{
+		wicInt p;
+		overflowed[0] |= MULT_OVERFLOWS(x[i], y[i], &p);
+		high[0] += HIGH_HALF(p);
+		low[0] += LOW_HALF(p);
+	}
+#else
+	// 32 bit products are exact in 64 bits, and fit in a wicInt if they do not change when narrowed to one.
+	for (i = 0; i + ARRAY_LANES <= n; i += ARRAY_LANES)
+	{
+		EACH_LANE
+		{
+			long long product = (long long) x[i + l] * y[i + l];
+			overflowed[l] |= product ^ (wicInt) product;
+			high[l] += HIGH_HALF(product);
+			low[l] += LOW_HALF(product);
+		}
+	}
+	for (; i < n; i++)
+	{
+		long long product = (long long) x[i] * y[i];
+		overflowed[0] |= product ^ (wicInt) product;
+		high[0] += HIGH_HALF(product);
+		low[0] += LOW_HALF(product);
+	}
+#endif
+	for (l = 1; l < ARRAY_LANES; l++)
+	{
+		high[0] += high[l];
+		low[0] += low[l];
+		overflowed[0] |= overflowed[l];
+	}
+	return exactSum(high[0], low[0], dot) || overflowed[0] != 0;
+}
+
+// Function: arrayAdd
+// Description: Runtime side of 'aadd' - adds the second array to the first, value by value. When checked, nothing is changed
+//                unless every sum fits.
+// Params: Array added to, array of the same length to add, 1 to check for overflow first, 0 to wrap around.
+// Returns: 1 if a sum does not fit in a wicInt (and nothing was added), 0 once added.
+// Modifies: First array.
+int arrayAdd(arrayType* a, arrayType* b, int check)
+{
+	wicInt overflowed[ARRAY_LANES];
+	wicInt* x = a -> values;
+	wicInt* y = b -> values;
+	int n = a -> length;
+	int i, l;
+	if (check)
+	{
+		EACH_LANE
+			overflowed[l] = 0;
+		// A sum overflows when it has a different sign from both of the values added.
+		for (i = 0; i + ARRAY_LANES <= n; i += ARRAY_LANES)
+		{
+			EACH_LANE
+			{
+				wicInt sum = (wicInt) ((wicUnsigned) x[i + l] + (wicUnsigned) y[i + l]);
+				overflowed[l] |= (x[i + l] ^ sum) & (y[i + l] ^ sum);
+			}
+		}
+		for (; i < n; i++)
+		{
+			wicInt sum = (wicInt) ((wicUnsigned) x[i] + (wicUnsigned) y[i]);
+			overflowed[0] |= (x[i] ^ sum) & (y[i] ^ sum);
+		}
+		for (l = 1; l < ARRAY_LANES; l++)
+			overflowed[0] |= overflowed[l];
+		if (overflowed[0] < 0)
+			return 1;
+	}
+	for (i = 0; i < n; i++)
+		x[i] = (wicInt) ((wicUnsigned) x[i] + (wicUnsigned) y[i]);
+	return 0;
+}
+
+// Function: arrayMult
+// Description: Runtime side of 'amult' - multiplies the first array by the second, value by value. When checked, nothing is
+//                changed unless every product fits.
+// Params: Array multiplied, array of the same length to multiply it by, 1 to check for overflow first, 0 to wrap around.
+// Returns: 1 if a product does not fit in a wicInt (and nothing was multiplied), 0 once multiplied.
+// Modifies: First array.
+int arrayMult(arrayType* a, arrayType* b, int check)
+{
+	long long overflowed[ARRAY_LANES];
+	wicInt* x = a -> values;
+	wicInt* y = b -> values;
+	int n = a -> length;
+	int i, l;
+	if (check)
+	{
+		EACH_LANE
+			overflowed[l] = 0;
+#if defined(WIC_INT64)
+		for (i = 0; i < n; i++)
+		{
+			wicInt product;
+			overflowed[0] |= MULT_OVERFLOWS(x[i], y[i], &product);
+		}
+#else
+		for (i = 0; i + ARRAY_LANES <= n; i += ARRAY_LANES)
+		{
+			EACH_LANE
+			{
+				long long product = (long long) x[i + l] * y[i + l];
+				overflowed[l] |= product ^ (wicInt) product;
+			}
+		}
+		for (; i < n; i++)
+		{
+			long long product = (long long) x[i] * y[i];
+			overflowed[0] |= product ^ (wicInt) product;
+		}
+#endif
+		for (l = 1; l < ARRAY_LANES; l++)
+			overflowed[0] |= overflowed[l];
+		if (overflowed[0] != 0)
+			return 1;
+	}
+	for (i = 0; i < n; i++)
+		x[i] = (wicInt) ((wicUnsigned) x[i] * (wicUnsigned) y[i]);
+	return 0;
+}
+
+// Function: arrayMin / arrayMax
+// Description: Runtime side of 'amin' and 'amax' - finds the smallest or largest value in an array.
+// Params: Array.
+// Returns: The smallest or largest value, 0 for an empty array.
+// Modifies: None.
+#define ARRAY_EXTREME(better) \
+	wicInt best[ARRAY_LANES]; \
+	wicInt* values = array -> values; \
+	int n = array -> length; \
+	int i, l; \
+	if (n == 0) \
+		return 0; \
+	EACH_LANE \
+		best[l] = values[0]; \
+	for (i = 0; i + ARRAY_LANES <= n; i += ARRAY_LANES) \
+	{ \
+		EACH_LANE \
+			best[l] = values[i + l] better best[l] ? values[i + l] : best[l]; \
+	} \
+	for (; i < n; i++) \
+		best[0] = values[i] better best[0] ? values[i] : best[0]; \
+	for (l = 1; l < ARRAY_LANES; l++) \
+		best[0] = best[l] better best[0] ? best[l] : best[0]; \
+	return best[0]
+
+wicInt arrayMin(arrayType* array)
+{
+	ARRAY_EXTREME(<);
+}
+
+wicInt arrayMax(arrayType* array)
+{
+	ARRAY_EXTREME(>);
+}
+
+// Function: arrayCount
+// Description: Runtime side of 'acounteq'..'acountge' - counts the values in an array that compare with a value as the test
+//                asks: equal, not equal, less, less or equal, greater, greater or equal.
+// Params: Array, test (0 for eq to 5 for ge, in the order of the tstXX opcodes), value.
+// Returns: Number of values that pass.
+// Modifies: None.
+#define COUNT_LOOP(cmp) \
+	for (i = 0; i + ARRAY_LANES <= n; i += ARRAY_LANES) \
+	{ \
+		EACH_LANE \
+			counts[l] += values[i + l] cmp value; \
+	} \
+	for (; i < n; i++) \
+		counts[0] += values[i] cmp value; \
+	break
+
+wicInt arrayCount(arrayType* array, int test, wicInt value)
+{
+	wicInt counts[ARRAY_LANES];
+	wicInt* values = array -> values;
+	int n = array -> length;
+	int i, l;
+	EACH_LANE
+		counts[l] = 0;
+	switch (test)
+	{
+	case 0:
+		COUNT_LOOP(==);
+	case 1:
+		COUNT_LOOP(!=);
+	case 2:
+		COUNT_LOOP(<);
+	case 3:
+		COUNT_LOOP(<=);
+	case 4:
+		COUNT_LOOP(>);
+	default:
+		COUNT_LOOP(>=);
+	}
+	for (l = 1; l < ARRAY_LANES; l++)
+		counts[0] += counts[l];
+	return counts[0];
+}
@@ -0,0 +1,30 @@
+#ifndef ARRAY_H
+#define ARRAY_H
+#include <stddef.h>
+#include "value.h"
+
+// An array variable. Its values are allocated by 'array', or mapped from a file (see mapArrayFile).
+typedef struct
+{
+	wicInt* values;
+	int length;
+	// Bytes mapped from a file, 0 if the values were allocated.
+	size_t mappedBytes;
+} arrayType;
+
+// Arrays - named separately from the scalar variables, numbered by resolveProgram, and worked on a whole array at a time by
+// loops the compiler turns into vector instructions. The arrays and their table belong to the current VM (see vm.h).
+int resizeArray(int array, wicInt length, int line);
+int mapArrayFile(char* name, char* fileName);
+void releaseArrays();
+void emptyArrays();
+void printArrays();
+int arraySum(arrayType* array, wicInt* sum);
+int arrayDot(arrayType* a, arrayType* b, wicInt* dot);
+int arrayAdd(arrayType* a, arrayType* b, int check);
+int arrayMult(arrayType* a, arrayType* b, int check);
+wicInt arrayMin(arrayType* array);
+wicInt arrayMax(arrayType* array);
+wicInt arrayCount(arrayType* array, int test, wicInt value);
+
+#endif
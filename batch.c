@@ -0,0 +1,377 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+#include "instructions.h"
+#include "loader.h"
+#include "optimizer.h"
+#include "vm.h"
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+// Size of the copies made when printing a job's output.
+#define BATCH_COPY_CHUNK 4096
+
+// Lock guarding one worker's queue.
+#if defined(_WIN32)
+typedef CRITICAL_SECTION batchLockType;
+#define LOCK_INIT(l) InitializeCriticalSection(l)
+#define LOCK_FREE(l) DeleteCriticalSection(l)
+#define LOCK(l) EnterCriticalSection(l)
+#define UNLOCK(l) LeaveCriticalSection(l)
+#else
+typedef pthread_mutex_t batchLockType;
+#define LOCK_INIT(l) pthread_mutex_init(l, NULL)
+#define LOCK_FREE(l) pthread_mutex_destroy(l)
+#define LOCK(l) pthread_mutex_lock(l)
+#define UNLOCK(l) pthread_mutex_unlock(l)
+#endif
+
+// One program to run, and how it went.
+typedef struct
+{
+	char* program;
+	// File 'get' reads from, NULL for stdin.
+	char* input;
+	// Everything the program printed, kept until the whole batch is done so jobs never interleave.
+	FILE* output;
+	// 0 once the program has run, 2 if a file could not be opened, 3 if the program did not load.
+	int status;
+	double seconds;
+} batchJobType;
+
+// A worker's queue of job numbers. The worker takes its own jobs from the tail, newest first; idle workers steal from the
+// head, so a thief and the owner only meet when the queue is down to its last job.
+typedef struct
+{
+	batchLockType lock;
+	int* jobs;
+	int head;
+	int tail;
+	int stolen;
+} batchQueueType;
+
+// One run of the whole batch.
+typedef struct
+{
+	batchJobType* jobs;
+	int jobCount;
+	batchQueueType* queues;
+	int threads;
+	engineType engine;
+	overflowModeType overflowMode;
+	int optLevel;
+	int quiet;
+} batchRunType;
+
+typedef struct
+{
+	batchRunType* run;
+	int id;
+} batchWorkerType;
+
+// Function: batchCores
+// Description: Reports how many processors the machine has online.
+// Params: None.
+// Returns: Processor count, at least 1.
+// Modifies: None.
+int batchCores()
+{
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? (int) info.dwNumberOfProcessors : 1;
+#else
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return cores > 0 ? (int) cores : 1;
+#endif
+}
+
+// Function: runJob
+// Description: Runs one program start to finish on a VM of its own, which is thrown away afterwards. The program's output is
+//                kept in a temporary file.
+// Params: Job, engine, overflow mode, optimization level, 1 for quiet.
+// Returns: None.
+// Modifies: Job.
+static void runJob(batchJobType* job, engineType engine, overflowModeType overflowMode, int optLevel, int quiet)
+{
+	vmType* vm = createVm();
+	FILE* program;
+	FILE* input = NULL;
+	double t0 = wallSeconds();
+	useVm(vm);
+	setEngine(engine);
+	setOverflowMode(overflowMode);
+	setQuiet(quiet);
+	setPrompts(0);
+	job -> output = tmpfile();
+	setVmFiles(NULL, job -> output);
+	program = fopen(job -> program, "r");
+	if (job -> input != NULL)
+		input = fopen(job -> input, "r");
+	if (program == NULL || (job -> input != NULL && input == NULL))
+	{
+		fprintf(vmOutput(), "The file could not be loaded - please check the name!\n");
+		job -> status = 2;
+	}
+	else if (loadFile(program) != 0 || resolveProgram() != 0)
+	{
+		job -> status = 3;
+	}
+	else
+	{
+		setVmFiles(input, job -> output);
+		optimizeProgram(optLevel);
+		runEngine();
+		job -> status = 0;
+	}
+	job -> seconds = wallSeconds() - t0;
+	if (program != NULL)
+		fclose(program);
+	if (input != NULL)
+		fclose(input);
+	useVm(NULL);
+	destroyVm(vm);
+}
+
+// Function: takeJob
+// Description: Takes the next job for a worker: the newest one in its own queue, or failing that the oldest one in another
+//                worker's queue. Jobs are all queued before the workers start, so once every queue is empty the batch is done.
+// Params: Run, worker number.
+// Returns: Job number, or -1 if there is nothing left.
+// Modifies: Queues.
+static int takeJob(batchRunType* run, int id)
+{
+	batchQueueType* own = &run -> queues[id];
+	int job = -1;
+	int i;
+	LOCK(&own -> lock);
+	if (own -> tail > own -> head)
+		job = own -> jobs[--own -> tail];
+	UNLOCK(&own -> lock);
+	for (i = 1; job < 0 && i < run -> threads; i++)
+	{
+		batchQueueType* victim = &run -> queues[(id + i) % run -> threads];
+		LOCK(&victim -> lock);
+		if (victim -> tail > victim -> head)
+		{
+			job = victim -> jobs[victim -> head++];
+			own -> stolen++;
+		}
+		UNLOCK(&victim -> lock);
+	}
+	return job;
+}
+
+// Function: batchWorker
+// Description: Worker loop - runs jobs until there are none left anywhere.
+// Params: Worker.
+// Returns: None.
+// Modifies: Jobs, queues.
+static void batchWorker(batchWorkerType* worker)
+{
+	batchRunType* run = worker -> run;
+	int job;
+	while ((job = takeJob(run, worker -> id)) >= 0)
+		runJob(&run -> jobs[job], run -> engine, run -> overflowMode, run -> optLevel, run -> quiet);
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI batchThread(LPVOID worker)
+{
+	batchWorker((batchWorkerType*) worker);
+	return 0;
+}
+#else
+static void* batchThread(void* worker)
+{
+	batchWorker((batchWorkerType*) worker);
+	return NULL;
+}
+#endif
+
+// Function: runPool
+// Description: Runs every job once on the given number of threads. Jobs are dealt out to the workers in contiguous blocks,
+//                and the calling thread works as worker 0.
+// Params: Run, with its jobs and thread count filled in.
+// Returns: Number of jobs stolen from another worker's queue.
+// Modifies: Jobs. Output files from an earlier run of the same jobs are closed.
+static int runPool(batchRunType* run)
+{
+	batchWorkerType* workers = (batchWorkerType*) malloc(run -> threads * sizeof(batchWorkerType));
+	int* slots = (int*) malloc((run -> jobCount + 1) * sizeof(int));
+	int stolen = 0;
+	int i;
+#if defined(_WIN32)
+	HANDLE* handles = (HANDLE*) malloc(run -> threads * sizeof(HANDLE));
+#else
+	pthread_t* handles = (pthread_t*) malloc(run -> threads * sizeof(pthread_t));
+#endif
+	run -> queues = (batchQueueType*) malloc(run -> threads * sizeof(batchQueueType));
+	if (workers == NULL || slots == NULL || handles == NULL || run -> queues == NULL)
+	{
+		printf("Out of memory starting the batch!\n");
+		exit(5);
+	}
+	for (i = 0; i < run -> jobCount; i++)
+	{
+		if (run -> jobs[i].output != NULL)
+			fclose(run -> jobs[i].output);
+		run -> jobs[i].output = NULL;
+		slots[i] = i;
+	}
+	for (i = 0; i < run -> threads; i++)
+	{
+		LOCK_INIT(&run -> queues[i].lock);
+		run -> queues[i].jobs = slots;
+		run -> queues[i].head = (int) ((long long) run -> jobCount * i / run -> threads);
+		run -> queues[i].tail = (int) ((long long) run -> jobCount * (i + 1) / run -> threads);
+		run -> queues[i].stolen = 0;
+		workers[i].run = run;
+		workers[i].id = i;
+	}
+	for (i = 1; i < run -> threads; i++)
+	{
+#if defined(_WIN32)
+		handles[i] = CreateThread(NULL, 0, batchThread, &workers[i], 0, NULL);
+		if (handles[i] == NULL)
+#else
+		if (pthread_create(&handles[i], NULL, batchThread, &workers[i]) != 0)
+#endif
+		{
+			printf("Could not start batch worker thread %d!\n", i);
+			exit(5);
+		}
+	}
+	batchWorker(&workers[0]);
+	for (i = 1; i < run -> threads; i++)
+	{
+#if defined(_WIN32)
+		WaitForSingleObject(handles[i], INFINITE);
+		CloseHandle(handles[i]);
+#else
+		pthread_join(handles[i], NULL);
+#endif
+	}
+	for (i = 0; i < run -> threads; i++)
+	{
+		stolen += run -> queues[i].stolen;
+		LOCK_FREE(&run -> queues[i].lock);
+	}
+	free(run -> queues);
+	run -> queues = NULL;
+	free(handles);
+	free(slots);
+	free(workers);
+	return stolen;
+}
+
+// Function: printJob
+// Description: Prints a finished job: its name, everything it printed, and how it ended.
+// Params: Job.
+// Returns: None.
+// Modifies: None.
+static void printJob(batchJobType* job)
+{
+	char buffer[BATCH_COPY_CHUNK];
+	size_t got;
+	if (job -> input != NULL)
+		printf("==> %s < %s\n", job -> program, job -> input);
+	else
+		printf("==> %s\n", job -> program);
+	if (job -> output != NULL)
+	{
+		rewind(job -> output);
+		while ((got = fread(buffer, 1, sizeof(buffer), job -> output)) > 0)
+			fwrite(buffer, 1, got, stdout);
+	}
+	if (job -> status == 0)
+		printf("\nFinished in %f seconds\n\n", job -> seconds);
+	else
+		printf("\nFailed (exit code %d)\n\n", job -> status);
+}
+
+// Function: runBatch
+// Description: Runs a batch of programs on the selected engine, each on its own VM, spread over a pool of worker threads.
+//                Normally prints every program's output in the order given, then the batch's throughput. When scaling, runs
+//                the whole batch quietly on 1, 2, 4... threads up to the given count and prints the throughput of each.
+// Params: Job specs ('program.wic' or 'program.wic,input' to read 'get' values from a file), how many there are, thread count
+//           (0 for one per processor), times to repeat the list, 1 to scale, optimization level.
+// Returns: 0 if every program ran, otherwise the exit code of the first that did not.
+// Modifies: None.
+int runBatch(char** specs, int specCount, int threads, int repeat, int scale, int optLevel)
+{
+	batchRunType run;
+	double t0, seconds, base = 0.0;
+	int count, i, stolen;
+	int status = 0;
+	if (threads <= 0)
+		threads = batchCores();
+	if (repeat <= 0)
+		repeat = 1;
+	run.jobCount = specCount * repeat;
+	run.jobs = (batchJobType*) calloc(run.jobCount > 0 ? run.jobCount : 1, sizeof(batchJobType));
+	if (run.jobs == NULL)
+	{
+		printf("Out of memory starting the batch!\n");
+		exit(5);
+	}
+	for (i = 0; i < specCount; i++)
+	{
+		char* comma = strchr(specs[i], ',');
+		run.jobs[i].program = specs[i];
+		if (comma != NULL)
+		{
+			*comma = '\0';
+			run.jobs[i].input = comma + 1;
+		}
+	}
+	for (i = specCount; i < run.jobCount; i++)
+		run.jobs[i] = run.jobs[i % specCount];
+	run.engine = currentEngine();
+	run.overflowMode = currentVm -> overflowMode;
+	run.optLevel = optLevel;
+	run.quiet = scale;
+
+	if (scale)
+		printf("%8s %9s %10s %12s %8s %7s\n", "Threads", "Programs", "Seconds", "Programs/s", "Speedup", "Stolen");
+	count = scale ? 1 : threads;
+	for (;;)
+	{
+		run.threads = count;
+		t0 = wallSeconds();
+		stolen = runPool(&run);
+		seconds = wallSeconds() - t0;
+		if (seconds <= 0)
+			seconds = 1e-9;
+		if (base == 0.0)
+			base = seconds;
+		if (scale)
+			printf("%8d %9d %10.4f %12.1f %8.2f %7d\n", count, run.jobCount, seconds, run.jobCount / seconds, base / seconds,
+				stolen);
+		else
+		{
+			for (i = 0; i < run.jobCount; i++)
+				printJob(&run.jobs[i]);
+			printf("%d programs on %d threads in %f seconds: %.1f programs/s (%d stolen)\n", run.jobCount, count, seconds,
+				run.jobCount / seconds, stolen);
+		}
+		fflush(stdout);
+		if (count == threads)
+			break;
+		count = count * 2 < threads ? count * 2 : threads;
+	}
+	for (i = 0; i < run.jobCount; i++)
+	{
+		if (run.jobs[i].output != NULL)
+			fclose(run.jobs[i].output);
+		if (status == 0)
+			status = run.jobs[i].status;
+	}
+	free(run.jobs);
+	return status;
+}
@@ -0,0 +1,9 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+// Batch runner - runs many WIC programs at once, each on a VM of its own (see vm.h), on a pool of worker threads that steal
+// work from each other.
+int runBatch(char** specs, int specCount, int threads, int repeat, int scale, int optLevel);
+int batchCores();
+
+#endif
@@ -0,0 +1,887 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bench.h"
+#include "table.h"
+#include "instructions.h"
+#include "loader.h"
+#include "optimizer.h"
+#include "stack.h"
+#include "libwic.h"
+#include "profiler.h"
+#include "cache.h"
+#include "array.h"
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+// Key counts the table benchmark is run at.
+static const int benchKeyCounts[3] = {10, 100, 10000};
+
+// Reference copy of the old table lookup: entries in an array, scanned front to back with a string compare on each one.
+// It is only here so the hash table has something to be measured against.
+typedef struct
+{
+	char** keys;
+	int* values;
+	int size;
+} linearTable;
+
+// Function: linearRetrieve
+// Description: Linear-scan lookup, as the original retrieve() did it.
+// Params: Table to search, key to look for.
+// Returns: Value of key if found, -1 otherwise.
+// Modifies: None.
+static int linearRetrieve(linearTable* t, char* k)
+{
+	int i;
+	for (i = 0; i < t -> size; i++)
+	{
+		if (strcmp(t -> keys[i], k) == 0)
+			return t -> values[i];
+	}
+	return -1;
+}
+
+// Function: benchTable
+// Description: Times lookups in the hash table behind store/retrieve against the old linear scan at 10, 100 and 10,000 keys.
+//                Keys are looked up round-robin so every one is hit, and the number of lookups per size is chosen to keep
+//                the linear scan at 10,000 keys to a fraction of a second. Results are printed as nanoseconds per lookup.
+// Params: None.
+// Returns: None.
+// Modifies: None.
+void benchTable()
+{
+	int c;
+	printf("%8s %12s %16s %16s %10s\n", "keys", "lookups", "linear ns/op", "hash ns/op", "speedup");
+	for (c = 0; c < 3; c++)
+	{
+		int n = benchKeyCounts[c];
+		int lookups = 20000000 / n < 1000 ? 1000 : 20000000 / n;
+		char** keys = (char**) malloc(n * sizeof(char*));
+		linearTable linear;
+		tableType hashed;
+		clock_t c0, c1;
+		double linearNs, hashNs;
+		long sum = 0;
+		int i;
+		linear.keys = keys;
+		linear.values = (int*) malloc(n * sizeof(int));
+		linear.size = n;
+		initializeTable(&hashed);
+		for (i = 0; i < n; i++)
+		{
+			char name[16];
+			sprintf(name, "var%d", i);
+			keys[i] = internString(name);
+			linear.values[i] = i;
+			store(&hashed, i, name);
+		}
+
+		c0 = clock();
+		for (i = 0; i < lookups; i++)
+			sum += linearRetrieve(&linear, keys[i % n]);
+		c1 = clock();
+		linearNs = (double) (c1 - c0) / CLOCKS_PER_SEC * 1e9 / lookups;
+
+		c0 = clock();
+		for (i = 0; i < lookups; i++)
+			sum -= retrieve(&hashed, keys[i % n]);
+		c1 = clock();
+		hashNs = (double) (c1 - c0) / CLOCKS_PER_SEC * 1e9 / lookups;
+
+		// sum is printed only if something went wrong, which also stops the compiler from dropping the loops.
+		if (sum != 0)
+			printf("Lookup mismatch between the two tables (%ld)!\n", sum);
+		printf("%8d %12d %16.1f %16.1f %9.1fx\n", n, lookups, linearNs, hashNs, hashNs > 0 ? linearNs / hashNs : 0.0);
+		freeTable(&hashed);
+		free(linear.values);
+		free(keys);
+	}
+}
+
+// Function: timeLoad
+// Description: Generates a 1,000,000 line WIC program (labels with forward jumps, 1000 variables, arithmetic) into a temporary
+//                file and reports how long loadFile, resolveProgram and optimizeProgram at the default level take on
+//                it - the whole pipeline a program goes through before it runs.
+// Params: What to call the program in the report, whether every block adds a constant of its own (125,000 distinct
+//           constants for the optimizer to give slots) rather than all sharing one.
+// Returns: None.
+// Modifies: Instruction table, jump/symbol tables.
+static void timeLoad(const char* kind, int distinct)
+{
+	const int lines = 1000000;
+	FILE* file = tmpfile();
+	clock_t c0, c1, c2, c3;
+	long size;
+	int line = 0;
+	int block = 0;
+	if (file == NULL)
+	{
+		printf("Could not create a temporary file for the load benchmark!\n");
+		return;
+	}
+	// Each block is 8 lines, and jumps forward to the label starting the next block.
+	while (line + 8 <= lines)
+	{
+		fprintf(file, "L%d label                     | block %d\n", block, block);
+		fprintf(file, "   push v%d\n", block % 1000);
+		fprintf(file, "   push %d\n", distinct ? block + 7 : 7);
+		fprintf(file, "   add\n");
+		fprintf(file, "   pop v%d\n", (block + 1) % 1000);
+		fprintf(file, "   push v%d\n", block % 1000);
+		fprintf(file, "   jf L%d\n", block + 1);
+		fprintf(file, "\n");
+		line += 8;
+		block++;
+	}
+	fprintf(file, "L%d label\n", block);
+	line++;
+	while (line < lines - 1)
+	{
+		fprintf(file, "   nop\n");
+		line++;
+	}
+	fprintf(file, "   halt\n");
+	fflush(file);
+	size = ftell(file);
+	rewind(file);
+
+	c0 = clock();
+	initialize();
+	if (loadFile(file) != 0)
+		printf("Generated program did not load!\n");
+	c1 = clock();
+	if (resolveProgram() != 0)
+		printf("Generated program did not resolve!\n");
+	c2 = clock();
+	optimizeProgram(OPT_LEVEL_MAX);
+	c3 = clock();
+	fclose(file);
+	printf("Loaded %d lines, %s (%ld bytes, %d labels, %d symbols, %d constants)\n", lines, kind, size, vmJumpTable.size,
+		vmSymbolTable.size, vmSlotCount - vmVariableCount);
+	printf("Load:     %f s\n", (float) (c1 - c0) / CLOCKS_PER_SEC);
+	printf("Resolve:  %f s\n", (float) (c2 - c1) / CLOCKS_PER_SEC);
+	printf("Optimize: %f s (level %d)\n", (float) (c3 - c2) / CLOCKS_PER_SEC, OPT_LEVEL_MAX);
+	printf("Total:    %f s (%.0f lines/s)\n", (float) (c3 - c0) / CLOCKS_PER_SEC,
+		(c3 - c0) > 0 ? lines / ((double) (c3 - c0) / CLOCKS_PER_SEC) : 0.0);
+}
+
+// Function: benchLoad
+// Description: Times loading a million line program from source to the code the engines run (see timeLoad), once with every
+//                block adding the same constant and once with each adding its own.
+// Params: None.
+// Returns: None.
+// Modifies: Instruction table, jump/symbol tables.
+void benchLoad()
+{
+	timeLoad("shared constants", 0);
+	printf("\n");
+	timeLoad("distinct constants", 1);
+}
+
+// Benchmark suite settings: untimed warm-up runs, then timed runs whose median is reported.
+#define SUITE_WARMUP_RUNS 1
+#define SUITE_TIMED_RUNS 5
+
+// Engines the suite runs every program on, by command line name. Each program is then run once more on the switch engine
+// with checkpoints (see checkpoint.c) written every SUITE_CHECKPOINT_INTERVAL instructions, for what they cost, to a file
+// of its own in the temporary directory (see makeCheckpointFile).
+static const char* suiteEngines[5] = {"switch", "threaded", "jit", "register", "trace"};
+#define SUITE_CHECKPOINT_INTERVAL 10000000
+#define SUITE_CHECKPOINT_NAME_MAX 1024
+
+// Writes the WIC source of a suite program to a file, scaled by a size parameter.
+typedef void (*generatorFunction)(FILE* file, int size);
+
+typedef struct
+{
+	const char* name;
+	generatorFunction generate;
+	int size;
+} suiteCase;
+
+// Result of running one program on one engine.
+typedef struct
+{
+	double median;
+	double fastest;
+	// Peak resident set size in KB, -1 where it cannot be measured.
+	long peakKb;
+} suiteResult;
+
+// Function: generateGcd
+// Description: The GCD program from testGCD.wic, with m = size and n = 1 - the program TimeResults.txt was timed with.
+// Params: File to write to, M.
+// Returns: None.
+// Modifies: File.
+static void generateGcd(FILE* file, int size)
+{
+	fprintf(file, "   push %d\n   pop m\n   push 1\n   pop n\n", size);
+	fprintf(file, "L1 label\n   push m\n   push n\n   sub\n   tstne\n   jf L2\n");
+	fprintf(file, "   push m\n   push n\n   sub\n   tstlt\n   jf L3\n");
+	fprintf(file, "   push n\n   push m\n   sub\n   pop n\n   j L4\n");
+	fprintf(file, "L3 label\n   push m\n   push n\n   sub\n   pop m\n");
+	fprintf(file, "L4 label\n   j L1\nL2 label\n   put m\n   halt\n");
+}
+
+// Function: generateNestedLoops
+// Description: Two nested counting loops, size x size iterations, folding i * j into an alternating sum (sum = i * j - sum),
+//                which stays small enough that no overflow mode changes the result.
+// Params: File to write to, loop bound.
+// Returns: None.
+// Modifies: File.
+static void generateNestedLoops(FILE* file, int size)
+{
+	fprintf(file, "   push 0\n   pop i\n   push 0\n   pop sum\n");
+	fprintf(file, "L1 label\n   push i\n   push %d\n   sub\n   tstlt\n   jf L4\n   push 0\n   pop j\n", size);
+	fprintf(file, "L2 label\n   push j\n   push %d\n   sub\n   tstlt\n   jf L3\n", size);
+	fprintf(file, "   push i\n   push j\n   mult\n   push sum\n   sub\n   pop sum\n");
+	fprintf(file, "   push j\n   push 1\n   add\n   pop j\n   j L2\n");
+	fprintf(file, "L3 label\n   push i\n   push 1\n   add\n   pop i\n   j L1\n");
+	fprintf(file, "L4 label\n   put sum\n   halt\n");
+}
+
+// Function: generateArithmetic
+// Description: A loop of long arithmetic expressions (add, sub, mult and div, with modulo done the WIC way) and little
+//                branching.
+// Params: File to write to, iterations.
+// Returns: None.
+// Modifies: File.
+static void generateArithmetic(FILE* file, int size)
+{
+	fprintf(file, "   push 1\n   pop i\n   push 0\n   pop c\n");
+	fprintf(file, "L1 label\n   push i\n   push %d\n   sub\n   tstlt\n   jf L2\n", size);
+	// a = (i mod 1000) * 3 + 7
+	fprintf(file, "   push i\n   push i\n   push 1000\n   div\n   push 1000\n   mult\n   sub\n   push 3\n   mult\n   push 7\n   add\n   pop a\n");
+	// b = a * 5 + 11
+	fprintf(file, "   push a\n   push 5\n   mult\n   push 11\n   add\n   pop b\n");
+	// c = (a * b + c) mod 1000
+	fprintf(file, "   push a\n   push b\n   mult\n   push c\n   add\n   pop t\n");
+	fprintf(file, "   push t\n   push t\n   push 1000\n   div\n   push 1000\n   mult\n   sub\n   pop c\n");
+	fprintf(file, "   push i\n   push 1\n   add\n   pop i\n   j L1\n");
+	fprintf(file, "L2 label\n   put c\n   halt\n");
+}
+
+// Function: generateBranches
+// Description: A loop where every iteration takes one of four paths through a chain of tests on i mod 7.
+// Params: File to write to, iterations.
+// Returns: None.
+// Modifies: File.
+static void generateBranches(FILE* file, int size)
+{
+	fprintf(file, "   push 1\n   pop i\n   push 0\n   pop p\n   push 0\n   pop q\n   push 0\n   pop r\n   push 0\n   pop s\n");
+	fprintf(file, "L1 label\n   push i\n   push %d\n   sub\n   tstlt\n   jf L9\n", size);
+	fprintf(file, "   push i\n   push i\n   push 7\n   div\n   push 7\n   mult\n   sub\n   pop x\n");
+	fprintf(file, "   push x\n   tsteq\n   jf L2\n   push p\n   push 1\n   add\n   pop p\n   j L8\n");
+	fprintf(file, "L2 label\n   push x\n   push 3\n   sub\n   tstlt\n   jf L3\n   push q\n   push 1\n   add\n   pop q\n   j L8\n");
+	fprintf(file, "L3 label\n   push x\n   push 5\n   sub\n   tstgt\n   jf L4\n   push r\n   push 1\n   add\n   pop r\n   j L8\n");
+	fprintf(file, "L4 label\n   push s\n   push 1\n   add\n   pop s\n");
+	fprintf(file, "L8 label\n   push i\n   push 1\n   add\n   pop i\n   j L1\n");
+	fprintf(file, "L9 label\n   put p\n   put q\n   put r\n   put s\n   halt\n");
+}
+
+// Function: generateLabels
+// Description: size labelled blocks, laid out in a scrambled order so every block ends in a real jump, run through 100
+//                times.
+// Params: File to write to, number of blocks.
+// Returns: None.
+// Modifies: File.
+static void generateLabels(FILE* file, int size)
+{
+	int i;
+	fprintf(file, "   push 0\n   pop c\n   push 0\n   pop round\n   j B0\n");
+	for (i = 0; i < size; i++)
+	{
+		// 7919 is prime, so this visits every block once as long as size is not a multiple of it.
+		int block = (int) (((long long) i * 7919) % size);
+		fprintf(file, "B%d label\n   push c\n   push 1\n   add\n   pop c\n   j B%d\n", block, block + 1);
+	}
+	fprintf(file, "B%d label\n   push round\n   push 1\n   add\n   pop round\n", size);
+	fprintf(file, "   push round\n   push 100\n   sub\n   tstlt\n   jf END\n   j B0\n");
+	fprintf(file, "END label\n   put c\n   halt\n");
+}
+
+// Function: generateVariables
+// Description: size variables, each set from the one before it, run through 100 times.
+// Params: File to write to, number of variables.
+// Returns: None.
+// Modifies: File.
+static void generateVariables(FILE* file, int size)
+{
+	int i;
+	fprintf(file, "   push 0\n   pop round\nL1 label\n   push round\n   push 1\n   add\n   pop v0\n");
+	for (i = 1; i < size; i++)
+		fprintf(file, "   push v%d\n   push 1\n   add\n   pop v%d\n", i - 1, i);
+	fprintf(file, "   push round\n   push 1\n   add\n   pop round\n");
+	fprintf(file, "   push round\n   push 100\n   sub\n   tstlt\n   jf L2\n   j L1\nL2 label\n   put v%d\n   halt\n", size - 1);
+}
+
+// Programs in the benchmark suite.
+static const suiteCase suiteCases[] = {
+	{"gcd", generateGcd, 1000},
+	{"gcd", generateGcd, 10000},
+	{"gcd", generateGcd, 100000},
+	{"gcd", generateGcd, 1000000},
+	{"gcd", generateGcd, 10000000},
+	{"gcd", generateGcd, 100000000},
+	{"nested-loops", generateNestedLoops, 2000},
+	{"arithmetic", generateArithmetic, 1000000},
+	{"branches", generateBranches, 1000000},
+	{"labels", generateLabels, 10000},
+	{"variables", generateVariables, 10000}
+};
+
+// Function: compareSeconds
+// Description: qsort comparison for run times.
+// Params: Two doubles.
+// Returns: Negative, zero or positive.
+// Modifies: None.
+static int compareSeconds(const void* a, const void* b)
+{
+	double x = *(const double*) a;
+	double y = *(const double*) b;
+	return x < y ? -1 : x > y;
+}
+
+// Function: timeRuns
+// Description: Runs the loaded program on the selected engine, warm-up runs first, and times each of the rest. Variables and
+//                the stack are reset before every run.
+// Params: Result to fill in (median and fastest run).
+// Returns: None.
+// Modifies: Result, variables, stack.
+static void timeRuns(suiteResult* result)
+{
+	double seconds[SUITE_TIMED_RUNS];
+	int i;
+	for (i = 0; i < SUITE_WARMUP_RUNS + SUITE_TIMED_RUNS; i++)
+	{
+		double t0;
+		memset(vmVariables, 0, vmVariableCount * sizeof(wicInt));
+		vmStack.stackIndex = 0;
+		t0 = wallSeconds();
+		runEngine();
+		if (i >= SUITE_WARMUP_RUNS)
+			seconds[i - SUITE_WARMUP_RUNS] = wallSeconds() - t0;
+	}
+	qsort(seconds, SUITE_TIMED_RUNS, sizeof(double), compareSeconds);
+	result -> median = seconds[SUITE_TIMED_RUNS / 2];
+	result -> fastest = seconds[0];
+}
+
+// Function: measureEngine
+// Description: Times the loaded program on the selected engine. Where fork is available each engine gets a process of its
+//                own, so its peak resident set size is its own and one engine's crash does not take the suite down.
+// Params: Result to fill in.
+// Returns: 0 on success, -1 if the measurement failed.
+// Modifies: Result.
+static int measureEngine(suiteResult* result)
+{
+#if !defined(_WIN32)
+	int fds[2];
+	pid_t child;
+	int status;
+	if (pipe(fds) != 0)
+		return -1;
+	fflush(stdout);
+	child = fork();
+	if (child < 0)
+	{
+		close(fds[0]);
+		close(fds[1]);
+		return -1;
+	}
+	if (child == 0)
+	{
+		struct rusage usage;
+		close(fds[0]);
+		timeRuns(result);
+		getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+		result -> peakKb = usage.ru_maxrss / 1024;
+#else
+		result -> peakKb = usage.ru_maxrss;
+#endif
+		if (write(fds[1], result, sizeof(*result)) != (ssize_t) sizeof(*result))
+			_exit(1);
+		_exit(0);
+	}
+	close(fds[1]);
+	status = read(fds[0], result, sizeof(*result)) == (ssize_t) sizeof(*result) ? 0 : -1;
+	close(fds[0]);
+	waitpid(child, NULL, 0);
+	return status;
+#else
+	timeRuns(result);
+	result -> peakKb = -1;
+	return 0;
+#endif
+}
+
+// Function: makeCheckpointFile
+// Description: Creates an empty file with a name no other file has in the temporary directory ($TMPDIR, or /tmp), for the
+//                suite's checkpoints.
+// Params: Where to put its name (SUITE_CHECKPOINT_NAME_MAX bytes).
+// Returns: 0, or -1 if it could not be created.
+// Modifies: Name.
+static int makeCheckpointFile(char* name)
+{
+#if defined(_WIN32)
+	char directory[MAX_PATH + 1];
+	DWORD length = GetTempPathA(sizeof(directory), directory);
+	return length > 0 && length < sizeof(directory) && GetTempFileNameA(directory, "wic", 0, name) != 0 ? 0 : -1;
+#else
+	const char* directory = getenv("TMPDIR");
+	int fd;
+	if (directory == NULL || directory[0] == '\0')
+		directory = "/tmp";
+	if (strlen(directory) + 32 > SUITE_CHECKPOINT_NAME_MAX)
+		return -1;
+	sprintf(name, "%s/benchSuiteXXXXXX", directory);
+	fd = mkstemp(name);
+	if (fd < 0)
+		return -1;
+	close(fd);
+	return 0;
+#endif
+}
+
+// Function: removeCheckpointFile
+// Description: Deletes the suite's checkpoint file, and the temporary one a checkpoint is written to before it is renamed
+//                into place, in case a run died part way through writing it.
+// Params: Checkpoint file name.
+// Returns: None.
+// Modifies: None.
+static void removeCheckpointFile(char* name)
+{
+	char temporary[SUITE_CHECKPOINT_NAME_MAX + 8];
+	sprintf(temporary, "%s.tmp", name);
+	remove(temporary);
+	remove(name);
+}
+
+// Function: benchSuite
+// Description: Generates each suite program, counts the WIC instructions it executes (on the profiling engine, unoptimized),
+//                then times it on every engine at the default optimization level, and on the switch engine with checkpoints.
+//                Reports the median and fastest of the timed runs, WIC instructions per second at the median, and peak RSS,
+//                one row per program and engine.
+// Params: 1 for JSON output, 0 for CSV.
+// Returns: None.
+// Modifies: Instruction table, jump/symbol tables, variables, stack.
+void benchSuite(int json)
+{
+	int i, e;
+	int rows = 0;
+	int engineCount = (int) (sizeof(suiteEngines) / sizeof(suiteEngines[0]));
+	char checkpointName[SUITE_CHECKPOINT_NAME_MAX];
+	if (makeCheckpointFile(checkpointName) != 0)
+	{
+		printf("Could not create a temporary file for the benchmark suite's checkpoints!\n");
+		exit(2);
+	}
+	setQuiet(1);
+	if (json)
+		printf("[\n");
+	else
+		printf("program,size,engine,opt_level,instructions,runs,median_s,fastest_s,instructions_per_s,peak_rss_kb\n");
+	for (i = 0; i < (int) (sizeof(suiteCases) / sizeof(suiteCases[0])); i++)
+	{
+		FILE* file = tmpfile();
+		long long instructions;
+		if (file == NULL)
+		{
+			printf("Could not create a temporary file for the benchmark suite!\n");
+			removeCheckpointFile(checkpointName);
+			exit(5);
+		}
+		suiteCases[i].generate(file, suiteCases[i].size);
+		rewind(file);
+		initialize();
+		if (loadFile(file) != 0 || resolveProgram() != 0)
+		{
+			printf("Suite program %s did not load!\n", suiteCases[i].name);
+			fclose(file);
+			removeCheckpointFile(checkpointName);
+			exit(3);
+		}
+		fclose(file);
+		// Every engine is credited with the instructions of the program as written, whatever it actually dispatches.
+		optimizeProgram(0);
+		setEngine(ENGINE_PROFILE);
+		runEngine();
+		instructions = profiledInstructions();
+		optimizeProgram(OPT_LEVEL_MAX);
+		for (e = 0; e <= engineCount; e++)
+		{
+			suiteResult result;
+			double ips;
+			const char* engineName = e < engineCount ? suiteEngines[e] : "switch+checkpoint";
+			setEngine(e < engineCount ? (engineType) engineFromName((char*) suiteEngines[e]) : ENGINE_SWITCH);
+			setCheckpoint(e < engineCount ? NULL : checkpointName, SUITE_CHECKPOINT_INTERVAL);
+			if (measureEngine(&result) != 0)
+			{
+				fprintf(stderr, "%s %d on %s failed\n", suiteCases[i].name, suiteCases[i].size, engineName);
+				continue;
+			}
+			ips = result.median > 0 ? instructions / result.median : 0.0;
+			if (json)
+			{
+				printf("%s  {\"program\": \"%s\", \"size\": %d, \"engine\": \"%s\", \"opt_level\": %d, \"instructions\": %lld, "
+					"\"runs\": %d, \"median_s\": %.6f, \"fastest_s\": %.6f, \"instructions_per_s\": %.0f, \"peak_rss_kb\": %ld}",
+					rows > 0 ? ",\n" : "", suiteCases[i].name, suiteCases[i].size, engineName, OPT_LEVEL_MAX,
+					instructions, SUITE_TIMED_RUNS, result.median, result.fastest, ips, result.peakKb);
+			}
+			else
+			{
+				printf("%s,%d,%s,%d,%lld,%d,%.6f,%.6f,%.0f,%ld\n", suiteCases[i].name, suiteCases[i].size, engineName,
+					OPT_LEVEL_MAX, instructions, SUITE_TIMED_RUNS, result.median, result.fastest, ips, result.peakKb);
+			}
+			fflush(stdout);
+			rows++;
+		}
+		setCheckpoint(NULL, 0);
+	}
+	removeCheckpointFile(checkpointName);
+	if (json)
+		printf("\n]\n");
+	setQuiet(0);
+}
+
+// Startup benchmark settings: timed loads of each program, whose median is reported, and where the program is written.
+#define CACHE_TIMED_RUNS 11
+#define CACHE_BENCH_FILE "benchCache.wic"
+
+// Function: timeLoads
+// Description: Times loading the benchmark program, either from the source or from its bytecode cache.
+// Params: Open program file, 1 to load from the cache.
+// Returns: Median load time in seconds, or -1 if the cache could not be used.
+// Modifies: Instruction table, jump/symbol tables, variables, stack.
+static double timeLoads(FILE* file, int cached)
+{
+	double seconds[CACHE_TIMED_RUNS];
+	double t0;
+	int i;
+	for (i = 0; i < CACHE_TIMED_RUNS; i++)
+	{
+		rewind(file);
+		t0 = wallSeconds();
+		initialize();
+		if (cached)
+		{
+			if (loadProgramCache(CACHE_BENCH_FILE, file) != 0)
+				return -1;
+		}
+		else if (loadFile(file) != 0 || resolveProgram() != 0)
+			return -1;
+		seconds[i] = wallSeconds() - t0;
+	}
+	qsort(seconds, CACHE_TIMED_RUNS, sizeof(double), compareSeconds);
+	return seconds[CACHE_TIMED_RUNS / 2];
+}
+
+// Function: benchCache
+// Description: Compares startup from source (parse and resolve) with startup from the bytecode cache, on the labels and
+//                variables suite programs at growing sizes. Each program is written to benchCache.wic in the working
+//                directory, and it and its cache are removed afterwards.
+// Params: None.
+// Returns: None.
+// Modifies: Instruction table, jump/symbol tables, variables, stack.
+void benchCache()
+{
+	static const suiteCase cases[] = {
+		{"labels", generateLabels, 1000},
+		{"labels", generateLabels, 10000},
+		{"labels", generateLabels, 100000},
+		{"variables", generateVariables, 1000},
+		{"variables", generateVariables, 10000},
+		{"variables", generateVariables, 100000}
+	};
+	int i;
+	printf("program,size,lines,source_bytes,cache_bytes,parse_s,cached_s,speedup\n");
+	for (i = 0; i < (int) (sizeof(cases) / sizeof(cases[0])); i++)
+	{
+		FILE* file = fopen(CACHE_BENCH_FILE, "w+");
+		FILE* cache;
+		double parse, cached;
+		long sourceBytes, cacheBytes = -1;
+		if (file == NULL)
+		{
+			printf("Could not write %s for the cache benchmark!\n", CACHE_BENCH_FILE);
+			return;
+		}
+		cases[i].generate(file, cases[i].size);
+		fflush(file);
+		sourceBytes = ftell(file);
+		parse = timeLoads(file, 0);
+		rewind(file);
+		if (parse < 0 || saveProgramCache(CACHE_BENCH_FILE, file) != 0)
+		{
+			printf("Could not build the cache for %s %d!\n", cases[i].name, cases[i].size);
+			fclose(file);
+			break;
+		}
+		cached = timeLoads(file, 1);
+		cache = fopen(CACHE_BENCH_FILE "b", "rb");
+		if (cache != NULL)
+		{
+			fseek(cache, 0, SEEK_END);
+			cacheBytes = ftell(cache);
+			fclose(cache);
+		}
+		printf("%s,%d,%d,%ld,%ld,%.6f,%.6f,%.1f\n", cases[i].name, cases[i].size, vmInstTab.instructionCount, sourceBytes,
+			cacheBytes, parse, cached, cached > 0 ? parse / cached : 0.0);
+		fflush(stdout);
+		fclose(file);
+	}
+	initialize();
+	remove(CACHE_BENCH_FILE);
+	remove(CACHE_BENCH_FILE "b");
+}
+
+// Embedding benchmark settings: compiles timed, and runs timed for each way of running an instance.
+#define EMBED_COMPILES 10000
+#define EMBED_RUNS 1000000
+
+// A small scoring rule, score = 3a + 5b - c, of the kind the library is meant to run millions of times.
+static const char embedProgram[] =
+	"   get a\n   get b\n   get c\n   push a\n   push 3\n   mult\n   push b\n   push 5\n   mult\n   add\n"
+	"   push c\n   sub\n   pop score\n   put score\n   halt\n";
+
+// Inputs the embedding benchmark's callbacks hand out.
+typedef struct
+{
+	wicInt values[3];
+	int taken;
+	wicInt score;
+} embedContext;
+
+// Function: embedGet / embedPut
+// Description: Callbacks for the embedding benchmark - hand out the next input, and keep the score.
+// Params: Context, variable name, value.
+// Returns: embedGet: 0, or -1 once the inputs run out.
+// Modifies: Context.
+static int embedGet(void* context, const char* name, wicInt* value)
+{
+	embedContext* inputs = (embedContext*) context;
+	(void) name;
+	if (inputs -> taken >= 3)
+		return -1;
+	*value = inputs -> values[inputs -> taken++];
+	return 0;
+}
+
+static void embedPut(void* context, const char* name, wicInt value)
+{
+	(void) name;
+	((embedContext*) context) -> score = value;
+}
+
+// Function: printEmbedRow
+// Description: Prints one row of the embedding benchmark.
+// Params: What was timed, how many times, total seconds.
+// Returns: None.
+// Modifies: None.
+static void printEmbedRow(const char* step, int runs, double seconds)
+{
+	printf("%s,%d,%.6f,%.1f,%.0f\n", step, runs, seconds, seconds * 1e9 / runs, seconds > 0 ? runs / seconds : 0.0);
+	fflush(stdout);
+}
+
+// Function: benchEmbed
+// Description: Times the library (see libwic.c) on a small scoring rule: compiling it, then running it with a new instance
+//                every time, with one instance reset between runs, and with that instance taking its input and output
+//                through callbacks rather than arrays. Every score is checked.
+// Params: None.
+// Returns: None.
+// Modifies: None.
+void benchEmbed()
+{
+	wicProgramType* program;
+	wicInstanceType* instance;
+	embedContext context;
+	wicInt inputs[3];
+	wicInt score;
+	double t0;
+	int i, wrong = 0;
+	printf("step,runs,seconds,ns_per_run,runs_per_s\n");
+	t0 = wallSeconds();
+	for (i = 0; i < EMBED_COMPILES; i++)
+		wicFreeProgram(wicCompile(embedProgram, sizeof(embedProgram) - 1, OPT_LEVEL_MAX));
+	printEmbedRow("compile", EMBED_COMPILES, wallSeconds() - t0);
+	program = wicCompile(embedProgram, sizeof(embedProgram) - 1, OPT_LEVEL_MAX);
+	if (program == NULL)
+	{
+		printf("The embedding benchmark program did not compile!\n");
+		exit(3);
+	}
+
+	t0 = wallSeconds();
+	for (i = 0; i < EMBED_RUNS; i++)
+	{
+		inputs[0] = i % 1000;
+		inputs[1] = i % 77;
+		inputs[2] = i % 13;
+		instance = wicCreateInstance(program);
+		wicBindInput(instance, inputs, 3);
+		wicBindOutput(instance, &score, 1);
+		wrong += wicRun(instance, 0) != WIC_HALTED || score != 3 * inputs[0] + 5 * inputs[1] - inputs[2];
+		wicDestroyInstance(instance);
+	}
+	printEmbedRow("create+run+destroy", EMBED_RUNS, wallSeconds() - t0);
+
+	instance = wicCreateInstance(program);
+	wicBindInput(instance, inputs, 3);
+	wicBindOutput(instance, &score, 1);
+	t0 = wallSeconds();
+	for (i = 0; i < EMBED_RUNS; i++)
+	{
+		inputs[0] = i % 1000;
+		inputs[1] = i % 77;
+		inputs[2] = i % 13;
+		wicReset(instance);
+		wrong += wicRun(instance, 0) != WIC_HALTED || score != 3 * inputs[0] + 5 * inputs[1] - inputs[2];
+	}
+	printEmbedRow("reset+run", EMBED_RUNS, wallSeconds() - t0);
+
+	wicSetCallbacks(instance, embedGet, embedPut, &context);
+	t0 = wallSeconds();
+	for (i = 0; i < EMBED_RUNS; i++)
+	{
+		context.values[0] = i % 1000;
+		context.values[1] = i % 77;
+		context.values[2] = i % 13;
+		context.taken = 0;
+		wicReset(instance);
+		wrong += wicRun(instance, 0) != WIC_HALTED
+			|| context.score != 3 * context.values[0] + 5 * context.values[1] - context.values[2];
+	}
+	printEmbedRow("reset+run (callbacks)", EMBED_RUNS, wallSeconds() - t0);
+	wicDestroyInstance(instance);
+	wicFreeProgram(program);
+	if (wrong > 0)
+		printf("%d runs gave the wrong score!\n", wrong);
+}
+
+// Array benchmark settings: values in the array file, and timed runs of each program, whose median is reported.
+#define ARRAY_BENCH_LENGTH 1000000
+#define ARRAY_TIMED_RUNS 5
+#define ARRAY_BENCH_FILE "benchArrays.bin"
+
+// An array reduction, written once with the bulk instruction and once as the WIC loop it replaces. Both leave the result
+// in r. The loop runs i over the array, with its setup before it and its body inside it.
+typedef struct
+{
+	const char* name;
+	const char* bulk;
+	const char* setup;
+	const char* body;
+} arrayCase;
+
+static const char arrayLoopStart[] =
+	"   alen a\n   pop n\n   push 0\n   pop i\nloop label\n   push i\n   push n\n   sub\n   tstlt\n   jf done\n";
+static const char arrayLoopEnd[] = "   push i\n   push 1\n   add\n   pop i\n   j loop\ndone label\n   halt\n";
+
+// Function: timeArrayProgram
+// Description: Loads a program over the benchmark array, mapped from its file, and times runs of it on the selected engine.
+// Params: Program source, where to put the median time to map the file, where to put the program's result (r).
+// Returns: Median run time in seconds.
+// Modifies: Instruction table, jump/symbol/array tables, variables, arrays, stack.
+static double timeArrayProgram(char* source, double* mapSeconds, wicInt* result)
+{
+	double seconds[ARRAY_TIMED_RUNS];
+	double maps[ARRAY_TIMED_RUNS];
+	int i;
+	initialize();
+	if (loadProgram(source, strlen(source)) != 0 || resolveProgram() != 0)
+	{
+		printf("An array benchmark program did not load!\n");
+		exit(3);
+	}
+	optimizeProgram(OPT_LEVEL_MAX);
+	for (i = 0; i < ARRAY_TIMED_RUNS; i++)
+	{
+		double t0 = wallSeconds();
+		if (mapArrayFile("a", ARRAY_BENCH_FILE) != 0)
+			exit(2);
+		maps[i] = wallSeconds() - t0;
+		memset(vmVariables, 0, vmVariableCount * sizeof(wicInt));
+		vmStack.stackIndex = 0;
+		t0 = wallSeconds();
+		runEngine();
+		seconds[i] = wallSeconds() - t0;
+	}
+	*result = vmVariables[retrieve(&vmSymbolTable, "r")];
+	qsort(maps, ARRAY_TIMED_RUNS, sizeof(double), compareSeconds);
+	qsort(seconds, ARRAY_TIMED_RUNS, sizeof(double), compareSeconds);
+	*mapSeconds = maps[ARRAY_TIMED_RUNS / 2];
+	return seconds[ARRAY_TIMED_RUNS / 2];
+}
+
+// Function: benchArrays
+// Description: Compares the bulk array instructions (see array.c) with the WIC loops they replace - sum, dot product, max and
+//                count - over an array of ARRAY_BENCH_LENGTH values mapped from benchArrays.bin, written to the working
+//                directory and removed afterwards. Both run on the threaded engine, and their results are checked against
+//                each other. Reports the median time to map the file and to run each program.
+// Params: None.
+// Returns: None.
+// Modifies: Instruction table, jump/symbol/array tables, variables, arrays, stack.
+void benchArrays()
+{
+	static const arrayCase cases[] = {
+		{"sum", "   asum a\n   pop r\n   halt\n", "",
+			"   push i\n   aload a\n   push r\n   add\n   pop r\n"},
+		{"dot", "   adot a,a\n   pop r\n   halt\n", "",
+			"   push i\n   aload a\n   push i\n   aload a\n   mult\n   push r\n   add\n   pop r\n"},
+		{"max", "   amax a\n   pop r\n   halt\n", "   push 0\n   aload a\n   pop r\n",
+			"   push i\n   aload a\n   pop v\n   push v\n   push r\n   sub\n   tstgt\n   jf skip\n   push v\n   pop r\n"
+			"skip label\n"},
+		{"count_lt_0", "   push 0\n   acountlt a\n   pop r\n   halt\n", "",
+			"   push i\n   aload a\n   tstlt\n   push r\n   add\n   pop r\n"}
+	};
+	char source[1024];
+	FILE* file = fopen(ARRAY_BENCH_FILE, "wb");
+	wicInt value;
+	int i;
+	if (file == NULL)
+	{
+		printf("Could not write %s for the array benchmark!\n", ARRAY_BENCH_FILE);
+		return;
+	}
+	// Small values, so no sum or dot product overflows even with 32 bit values.
+	for (i = 0; i < ARRAY_BENCH_LENGTH; i++)
+	{
+		value = (wicInt) ((i * 7919LL) % 41) - 20;
+		fwrite(&value, sizeof(wicInt), 1, file);
+	}
+	if (fclose(file) != 0)
+	{
+		printf("Could not write %s for the array benchmark!\n", ARRAY_BENCH_FILE);
+		remove(ARRAY_BENCH_FILE);
+		return;
+	}
+	setQuiet(1);
+	setEngine(ENGINE_THREADED);
+	printf("operation,length,map_s,bulk_s,loop_s,speedup,result\n");
+	for (i = 0; i < (int) (sizeof(cases) / sizeof(cases[0])); i++)
+	{
+		double mapSeconds, loopMapSeconds, bulk, loop;
+		wicInt bulkResult, loopResult;
+		bulk = timeArrayProgram((char*) cases[i].bulk, &mapSeconds, &bulkResult);
+		sprintf(source, "   push 0\n   pop r\n%s%s%s%s", cases[i].setup, arrayLoopStart, cases[i].body, arrayLoopEnd);
+		loop = timeArrayProgram(source, &loopMapSeconds, &loopResult);
+		printf("%s,%d,%.6f,%.6f,%.6f,%.1f," WIC_INT_FORMAT "\n", cases[i].name, ARRAY_BENCH_LENGTH, mapSeconds, bulk, loop,
+			bulk > 0 ? loop / bulk : 0.0, bulkResult);
+		if (bulkResult != loopResult)
+			printf("The %s loop gave " WIC_INT_FORMAT " rather than " WIC_INT_FORMAT "!\n", cases[i].name, loopResult, bulkResult);
+		fflush(stdout);
+	}
+	initialize();
+	setQuiet(0);
+	remove(ARRAY_BENCH_FILE);
+}
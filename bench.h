@@ -0,0 +1,12 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+// Benchmarks, run from the command line instead of interpreting a program.
+void benchTable();
+void benchLoad();
+void benchSuite(int json);
+void benchCache();
+void benchEmbed();
+void benchArrays();
+
+#endif
@@ -0,0 +1,738 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bigint.h"
+#include "instructions.h"
+
+// An arbitrary-precision integer: sign and magnitude, the magnitude in base 2^32 digits, least significant first. Zero has
+// no digits and sign 0. Every value owns its digits.
+typedef struct
+{
+	int sign;
+	int length;
+	unsigned int* digits;
+} bigIntType;
+
+// Everything the promoted engine runs on: a bignum for every variable slot, and the stack, bottom first.
+typedef struct
+{
+	bigIntType* vars;
+	bigIntType* stack;
+	int depth;
+	int capacity;
+} promotedStateType;
+
+// Function: allocateDigits
+// Description: Allocates room for a magnitude.
+// Params: Number of digits.
+// Returns: The digits, uninitialized.
+// Modifies: None.
+static unsigned int* allocateDigits(int count)
+{
+	unsigned int* digits = (unsigned int*) malloc((count > 0 ? count : 1) * sizeof(unsigned int));
+	if (digits == NULL)
+	{
+		printf("Out of memory in arbitrary-precision arithmetic!\n");
+		exit(5);
+	}
+	return digits;
+}
+
+// Function: normalize
+// Description: Drops leading zero digits, and makes a value with no digits left zero.
+// Params: Value.
+// Returns: The value, normalized.
+// Modifies: None.
+static bigIntType normalize(bigIntType x)
+{
+	while (x.length > 0 && x.digits[x.length - 1] == 0)
+		x.length--;
+	if (x.length == 0)
+		x.sign = 0;
+	return x;
+}
+
+// Function: bigFromInt
+// Description: Converts a wicInt to a bignum.
+// Params: Value.
+// Returns: New bignum.
+// Modifies: None.
+static bigIntType bigFromInt(wicInt value)
+{
+	bigIntType x;
+	// Negated as unsigned so the most negative value does not overflow.
+	wicUnsigned u = value < 0 ? 0u - (wicUnsigned) value : (wicUnsigned) value;
+	x.digits = allocateDigits(2);
+	x.length = 0;
+	while (u != 0)
+	{
+		x.digits[x.length++] = (unsigned int) (u & 0xFFFFFFFFu);
+		// Two shifts, since shifting a 32 bit value by 32 is undefined.
+		u = u >> 16 >> 16;
+	}
+	x.sign = value < 0 ? -1 : value > 0;
+	return x;
+}
+
+// Function: bigFits
+// Description: Converts a bignum back to a wicInt, if it fits in one.
+// Params: Value, where to put the wicInt.
+// Returns: 1 if it fits, 0 if not (the wicInt is left alone).
+// Modifies: wicInt.
+static int bigFits(bigIntType x, wicInt* value)
+{
+	wicUnsigned u = 0;
+	int i;
+	if (x.length * 32 > (int) sizeof(wicInt) * 8)
+		return 0;
+	for (i = x.length - 1; i >= 0; i--)
+		u = (u << 16 << 16) | x.digits[i];
+	if (x.sign >= 0 ? u > (wicUnsigned) WIC_INT_MAX : u > (wicUnsigned) WIC_INT_MAX + 1)
+		return 0;
+	*value = x.sign < 0 ? (wicInt) (0 - u) : (wicInt) u;
+	return 1;
+}
+
+// Function: bigCopy
+// Description: Copies a bignum.
+// Params: Value.
+// Returns: New bignum with the same value.
+// Modifies: None.
+static bigIntType bigCopy(bigIntType x)
+{
+	bigIntType y = x;
+	y.digits = allocateDigits(x.length);
+	memcpy(y.digits, x.digits, x.length * sizeof(unsigned int));
+	return y;
+}
+
+// Function: bigFree
+// Description: Releases a bignum's digits.
+// Params: Value.
+// Returns: None.
+// Modifies: Value (left as zero).
+static void bigFree(bigIntType* x)
+{
+	free(x -> digits);
+	x -> digits = NULL;
+	x -> length = 0;
+	x -> sign = 0;
+}
+
+// Function: compareMagnitudes
+// Description: Compares the magnitudes of two bignums, ignoring their signs.
+// Params: Two values.
+// Returns: Negative, zero or positive as |a| is less than, equal to or greater than |b|.
+// Modifies: None.
+static int compareMagnitudes(bigIntType a, bigIntType b)
+{
+	int i;
+	if (a.length != b.length)
+		return a.length < b.length ? -1 : 1;
+	for (i = a.length - 1; i >= 0; i--)
+	{
+		if (a.digits[i] != b.digits[i])
+			return a.digits[i] < b.digits[i] ? -1 : 1;
+	}
+	return 0;
+}
+
+// Function: addMagnitudes
+// Description: Works out |a| + |b|.
+// Params: Two values, sign to give the result.
+// Returns: New bignum.
+// Modifies: None.
+static bigIntType addMagnitudes(bigIntType a, bigIntType b, int sign)
+{
+	bigIntType r;
+	unsigned long long carry = 0;
+	int n = a.length > b.length ? a.length : b.length;
+	int i;
+	r.digits = allocateDigits(n + 1);
+	for (i = 0; i < n; i++)
+	{
+		carry += (unsigned long long) (i < a.length ? a.digits[i] : 0) + (i < b.length ? b.digits[i] : 0);
+		r.digits[i] = (unsigned int) carry;
+		carry >>= 32;
+	}
+	r.digits[n] = (unsigned int) carry;
+	r.length = n + 1;
+	r.sign = sign;
+	return normalize(r);
+}
+
+// Function: subtractMagnitudes
+// Description: Works out |a| - |b|, where |a| >= |b|.
+// Params: Two values, sign to give the result.
+// Returns: New bignum.
+// Modifies: None.
+static bigIntType subtractMagnitudes(bigIntType a, bigIntType b, int sign)
+{
+	bigIntType r;
+	unsigned long long borrow = 0;
+	int i;
+	r.digits = allocateDigits(a.length);
+	for (i = 0; i < a.length; i++)
+	{
+		unsigned long long d = (unsigned long long) a.digits[i] - (i < b.length ? b.digits[i] : 0) - borrow;
+		r.digits[i] = (unsigned int) d;
+		borrow = d >> 63;
+	}
+	r.length = a.length;
+	r.sign = sign;
+	return normalize(r);
+}
+
+// Function: bigAdd
+// Description: Works out a + b.
+// Params: Two values.
+// Returns: New bignum.
+// Modifies: None.
+static bigIntType bigAdd(bigIntType a, bigIntType b)
+{
+	if (a.sign == b.sign || b.sign == 0)
+		return addMagnitudes(a, b, a.sign != 0 ? a.sign : b.sign);
+	if (a.sign == 0)
+		return addMagnitudes(a, b, b.sign);
+	if (compareMagnitudes(a, b) >= 0)
+		return subtractMagnitudes(a, b, a.sign);
+	return subtractMagnitudes(b, a, b.sign);
+}
+
+// Function: bigSubtract
+// Description: Works out a - b.
+// Params: Two values.
+// Returns: New bignum.
+// Modifies: None.
+static bigIntType bigSubtract(bigIntType a, bigIntType b)
+{
+	// A negated view of b - the digits are only read.
+	b.sign = -b.sign;
+	return bigAdd(a, b);
+}
+
+// Function: bigMultiply
+// Description: Works out a * b, by long multiplication.
+// Params: Two values.
+// Returns: New bignum.
+// Modifies: None.
+static bigIntType bigMultiply(bigIntType a, bigIntType b)
+{
+	bigIntType r;
+	int i, j;
+	r.length = a.length + b.length;
+	r.digits = allocateDigits(r.length);
+	memset(r.digits, 0, r.length * sizeof(unsigned int));
+	for (i = 0; i < a.length; i++)
+	{
+		unsigned long long carry = 0;
+		for (j = 0; j < b.length; j++)
+		{
+			carry += (unsigned long long) a.digits[i] * b.digits[j] + r.digits[i + j];
+			r.digits[i + j] = (unsigned int) carry;
+			carry >>= 32;
+		}
+		r.digits[i + b.length] = (unsigned int) carry;
+	}
+	r.sign = a.sign * b.sign;
+	return normalize(r);
+}
+
+// Function: divideSmall
+// Description: Divides a magnitude in place by a single digit.
+// Params: Digits, number of digits, divisor (not zero).
+// Returns: Remainder.
+// Modifies: Digits (left holding the quotient).
+static unsigned int divideSmall(unsigned int* digits, int length, unsigned int divisor)
+{
+	unsigned long long remainder = 0;
+	int i;
+	for (i = length - 1; i >= 0; i--)
+	{
+		unsigned long long current = (remainder << 32) | digits[i];
+		digits[i] = (unsigned int) (current / divisor);
+		remainder = current % divisor;
+	}
+	return (unsigned int) remainder;
+}
+
+// Function: bigDivide
+// Description: Works out a / b, rounded towards zero as C does. Single digit divisors take the short division; longer ones
+//                go a bit at a time, shifting the dividend into a remainder and subtracting the divisor whenever it fits.
+// Params: Two values, b not zero.
+// Returns: New bignum.
+// Modifies: None.
+static bigIntType bigDivide(bigIntType a, bigIntType b)
+{
+	bigIntType q = bigCopy(a);
+	bigIntType remainder;
+	int bit, i;
+	q.sign = a.sign * b.sign;
+	if (b.length == 1)
+	{
+		divideSmall(q.digits, q.length, b.digits[0]);
+		return normalize(q);
+	}
+	memset(q.digits, 0, q.length * sizeof(unsigned int));
+	remainder.sign = 1;
+	remainder.length = 0;
+	remainder.digits = allocateDigits(b.length + 1);
+	for (bit = a.length * 32 - 1; bit >= 0; bit--)
+	{
+		unsigned int in = (a.digits[bit / 32] >> (bit % 32)) & 1;
+		// remainder = remainder * 2 + the next bit of a
+		for (i = 0; i < remainder.length; i++)
+		{
+			unsigned int out = remainder.digits[i] >> 31;
+			remainder.digits[i] = (remainder.digits[i] << 1) | in;
+			in = out;
+		}
+		if (in != 0)
+			remainder.digits[remainder.length++] = in;
+		if (compareMagnitudes(remainder, b) >= 0)
+		{
+			unsigned long long borrow = 0;
+			for (i = 0; i < remainder.length; i++)
+			{
+				unsigned long long d = (unsigned long long) remainder.digits[i] - (i < b.length ? b.digits[i] : 0) - borrow;
+				remainder.digits[i] = (unsigned int) d;
+				borrow = d >> 63;
+			}
+			while (remainder.length > 0 && remainder.digits[remainder.length - 1] == 0)
+				remainder.length--;
+			q.digits[bit / 32] |= 1u << (bit % 32);
+		}
+	}
+	free(remainder.digits);
+	return normalize(q);
+}
+
+// Function: writeBig
+// Description: Adds a bignum, in decimal, to the current VM's output buffer. Nine digits at a time come off the bottom of a
+//                copy by dividing it by 10^9.
+// Params: Value.
+// Returns: None.
+// Modifies: Current VM's output buffer.
+static void writeBig(bigIntType x)
+{
+	bigIntType copy;
+	unsigned int* chunks;
+	int count = 0;
+	char text[16];
+	if (x.sign == 0)
+	{
+		vmWrite("0", 1);
+		return;
+	}
+	copy = bigCopy(x);
+	// log10(2^32) < 9.7, so each digit makes at most 1.1 chunks.
+	chunks = allocateDigits(copy.length * 2 + 1);
+	while (copy.length > 0)
+	{
+		chunks[count++] = divideSmall(copy.digits, copy.length, 1000000000u);
+		copy = normalize(copy);
+	}
+	if (x.sign < 0)
+		vmWrite("-", 1);
+	sprintf(text, "%u", chunks[--count]);
+	vmWrite(text, (int) strlen(text));
+	while (count > 0)
+	{
+		sprintf(text, "%09u", chunks[--count]);
+		vmWrite(text, 9);
+	}
+	free(chunks);
+	free(copy.digits);
+}
+
+// Function: pushBig
+// Description: Pushes a value onto the promoted engine's stack, growing it if it is full.
+// Params: State, value (the stack takes ownership).
+// Returns: None.
+// Modifies: State.
+static void pushBig(promotedStateType* s, bigIntType x)
+{
+	if (s -> depth == s -> capacity)
+	{
+		s -> capacity = s -> capacity * 2 + 16;
+		s -> stack = (bigIntType*) realloc(s -> stack, s -> capacity * sizeof(bigIntType));
+		if (s -> stack == NULL)
+		{
+			printf("Out of memory in arbitrary-precision arithmetic!\n");
+			exit(5);
+		}
+	}
+	s -> stack[s -> depth++] = x;
+}
+
+// Function: printPromotedTables
+// Description: printTables, with the variables' arbitrary-precision values.
+// Params: State.
+// Returns: None.
+// Modifies: None.
+static void printPromotedTables(promotedStateType* s)
+{
+	int i;
+	printJumpTable();
+	vmPrintf("\nSymbol Table Values: \n");
+	for (i = 0; i < vmSymbolTable.size; i++)
+	{
+		vmPrintf("Symbol: <%s>, Value: <", vmSymbolTable.entries[i].key);
+		writeBig(s -> vars[vmSymbolTable.entries[i].value]);
+		vmPrintf(">\n");
+	}
+	printArrays();
+}
+
+// Function: popArrayValue
+// Description: Pops a value that is to index or go into an array, which only hold wicInts.
+// Params: State, where to put the value, instruction popping it.
+// Returns: 1 if it fits in a wicInt, otherwise 0 after saying so.
+// Modifies: State, value.
+static int popArrayValue(promotedStateType* s, wicInt* value, instructionType* inst)
+{
+	bigIntType x = s -> stack[--s -> depth];
+	int fits = bigFits(x, value);
+	bigFree(&x);
+	if (!fits)
+		vmPrintf("\nA value on line %d is too large for array %s!\n", inst -> line, inst -> operand);
+	return fits;
+}
+
+// Function: stepArray
+// Description: Runs one array instruction for the promoted engine. The arrays stay wicInts: sums and dot products are
+//                worked out exactly, and anything that would have to store a value too large for one stops the program.
+// Params: State, address of the instruction.
+// Returns: Address of the next instruction, or -1 once the program has stopped with an error.
+// Modifies: State, arrays.
+static int stepArray(promotedStateType* s, int pc)
+{
+	instructionType* inst = &vmCodeTab.instructions[pc];
+	arrayType* array = &currentVm -> arrays[inst -> arg.slot];
+	arrayType* second = &currentVm -> arrays[inst -> a];
+	bigIntType total, term, next, product;
+	wicInt index, value;
+	int i, below;
+	switch (inst -> op)
+	{
+	case OP_ARRAY:
+		if (!popArrayValue(s, &value, inst) || resizeArray(inst -> arg.slot, value, inst -> line) != 0)
+			return -1;
+		return pc + 1;
+	case OP_ALOAD:
+	case OP_ASTORE:
+		if (inst -> op == OP_ASTORE && !popArrayValue(s, &value, inst))
+			return -1;
+		if (!popArrayValue(s, &index, inst))
+			return -1;
+		if (index < 0 || index >= array -> length)
+		{
+			vmPrintf("\nArray index out of bounds for %s on line %d!\n", inst -> operand, inst -> line);
+			return -1;
+		}
+		if (inst -> op == OP_ASTORE)
+			array -> values[index] = value;
+		else
+			pushBig(s, bigFromInt(array -> values[index]));
+		return pc + 1;
+	case OP_ALEN:
+		pushBig(s, bigFromInt(array -> length));
+		return pc + 1;
+	case OP_AMIN:
+		pushBig(s, bigFromInt(arrayMin(array)));
+		return pc + 1;
+	case OP_AMAX:
+		pushBig(s, bigFromInt(arrayMax(array)));
+		return pc + 1;
+	case OP_ASUM:
+	case OP_ADOT:
+		if (inst -> op == OP_ADOT && array -> length != second -> length)
+		{
+			vmPrintf("\nThe arrays %s differ in length on line %d!\n", inst -> operand, inst -> line);
+			return -1;
+		}
+		// The kernels are exact; only a result that does not fit has to be added up again on bignums.
+		if (inst -> op == OP_ASUM ? arraySum(array, &value) == 0 : arrayDot(array, second, &value) == 0)
+		{
+			pushBig(s, bigFromInt(value));
+			return pc + 1;
+		}
+		total = bigFromInt(0);
+		for (i = 0; i < array -> length; i++)
+		{
+			term = bigFromInt(array -> values[i]);
+			if (inst -> op == OP_ADOT)
+			{
+				next = bigFromInt(second -> values[i]);
+				product = bigMultiply(term, next);
+				bigFree(&term);
+				bigFree(&next);
+				term = product;
+			}
+			next = bigAdd(total, term);
+			bigFree(&total);
+			bigFree(&term);
+			total = next;
+		}
+		pushBig(s, total);
+		return pc + 1;
+	case OP_AADD:
+	case OP_AMULT:
+		if (array -> length != second -> length)
+		{
+			vmPrintf("\nThe arrays %s differ in length on line %d!\n", inst -> operand, inst -> line);
+			return -1;
+		}
+		// Checked, so the array is left as it was if any result does not fit.
+		if (inst -> op == OP_AADD ? arrayAdd(array, second, 1) != 0 : arrayMult(array, second, 1) != 0)
+		{
+			vmPrintf("\nA result on line %d is too large for array %s!\n", inst -> line, inst -> operand);
+			return -1;
+		}
+		return pc + 1;
+	case OP_ACOUNTEQ:
+	case OP_ACOUNTNE:
+	case OP_ACOUNTLT:
+	case OP_ACOUNTLE:
+	case OP_ACOUNTGT:
+	case OP_ACOUNTGE:
+		total = s -> stack[--s -> depth];
+		if (bigFits(total, &value))
+			value = arrayCount(array, inst -> op - OP_ACOUNTEQ, value);
+		else
+		{
+			// Larger than every element, or smaller than every element.
+			below = total.sign > 0;
+			value = inst -> op == OP_ACOUNTNE || (below ? inst -> op == OP_ACOUNTLT || inst -> op == OP_ACOUNTLE :
+				inst -> op == OP_ACOUNTGT || inst -> op == OP_ACOUNTGE) ? array -> length : 0;
+		}
+		bigFree(&total);
+		pushBig(s, bigFromInt(value));
+		return pc + 1;
+	default:
+		return pc + 1;
+	}
+}
+
+// Function: stepPromoted
+// Description: Runs one instruction on bignums, the same way the stack engines run it on wicInts.
+// Params: State, address of the instruction.
+// Returns: Address of the next instruction, or -1 once the program has halted or stopped with an error.
+// Modifies: State.
+static int stepPromoted(promotedStateType* s, int pc)
+{
+	instructionType* inst = &vmCodeTab.instructions[pc];
+	bigIntType lop, rop, result;
+	wicInt value;
+	int needed;
+	stackEffect(inst -> op, &needed);
+	if (s -> depth < needed)
+	{
+		vmPrintf("\nStack underflow on line %d!\n", inst -> line);
+		return -1;
+	}
+	switch (inst -> op)
+	{
+	case OP_GET:
+		if (!currentVm -> noPrompts)
+		{
+			vmPrintf("Enter %s > ", inst -> operand);
+			vmFlush();
+		}
+		if (vmReadInt(&value) == 0)
+		{
+			bigFree(&s -> vars[inst -> arg.slot]);
+			s -> vars[inst -> arg.slot] = bigFromInt(value);
+		}
+		return pc + 1;
+	case OP_PUT:
+		if (!currentVm -> quiet)
+		{
+			vmWrite(inst -> operand, (int) strlen(inst -> operand));
+			vmWrite(" = ", 3);
+			writeBig(s -> vars[inst -> arg.slot]);
+			vmWrite("\n", 1);
+		}
+		return pc + 1;
+	case OP_PUSH:
+		pushBig(s, bigCopy(s -> vars[inst -> arg.slot]));
+		return pc + 1;
+	case OP_PUSHI:
+		pushBig(s, bigFromInt(inst -> arg.immediate));
+		return pc + 1;
+	case OP_POP:
+		bigFree(&s -> vars[inst -> arg.slot]);
+		s -> vars[inst -> arg.slot] = s -> stack[--s -> depth];
+		return pc + 1;
+	case OP_ADD:
+	case OP_SUB:
+	case OP_MULT:
+	case OP_DIV:
+	case OP_AND:
+	case OP_OR:
+		rop = s -> stack[s -> depth - 1];
+		lop = s -> stack[s -> depth - 2];
+		if (inst -> op == OP_DIV && rop.sign == 0)
+		{
+			divideByZero(inst -> line);
+			return -1;
+		}
+		if (inst -> op == OP_ADD)
+			result = bigAdd(lop, rop);
+		else if (inst -> op == OP_SUB)
+			result = bigSubtract(lop, rop);
+		else if (inst -> op == OP_MULT)
+			result = bigMultiply(lop, rop);
+		else if (inst -> op == OP_DIV)
+			result = bigDivide(lop, rop);
+		else
+			result = bigFromInt(inst -> op == OP_AND ? rop.sign > 0 && lop.sign > 0 : rop.sign != 0 || lop.sign != 0);
+		bigFree(&s -> stack[s -> depth - 1]);
+		bigFree(&s -> stack[s -> depth - 2]);
+		s -> depth -= 2;
+		pushBig(s, result);
+		return pc + 1;
+	case OP_NOT:
+	case OP_TSTEQ:
+	case OP_TSTNE:
+	case OP_TSTLT:
+	case OP_TSTLE:
+	case OP_TSTGT:
+	case OP_TSTGE:
+		lop = s -> stack[--s -> depth];
+		switch (inst -> op)
+		{
+		case OP_TSTNE:
+			value = lop.sign != 0;
+			break;
+		case OP_TSTLT:
+			value = lop.sign < 0;
+			break;
+		case OP_TSTLE:
+			value = lop.sign <= 0;
+			break;
+		case OP_TSTGT:
+			value = lop.sign > 0;
+			break;
+		case OP_TSTGE:
+			value = lop.sign >= 0;
+			break;
+		default:
+			value = lop.sign == 0;
+			break;
+		}
+		bigFree(&lop);
+		pushBig(s, bigFromInt(value));
+		return pc + 1;
+	case OP_J:
+		return inst -> arg.target;
+	case OP_JF:
+		lop = s -> stack[--s -> depth];
+		value = lop.sign == 0;
+		bigFree(&lop);
+		return value ? inst -> arg.target : pc + 1;
+	case OP_HALT:
+		if (!currentVm -> quiet)
+		{
+			vmPrintf("\nHalted!\n");
+			printPromotedTables(s);
+		}
+		vmFlush();
+		return -1;
+	case OP_MOVE:
+		result = bigCopy(s -> vars[inst -> a]);
+		bigFree(&s -> vars[inst -> arg.slot]);
+		s -> vars[inst -> arg.slot] = result;
+		return pc + 1;
+	case OP_ADDV:
+	case OP_SUBV:
+	case OP_MULTV:
+		lop = s -> vars[inst -> a];
+		rop = s -> vars[inst -> b];
+		result = inst -> op == OP_ADDV ? bigAdd(lop, rop) : inst -> op == OP_SUBV ? bigSubtract(lop, rop) : bigMultiply(lop, rop);
+		bigFree(&s -> vars[inst -> arg.slot]);
+		s -> vars[inst -> arg.slot] = result;
+		return pc + 1;
+	case OP_JFEQ:
+	case OP_JFNE:
+	case OP_JFLT:
+	case OP_JFLE:
+	case OP_JFGT:
+	case OP_JFGE:
+		result = bigSubtract(s -> vars[inst -> a], s -> vars[inst -> b]);
+		switch (inst -> op)
+		{
+		case OP_JFEQ:
+			value = result.sign == 0;
+			break;
+		case OP_JFNE:
+			value = result.sign != 0;
+			break;
+		case OP_JFLT:
+			value = result.sign < 0;
+			break;
+		case OP_JFLE:
+			value = result.sign <= 0;
+			break;
+		case OP_JFGT:
+			value = result.sign > 0;
+			break;
+		default:
+			value = result.sign >= 0;
+			break;
+		}
+		bigFree(&result);
+		return value ? pc + 1 : inst -> arg.target;
+	case OP_LABEL:
+	case OP_NOP:
+		return pc + 1;
+	default:
+		if (inst -> op >= OP_ARRAY && inst -> op <= OP_ACOUNTGE)
+			return stepArray(s, pc);
+		// Running off the end restarts the program.
+		return 0;
+	}
+}
+
+// Function: runPromoted
+// Description: Carries on running the program on arbitrary-precision values, from the instruction an engine stopped in front
+//                of because its result did not fit in a wicInt. The variables and the stack are converted to bignums and the
+//                rest of the run is interpreted one instruction at a time on them - nothing goes back to the fast engines, so
+//                this is for programs that really do need big numbers. Once it stops, variables that fit in a wicInt again
+//                are written back; the others keep the value they had when the program was promoted.
+// Params: Address to carry on from.
+// Returns: None.
+// Modifies: Stack, variables.
+void runPromoted(int pc)
+{
+	promotedStateType s;
+	wicInt value;
+	int i;
+	s.vars = (bigIntType*) malloc((vmSlotCount > 0 ? vmSlotCount : 1) * sizeof(bigIntType));
+	s.stack = NULL;
+	s.depth = 0;
+	s.capacity = 0;
+	if (s.vars == NULL)
+	{
+		printf("Out of memory in arbitrary-precision arithmetic!\n");
+		exit(5);
+	}
+	for (i = 0; i < vmSlotCount; i++)
+		s.vars[i] = bigFromInt(vmVariables[i]);
+	for (i = 1; i <= vmStack.stackIndex; i++)
+		pushBig(&s, bigFromInt(vmStack.theStack[i]));
+	while (pc >= 0)
+		pc = stepPromoted(&s, pc);
+	for (i = 0; i < vmSlotCount; i++)
+	{
+		if (bigFits(s.vars[i], &value))
+			vmVariables[i] = value;
+		bigFree(&s.vars[i]);
+	}
+	for (i = 0; i < s.depth; i++)
+		bigFree(&s.stack[i]);
+	// What was left on the stack may not fit a wicInt.
+	vmStack.stackIndex = 0;
+	free(s.vars);
+	free(s.stack);
+}
@@ -0,0 +1,7 @@
+#ifndef BIGINT_H
+#define BIGINT_H
+
+// Arbitrary-precision engine the program moves on to when an operation overflows in OVERFLOW_PROMOTE mode (see bigint.c).
+void runPromoted(int pc);
+
+#endif
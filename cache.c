@@ -0,0 +1,419 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cache.h"
+#include "instructions.h"
+#include "loader.h"
+#include "table.h"
+#include "vm.h"
+
+// Bytecode cache file layout. Everything is in the byte order, int size and value width (see wicInt) of the build that wrote
+// it; a cache from anywhere else fails the header checks and is simply rebuilt. The header carries a checksum of the whole
+// file, so a cache that was damaged after it was written is rebuilt too rather than run. After the header come, in order:
+//   cacheInstructionType instructions[instructionCount]
+//   int depths[instructionCount + 1]            (instTab.depths, see analyzeStack)
+//   cacheEntryType symbols[symbolCount]         (name -> variable slot, in symbol table order)
+//   cacheEntryType labels[labelCount]           (name -> address, in jump table order)
+//   cacheEntryType arrays[arrayCount]           (name -> array number, in array table order)
+//   char strings[stringBytes]                   ('\0' terminated names, each stored once)
+#define CACHE_MAGIC "WICB"
+#define CACHE_VERSION 4
+#define CACHE_BYTE_ORDER 0x01020304
+#define CACHE_HASH_START 14695981039346656037ULL
+
+typedef struct
+{
+	char magic[4];
+	int version;
+	int byteOrder;
+	// OP_COUNT and sizeof(wicInt) when the cache was written, so a build with different opcodes or values never trusts it.
+	int opcodeCount;
+	int valueSize;
+	// FNV-1a hash and length of the source the cache was built from.
+	unsigned long long sourceChecksum;
+	unsigned long long sourceLength;
+	// FNV-1a hash of the header (taken with this field zero) and everything after it.
+	unsigned long long checksum;
+	int instructionCount;
+	int variableSlots;
+	int maxDepth;
+	int symbolCount;
+	int labelCount;
+	int arrayCount;
+	int stringBytes;
+} cacheHeaderType;
+
+// A resolved instruction. arg is the immediate, slot, array or target exactly as resolveProgram left it, and a the second
+// array of an instruction that has two.
+typedef struct
+{
+	int op;
+	int line;
+	wicInt arg;
+	int a;
+	// Offset of the operand text in the string section.
+	int operand;
+} cacheInstructionType;
+
+typedef struct
+{
+	// Offset of the name in the string section.
+	int key;
+	int value;
+} cacheEntryType;
+
+// String section being built by saveProgramCache, with the offset each name was given.
+typedef struct
+{
+	tableType offsets;
+	char* text;
+	int used;
+	int capacity;
+} stringSectionType;
+
+// Function: cacheName
+// Description: Works out the cache file name for a program: the source name with a 'b' on the end (PROGRAM.wicb).
+// Params: Source file name.
+// Returns: malloc'd cache file name.
+// Modifies: None.
+static char* cacheName(char* sourceName)
+{
+	char* name = (char*) malloc(strlen(sourceName) + 2);
+	if (name == NULL)
+	{
+		printf("Out of memory naming the bytecode cache!\n");
+		exit(5);
+	}
+	strcpy(name, sourceName);
+	strcat(name, "b");
+	return name;
+}
+
+// Function: hashBytes
+// Description: Adds bytes to an FNV-1a hash. Start from CACHE_HASH_START; hashing pieces one after another gives the same
+//                hash as hashing them joined together.
+// Params: Hash so far, bytes, how many.
+// Returns: The hash with the bytes added.
+// Modifies: None.
+static unsigned long long hashBytes(unsigned long long h, const void* bytes, size_t length)
+{
+	const unsigned char* p = (const unsigned char*) bytes;
+	size_t i;
+	for (i = 0; i < length; i++)
+	{
+		h ^= p[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+// Function: checksumSource
+// Description: FNV-1a hash of a whole source file. The file is left at its start, ready to be loaded.
+// Params: Source file, where to put its length.
+// Returns: 64 bit hash of the file.
+// Modifies: Length, the file's position.
+static unsigned long long checksumSource(FILE* source, unsigned long long* length)
+{
+	sourceTextType text;
+	unsigned long long h;
+	readSource(source, &text);
+	h = hashBytes(CACHE_HASH_START, text.text, text.length);
+	*length = text.length;
+	releaseSource(&text);
+	rewind(source);
+	return h;
+}
+
+// Function: validCache
+// Description: Checks a mapped cache file against its checksum and the source it claims to be built from, and checks that
+//                every count, offset, slot and target in it is in range, so a stale, damaged or foreign cache is never run.
+// Params: Mapped cache, source file.
+// Returns: 1 if the cache can be used, 0 if not.
+// Modifies: The source file's position.
+static int validCache(sourceTextType* cache, FILE* source)
+{
+	cacheHeaderType* header = (cacheHeaderType*) cache -> text;
+	cacheHeaderType unsummed;
+	cacheInstructionType* instructions;
+	cacheEntryType* entries;
+	int* depths;
+	char* strings;
+	unsigned long long size, sourceLength, checksum;
+	int i;
+	if (cache -> length < sizeof(cacheHeaderType) || memcmp(header -> magic, CACHE_MAGIC, 4) != 0
+		|| header -> version != CACHE_VERSION || header -> byteOrder != CACHE_BYTE_ORDER || header -> opcodeCount != OP_COUNT
+		|| header -> valueSize != (int) sizeof(wicInt)
+		|| header -> instructionCount <= 0 || header -> variableSlots < 0 || header -> symbolCount < 0
+		|| header -> labelCount < 0 || header -> arrayCount < 0 || header -> stringBytes <= 0)
+		return 0;
+	size = sizeof(cacheHeaderType) + (unsigned long long) header -> instructionCount * sizeof(cacheInstructionType)
+		+ ((unsigned long long) header -> instructionCount + 1) * sizeof(int)
+		+ ((unsigned long long) header -> symbolCount + header -> labelCount + header -> arrayCount) * sizeof(cacheEntryType)
+		+ (unsigned long long) header -> stringBytes;
+	if (size != cache -> length)
+		return 0;
+	// Copied byte for byte, so the header's padding is hashed just as it was written.
+	memcpy(&unsummed, header, sizeof(cacheHeaderType));
+	unsummed.checksum = 0;
+	checksum = hashBytes(CACHE_HASH_START, &unsummed, sizeof(unsummed));
+	if (hashBytes(checksum, header + 1, cache -> length - sizeof(cacheHeaderType)) != header -> checksum)
+		return 0;
+	instructions = (cacheInstructionType*) (header + 1);
+	depths = (int*) (instructions + header -> instructionCount);
+	entries = (cacheEntryType*) (depths + header -> instructionCount + 1);
+	strings = (char*) (entries + header -> symbolCount + header -> labelCount + header -> arrayCount);
+	if (strings[header -> stringBytes - 1] != '\0' || header -> maxDepth < -1)
+		return 0;
+	for (i = 0; i < header -> instructionCount; i++)
+	{
+		cacheInstructionType* inst = &instructions[i];
+		if (inst -> op <= OP_END || inst -> op > OP_HALT || inst -> operand < 0 || inst -> operand >= header -> stringBytes)
+			return 0;
+		if ((inst -> op == OP_J || inst -> op == OP_JF || inst -> op == OP_SPAWN) && (inst -> arg < 0 || inst -> arg > header -> instructionCount))
+			return 0;
+		if ((inst -> op == OP_GET || inst -> op == OP_PUT || inst -> op == OP_PUSH || inst -> op == OP_POP)
+			&& (inst -> arg < 0 || inst -> arg >= header -> variableSlots))
+			return 0;
+		if (inst -> op >= OP_ARRAY && inst -> op <= OP_ACOUNTGE && (inst -> arg < 0 || inst -> arg >= header -> arrayCount
+			|| inst -> a < 0 || inst -> a >= header -> arrayCount))
+			return 0;
+	}
+	for (i = 0; i <= header -> instructionCount; i++)
+	{
+		if (depths[i] < -1 || depths[i] > header -> maxDepth)
+			return 0;
+	}
+	for (i = 0; i < header -> symbolCount + header -> labelCount + header -> arrayCount; i++)
+	{
+		int limit = i < header -> symbolCount ? header -> variableSlots
+			: i < header -> symbolCount + header -> labelCount ? header -> instructionCount + 1 : header -> arrayCount;
+		if (entries[i].key < 0 || entries[i].key >= header -> stringBytes || entries[i].value < 0 || entries[i].value >= limit)
+			return 0;
+	}
+	// Last, as it reads the whole source: the cache must have been built from exactly this text.
+	return checksumSource(source, &sourceLength) == header -> sourceChecksum && sourceLength == header -> sourceLength;
+}
+
+// Function: loadProgramCache
+// Description: Loads a program from its bytecode cache, if there is an up to date one. The cache is mapped read-only and the
+//                instructions, tables and variables are set up straight from it, already resolved - nothing is parsed, and
+//                operand text and table keys point into the mapping rather than being copied. Must follow initialize, and
+//                takes the place of loadFile and resolveProgram. The source is not used when keepSource is on.
+// Params: Source file name, the open source file.
+// Returns: 0 if the program was loaded from the cache, -1 if it has to be loaded from the source (the file is left at its start).
+// Modifies: Instruction table, jump/symbol/array tables, variables, arrays, stack, the VM's cache mapping.
+int loadProgramCache(char* sourceName, FILE* source)
+{
+	char* name;
+	FILE* file;
+	sourceTextType cache;
+	cacheHeaderType* header;
+	cacheInstructionType* instructions;
+	cacheEntryType* entries;
+	int* depths;
+	char* strings;
+	int count, i;
+	// The profiler's report needs the source text itself.
+	if (currentVm -> keptSource.keeping)
+		return -1;
+	name = cacheName(sourceName);
+	file = fopen(name, "rb");
+	free(name);
+	if (file == NULL)
+		return -1;
+	readSource(file, &cache);
+	fclose(file);
+	if (!validCache(&cache, source))
+	{
+		releaseSource(&cache);
+		rewind(source);
+		return -1;
+	}
+	header = (cacheHeaderType*) cache.text;
+	count = header -> instructionCount;
+	instructions = (cacheInstructionType*) (header + 1);
+	depths = (int*) (instructions + count);
+	entries = (cacheEntryType*) (depths + count + 1);
+	strings = (char*) (entries + header -> symbolCount + header -> labelCount + header -> arrayCount);
+
+	vmInstTab.instructions = (instructionType*) malloc((count + 1) * sizeof(instructionType));
+	vmInstTab.depths = (int*) malloc((count + 1) * sizeof(int));
+	vmVariables = (wicInt*) calloc(header -> variableSlots > 0 ? header -> variableSlots : 1, sizeof(wicInt));
+	currentVm -> arrays = (arrayType*) calloc(header -> arrayCount > 0 ? header -> arrayCount : 1, sizeof(arrayType));
+	if (vmInstTab.instructions == NULL || vmInstTab.depths == NULL || vmVariables == NULL || currentVm -> arrays == NULL)
+	{
+		printf("Out of memory loading the bytecode cache!\n");
+		exit(5);
+	}
+	for (i = 0; i < count; i++)
+	{
+		vmInstTab.instructions[i].op = (opcodeType) instructions[i].op;
+		// The union's members differ in size once wicInt is 64 bits, so the one in use is written.
+		if (instructions[i].op == OP_PUSHI)
+			vmInstTab.instructions[i].arg.immediate = instructions[i].arg;
+		else
+			vmInstTab.instructions[i].arg.slot = (int) instructions[i].arg;
+		vmInstTab.instructions[i].a = instructions[i].a;
+		vmInstTab.instructions[i].b = 0;
+		vmInstTab.instructions[i].line = instructions[i].line;
+		vmInstTab.instructions[i].operand = strings + instructions[i].operand;
+	}
+	memset(&vmInstTab.instructions[count], 0, sizeof(instructionType));
+	vmInstTab.instructions[count].operand = "";
+	vmInstTab.instructionCount = count;
+	vmInstTab.capacity = count + 1;
+	memcpy(vmInstTab.depths, depths, (count + 1) * sizeof(int));
+	vmInstTab.maxDepth = header -> maxDepth;
+	for (i = 0; i < header -> symbolCount; i++)
+		storeKey(&vmSymbolTable, entries[i].value, strings + entries[i].key);
+	for (; i < header -> symbolCount + header -> labelCount; i++)
+		storeKey(&vmJumpTable, entries[i].value, strings + entries[i].key);
+	for (; i < header -> symbolCount + header -> labelCount + header -> arrayCount; i++)
+		storeKey(&vmArrayTable, entries[i].value, strings + entries[i].key);
+	currentVm -> arrayCount = header -> arrayCount;
+	vmVariableCount = header -> variableSlots;
+	clearConstants(vmVariableCount > 0 ? vmVariableCount : 1);
+	if (vmInstTab.maxDepth >= 0)
+		initStack(vmInstTab.maxDepth);
+	setCode(NULL, 0);
+	// Operands and keys point into the mapping, so it stays until the next program is loaded.
+	currentVm -> cache = cache;
+	return 0;
+}
+
+// Function: addString
+// Description: Adds a name to the string section being built, unless it is already there.
+// Params: String section, name.
+// Returns: Offset of the name in the section.
+// Modifies: String section.
+static int addString(stringSectionType* section, char* s)
+{
+	int offset = retrieve(&section -> offsets, s);
+	int length;
+	if (offset >= 0)
+		return offset;
+	length = (int) strlen(s) + 1;
+	if (section -> used + length > section -> capacity)
+	{
+		int capacity = section -> capacity * 2 > section -> used + length ? section -> capacity * 2 : section -> used + length;
+		char* grown = (char*) realloc(section -> text, capacity);
+		if (grown == NULL)
+		{
+			printf("Out of memory writing the bytecode cache!\n");
+			exit(5);
+		}
+		section -> text = grown;
+		section -> capacity = capacity;
+	}
+	offset = section -> used;
+	memcpy(section -> text + offset, s, length);
+	section -> used += length;
+	store(&section -> offsets, offset, s);
+	return offset;
+}
+
+// Function: saveProgramCache
+// Description: Writes the loaded and resolved program out as its bytecode cache, for loadProgramCache to pick up on later
+//                runs. Must follow resolveProgram, before the program runs. The cache is written under a temporary name and
+//                renamed into place, so a run that loads it never sees half a file.
+// Params: Source file name, the open source file.
+// Returns: 0 on success, -1 if the cache could not be written (the program is not affected).
+// Modifies: The source file's position.
+int saveProgramCache(char* sourceName, FILE* source)
+{
+	cacheHeaderType header;
+	stringSectionType section;
+	cacheInstructionType* instructions;
+	cacheEntryType* entries;
+	char* name = cacheName(sourceName);
+	char* temporary = (char*) malloc(strlen(name) + 5);
+	FILE* file;
+	int count = vmInstTab.instructionCount;
+	int written, i;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CACHE_MAGIC, 4);
+	header.version = CACHE_VERSION;
+	header.byteOrder = CACHE_BYTE_ORDER;
+	header.opcodeCount = OP_COUNT;
+	header.valueSize = sizeof(wicInt);
+	header.sourceChecksum = checksumSource(source, &header.sourceLength);
+	header.instructionCount = count;
+	header.variableSlots = vmVariableCount;
+	header.maxDepth = vmInstTab.maxDepth;
+	header.symbolCount = vmSymbolTable.size;
+	header.labelCount = vmJumpTable.size;
+	header.arrayCount = vmArrayTable.size;
+
+	initializeTable(&section.offsets);
+	section.text = NULL;
+	section.used = 0;
+	section.capacity = 0;
+	instructions = (cacheInstructionType*) malloc((count + 1) * sizeof(cacheInstructionType));
+	entries = (cacheEntryType*) malloc((header.symbolCount + header.labelCount + header.arrayCount + 1)
+		* sizeof(cacheEntryType));
+	if (temporary == NULL || instructions == NULL || entries == NULL)
+	{
+		printf("Out of memory writing the bytecode cache!\n");
+		exit(5);
+	}
+	addString(&section, "");
+	for (i = 0; i < count; i++)
+	{
+		instructions[i].op = vmInstTab.instructions[i].op;
+		instructions[i].arg = vmInstTab.instructions[i].op == OP_PUSHI ? vmInstTab.instructions[i].arg.immediate
+			: vmInstTab.instructions[i].arg.slot;
+		instructions[i].a = vmInstTab.instructions[i].op >= OP_ARRAY && vmInstTab.instructions[i].op <= OP_ACOUNTGE
+			? vmInstTab.instructions[i].a : 0;
+		instructions[i].line = vmInstTab.instructions[i].line;
+		instructions[i].operand = addString(&section, vmInstTab.instructions[i].operand);
+	}
+	for (i = 0; i < vmSymbolTable.size; i++)
+	{
+		entries[i].key = addString(&section, vmSymbolTable.entries[i].key);
+		entries[i].value = vmSymbolTable.entries[i].value;
+	}
+	for (i = 0; i < vmJumpTable.size; i++)
+	{
+		entries[vmSymbolTable.size + i].key = addString(&section, vmJumpTable.entries[i].key);
+		entries[vmSymbolTable.size + i].value = vmJumpTable.entries[i].value;
+	}
+	for (i = 0; i < vmArrayTable.size; i++)
+	{
+		entries[vmSymbolTable.size + vmJumpTable.size + i].key = addString(&section, vmArrayTable.entries[i].key);
+		entries[vmSymbolTable.size + vmJumpTable.size + i].value = vmArrayTable.entries[i].value;
+	}
+	header.stringBytes = section.used;
+	header.checksum = hashBytes(CACHE_HASH_START, &header, sizeof(header));
+	header.checksum = hashBytes(header.checksum, instructions, count * sizeof(cacheInstructionType));
+	header.checksum = hashBytes(header.checksum, vmInstTab.depths, (count + 1) * sizeof(int));
+	header.checksum = hashBytes(header.checksum, entries,
+		(header.symbolCount + header.labelCount + header.arrayCount) * sizeof(cacheEntryType));
+	header.checksum = hashBytes(header.checksum, section.text, section.used);
+
+	sprintf(temporary, "%s.tmp", name);
+	file = fopen(temporary, "wb");
+	written = file != NULL
+		&& fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(instructions, sizeof(cacheInstructionType), count, file) == (size_t) count
+		&& fwrite(vmInstTab.depths, sizeof(int), count + 1, file) == (size_t) (count + 1)
+		&& fwrite(entries, sizeof(cacheEntryType), header.symbolCount + header.labelCount + header.arrayCount, file)
+			== (size_t) (header.symbolCount + header.labelCount + header.arrayCount)
+		&& fwrite(section.text, 1, section.used, file) == (size_t) section.used;
+	if (file != NULL && fclose(file) != 0)
+		written = 0;
+	// rename does not replace an existing file everywhere.
+	if (written)
+	{
+		remove(name);
+		written = rename(temporary, name) == 0;
+	}
+	if (!written)
+		remove(temporary);
+	freeTable(&section.offsets);
+	free(section.text);
+	free(entries);
+	free(instructions);
+	free(temporary);
+	free(name);
+	return written ? 0 : -1;
+}
@@ -0,0 +1,10 @@
+#ifndef CACHE_H
+#define CACHE_H
+#include <stdio.h>
+
+// Bytecode cache - a program saved after loading and resolving, as PROGRAM.wicb next to PROGRAM.wic, so that later runs
+// map it instead of parsing the source again.
+int loadProgramCache(char* sourceName, FILE* source);
+int saveProgramCache(char* sourceName, FILE* source);
+
+#endif
@@ -0,0 +1,379 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "engine.h"
+#include "checkpoint.h"
+#include "loader.h"
+
+// Checkpoint file layout. Like the bytecode cache (see cache.c) it is in the byte order, int size and value width of the
+// build that wrote it, and any other build refuses it. After the header come, in order:
+//   wicInt stack[stackDepth]                    (bottom first)
+//   wicInt values[valueCount]                   (variable values, in slot order)
+//   wicInt lengths[arrayCount]                  (array lengths, in array number order)
+//   wicInt elements[elementCount]               (every array's values, one array after another)
+//   char names[nameBytes]                       ('\0' terminated name of each of those variables, in the same order)
+#define CHECKPOINT_MAGIC "WICK"
+#define CHECKPOINT_VERSION 2
+#define CHECKPOINT_BYTE_ORDER 0x01020304
+
+// Signal that writes a checkpoint and carries on. SIGINT and SIGTERM write one and stop.
+#if defined(SIGUSR1)
+#define CHECKPOINT_SIGNAL SIGUSR1
+#elif defined(SIGBREAK)
+#define CHECKPOINT_SIGNAL SIGBREAK
+#endif
+
+typedef struct
+{
+	char magic[4];
+	int version;
+	int byteOrder;
+	int valueSize;
+	// Hash of the program the engines run (see programChecksum). Addresses and stack depths mean nothing in any other.
+	unsigned long long programChecksum;
+	// Address of the instruction to run next, and what arithmetic was doing on overflow.
+	int pc;
+	int overflowMode;
+	// Values 'get' had read from the input. A resumed run skips as many before it carries on.
+	long long valuesRead;
+	int stackDepth;
+	int valueCount;
+	// Arrays are numbered the same in the same program, so they are saved by number rather than by name.
+	int arrayCount;
+	long long elementCount;
+	int nameBytes;
+} checkpointHeaderType;
+
+// Instructions left before the next checkpoint, and the signal that arrived since the last one, or 0. They are statics
+// rather than part of the VM so the signal handler can reach one and the engine's step does not go through currentVm
+// for the other; only one program is checkpointed at a time.
+static long long checkpointLeft;
+static volatile sig_atomic_t checkpointSignal;
+
+// Function: onCheckpointSignal
+// Description: Signal handler - asks the checkpointing engine for a checkpoint at its next jump.
+// Params: Signal number.
+// Returns: None.
+// Modifies: Pending signal.
+static void onCheckpointSignal(int number)
+{
+	// Some systems reset the handler once it has run.
+	signal(number, onCheckpointSignal);
+	checkpointSignal = number;
+}
+
+// Function: setCheckpoint
+// Description: Checkpoints the program from now on: runEngine runs it on the checkpointing engine, which writes its state to
+//                the file every so many instructions, and whenever one of the checkpoint signals arrives. SIGINT and SIGTERM
+//                stop the program once the checkpoint is written, so a job that is preempted can be resumed later (see
+//                resumeCheckpoint); CHECKPOINT_SIGNAL lets it carry on.
+// Params: File to write, or NULL to stop checkpointing; instructions between checkpoints, 0 for only on a signal.
+// Returns: None.
+// Modifies: Current VM, signal handlers.
+void setCheckpoint(char* fileName, long long interval)
+{
+	void (*handler)(int) = fileName != NULL ? onCheckpointSignal : SIG_DFL;
+	currentVm -> checkpoint.fileName = fileName;
+	currentVm -> checkpoint.interval = interval > 0 ? interval : 0;
+	signal(SIGINT, handler);
+	signal(SIGTERM, handler);
+#if defined(CHECKPOINT_SIGNAL)
+	signal(CHECKPOINT_SIGNAL, handler);
+#endif
+}
+
+// Function: mixChecksum
+// Description: Adds a value to an FNV-1a hash, a byte at a time.
+// Params: Hash so far, value.
+// Returns: New hash.
+// Modifies: None.
+static unsigned long long mixChecksum(unsigned long long h, long long value)
+{
+	int i;
+	for (i = 0; i < 8; i++)
+	{
+		h ^= (unsigned char) (value >> (i * 8));
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+// Function: programChecksum
+// Description: Hashes the program the engines run - every instruction and the constants superinstructions use - so that a
+//                checkpoint is only resumed by the same program, built at the same optimization level.
+// Params: None.
+// Returns: 64 bit hash.
+// Modifies: None.
+static unsigned long long programChecksum()
+{
+	unsigned long long h = 14695981039346656037ULL;
+	int i;
+	for (i = 0; i < vmCodeTab.instructionCount; i++)
+	{
+		instructionType* inst = &vmCodeTab.instructions[i];
+		h = mixChecksum(h, inst -> op);
+		h = mixChecksum(h, inst -> op == OP_PUSHI ? inst -> arg.immediate : inst -> arg.slot);
+		h = mixChecksum(h, inst -> a);
+		h = mixChecksum(h, inst -> b);
+	}
+	for (i = vmVariableCount; i < vmSlotCount; i++)
+		h = mixChecksum(h, vmVariables[i]);
+	return mixChecksum(h, vmCodeTab.instructionCount);
+}
+
+// Function: writeCheckpoint
+// Description: Writes the program's state in front of an instruction to the checkpoint file. It is written under a temporary
+//                name and renamed into place, so a run that dies part way through a checkpoint still leaves the last one.
+// Params: Address of the instruction to run next.
+// Returns: 0 on success, -1 if the checkpoint could not be written.
+// Modifies: None.
+static int writeCheckpoint(int pc)
+{
+	checkpointHeaderType header;
+	char* name = currentVm -> checkpoint.fileName;
+	char* temporary = (char*) malloc(strlen(name) + 5);
+	char** names = (char**) malloc((vmVariableCount + 1) * sizeof(char*));
+	FILE* file;
+	int written, i;
+	if (temporary == NULL || names == NULL)
+	{
+		printf("Out of memory writing a checkpoint!\n");
+		exit(5);
+	}
+	for (i = 0; i < vmVariableCount; i++)
+		names[i] = "";
+	for (i = 0; i < vmSymbolTable.size; i++)
+	{
+		if (vmSymbolTable.entries[i].value < vmVariableCount)
+			names[vmSymbolTable.entries[i].value] = vmSymbolTable.entries[i].key;
+	}
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CHECKPOINT_MAGIC, 4);
+	header.version = CHECKPOINT_VERSION;
+	header.byteOrder = CHECKPOINT_BYTE_ORDER;
+	header.valueSize = sizeof(wicInt);
+	header.programChecksum = programChecksum();
+	header.pc = pc;
+	header.overflowMode = currentVm -> overflowMode;
+	header.valuesRead = currentVm -> valuesRead;
+	header.stackDepth = vmStack.stackIndex;
+	header.valueCount = vmVariableCount;
+	header.arrayCount = currentVm -> arrayCount;
+	for (i = 0; i < header.arrayCount; i++)
+		header.elementCount += currentVm -> arrays[i].length;
+	for (i = 0; i < vmVariableCount; i++)
+		header.nameBytes += (int) strlen(names[i]) + 1;
+
+	sprintf(temporary, "%s.tmp", name);
+	file = fopen(temporary, "wb");
+	written = file != NULL
+		&& fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(vmStack.theStack + 1, sizeof(wicInt), header.stackDepth, file) == (size_t) header.stackDepth
+		&& fwrite(vmVariables, sizeof(wicInt), vmVariableCount, file) == (size_t) vmVariableCount;
+	for (i = 0; written && i < header.arrayCount; i++)
+	{
+		wicInt length = currentVm -> arrays[i].length;
+		written = fwrite(&length, sizeof(wicInt), 1, file) == 1;
+	}
+	for (i = 0; written && i < header.arrayCount; i++)
+	{
+		arrayType* array = &currentVm -> arrays[i];
+		written = fwrite(array -> values, sizeof(wicInt), array -> length, file) == (size_t) array -> length;
+	}
+	for (i = 0; written && i < vmVariableCount; i++)
+		written = fwrite(names[i], 1, strlen(names[i]) + 1, file) == strlen(names[i]) + 1;
+	if (file != NULL && fclose(file) != 0)
+		written = 0;
+	if (written)
+	{
+		// rename replaces the old checkpoint in one step, except on Windows, where it has to go first.
+#if defined(_WIN32)
+		remove(name);
+#endif
+		written = rename(temporary, name) == 0;
+	}
+	if (!written)
+		remove(temporary);
+	free(names);
+	free(temporary);
+	return written ? 0 : -1;
+}
+
+// Function: takeCheckpoint
+// Description: Writes a checkpoint for the checkpointing engine, with the program output so far flushed first, and starts the
+//                count to the next one. A program that cannot be checkpointed carries on regardless.
+// Params: Address of the instruction to run next.
+// Returns: 1 if the program should stop, because SIGINT or SIGTERM asked for the checkpoint, otherwise 0.
+// Modifies: Checkpoint count.
+static int takeCheckpoint(int pc)
+{
+	int stop = checkpointSignal != 0;
+#if defined(CHECKPOINT_SIGNAL)
+	stop = stop && checkpointSignal != CHECKPOINT_SIGNAL;
+#endif
+	checkpointSignal = 0;
+	checkpointLeft = currentVm -> checkpoint.interval > 0 ? currentVm -> checkpoint.interval : -1;
+	vmFlush();
+	if (writeCheckpoint(pc) == 0)
+		currentVm -> checkpoint.written++;
+	else
+		vmPrintf("\nCould not write the checkpoint %s!\n", currentVm -> checkpoint.fileName);
+	if (stop)
+	{
+		vmPrintf("\nStopped on line %d - run again with --resume=%s to carry on.\n", vmCodeTab.instructions[pc].line,
+			currentVm -> checkpoint.fileName);
+		vmFlush();
+	}
+	return stop;
+}
+
+// The switch engine, with the checkpointing hooks. The instruction count is checked before every instruction, and signals
+// at every jump, which every program that runs for long enough takes.
+#define CHECKPOINT() \
+	{ \
+		SAVE_STACK(); \
+		if (takeCheckpoint(pc)) \
+			goto halted; \
+	}
+#define SWITCH_ENGINE static void runCheckpointEngine
+#define SWITCH_STEP() if (--checkpointLeft == 0) CHECKPOINT()
+#define SWITCH_BRANCH() if (checkpointSignal != 0) CHECKPOINT()
+#define SWITCH_DONE()
+#include "switchEngine.h"
+#undef CHECKPOINT
+
+// Function: runCheckpointed
+// Description: Runs codeTab on the checkpointing engine (see setCheckpoint).
+// Params: Address to start at.
+// Returns: None.
+// Modifies: Stack, variables, checkpoint file.
+void runCheckpointed(int pc)
+{
+	// Never reaching zero is the same as never.
+	checkpointLeft = currentVm -> checkpoint.interval > 0 ? currentVm -> checkpoint.interval : -1;
+	runCheckpointEngine(pc);
+}
+
+// Function: validCheckpoint
+// Description: Checks a checkpoint file's header, and that its size and sections agree with it and with the loaded program.
+// Params: Checkpoint file contents.
+// Returns: 1 if it can be resumed from, 0 if not.
+// Modifies: None.
+static int validCheckpoint(sourceTextType* text)
+{
+	checkpointHeaderType* header = (checkpointHeaderType*) text -> text;
+	wicInt* lengths;
+	long long elements;
+	char* names;
+	int i, count;
+	if (text -> length < sizeof(checkpointHeaderType) || memcmp(header -> magic, CHECKPOINT_MAGIC, 4) != 0
+		|| header -> version != CHECKPOINT_VERSION || header -> byteOrder != CHECKPOINT_BYTE_ORDER
+		|| header -> valueSize != (int) sizeof(wicInt) || header -> pc < 0 || header -> pc > vmCodeTab.instructionCount
+		|| header -> overflowMode < OVERFLOW_TRAP || header -> overflowMode > OVERFLOW_PROMOTE
+		|| header -> valuesRead < 0 || header -> stackDepth < 0 || header -> valueCount < 0 || header -> nameBytes < 0
+		|| header -> arrayCount != currentVm -> arrayCount || header -> elementCount < 0)
+		return 0;
+	if (text -> length != sizeof(checkpointHeaderType) + ((unsigned long long) header -> stackDepth + header -> valueCount
+		+ header -> arrayCount + header -> elementCount) * sizeof(wicInt) + header -> nameBytes)
+		return 0;
+	lengths = (wicInt*) (header + 1) + header -> stackDepth + header -> valueCount;
+	elements = 0;
+	for (i = 0; i < header -> arrayCount; i++)
+	{
+		// Lengths are saved as wicInts; in a 64 bit build, one may be too large for the int the array keeps it in.
+#if defined(WIC_INT64)
+		if (lengths[i] < 0 || lengths[i] > INT_MAX)
+#else
+		if (lengths[i] < 0)
+#endif
+			return 0;
+		elements += lengths[i];
+	}
+	if (elements != header -> elementCount)
+		return 0;
+	if (vmCodeTab.depths[header -> pc] >= 0 && vmCodeTab.depths[header -> pc] != header -> stackDepth)
+		return 0;
+	names = text -> text + text -> length - header -> nameBytes;
+	count = 0;
+	for (i = 0; i < header -> nameBytes; i++)
+		count += names[i] == '\0';
+	return count == header -> valueCount && (header -> nameBytes == 0 || names[header -> nameBytes - 1] == '\0');
+}
+
+// Function: resumeCheckpoint
+// Description: Loads the state a checkpoint was taken in - variables by name, arrays, the stack, the overflow mode and how
+//                much input had been read - so that the next run carries on where the checkpointed one left off. Must follow
+//                optimizeProgram, with the program the checkpoint was taken of, built at the same optimization level; the
+//                values 'get' had already read are read again and thrown away, so the input must be the same too.
+// Params: Checkpoint file name.
+// Returns: None.
+// Modifies: Variables, arrays, stack, overflow mode, the VM's input, where the next run starts.
+void resumeCheckpoint(char* fileName)
+{
+	FILE* file = fopen(fileName, "rb");
+	sourceTextType text;
+	checkpointHeaderType* header;
+	wicInt* values;
+	wicInt* elements;
+	char* name;
+	wicInt skipped;
+	long long i;
+	if (file == NULL)
+	{
+		printf("The checkpoint %s could not be opened!\n", fileName);
+		exit(2);
+	}
+	readSource(file, &text);
+	fclose(file);
+	if (!validCheckpoint(&text))
+	{
+		printf("%s is not a checkpoint this build can resume!\n", fileName);
+		exit(3);
+	}
+	header = (checkpointHeaderType*) text.text;
+	if (header -> programChecksum != programChecksum())
+	{
+		printf("The checkpoint %s was taken of a different program, or at another optimization level!\n", fileName);
+		exit(3);
+	}
+	values = (wicInt*) (header + 1);
+	vmStack.stackIndex = 0;
+	for (i = 0; i < header -> stackDepth; i++)
+	{
+		if (stackPush(values[i]) != 0)
+		{
+			printf("Out of memory resuming the checkpoint!\n");
+			exit(5);
+		}
+	}
+	values += header -> stackDepth;
+	elements = values + header -> valueCount + header -> arrayCount;
+	for (i = 0; i < header -> arrayCount; i++)
+	{
+		wicInt length = values[header -> valueCount + i];
+		resizeArray((int) i, length, vmCodeTab.instructions[header -> pc].line);
+		memcpy(currentVm -> arrays[i].values, elements, (size_t) length * sizeof(wicInt));
+		elements += length;
+	}
+	name = (char*) elements;
+	for (i = 0; i < header -> valueCount; i++)
+	{
+		int slot = retrieve(&vmSymbolTable, name);
+		if (slot < 0 || slot >= vmVariableCount)
+		{
+			printf("The checkpoint %s has a variable '%s' the program does not!\n", fileName, name);
+			exit(3);
+		}
+		vmVariables[slot] = values[i];
+		name += strlen(name) + 1;
+	}
+	setOverflowMode((overflowModeType) header -> overflowMode);
+	for (i = 0; i < header -> valuesRead; i++)
+	{
+		if (vmReadInt(&skipped) != 0)
+			break;
+	}
+	currentVm -> checkpoint.resumePc = header -> pc;
+	releaseSource(&text);
+}
@@ -0,0 +1,23 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+// Checkpointing settings of a VM (see setCheckpoint), and where a resumed run carries on from.
+typedef struct
+{
+	// File the running program's state is written to, or NULL when it is not checkpointed.
+	char* fileName;
+	// Instructions between checkpoints, 0 to write them only when signalled.
+	long long interval;
+	// Checkpoints written so far.
+	int written;
+	// Address the next run starts at: where the checkpoint it was resumed from left off, otherwise 0.
+	int resumePc;
+} checkpointType;
+
+// Checkpointing engine - the switch engine compiled again with hooks that write the whole program state to a file every so
+// many instructions or on a signal (see checkpoint.c), and the resume that loads it back.
+void setCheckpoint(char* fileName, long long interval);
+void runCheckpointed(int pc);
+void resumeCheckpoint(char* fileName);
+
+#endif
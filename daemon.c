@@ -0,0 +1,1240 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include "daemon.h"
+#include "batch.h"
+#include "libwic.h"
+#include "loader.h"
+#include "vm.h"
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#endif
+
+// Daemon protocol. Requests and replies are lines of text; a connection can carry any number of requests, one after another.
+//   run SOURCE_BYTES [VALUE...]    followed by exactly SOURCE_BYTES bytes of WIC source. The values are what 'get' reads,
+//                                  in order. Replies with a line 'put NAME VALUE' for each 'put', as the program runs,
+//                                  then 'ok INSTRUCTIONS hit|miss' (whether the compiled program was already cached), or
+//                                  'error MESSAGE' if it did not load (with the loader's reason), stopped with an error, or
+//                                  ran past the daemon's instruction budget.
+//   stats                          replies 'stats REQUESTS HITS MISSES CACHED EVICTED'.
+// Anything else is answered with an error, and the connection closed.
+
+// Size of a connection's input and output buffers. A request line must fit in one.
+#define DAEMON_BUFFER 65536
+// Largest program source a request may send.
+#define DAEMON_MAX_SOURCE (16 * 1024 * 1024)
+// Instructions a program runs between sending what it has output and checking that the client is still there.
+#define DAEMON_SLICE 1000000
+// Instructions a request may run when no budget is given, after which it is stopped with an error.
+#define DAEMON_BUDGET 1000000000LL
+// Milliseconds a client that has stopped reading gets to make room for more output before it is given up on.
+#define DAEMON_WRITE_TIMEOUT 10000
+// Queue of connections the kernel holds for the daemon before it accepts them.
+#define DAEMON_BACKLOG 128
+
+#if !defined(_WIN32)
+
+// A cached program, and idle instances of it, reset and ready to run.
+typedef struct
+{
+	// FNV-1a hash of the source, which is kept to tell apart sources whose hashes collide.
+	unsigned long long hash;
+	char* source;
+	size_t length;
+	wicProgramType* program;
+	wicInstanceType** idle;
+	int idleCount;
+	// Requests running it now, and when it was last asked for. An entry evicted while in use is freed by its last user.
+	int users;
+	long long lastUsed;
+	int evicted;
+} daemonEntryType;
+
+// A client connection, with buffered input and output.
+typedef struct daemonConnection
+{
+	int fd;
+	char in[DAEMON_BUFFER];
+	int inStart;
+	int inEnd;
+	char out[DAEMON_BUFFER];
+	int outUsed;
+	// Set once a write has failed - the client has gone or stopped reading.
+	int broken;
+	// The request arriving on the connection (see bufferRequest): its line, once it is all there, or tooLong if it did not
+	// fit in the buffer, and for 'run' its source, of which sourceHave bytes have arrived so far.
+	char line[DAEMON_BUFFER];
+	int haveLine;
+	int tooLong;
+	char* source;
+	size_t sourceLength;
+	size_t sourceHave;
+	struct daemonConnection* next;
+} daemonConnectionType;
+
+// The daemon: its program cache, and the connections passed between the dispatcher and the workers. One lock guards all of
+// it; nothing slow (compiling, running, reading or writing a connection) is done while holding it.
+typedef struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	daemonEntryType** entries;
+	int entryCount;
+	int capacity;
+	long long clock;
+	// Idle instances kept per program - one per worker is all that can ever be in use at once.
+	int idleLimit;
+	int optLevel;
+	long long budget;
+	overflowModeType overflowMode;
+	// Connections with a request waiting, oldest first, for the workers, and connections the workers have finished a
+	// request on, for the dispatcher to watch again. Writing to wake tells the dispatcher there are some.
+	daemonConnectionType* waitingHead;
+	daemonConnectionType* waitingTail;
+	daemonConnectionType* returned;
+	int wake[2];
+	long long requests;
+	long long hits;
+	long long misses;
+	long long evictions;
+} daemonType;
+
+// Set by SIGINT and SIGTERM: the dispatcher stops accepting, removes the socket and returns.
+static volatile sig_atomic_t daemonStop;
+
+// Function: onDaemonSignal
+// Description: Signal handler - asks the daemon to stop.
+// Params: Signal number.
+// Returns: None.
+// Modifies: daemonStop.
+static void onDaemonSignal(int number)
+{
+	(void) number;
+	daemonStop = 1;
+}
+
+// Function: hashSource
+// Description: FNV-1a hash of a program's source, its key in the cache.
+// Params: Source, its length.
+// Returns: 64 bit hash.
+// Modifies: None.
+static unsigned long long hashSource(const char* source, size_t length)
+{
+	unsigned long long h = 14695981039346656037ULL;
+	size_t i;
+	for (i = 0; i < length; i++)
+	{
+		h ^= (unsigned char) source[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+// Function: newConnection
+// Description: Wraps a connected socket in a connection, with empty buffers.
+// Params: Socket.
+// Returns: The connection.
+// Modifies: None.
+static daemonConnectionType* newConnection(int fd)
+{
+	daemonConnectionType* c = (daemonConnectionType*) malloc(sizeof(daemonConnectionType));
+	if (c == NULL)
+	{
+		printf("Out of memory accepting a connection!\n");
+		exit(5);
+	}
+	c -> fd = fd;
+	c -> inStart = 0;
+	c -> inEnd = 0;
+	c -> outUsed = 0;
+	c -> broken = 0;
+	c -> haveLine = 0;
+	c -> tooLong = 0;
+	c -> source = NULL;
+	c -> next = NULL;
+	return c;
+}
+
+// Function: closeConnection
+// Description: Closes a connection and frees it, with any request half read on it.
+// Params: Connection.
+// Returns: None.
+// Modifies: None.
+static void closeConnection(daemonConnectionType* c)
+{
+	close(c -> fd);
+	free(c -> source);
+	free(c);
+}
+
+// Function: fillInput
+// Description: Reads more of what the other end sent into a connection's input buffer, moving what is still unread to the
+//                front first.
+// Params: Connection.
+// Returns: Bytes read, 0 at the end of the input or if the buffer is full, -1 on an error.
+// Modifies: Connection.
+static int fillInput(daemonConnectionType* c)
+{
+	ssize_t got;
+	if (c -> inStart > 0)
+	{
+		memmove(c -> in, c -> in + c -> inStart, c -> inEnd - c -> inStart);
+		c -> inEnd -= c -> inStart;
+		c -> inStart = 0;
+	}
+	if (c -> inEnd == DAEMON_BUFFER)
+		return 0;
+	do
+		got = read(c -> fd, c -> in + c -> inEnd, DAEMON_BUFFER - c -> inEnd);
+	while (got < 0 && errno == EINTR);
+	if (got > 0)
+		c -> inEnd += (int) got;
+	return (int) got;
+}
+
+// Function: readLine
+// Description: Reads the next line from a connection. The line stays in the input buffer, so it must be used before
+//                anything else is read.
+// Params: Connection, where to put the line ('\0' terminated, without its newline).
+// Returns: Its length, -1 at the end of the input or on an error, -2 if it is too long for the buffer.
+// Modifies: Connection.
+static int readLine(daemonConnectionType* c, char** line)
+{
+	for (;;)
+	{
+		char* end = (char*) memchr(c -> in + c -> inStart, '\n', c -> inEnd - c -> inStart);
+		int got;
+		if (end != NULL)
+		{
+			*end = '\0';
+			*line = c -> in + c -> inStart;
+			c -> inStart = (int) (end - c -> in) + 1;
+			return (int) (end - *line);
+		}
+		if (c -> inStart == 0 && c -> inEnd == DAEMON_BUFFER)
+			return -2;
+		got = fillInput(c);
+		if (got <= 0)
+			return -1;
+	}
+}
+
+// Function: bufferRequest
+// Description: Moves what has arrived on a connection into its request - the line, then for 'run' the source - without
+//                reading anything more from the socket.
+// Params: Connection.
+// Returns: 1 once the whole request is there, 0 while more is to come.
+// Modifies: Connection.
+static int bufferRequest(daemonConnectionType* c)
+{
+	size_t take;
+	if (!c -> haveLine)
+	{
+		char* start = c -> in + c -> inStart;
+		char* end = (char*) memchr(start, '\n', c -> inEnd - c -> inStart);
+		char* after;
+		long long length;
+		if (end == NULL)
+		{
+			// A line that fills the whole buffer will never fit; it is answered with an error (see serveRequest).
+			if (c -> inStart > 0 || c -> inEnd < DAEMON_BUFFER)
+				return 0;
+			c -> line[0] = '\0';
+			c -> haveLine = 1;
+			c -> tooLong = 1;
+			return 1;
+		}
+		*end = '\0';
+		memcpy(c -> line, start, end - start + 1);
+		c -> inStart += (int) (end - start) + 1;
+		c -> haveLine = 1;
+		if (strncmp(c -> line, "run ", 4) != 0)
+			return 1;
+		errno = 0;
+		length = strtoll(c -> line + 4, &after, 10);
+		// A bad length is left for serveRequest to answer.
+		if (after == c -> line + 4 || errno == ERANGE || length <= 0 || length > DAEMON_MAX_SOURCE)
+			return 1;
+		c -> source = (char*) malloc((size_t) length);
+		if (c -> source == NULL)
+		{
+			printf("Out of memory reading a request!\n");
+			exit(5);
+		}
+		c -> sourceLength = (size_t) length;
+		c -> sourceHave = 0;
+	}
+	if (c -> source == NULL)
+		return 1;
+	take = (size_t) (c -> inEnd - c -> inStart);
+	if (take > c -> sourceLength - c -> sourceHave)
+		take = c -> sourceLength - c -> sourceHave;
+	memcpy(c -> source + c -> sourceHave, c -> in + c -> inStart, take);
+	c -> inStart += (int) take;
+	c -> sourceHave += take;
+	return c -> sourceHave == c -> sourceLength;
+}
+
+// Function: readRequest
+// Description: Dispatcher side of reading requests - takes whatever has arrived on a connection, without waiting for more,
+//                so a client that sends its request slowly never holds up a worker.
+// Params: Connection (its socket non-blocking).
+// Returns: 1 once a whole request is there, 0 while more is to come, -1 if the client has gone.
+// Modifies: Connection.
+static int readRequest(daemonConnectionType* c)
+{
+	int got;
+	if (bufferRequest(c))
+		return 1;
+	got = fillInput(c);
+	if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+		return -1;
+	return bufferRequest(c);
+}
+
+// Function: writeAll
+// Description: Writes bytes to a socket, however many writes it takes. On a non-blocking socket, it waits up to
+//                DAEMON_WRITE_TIMEOUT for room each time the other end falls behind.
+// Params: Socket, bytes, how many.
+// Returns: 0, or -1 if the other end has gone or stopped reading.
+// Modifies: None.
+static int writeAll(int fd, const char* bytes, size_t length)
+{
+	while (length > 0)
+	{
+		ssize_t done = write(fd, bytes, length);
+		if (done < 0 && errno == EINTR)
+			continue;
+		if (done < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			struct pollfd room;
+			int ready;
+			room.fd = fd;
+			room.events = POLLOUT;
+			do
+				ready = poll(&room, 1, DAEMON_WRITE_TIMEOUT);
+			while (ready < 0 && errno == EINTR);
+			if (ready <= 0)
+				return -1;
+			continue;
+		}
+		if (done <= 0)
+			return -1;
+		bytes += done;
+		length -= (size_t) done;
+	}
+	return 0;
+}
+
+// Function: flushOutput
+// Description: Sends what is in a connection's output buffer.
+// Params: Connection.
+// Returns: None.
+// Modifies: Connection (broken if the client has gone).
+static void flushOutput(daemonConnectionType* c)
+{
+	if (c -> outUsed > 0 && !c -> broken && writeAll(c -> fd, c -> out, c -> outUsed) != 0)
+		c -> broken = 1;
+	c -> outUsed = 0;
+}
+
+// Function: writeOutput
+// Description: Adds text to a connection's output, sending the buffer whenever it fills up.
+// Params: Connection, text, its length.
+// Returns: None.
+// Modifies: Connection.
+static void writeOutput(daemonConnectionType* c, const char* text, int length)
+{
+	if (c -> outUsed + length > DAEMON_BUFFER)
+		flushOutput(c);
+	if (length > DAEMON_BUFFER)
+	{
+		if (!c -> broken && writeAll(c -> fd, text, length) != 0)
+			c -> broken = 1;
+		return;
+	}
+	memcpy(c -> out + c -> outUsed, text, length);
+	c -> outUsed += length;
+}
+
+// Function: replyError
+// Description: Sends an 'error' reply. The message is put on one line.
+// Params: Connection, message.
+// Returns: None.
+// Modifies: Connection.
+static void replyError(daemonConnectionType* c, const char* message)
+{
+	const char* p;
+	writeOutput(c, "error ", 6);
+	for (p = message; *p != '\0'; p++)
+		writeOutput(c, *p == '\n' || *p == '\r' ? " " : p, 1);
+	writeOutput(c, "\n", 1);
+}
+
+// Function: daemonPut
+// Description: Put callback of every instance the daemon runs - sends the value to the client as a 'put' line.
+// Params: Connection, variable name, value.
+// Returns: None.
+// Modifies: Connection.
+static void daemonPut(void* context, const char* name, wicInt value)
+{
+	daemonConnectionType* c = (daemonConnectionType*) context;
+	char text[32];
+	writeOutput(c, "put ", 4);
+	writeOutput(c, name, (int) strlen(name));
+	writeOutput(c, text, sprintf(text, " " WIC_INT_FORMAT "\n", value));
+}
+
+// Function: clientGone
+// Description: Checks, without waiting, whether the client has closed its end of the connection.
+// Params: Connection.
+// Returns: 1 if it has, 0 if it is still there.
+// Modifies: None.
+static int clientGone(daemonConnectionType* c)
+{
+	char byte;
+	return c -> broken || recv(c -> fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == 0;
+}
+
+// Function: freeEntry
+// Description: Frees a cached program, its idle instances and its source.
+// Params: Entry.
+// Returns: None.
+// Modifies: None.
+static void freeEntry(daemonEntryType* entry)
+{
+	int i;
+	for (i = 0; i < entry -> idleCount; i++)
+		wicDestroyInstance(entry -> idle[i]);
+	wicFreeProgram(entry -> program);
+	free(entry -> idle);
+	free(entry -> source);
+	free(entry);
+}
+
+// Function: findEntry
+// Description: Looks a program up in the cache. The cache is small, so it is a scan; the hash is compared before anything
+//                else. Must be called holding the lock.
+// Params: Daemon, source's hash, source, its length.
+// Returns: The entry, or NULL if the program is not cached.
+// Modifies: None.
+static daemonEntryType* findEntry(daemonType* d, unsigned long long hash, const char* source, size_t length)
+{
+	int i;
+	for (i = 0; i < d -> entryCount; i++)
+	{
+		daemonEntryType* entry = d -> entries[i];
+		if (entry -> hash == hash && entry -> length == length && memcmp(entry -> source, source, length) == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+// Function: acquireEntry
+// Description: Finds a program in the cache, compiling it and caching it if it is not there, in place of the least recently
+//                used program once the cache is full. It is compiled without holding the lock, so another request may
+//                compile the same program at the same time; whichever is cached first is kept.
+// Params: Daemon, source (the cache takes it over if it keeps it, and sets it to NULL), its length, where to put 1 if the
+//           program was already cached.
+// Returns: The entry, which the caller must release (see releaseEntry), or NULL if the program did not load.
+// Modifies: Cache, source.
+static daemonEntryType* acquireEntry(daemonType* d, char** source, size_t length, int* hit)
+{
+	unsigned long long hash = hashSource(*source, length);
+	daemonEntryType* entry;
+	daemonEntryType* dropped = NULL;
+	wicProgramType* program;
+	int i, oldest;
+	pthread_mutex_lock(&d -> lock);
+	d -> requests++;
+	entry = findEntry(d, hash, *source, length);
+	*hit = entry != NULL;
+	if (entry != NULL)
+	{
+		d -> hits++;
+		entry -> users++;
+		entry -> lastUsed = ++d -> clock;
+		pthread_mutex_unlock(&d -> lock);
+		return entry;
+	}
+	d -> misses++;
+	pthread_mutex_unlock(&d -> lock);
+
+	program = wicCompile(*source, length, d -> optLevel);
+	if (program == NULL)
+		return NULL;
+	pthread_mutex_lock(&d -> lock);
+	entry = findEntry(d, hash, *source, length);
+	if (entry != NULL)
+	{
+		entry -> users++;
+		entry -> lastUsed = ++d -> clock;
+		pthread_mutex_unlock(&d -> lock);
+		wicFreeProgram(program);
+		return entry;
+	}
+	entry = (daemonEntryType*) calloc(1, sizeof(daemonEntryType));
+	if (entry == NULL || (entry -> idle = (wicInstanceType**) malloc(d -> idleLimit * sizeof(wicInstanceType*))) == NULL)
+	{
+		printf("Out of memory caching a program!\n");
+		exit(5);
+	}
+	entry -> hash = hash;
+	entry -> source = *source;
+	entry -> length = length;
+	entry -> program = program;
+	entry -> users = 1;
+	entry -> lastUsed = ++d -> clock;
+	*source = NULL;
+	if (d -> entryCount == d -> capacity)
+	{
+		oldest = 0;
+		for (i = 1; i < d -> entryCount; i++)
+		{
+			if (d -> entries[i] -> lastUsed < d -> entries[oldest] -> lastUsed)
+				oldest = i;
+		}
+		dropped = d -> entries[oldest];
+		d -> entries[oldest] = d -> entries[--d -> entryCount];
+		d -> evictions++;
+		dropped -> evicted = 1;
+		if (dropped -> users > 0)
+			dropped = NULL;
+	}
+	d -> entries[d -> entryCount++] = entry;
+	pthread_mutex_unlock(&d -> lock);
+	if (dropped != NULL)
+		freeEntry(dropped);
+	return entry;
+}
+
+// Function: takeInstance
+// Description: Gives a request an instance of a cached program to run - an idle one if there is one, else a new one.
+// Params: Daemon, entry.
+// Returns: The instance, reset.
+// Modifies: Entry.
+static wicInstanceType* takeInstance(daemonType* d, daemonEntryType* entry)
+{
+	wicInstanceType* instance = NULL;
+	pthread_mutex_lock(&d -> lock);
+	if (entry -> idleCount > 0)
+		instance = entry -> idle[--entry -> idleCount];
+	pthread_mutex_unlock(&d -> lock);
+	if (instance == NULL)
+	{
+		instance = wicCreateInstance(entry -> program);
+		wicSetOverflowMode(instance, d -> overflowMode);
+	}
+	return instance;
+}
+
+// Function: releaseEntry
+// Description: Finishes a request's use of a cached program. Its instance is reset and kept for the next request, and an
+//                entry evicted while the request ran is freed if this was its last user.
+// Params: Daemon, entry, instance the request ran.
+// Returns: None.
+// Modifies: Cache.
+static void releaseEntry(daemonType* d, daemonEntryType* entry, wicInstanceType* instance)
+{
+	int drop;
+	wicSetCallbacks(instance, NULL, NULL, NULL);
+	wicBindInput(instance, NULL, 0);
+	wicReset(instance);
+	pthread_mutex_lock(&d -> lock);
+	entry -> users--;
+	drop = entry -> evicted && entry -> users == 0;
+	if (entry -> idleCount < d -> idleLimit)
+	{
+		entry -> idle[entry -> idleCount++] = instance;
+		instance = NULL;
+	}
+	pthread_mutex_unlock(&d -> lock);
+	wicDestroyInstance(instance);
+	if (drop)
+		freeEntry(entry);
+}
+
+// Function: parseValues
+// Description: Parses the values on a 'run' line.
+// Params: Text after the source length, where to put the values (room for one per two characters of text, plus one).
+// Returns: How many there are, or -1 if one is not a number or does not fit in a wicInt.
+// Modifies: Values.
+static int parseValues(char* text, wicInt* values)
+{
+	int count = 0;
+	for (;;)
+	{
+		char* end;
+		long long value;
+		while (*text == ' ' || *text == '\t' || *text == '\r')
+			text++;
+		if (*text == '\0')
+			return count;
+		errno = 0;
+		value = strtoll(text, &end, 10);
+		if (end == text || (*end != '\0' && *end != ' ' && *end != '\t' && *end != '\r') || errno == ERANGE
+			|| value < WIC_INT_MIN || value > WIC_INT_MAX)
+			return -1;
+		values[count++] = (wicInt) value;
+		text = end;
+	}
+}
+
+// Function: runProgram
+// Description: Runs the program a 'run' request sent. It runs in slices of DAEMON_SLICE instructions, with its output sent
+//                after each, so a long run streams its 'put's; it is stopped with an error once it has run the daemon's
+//                budget, and abandoned if the client goes away.
+// Params: Daemon, connection, the values its gets take, how many.
+// Returns: 0 if the connection can take another request, -1 if the client has gone.
+// Modifies: Cache, connection (the cache may take its source).
+static int runProgram(daemonType* d, daemonConnectionType* c, wicInt* values, int count)
+{
+	char text[96];
+	daemonEntryType* entry;
+	wicInstanceType* instance;
+	wicStatusType status;
+	int hit, gone = 0;
+	entry = acquireEntry(d, &c -> source, c -> sourceLength, &hit);
+	if (entry == NULL)
+	{
+		// wicCompile kept the loader's reason on this thread.
+		replyError(c, wicLastError()[0] != '\0' ? wicLastError() : "the program did not load");
+		return 0;
+	}
+	instance = takeInstance(d, entry);
+	wicBindInput(instance, values, count);
+	wicSetCallbacks(instance, NULL, daemonPut, c);
+	for (;;)
+	{
+		long long left = d -> budget - wicInstructionCount(instance);
+		status = WIC_BUDGET;
+		if (left <= 0)
+			break;
+		status = wicRun(instance, left < DAEMON_SLICE ? left : DAEMON_SLICE);
+		if (status != WIC_BUDGET)
+			break;
+		flushOutput(c);
+		if (clientGone(c))
+		{
+			gone = 1;
+			break;
+		}
+	}
+	if (status == WIC_HALTED)
+	{
+		sprintf(text, "ok %lld %s\n", wicInstructionCount(instance), hit ? "hit" : "miss");
+		writeOutput(c, text, (int) strlen(text));
+	}
+	else if (status == WIC_BUDGET)
+	{
+		sprintf(text, "the program ran past its budget of %lld instructions", d -> budget);
+		replyError(c, text);
+	}
+	else
+		replyError(c, wicErrorMessage(instance));
+	releaseEntry(d, entry, instance);
+	return gone ? -1 : 0;
+}
+
+// Function: serveRequest
+// Description: Answers the request that has arrived on a connection (see bufferRequest), and clears it for the next one.
+// Params: Daemon, connection.
+// Returns: 0 if the connection can take another request, -1 if it is finished with.
+// Modifies: Cache, connection.
+static int serveRequest(daemonType* d, daemonConnectionType* c)
+{
+	char text[96];
+	char* end;
+	wicInt* values;
+	int count, keep = -1;
+	if (c -> tooLong)
+		replyError(c, "the request line is too long");
+	else if (strcmp(c -> line, "stats") == 0)
+	{
+		pthread_mutex_lock(&d -> lock);
+		sprintf(text, "stats %lld %lld %lld %d %lld\n", d -> requests, d -> hits, d -> misses, d -> entryCount,
+			d -> evictions);
+		pthread_mutex_unlock(&d -> lock);
+		writeOutput(c, text, (int) strlen(text));
+		keep = 0;
+	}
+	else if (strncmp(c -> line, "run ", 4) != 0)
+		replyError(c, "unknown request");
+	else if (c -> source == NULL)
+		replyError(c, "the source length is missing or too large");
+	else
+	{
+		strtoll(c -> line + 4, &end, 10);
+		values = (wicInt*) malloc((strlen(end) / 2 + 1) * sizeof(wicInt));
+		if (values == NULL)
+		{
+			printf("Out of memory reading a request!\n");
+			exit(5);
+		}
+		count = parseValues(end, values);
+		if (count < 0)
+		{
+			replyError(c, "an input value is not a number, or is too large");
+			keep = 0;
+		}
+		else
+			keep = runProgram(d, c, values, count);
+		free(values);
+	}
+	flushOutput(c);
+	free(c -> source);
+	c -> source = NULL;
+	c -> haveLine = 0;
+	c -> tooLong = 0;
+	return c -> broken ? -1 : keep;
+}
+
+// Function: daemonWorker
+// Description: Worker thread - serves the requests the dispatcher has read in full, and hands each connection back once
+//                there is no other whole request buffered on it, or closes it if it is finished with.
+// Params: Daemon.
+// Returns: Never.
+// Modifies: Cache, connections.
+static void* daemonWorker(void* argument)
+{
+	daemonType* d = (daemonType*) argument;
+	for (;;)
+	{
+		daemonConnectionType* c;
+		int keep;
+		pthread_mutex_lock(&d -> lock);
+		while (d -> waitingHead == NULL)
+			pthread_cond_wait(&d -> ready, &d -> lock);
+		c = d -> waitingHead;
+		d -> waitingHead = c -> next;
+		if (d -> waitingHead == NULL)
+			d -> waitingTail = NULL;
+		pthread_mutex_unlock(&d -> lock);
+		// Requests sent back to back may already be buffered, where poll would never see them.
+		do
+			keep = serveRequest(d, c) == 0;
+		while (keep && bufferRequest(c));
+		if (!keep)
+		{
+			closeConnection(c);
+			continue;
+		}
+		pthread_mutex_lock(&d -> lock);
+		c -> next = d -> returned;
+		d -> returned = c;
+		pthread_mutex_unlock(&d -> lock);
+		if (write(d -> wake[1], "w", 1) < 0)
+			continue;
+	}
+	return NULL;
+}
+
+// Connections between requests, which the dispatcher polls, with room to poll the listening socket and the wake pipe too.
+typedef struct
+{
+	daemonConnectionType** connections;
+	struct pollfd* polls;
+	int count;
+	int capacity;
+} daemonWatchType;
+
+// Function: watchConnection
+// Description: Adds a connection to those the dispatcher polls, making room for it first.
+// Params: Watched connections, connection (NULL just to make sure there is room to poll them all).
+// Returns: None.
+// Modifies: Watched connections.
+static void watchConnection(daemonWatchType* watched, daemonConnectionType* c)
+{
+	if (watched -> count + 3 > watched -> capacity)
+	{
+		watched -> capacity = watched -> capacity * 2 + 16;
+		watched -> connections = (daemonConnectionType**) realloc(watched -> connections,
+			watched -> capacity * sizeof(daemonConnectionType*));
+		watched -> polls = (struct pollfd*) realloc(watched -> polls, watched -> capacity * sizeof(struct pollfd));
+		if (watched -> connections == NULL || watched -> polls == NULL)
+		{
+			printf("Out of memory in the daemon!\n");
+			exit(5);
+		}
+	}
+	if (c != NULL)
+		watched -> connections[watched -> count++] = c;
+}
+
+// Function: listenOn
+// Description: Creates the daemon's socket. A socket file left behind by a daemon that is no longer running is replaced.
+// Params: Socket file name.
+// Returns: The listening socket, or -1 after saying why there is none.
+// Modifies: The socket file.
+static int listenOn(char* socketName)
+{
+	struct sockaddr_un address;
+	struct stat info;
+	int fd;
+	if (strlen(socketName) >= sizeof(address.sun_path))
+	{
+		printf("The socket name %s is too long!\n", socketName);
+		return -1;
+	}
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketName);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+	{
+		printf("Could not create a socket!\n");
+		return -1;
+	}
+	if (stat(socketName, &info) == 0)
+	{
+		if (!S_ISSOCK(info.st_mode))
+		{
+			printf("%s is already there, and is not a socket!\n", socketName);
+			close(fd);
+			return -1;
+		}
+		if (connect(fd, (struct sockaddr*) &address, sizeof(address)) == 0)
+		{
+			printf("A daemon is already listening on %s!\n", socketName);
+			close(fd);
+			return -1;
+		}
+		close(fd);
+		unlink(socketName);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	}
+	if (fd < 0 || bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0 || listen(fd, DAEMON_BACKLOG) != 0)
+	{
+		printf("Could not listen on %s!\n", socketName);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+// Function: runDaemon
+// Description: Runs the daemon until SIGINT or SIGTERM. The calling thread is the dispatcher: it accepts connections, and
+//                reads from every connection that is between requests, handing one to the worker pool only once a whole
+//                request has arrived on it, so a few workers can serve many clients, however slowly they send. Programs
+//                are compiled once at the given optimization level, cached (the least recently used dropped once more than
+//                cacheSize are), and run on instances of their own (see libwic.c) - on the budgeted switch engine, trapping
+//                or wrapping on overflow as selected, never promoting, for at most budget instructions a request.
+// Params: Socket file name, worker threads (0 for one per processor), most programs to cache, instructions a request may run
+//           (0 for DAEMON_BUDGET), optimization level.
+// Returns: 0 once stopped, 2 if the socket could not be created.
+// Modifies: The socket file, which is removed again when the daemon stops.
+int runDaemon(char* socketName, int threads, int cacheSize, long long budget, int optLevel)
+{
+	daemonType d;
+	daemonWatchType watched;
+	struct sigaction action;
+	pthread_t handle;
+	int listener, i;
+	memset(&d, 0, sizeof(d));
+	memset(&watched, 0, sizeof(watched));
+	d.capacity = cacheSize > 0 ? cacheSize : 1;
+	d.idleLimit = threads > 0 ? threads : batchCores();
+	d.optLevel = optLevel;
+	d.budget = budget > 0 ? budget : DAEMON_BUDGET;
+	d.overflowMode = currentVm -> overflowMode == OVERFLOW_WRAP ? OVERFLOW_WRAP : OVERFLOW_TRAP;
+	d.entries = (daemonEntryType**) malloc(d.capacity * sizeof(daemonEntryType*));
+	if (d.entries == NULL)
+	{
+		printf("Out of memory starting the daemon!\n");
+		exit(5);
+	}
+	listener = listenOn(socketName);
+	if (listener < 0)
+		return 2;
+	if (pipe(d.wake) != 0)
+	{
+		printf("Could not start the daemon!\n");
+		close(listener);
+		unlink(socketName);
+		return 2;
+	}
+	pthread_mutex_init(&d.lock, NULL);
+	pthread_cond_init(&d.ready, NULL);
+	// A client that goes away mid-reply must not take the daemon with it, and no SA_RESTART, so a stop signal interrupts
+	// the poll.
+	signal(SIGPIPE, SIG_IGN);
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = onDaemonSignal;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	for (i = 0; i < d.idleLimit; i++)
+	{
+		if (pthread_create(&handle, NULL, daemonWorker, &d) != 0)
+		{
+			printf("Could not start daemon worker thread %d!\n", i);
+			exit(5);
+		}
+		pthread_detach(handle);
+	}
+	printf("Listening on %s with %d workers, caching up to %d programs, running each for up to %lld instructions.\n",
+		socketName, d.idleLimit, d.capacity, d.budget);
+	fflush(stdout);
+
+	while (!daemonStop)
+	{
+		int kept = 0;
+		watchConnection(&watched, NULL);
+		watched.polls[0].fd = listener;
+		watched.polls[1].fd = d.wake[0];
+		for (i = 0; i < watched.count; i++)
+			watched.polls[i + 2].fd = watched.connections[i] -> fd;
+		for (i = 0; i < watched.count + 2; i++)
+		{
+			watched.polls[i].events = POLLIN;
+			watched.polls[i].revents = 0;
+		}
+		if (poll(watched.polls, watched.count + 2, -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			printf("The daemon could not wait for requests!\n");
+			break;
+		}
+		// Connections with a whole request waiting go to the workers; the rest are watched again, or closed if the client
+		// has gone.
+		for (i = 0; i < watched.count; i++)
+		{
+			int ready = watched.polls[i + 2].revents != 0 ? readRequest(watched.connections[i]) : 0;
+			if (ready < 0)
+				closeConnection(watched.connections[i]);
+			if (ready <= 0)
+			{
+				if (ready == 0)
+					watched.connections[kept++] = watched.connections[i];
+				continue;
+			}
+			pthread_mutex_lock(&d.lock);
+			watched.connections[i] -> next = NULL;
+			if (d.waitingTail != NULL)
+				d.waitingTail -> next = watched.connections[i];
+			else
+				d.waitingHead = watched.connections[i];
+			d.waitingTail = watched.connections[i];
+			pthread_cond_signal(&d.ready);
+			pthread_mutex_unlock(&d.lock);
+		}
+		watched.count = kept;
+		if (watched.polls[1].revents != 0)
+		{
+			char drained[64];
+			daemonConnectionType* c;
+			if (read(d.wake[0], drained, sizeof(drained)) < 0)
+				continue;
+			pthread_mutex_lock(&d.lock);
+			c = d.returned;
+			d.returned = NULL;
+			pthread_mutex_unlock(&d.lock);
+			while (c != NULL)
+			{
+				daemonConnectionType* next = c -> next;
+				watchConnection(&watched, c);
+				c = next;
+			}
+		}
+		if (watched.polls[0].revents != 0)
+		{
+			int fd = accept(listener, NULL, NULL);
+			// Non-blocking, so the dispatcher only ever takes what has arrived (see writeAll for the workers' side).
+			if (fd >= 0 && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0)
+				watchConnection(&watched, newConnection(fd));
+			else if (fd >= 0)
+				close(fd);
+		}
+	}
+	close(listener);
+	unlink(socketName);
+	pthread_mutex_lock(&d.lock);
+	printf("Stopped after %lld requests: %lld cache hits, %lld misses, %lld evictions.\n", d.requests, d.hits, d.misses,
+		d.evictions);
+	pthread_mutex_unlock(&d.lock);
+	// The workers may still be running requests; they go when the process exits.
+	return 0;
+}
+
+// One load generator client: its share of the requests, and how long each took.
+typedef struct
+{
+	const char* socketName;
+	const char* request;
+	size_t length;
+	int requests;
+	double* latencies;
+	int errors;
+	// Set if the client could not connect, or the daemon went away mid-run.
+	int failed;
+} loadClientType;
+
+// Function: connectTo
+// Description: Connects to a daemon's socket.
+// Params: Socket file name.
+// Returns: The connected socket, or -1.
+// Modifies: None.
+static int connectTo(const char* socketName)
+{
+	struct sockaddr_un address;
+	int fd;
+	if (strlen(socketName) >= sizeof(address.sun_path))
+		return -1;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, socketName);
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd >= 0 && connect(fd, (struct sockaddr*) &address, sizeof(address)) != 0)
+	{
+		close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+// Function: loadClient
+// Description: Load generator client thread - sends its requests one after another on one connection, timing each from
+//                sending it to reading its 'ok' or 'error' line.
+// Params: Client.
+// Returns: NULL.
+// Modifies: Client.
+static void* loadClient(void* argument)
+{
+	loadClientType* client = (loadClientType*) argument;
+	daemonConnectionType* c;
+	int fd = connectTo(client -> socketName);
+	int i;
+	if (fd < 0)
+	{
+		client -> failed = 1;
+		return NULL;
+	}
+	c = newConnection(fd);
+	for (i = 0; i < client -> requests; i++)
+	{
+		double start = wallSeconds();
+		char* line;
+		int got;
+		if (writeAll(fd, client -> request, client -> length) != 0)
+			break;
+		while ((got = readLine(c, &line)) >= 0 && strncmp(line, "ok ", 3) != 0 && strncmp(line, "error ", 6) != 0)
+			;
+		if (got < 0)
+			break;
+		client -> latencies[i] = wallSeconds() - start;
+		if (line[0] == 'e')
+			client -> errors++;
+	}
+	client -> failed = i < client -> requests;
+	close(fd);
+	free(c);
+	return NULL;
+}
+
+// Function: compareLatencies
+// Description: qsort comparison for request latencies.
+// Params: Two doubles.
+// Returns: Negative, zero or positive.
+// Modifies: None.
+static int compareLatencies(const void* a, const void* b)
+{
+	double x = *(const double*) a;
+	double y = *(const double*) b;
+	return x < y ? -1 : x > y;
+}
+
+// Function: buildRequest
+// Description: Builds the 'run' request the load generator sends: the program's source, with the values in an input file
+//                (integers separated by spaces, commas or new lines, as for '--input') on the request line.
+// Params: Program file name, input file name (NULL for none), where to put the request's length.
+// Returns: The request, or NULL after saying why there is none.
+// Modifies: Length.
+static char* buildRequest(char* program, char* input, size_t* length)
+{
+	sourceTextType source;
+	sourceTextType values;
+	FILE* file = fopen(program, "rb");
+	char* request;
+	size_t used, i;
+	if (file == NULL)
+	{
+		printf("Could not open %s!\n", program);
+		return NULL;
+	}
+	readSource(file, &source);
+	fclose(file);
+	values.text = NULL;
+	values.length = 0;
+	values.mapped = 0;
+	if (input != NULL)
+	{
+		file = fopen(input, "rb");
+		if (file == NULL)
+		{
+			printf("Could not open %s!\n", input);
+			releaseSource(&source);
+			return NULL;
+		}
+		readSource(file, &values);
+		fclose(file);
+	}
+	// Each value is copied with the separator in front of it, so the line is never longer than the file plus its header.
+	request = (char*) malloc(values.length + source.length + 32);
+	if (request == NULL)
+	{
+		printf("Out of memory building the request!\n");
+		exit(5);
+	}
+	used = (size_t) sprintf(request, "run %lu", (unsigned long) source.length);
+	for (i = 0; i < values.length; )
+	{
+		size_t start;
+		if (isspace((unsigned char) values.text[i]) || values.text[i] == ',')
+		{
+			i++;
+			continue;
+		}
+		start = i;
+		while (i < values.length && !isspace((unsigned char) values.text[i]) && values.text[i] != ',')
+			i++;
+		request[used++] = ' ';
+		memcpy(request + used, values.text + start, i - start);
+		used += i - start;
+	}
+	request[used++] = '\n';
+	memcpy(request + used, source.text, source.length);
+	*length = used + source.length;
+	releaseSource(&source);
+	if (input != NULL)
+		releaseSource(&values);
+	return request;
+}
+
+// Function: runLoad
+// Description: Load generator for the daemon. Clients, each a thread with its own connection, send the same program run
+//                between them until the given number of requests is done, then the throughput and the spread of request
+//                latencies are printed as CSV. The first request may compile the program; every other one should hit the
+//                daemon's cache.
+// Params: 'SOCKET,PROGRAM.wic' or 'SOCKET,PROGRAM.wic,INPUT', clients (0 for one per processor), total requests.
+// Returns: 0 if every request was answered, 2 if a file could not be read or the daemon could not be reached.
+// Modifies: None.
+int runLoad(char* spec, int clients, int requests)
+{
+	loadClientType* client;
+	pthread_t* handles;
+	double* latencies;
+	char* program = strchr(spec, ',');
+	char* input;
+	char* request;
+	size_t length;
+	double start, seconds;
+	int i, done = 0, errors = 0, failed = 0;
+	if (program == NULL)
+	{
+		printf("--load needs SOCKET,PROGRAM.wic!\n");
+		return 4;
+	}
+	*program++ = '\0';
+	input = strchr(program, ',');
+	if (input != NULL)
+		*input++ = '\0';
+	if (clients <= 0)
+		clients = batchCores();
+	if (requests < clients)
+		requests = clients;
+	request = buildRequest(program, input, &length);
+	if (request == NULL)
+		return 2;
+	client = (loadClientType*) calloc(clients, sizeof(loadClientType));
+	handles = (pthread_t*) malloc(clients * sizeof(pthread_t));
+	latencies = (double*) malloc(requests * sizeof(double));
+	if (client == NULL || handles == NULL || latencies == NULL)
+	{
+		printf("Out of memory starting the load!\n");
+		exit(5);
+	}
+	signal(SIGPIPE, SIG_IGN);
+	start = wallSeconds();
+	for (i = 0; i < clients; i++)
+	{
+		client[i].socketName = spec;
+		client[i].request = request;
+		client[i].length = length;
+		client[i].requests = requests / clients + (i < requests % clients);
+		client[i].latencies = latencies + done;
+		done += client[i].requests;
+		if (pthread_create(&handles[i], NULL, loadClient, &client[i]) != 0)
+		{
+			printf("Could not start load client %d!\n", i);
+			exit(5);
+		}
+	}
+	for (i = 0; i < clients; i++)
+		pthread_join(handles[i], NULL);
+	seconds = wallSeconds() - start;
+	for (i = 0; i < clients; i++)
+	{
+		errors += client[i].errors;
+		failed |= client[i].failed;
+	}
+	if (failed)
+		printf("Could not reach a daemon on %s for every request!\n", spec);
+	else
+	{
+		qsort(latencies, requests, sizeof(double), compareLatencies);
+		printf("clients,requests,seconds,requests_per_s,p50_ms,p99_ms,max_ms,errors\n");
+		printf("%d,%d,%.3f,%.0f,%.3f,%.3f,%.3f,%d\n", clients, requests, seconds, requests / seconds,
+			latencies[requests / 2] * 1e3, latencies[(int) (requests * 0.99)] * 1e3, latencies[requests - 1] * 1e3,
+			errors);
+	}
+	free(request);
+	free(client);
+	free(handles);
+	free(latencies);
+	return failed ? 2 : 0;
+}
+
+#else
+
+// Function: runDaemon
+// Description: Unix domain sockets and the daemon's poll loop are POSIX only.
+// Params: Socket file name, worker threads, most programs to cache, instructions a request may run, optimization level.
+// Returns: 4.
+// Modifies: None.
+int runDaemon(char* socketName, int threads, int cacheSize, long long budget, int optLevel)
+{
+	(void) socketName;
+	(void) threads;
+	(void) cacheSize;
+	(void) budget;
+	(void) optLevel;
+	printf("The daemon is not supported on this platform!\n");
+	return 4;
+}
+
+// Function: runLoad
+// Description: The load generator is POSIX only, like the daemon.
+// Params: Socket and program, clients, total requests.
+// Returns: 4.
+// Modifies: None.
+int runLoad(char* spec, int clients, int requests)
+{
+	(void) spec;
+	(void) clients;
+	(void) requests;
+	printf("The daemon is not supported on this platform!\n");
+	return 4;
+}
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+// Interpreter daemon - keeps compiled programs warm and runs them for clients over a Unix domain socket, on a pool of
+// worker threads, so that jobs running many programs skip process startup and parsing (see daemon.c for the protocol).
+// runLoad is its load generator.
+int runDaemon(char* socketName, int threads, int cacheSize, long long budget, int optLevel);
+int runLoad(char* spec, int clients, int requests);
+
+#endif
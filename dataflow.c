@@ -0,0 +1,626 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dataflow.h"
+#include "instructions.h"
+
+// Most cells (blocks times variables) spent following variable values from block to block. Past this only the stack is
+// followed, and every variable is taken to be unknown at the start of a block.
+#define DATAFLOW_MAX_CELLS (1 << 24)
+
+// The current VM's report (see foldReportType).
+#define vmFoldReport (currentVm -> foldReport)
+
+// What is known about a variable or a stack entry at one point: a constant it holds on every path that gets there, or nothing.
+typedef struct
+{
+	int known;
+	wicInt value;
+} valueType;
+
+// A basic block: a run of instructions only entered at the top and only left at the bottom. The block starting at the
+// program's length is the restart past the end, which holds no instructions and carries on at address 0.
+typedef struct
+{
+	int start;
+	int end;
+	int reached;
+	int queued;
+	// What is known on entry: the tracked variables, then the stack, bottom first.
+	valueType* in;
+} blockType;
+
+// Abstract machine state while working through a block.
+typedef struct
+{
+	// Variables, or NULL when they are not tracked.
+	valueType* vars;
+	valueType* stack;
+	// For each stack entry, the address of the push that put it there, or -1. Only set for constants pushed in the block
+	// being worked through, since only those can be removed along with the instruction that uses them.
+	int* producers;
+	int depth;
+	// Value the last jf popped.
+	valueType condition;
+} flowStateType;
+
+// The whole program being worked on.
+typedef struct
+{
+	instructionType* code;
+	int count;
+	blockType* blocks;
+	int blockCount;
+	// Block each address is in.
+	int* blockOf;
+	int trackedVars;
+	int* work;
+	int workCount;
+	flowStateType state;
+} flowType;
+
+// Function: constant
+// Description: Builds a known value.
+// Params: Value.
+// Returns: The known value.
+// Modifies: None.
+static valueType constant(wicInt value)
+{
+	valueType v;
+	v.known = 1;
+	v.value = value;
+	return v;
+}
+
+// Function: unknown
+// Description: Builds an unknown value.
+// Params: None.
+// Returns: The unknown value.
+// Modifies: None.
+static valueType unknown()
+{
+	valueType v;
+	v.known = 0;
+	v.value = 0;
+	return v;
+}
+
+// Function: pushValue
+// Description: Pushes a value onto the abstract stack.
+// Params: State, value, address of the instruction that pushed it if it may be removed, otherwise -1.
+// Returns: None.
+// Modifies: State.
+static void pushValue(flowStateType* s, valueType v, int producer)
+{
+	s -> stack[s -> depth] = v;
+	s -> producers[s -> depth] = v.known ? producer : -1;
+	s -> depth++;
+}
+
+// Function: popValue
+// Description: Pops a value off the abstract stack. The stack depths are static, so no path pops an empty stack.
+// Params: State, where to put the address of the push that produced the value (-1 if it may not be removed).
+// Returns: The value.
+// Modifies: State, producer.
+static valueType popValue(flowStateType* s, int* producer)
+{
+	s -> depth--;
+	*producer = s -> producers[s -> depth];
+	return s -> stack[s -> depth];
+}
+
+// Function: removeInstruction
+// Description: Turns an instruction into a nop, which the optimizer then drops.
+// Params: Program, address.
+// Returns: None.
+// Modifies: Program.
+static void removeInstruction(instructionType* code, int pc)
+{
+	code[pc].op = OP_NOP;
+}
+
+// Function: replaceWithPush
+// Description: Turns an instruction into an immediate push of a constant.
+// Params: Program, address, constant.
+// Returns: None.
+// Modifies: Program.
+static void replaceWithPush(instructionType* code, int pc, wicInt value)
+{
+	code[pc].op = OP_PUSHI;
+	code[pc].arg.immediate = value;
+}
+
+// Function: foldBinary
+// Description: Works out 'lop op rop' the way the engines would. Anything that overflows or divides by zero is left to run
+//                time, so the error (or the wrapped or promoted result, see setOverflowMode) comes from the engines.
+// Params: Opcode, left and right values, where to put the result.
+// Returns: 1 if the result was worked out, 0 if it has to be left to run time.
+// Modifies: Result.
+static int foldBinary(opcodeType op, wicInt lop, wicInt rop, wicInt* result)
+{
+	switch (op)
+	{
+	case OP_ADD:
+		return !ADD_OVERFLOWS(lop, rop, result);
+	case OP_SUB:
+		return !SUB_OVERFLOWS(lop, rop, result);
+	case OP_MULT:
+		return !MULT_OVERFLOWS(lop, rop, result);
+	case OP_DIV:
+		if (rop == 0 || DIV_OVERFLOWS(lop, rop))
+			return 0;
+		*result = lop / rop;
+		return 1;
+	case OP_AND:
+		*result = rop > 0 && lop > 0;
+		return 1;
+	case OP_OR:
+		*result = rop != 0 || lop != 0;
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// Function: foldTest
+// Description: Works out not or tsteq..tstge on a value.
+// Params: Opcode, value.
+// Returns: '1' or '0'.
+// Modifies: None.
+static int foldTest(opcodeType op, wicInt value)
+{
+	switch (op)
+	{
+	case OP_NOT:
+	case OP_TSTEQ:
+		return value == 0;
+	case OP_TSTNE:
+		return value != 0;
+	case OP_TSTLT:
+		return value < 0;
+	case OP_TSTLE:
+		return value <= 0;
+	case OP_TSTGT:
+		return value > 0;
+	default:
+		return value >= 0;
+	}
+}
+
+// Function: step
+// Description: Transfer function - moves the abstract state over one instruction. When rewriting, also replaces the
+//                instruction with what is left of it once everything known is taken out: a push of a variable with a known
+//                value becomes an immediate push, an operation on constants pushed in the same block becomes a push of the
+//                result (the pushes are removed), and a jf on such a constant becomes a j or nothing.
+// Params: Program, state, address, 1 to rewrite.
+// Returns: None.
+// Modifies: State, and the program when rewriting.
+static void step(flowType* flow, int pc, int rewrite)
+{
+	flowStateType* s = &flow -> state;
+	instructionType* inst = &vmInstTab.instructions[pc];
+	valueType lop, rop;
+	int lp, rp;
+	wicInt result;
+	// Set once the instruction has been turned into a push of its result, which may then be removed in turn.
+	int producer = -1;
+	switch (inst -> op)
+	{
+	case OP_GET:
+		if (s -> vars != NULL)
+			s -> vars[inst -> arg.slot] = unknown();
+		break;
+	case OP_PUSH:
+		lop = s -> vars != NULL ? s -> vars[inst -> arg.slot] : unknown();
+		if (rewrite && lop.known)
+			replaceWithPush(flow -> code, pc, lop.value);
+		pushValue(s, lop, pc);
+		break;
+	case OP_PUSHI:
+		pushValue(s, constant(inst -> arg.immediate), pc);
+		break;
+	case OP_POP:
+		lop = popValue(s, &lp);
+		if (s -> vars != NULL)
+			s -> vars[inst -> arg.slot] = lop;
+		break;
+	case OP_ADD:
+	case OP_SUB:
+	case OP_MULT:
+	case OP_DIV:
+	case OP_AND:
+	case OP_OR:
+		rop = popValue(s, &rp);
+		lop = popValue(s, &lp);
+		if (lop.known && rop.known && foldBinary(inst -> op, lop.value, rop.value, &result))
+		{
+			if (rewrite && lp >= 0 && rp >= 0)
+			{
+				removeInstruction(flow -> code, lp);
+				removeInstruction(flow -> code, rp);
+				replaceWithPush(flow -> code, pc, result);
+				vmFoldReport.folded++;
+				producer = pc;
+			}
+			pushValue(s, constant(result), producer);
+			break;
+		}
+		pushValue(s, unknown(), -1);
+		break;
+	case OP_NOT:
+	case OP_TSTEQ:
+	case OP_TSTNE:
+	case OP_TSTLT:
+	case OP_TSTLE:
+	case OP_TSTGT:
+	case OP_TSTGE:
+		lop = popValue(s, &lp);
+		if (!lop.known)
+		{
+			pushValue(s, unknown(), -1);
+			break;
+		}
+		result = foldTest(inst -> op, lop.value);
+		if (rewrite && lp >= 0)
+		{
+			removeInstruction(flow -> code, lp);
+			replaceWithPush(flow -> code, pc, result);
+			vmFoldReport.folded++;
+			producer = pc;
+		}
+		pushValue(s, constant(result), producer);
+		break;
+	case OP_JF:
+		s -> condition = popValue(s, &lp);
+		if (rewrite && s -> condition.known)
+		{
+			vmFoldReport.branches++;
+			if (lp >= 0)
+			{
+				removeInstruction(flow -> code, lp);
+				if (s -> condition.value == 0)
+					flow -> code[pc].op = OP_J;
+				else
+					removeInstruction(flow -> code, pc);
+			}
+		}
+		break;
+	case OP_SPAWN:
+	case OP_JOIN:
+	case OP_CHAN:
+	case OP_RECV:
+		// Handles and received values are only known at run time.
+		popValue(s, &lp);
+		pushValue(s, unknown(), -1);
+		break;
+	case OP_SEND:
+	case OP_ASTORE:
+		popValue(s, &rp);
+		popValue(s, &lp);
+		break;
+	case OP_ARRAY:
+		popValue(s, &lp);
+		break;
+	case OP_ALOAD:
+	case OP_ACOUNTEQ:
+	case OP_ACOUNTNE:
+	case OP_ACOUNTLT:
+	case OP_ACOUNTLE:
+	case OP_ACOUNTGT:
+	case OP_ACOUNTGE:
+		// Array values are not tracked - they can be loaded from a file, and tasks share them.
+		popValue(s, &lp);
+		pushValue(s, unknown(), -1);
+		break;
+	case OP_ALEN:
+	case OP_ASUM:
+	case OP_AMIN:
+	case OP_AMAX:
+	case OP_ADOT:
+		pushValue(s, unknown(), -1);
+		break;
+	default:
+		break;
+	}
+}
+
+// Function: reach
+// Description: Passes the state at the end of a block on to one of its successors. The first time a block is reached it
+//                takes the state as it is; after that, anything that differs becomes unknown. The block is queued whenever
+//                what is known on entry to it changes.
+// Params: Program, block reached.
+// Returns: None.
+// Modifies: The block, work list.
+static void reach(flowType* flow, int b)
+{
+	blockType* block = &flow -> blocks[b];
+	flowStateType* s = &flow -> state;
+	int changed = 0;
+	int i;
+	if (!block -> reached)
+	{
+		block -> reached = 1;
+		changed = 1;
+		if (flow -> trackedVars > 0)
+			memcpy(block -> in, s -> vars, flow -> trackedVars * sizeof(valueType));
+		memcpy(block -> in + flow -> trackedVars, s -> stack, s -> depth * sizeof(valueType));
+	}
+	else
+	{
+		for (i = 0; i < flow -> trackedVars + s -> depth; i++)
+		{
+			valueType* v = i < flow -> trackedVars ? &s -> vars[i] : &s -> stack[i - flow -> trackedVars];
+			if (block -> in[i].known && (!v -> known || v -> value != block -> in[i].value))
+			{
+				block -> in[i].known = 0;
+				changed = 1;
+			}
+		}
+	}
+	if (changed && !block -> queued)
+	{
+		block -> queued = 1;
+		flow -> work[flow -> workCount++] = b;
+	}
+}
+
+// Function: runBlock
+// Description: Works through one block from what is known on entry to it, then passes the result on to the blocks that can
+//                run next. A jf whose value is known only leads one way. A spawn leads both on and to its task's start,
+//                where the variables are as they were and the stack holds just the task's argument.
+// Params: Program, block, 1 to rewrite the block's instructions (see step).
+// Returns: None.
+// Modifies: Program state, successors, and the program when rewriting.
+static void runBlock(flowType* flow, int b, int rewrite)
+{
+	blockType* block = &flow -> blocks[b];
+	flowStateType* s = &flow -> state;
+	opcodeType last = block -> end > block -> start ? vmInstTab.instructions[block -> end - 1].op : OP_END;
+	int i;
+	if (flow -> trackedVars > 0)
+		memcpy(s -> vars, block -> in, flow -> trackedVars * sizeof(valueType));
+	s -> depth = vmInstTab.depths[block -> start];
+	memcpy(s -> stack, block -> in + flow -> trackedVars, s -> depth * sizeof(valueType));
+	for (i = 0; i < s -> depth; i++)
+		s -> producers[i] = -1;
+	for (i = block -> start; i < block -> end; i++)
+		step(flow, i, rewrite);
+	if (rewrite)
+		return;
+	switch (last)
+	{
+	case OP_END:
+		reach(flow, flow -> blockOf[0]);
+		break;
+	case OP_HALT:
+		break;
+	case OP_J:
+		reach(flow, flow -> blockOf[vmInstTab.instructions[block -> end - 1].arg.target]);
+		break;
+	case OP_JF:
+		if (!s -> condition.known || s -> condition.value == 0)
+			reach(flow, flow -> blockOf[vmInstTab.instructions[block -> end - 1].arg.target]);
+		if (!s -> condition.known || s -> condition.value != 0)
+			reach(flow, flow -> blockOf[block -> end]);
+		break;
+	case OP_SPAWN:
+		reach(flow, flow -> blockOf[block -> end]);
+		s -> depth = 1;
+		s -> stack[0] = unknown();
+		reach(flow, flow -> blockOf[vmInstTab.instructions[block -> end - 1].arg.target]);
+		break;
+	default:
+		reach(flow, flow -> blockOf[block -> end]);
+		break;
+	}
+}
+
+// Function: entryDepth
+// Description: Gives the stack depth on entry to a block. Blocks analyzeStack never reached have none, and take no room.
+// Params: Block.
+// Returns: Depth.
+// Modifies: None.
+static int entryDepth(blockType* block)
+{
+	return vmInstTab.depths[block -> start] > 0 ? vmInstTab.depths[block -> start] : 0;
+}
+
+// Function: findBlocks
+// Description: Splits the program into basic blocks. A block starts at address 0, at every jump or spawn target, after
+//                every jump, spawn and halt, and at the restart past the end.
+// Params: Program.
+// Returns: None.
+// Modifies: Program blocks.
+static void findBlocks(flowType* flow)
+{
+	int count = flow -> count;
+	char* leader = (char*) calloc(count + 1, 1);
+	int b = -1;
+	int i;
+	if (leader == NULL)
+		vmOutOfMemory("Out of memory optimizing the program!\n");
+	leader[0] = 1;
+	leader[count] = 1;
+	for (i = 0; i < count; i++)
+	{
+		opcodeType op = vmInstTab.instructions[i].op;
+		if (op == OP_J || op == OP_JF || op == OP_SPAWN)
+			leader[vmInstTab.instructions[i].arg.target] = 1;
+		if (op == OP_J || op == OP_JF || op == OP_SPAWN || op == OP_HALT)
+			leader[i + 1] = 1;
+	}
+	flow -> blockCount = 0;
+	for (i = 0; i <= count; i++)
+		flow -> blockCount += leader[i];
+	flow -> blocks = (blockType*) calloc(flow -> blockCount, sizeof(blockType));
+	flow -> blockOf = (int*) malloc((count + 1) * sizeof(int));
+	if (flow -> blocks == NULL || flow -> blockOf == NULL)
+	{
+		free(flow -> blocks);
+		free(flow -> blockOf);
+		free(leader);
+		vmOutOfMemory("Out of memory optimizing the program!\n");
+	}
+	for (i = 0; i <= count; i++)
+	{
+		if (leader[i])
+		{
+			if (b >= 0)
+				flow -> blocks[b].end = i;
+			flow -> blocks[++b].start = i;
+		}
+		flow -> blockOf[i] = b;
+	}
+	flow -> blocks[b].end = count;
+	free(leader);
+}
+
+// Function: removeJumps
+// Description: Removes the jumps left pointing at the instruction that would run next anyway, once everything between the
+//                two has been removed.
+// Params: Program.
+// Returns: None.
+// Modifies: Program.
+static void removeJumps(flowType* flow)
+{
+	int i, j;
+	for (i = 0; i < flow -> count; i++)
+	{
+		int target = flow -> code[i].arg.target;
+		if (flow -> code[i].op != OP_J || target <= i)
+			continue;
+		for (j = i + 1; j < target && (flow -> code[j].op == OP_NOP || flow -> code[j].op == OP_LABEL); j++)
+			;
+		if (j == target)
+		{
+			removeInstruction(flow -> code, i);
+			vmFoldReport.jumps++;
+		}
+	}
+}
+
+// Function: foldProgram
+// Description: Dataflow pass run by the optimizer at level 3. Builds the basic blocks of the loaded program, then finds what
+//                is known on entry to each block by following every path from address 0 until nothing changes: variables
+//                start out as zero, 'get' and anything computed from an unknown value are unknown, and where paths meet
+//                only what they agree on stays known. With that the program is rewritten in place:
+//                  - pushes of a variable that holds the same constant on every path become immediate pushes
+//                  - operations on constants pushed in the same block become a push of the result
+//                  - a jf on such a constant becomes a j, or is removed along with the push, when it always falls through
+//                  - blocks no path reaches are removed, and then jumps to the next remaining instruction
+//                Removed instructions become nops, so every address stays where it was. Nothing that changes a variable or
+//                prints is ever removed, so the program's output is the same. Only done when the stack depths are static
+//                (see analyzeStack), since otherwise stack entries cannot be told apart.
+// Params: Copy of the loaded program to rewrite, with the OP_END past the end.
+// Returns: None.
+// Modifies: Program, the VM's fold report.
+void foldProgram(instructionType* code)
+{
+	flowType flow;
+	valueType* cells;
+	size_t cellCount = 0;
+	int i, j;
+	memset(&vmFoldReport, 0, sizeof(vmFoldReport));
+	if (vmInstTab.maxDepth < 0)
+	{
+		vmFoldReport.skipped = 1;
+		return;
+	}
+	flow.code = code;
+	flow.count = vmInstTab.instructionCount;
+	findBlocks(&flow);
+	flow.trackedVars = (double) vmVariableCount * flow.blockCount <= DATAFLOW_MAX_CELLS ? vmVariableCount : 0;
+	for (i = 0; i < flow.blockCount; i++)
+		cellCount += flow.trackedVars + entryDepth(&flow.blocks[i]);
+	cells = (valueType*) malloc((cellCount > 0 ? cellCount : 1) * sizeof(valueType));
+	flow.state.vars = flow.trackedVars > 0 ? (valueType*) malloc(flow.trackedVars * sizeof(valueType)) : NULL;
+	flow.state.stack = (valueType*) malloc((vmInstTab.maxDepth + 1) * sizeof(valueType));
+	flow.state.producers = (int*) malloc((vmInstTab.maxDepth + 1) * sizeof(int));
+	flow.work = (int*) malloc(flow.blockCount * sizeof(int));
+	if (cells == NULL || flow.state.stack == NULL || flow.state.producers == NULL || flow.work == NULL ||
+		(flow.trackedVars > 0 && flow.state.vars == NULL))
+	{
+		free(flow.work);
+		free(flow.state.producers);
+		free(flow.state.stack);
+		free(flow.state.vars);
+		free(cells);
+		free(flow.blockOf);
+		free(flow.blocks);
+		vmOutOfMemory("Out of memory optimizing the program!\n");
+	}
+	cellCount = 0;
+	for (i = 0; i < flow.blockCount; i++)
+	{
+		flow.blocks[i].in = cells + cellCount;
+		cellCount += flow.trackedVars + entryDepth(&flow.blocks[i]);
+	}
+	// Start at address 0 with every variable zero and nothing on the stack, and keep going until nothing changes.
+	for (i = 0; i < flow.trackedVars; i++)
+		flow.state.vars[i] = constant(0);
+	flow.state.depth = 0;
+	flow.workCount = 0;
+	reach(&flow, 0);
+	while (flow.workCount > 0)
+	{
+		int b = flow.work[--flow.workCount];
+		flow.blocks[b].queued = 0;
+		runBlock(&flow, b, 0);
+	}
+	// Rewrite every block from what is known on entry to it, and remove the ones never reached.
+	vmFoldReport.trackedVariables = flow.trackedVars > 0 || vmVariableCount == 0;
+	vmFoldReport.blocks = flow.blockCount;
+	for (i = 0; i < flow.blockCount; i++)
+	{
+		blockType* block = &flow.blocks[i];
+		if (block -> reached)
+		{
+			vmFoldReport.reachedBlocks++;
+			runBlock(&flow, i, 1);
+			continue;
+		}
+		for (j = block -> start; j < block -> end; j++)
+		{
+			if (code[j].op != OP_NOP && code[j].op != OP_LABEL)
+				vmFoldReport.unreachable++;
+			removeInstruction(code, j);
+		}
+	}
+	removeJumps(&flow);
+	for (i = 0; i < flow.count; i++)
+	{
+		opcodeType was = vmInstTab.instructions[i].op;
+		if (code[i].op == OP_NOP && was != OP_NOP && was != OP_LABEL)
+			vmFoldReport.removed++;
+		if (code[i].op == OP_PUSHI && was == OP_PUSH)
+			vmFoldReport.propagated++;
+	}
+	free(flow.work);
+	free(flow.state.producers);
+	free(flow.state.stack);
+	free(flow.state.vars);
+	free(cells);
+	free(flow.blockOf);
+	free(flow.blocks);
+}
+
+// Function: printFoldReport
+// Description: Prints what the dataflow pass did to the program.
+// Params: None.
+// Returns: None.
+// Modifies: None.
+void printFoldReport()
+{
+	if (vmFoldReport.skipped)
+	{
+		printf("Dataflow: skipped - the stack depths are not static.\n\n");
+		return;
+	}
+	printf("Dataflow: %d of %d blocks reachable%s.\n", vmFoldReport.reachedBlocks, vmFoldReport.blocks,
+		vmFoldReport.trackedVariables ? "" : " (variables not tracked - too many blocks)");
+	printf("Removed %d instructions: %d unreachable, %d in folded expressions and branches, %d redundant jumps.\n",
+		vmFoldReport.removed, vmFoldReport.unreachable,
+		vmFoldReport.removed - vmFoldReport.unreachable - vmFoldReport.jumps, vmFoldReport.jumps);
+	printf("Folded %d expressions and %d branches; %d pushes of a constant variable made immediate.\n\n",
+		vmFoldReport.folded, vmFoldReport.branches, vmFoldReport.propagated);
+}
@@ -0,0 +1,33 @@
+#ifndef DATAFLOW_H
+#define DATAFLOW_H
+
+// What foldProgram did to the last program it was given.
+typedef struct
+{
+	// 1 if the stack depths were not static, in which case the program was left alone.
+	int skipped;
+	// 1 if variable values were followed between blocks, 0 if the program was too big and only the stack was.
+	int trackedVariables;
+	int blocks;
+	int reachedBlocks;
+	// Pushes of a variable whose value is the same constant on every path, turned into immediate pushes.
+	int propagated;
+	// add/sub/mult/div/and/or/not/tstXX worked out at load time, and jf whose direction is always the same.
+	int folded;
+	int branches;
+	// Instructions no path reaches, and jumps to the instruction that would run next anyway.
+	int unreachable;
+	int jumps;
+	// Instructions removed in total.
+	int removed;
+} foldReportType;
+
+// After the report type, which the VM (see vm.h) holds one of.
+#include "instructions.h"
+
+// Dataflow optimizer - splits the loaded program into basic blocks, follows constant values through variables and the stack
+// from block to block, and folds constant expressions and branches, removing whatever is left unreachable.
+void foldProgram(instructionType* code);
+void printFoldReport();
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+#include <stdio.h>
+#include "instructions.h"
+#include "stack.h"
+
+// Instruction bodies shared by the stack engines. Each engine keeps 'pc', 'tos', 'sp', 'limit', 'insts', 'vars' and
+// 'result' in locals, and defines the 'halted' label ENGINE_ERRORS jumps to. The top of the stack lives in 'tos'
+// rather than in memory, so 'push m; push n; sub' only touches memory to spill m when n is pushed - see stack.h for the
+// layout. 'insts' and 'vars' keep the engines from going through the current VM (see vm.h) on every instruction.
+#define INST (insts[pc])
+// Stop with an underflow error unless the stack holds at least n values.
+#define NEED(n) if (sp - vmStack.theStack < (n)) goto underflow
+// Spill the cached top of the stack and make x the new top, growing the stack first if it is full.
+#define PUSH(x) \
+	if (sp == limit) \
+	{ \
+		vmStack.stackIndex = (int) (sp - vmStack.theStack); \
+		if (stackGrow() != 0) \
+			goto overflow; \
+		sp = vmStack.theStack + vmStack.stackIndex; \
+		limit = vmStack.theStack + vmStack.capacity - 1; \
+	} \
+	*sp++ = tos; \
+	tos = (x)
+// Drop the top of the stack; the value below it becomes the cached top.
+#define DROP() tos = *--sp
+// Pop two values and push 'lop op rop', where rop was on top. lop is read straight out of memory.
+#define BINARY(expr) NEED(2); sp--; tos = (expr)
+#define LOP (*sp)
+#define ROP tos
+// Value below the top of the stack, before anything is popped.
+#define SECOND (sp[-1])
+// 1 when arithmetic that overflows just wraps around. Only looked at once an operation has overflowed, so the checks cost
+// a predictable branch on the overflow flag and nothing more.
+#define WRAPS() (currentVm -> overflowMode == OVERFLOW_WRAP)
+// Pop two values and push 'lop op rop', where check is ADD_OVERFLOWS, SUB_OVERFLOWS or MULT_OVERFLOWS. If the result
+// does not fit, the engine stops in front of the instruction with the stack untouched, unless overflow wraps around.
+#define CHECKED_BINARY(check) \
+	NEED(2); \
+	if (check(SECOND, tos, &result) && !WRAPS()) \
+		goto overflowed; \
+	sp--; \
+	tos = result
+// Store 'a op b' in the instruction's slot, checked as CHECKED_BINARY.
+#define CHECKED_SLOTS(check) \
+	if (check(vars[INST.a], vars[INST.b], &result) && !WRAPS()) \
+		goto overflowed; \
+	vars[INST.arg.slot] = result
+
+// get: capture user input and save it to the operand's variable slot.
+#define DO_GET() inputVariable(&INST); pc++
+// put: display(print) the value of the operand's variable to the screen.
+#define DO_PUT() outputVariable(&INST); pc++
+// push: push the value of the operand's variable slot onto the stack.
+#define DO_PUSH() PUSH(vars[INST.arg.slot]); pc++
+// pushi: push an immediate value, already converted at load time, onto the stack.
+#define DO_PUSHI() PUSH(INST.arg.immediate); pc++
+// pop: pop the top value off of the stack and save it to the operand's variable slot.
+#define DO_POP() NEED(1); vars[INST.arg.slot] = tos; DROP(); pc++
+// add, sub, mult: pop the top two values and push their sum, difference (second minus top) or product.
+#define DO_ADD() CHECKED_BINARY(ADD_OVERFLOWS); pc++
+#define DO_SUB() CHECKED_BINARY(SUB_OVERFLOWS); pc++
+#define DO_MULT() CHECKED_BINARY(MULT_OVERFLOWS); pc++
+// div: pop the top two values and push the second divided by the top. A zero divisor stops the engine with an error.
+#define DO_DIV() \
+	NEED(2); \
+	if (tos == 0) \
+		goto dividedByZero; \
+	if (DIV_OVERFLOWS(SECOND, tos) && !WRAPS()) \
+		goto overflowed; \
+	sp--; \
+	tos = WRAPPED_DIV(LOP, ROP); \
+	pc++
+// and: push '1' if both of the top two values are greater than zero, otherwise '0'.
+#define DO_AND() BINARY(ROP > 0 && LOP > 0); pc++
+// or: push '1' if either of the top two values is non-zero, otherwise '0'.
+#define DO_OR() BINARY(ROP != 0 || LOP != 0); pc++
+// not, tsteq..tstge: replace the top value with '1' if it passes the test against zero, otherwise '0'.
+#define DO_TEST(expr) NEED(1); tos = (expr); pc++
+#define DO_NOT() DO_TEST(tos == 0)
+#define DO_TSTEQ() DO_TEST(tos == 0)
+#define DO_TSTNE() DO_TEST(tos != 0)
+#define DO_TSTLT() DO_TEST(tos < 0)
+#define DO_TSTLE() DO_TEST(tos <= 0)
+#define DO_TSTGT() DO_TEST(tos > 0)
+#define DO_TSTGE() DO_TEST(tos >= 0)
+// j: jump to the address resolved from the operand's label at load time.
+#define DO_J() pc = INST.arg.target
+// move, addv, subv, multv: superinstructions for 'push a; pop slot' and 'push a; push b; op; pop slot'.
+#define DO_MOVE() vars[INST.arg.slot] = vars[INST.a]; pc++
+#define DO_ADDV() CHECKED_SLOTS(ADD_OVERFLOWS); pc++
+#define DO_SUBV() CHECKED_SLOTS(SUB_OVERFLOWS); pc++
+#define DO_MULTV() CHECKED_SLOTS(MULT_OVERFLOWS); pc++
+// jfeq..jfge: superinstruction for 'push a; push b; sub; tstXX; jf target'. Nothing touches the stack. The sub is checked
+// like any other, and the test is on its (possibly wrapped) result.
+#define DO_JFCMP(cmp) \
+	if (SUB_OVERFLOWS(vars[INST.a], vars[INST.b], &result) && !WRAPS()) \
+		goto overflowed; \
+	pc = result cmp 0 ? pc + 1 : INST.arg.target
+// jf: pop the top value; if it is false(0) jump to the operand's label, otherwise carry on.
+#define DO_JF() \
+	NEED(1); \
+	pc = tos == 0 ? INST.arg.target : pc + 1; \
+	DROP()
+// The array an array instruction names, or the second of the two it names.
+#define ARRAY_OPERAND (currentVm -> arrays[INST.arg.slot])
+#define ARRAY_SECOND (currentVm -> arrays[INST.a])
+// Stop with an error unless x indexes the array (a negative index wraps around to a large unsigned one).
+#define INDEX(x) if ((unsigned long long) (x) >= (unsigned long long) ARRAY_OPERAND.length) goto outOfBounds
+// array: pop a length and make the array that many zeros.
+#define DO_ARRAY() NEED(1); if (resizeArray(INST.arg.slot, tos, INST.line) != 0) goto halted; DROP(); pc++
+// aload: replace an index with the array's value at it.
+#define DO_ALOAD() NEED(1); INDEX(tos); tos = ARRAY_OPERAND.values[tos]; pc++
+// astore: pop a value, then an index, and store the value in the array at the index.
+#define DO_ASTORE() NEED(2); INDEX(SECOND); ARRAY_OPERAND.values[SECOND] = tos; DROP(); DROP(); pc++
+// alen: push the array's length.
+#define DO_ALEN() PUSH((wicInt) ARRAY_OPERAND.length); pc++
+// asum, adot: push the sum of the array, or of the products of two arrays of the same length, checked as one add (see
+// arraySum).
+#define DO_ASUM() \
+	if (arraySum(&ARRAY_OPERAND, &result) && !WRAPS()) \
+		goto overflowed; \
+	PUSH(result); \
+	pc++
+#define DO_ADOT() \
+	if (ARRAY_OPERAND.length != ARRAY_SECOND.length) \
+		goto mismatched; \
+	if (arrayDot(&ARRAY_OPERAND, &ARRAY_SECOND, &result) && !WRAPS()) \
+		goto overflowed; \
+	PUSH(result); \
+	pc++
+// amin, amax: push the smallest or largest value in the array, 0 if it is empty.
+#define DO_AMIN() PUSH(arrayMin(&ARRAY_OPERAND)); pc++
+#define DO_AMAX() PUSH(arrayMax(&ARRAY_OPERAND)); pc++
+// aadd, amult: add the second array to the first, or multiply the first by it, value by value. If any value overflows the
+// engine stops in front of the instruction with the array untouched, unless overflow wraps around.
+#define DO_AADD() \
+	if (ARRAY_OPERAND.length != ARRAY_SECOND.length) \
+		goto mismatched; \
+	if (arrayAdd(&ARRAY_OPERAND, &ARRAY_SECOND, !WRAPS())) \
+		goto overflowed; \
+	pc++
+#define DO_AMULT() \
+	if (ARRAY_OPERAND.length != ARRAY_SECOND.length) \
+		goto mismatched; \
+	if (arrayMult(&ARRAY_OPERAND, &ARRAY_SECOND, !WRAPS())) \
+		goto overflowed; \
+	pc++
+// acounteq..acountge: replace a value with how many of the array's values pass the test against it (test is 0 for eq to
+// 5 for ge, see arrayCount).
+#define DO_ACOUNT(test) NEED(1); tos = arrayCount(&ARRAY_OPERAND, test, tos); pc++
+// Engine entry and exit: load the program, the variables and the stack into the engine's locals, and write the stack back.
+// Nothing moves the program or the variables while an engine runs.
+#define LOAD_STACK() \
+	insts = vmCodeTab.instructions; \
+	vars = vmVariables; \
+	sp = vmStack.theStack + vmStack.stackIndex; \
+	limit = vmStack.theStack + vmStack.capacity - 1; \
+	tos = *sp
+#define SAVE_STACK() \
+	*sp = tos; \
+	vmStack.stackIndex = (int) (sp - vmStack.theStack)
+// Shared error exits. An arithmetic overflow is not reported here: the engine just records where it stopped, and runEngine
+// decides what happens next (see setOverflowMode).
+#define ENGINE_ERRORS() \
+underflow: \
+	vmPrintf("\nStack underflow on line %d!\n", INST.line); \
+	goto halted; \
+overflow: \
+	vmPrintf("\nStack overflow on line %d!\n", INST.line); \
+	goto halted; \
+dividedByZero: \
+	divideByZero(INST.line); \
+	goto halted; \
+outOfBounds: \
+	vmPrintf("\nArray index out of bounds for %s on line %d!\n", INST.operand, INST.line); \
+	goto halted; \
+mismatched: \
+	vmPrintf("\nThe arrays %s differ in length on line %d!\n", INST.operand, INST.line); \
+	goto halted; \
+overflowed: \
+	currentVm -> overflowPc = pc; \
+	goto halted
+
+#endif
@@ -0,0 +1,501 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "green.h"
+#include "libwic.h"
+#include "vm.h"
+
+// Instructions a program runs before the next one gets a turn, unless '--green-quantum' says otherwise.
+#define GREEN_QUANTUM 10000
+// Longest 'name = value' line a 'put' adds to a program's output.
+#define GREEN_LINE 128
+
+typedef struct greenRun greenRunType;
+
+// One green thread: a program's instance, the values waiting for its 'get', and how it has been scheduled.
+typedef struct greenTask
+{
+	char* program;
+	// File 'get' reads from, "@" for the previous program's 'put' values, NULL for no input at all.
+	char* input;
+	wicInstanceType* instance;
+	greenRunType* run;
+	// Values not yet taken by 'get', from head to count. closed once no more will come, after which 'get' sees the end
+	// of the input rather than parking.
+	wicInt* values;
+	int head;
+	int count;
+	int capacity;
+	int closed;
+	// Task whose input this one's 'put' values go to, instead of to the output.
+	struct greenTask* consumer;
+	// Next task in the run queue.
+	struct greenTask* next;
+	int parked;
+	// How the program ended, -1 while it can still run.
+	int status;
+	char* output;
+	int outputUsed;
+	int outputCapacity;
+	long long slices;
+	long long parks;
+	// When it last joined the run queue. ran is the time it has spent in the VM; fairShare is the time it was owed, had
+	// every slice been split evenly between the programs runnable at the time, up to shareAt (see greenSchedule).
+	double queuedAt;
+	double ran;
+	double fairShare;
+	double shareAt;
+} greenTaskType;
+
+// The scheduler: a round-robin queue of runnable tasks, and what running them cost.
+struct greenRun
+{
+	greenTaskType* head;
+	greenTaskType* tail;
+	int queued;
+	// Start of the slice being run, taken as the time of any wake-up during it.
+	double now;
+	// Time in the VM owed to a program that has been runnable since the start, had it all been shared evenly.
+	double shared;
+	double inVm;
+	double maxWait;
+	double totalWait;
+	long long switches;
+	long long wakes;
+	int parked;
+};
+
+// Function: greenEnqueue
+// Description: Puts a task at the back of the run queue.
+// Params: Scheduler, task, time it became runnable.
+// Returns: None.
+// Modifies: Run queue.
+static void greenEnqueue(greenRunType* run, greenTaskType* task, double now)
+{
+	task -> next = NULL;
+	task -> queuedAt = now;
+	run -> queued++;
+	if (run -> tail != NULL)
+		run -> tail -> next = task;
+	else
+		run -> head = task;
+	run -> tail = task;
+}
+
+// Function: greenWake
+// Description: Puts a parked task back in the run queue, now that there is input for it to take (or no more to wait for).
+// Params: Task.
+// Returns: None.
+// Modifies: Task, run queue.
+static void greenWake(greenTaskType* task)
+{
+	if (!task -> parked)
+		return;
+	task -> parked = 0;
+	task -> run -> parked--;
+	task -> run -> wakes++;
+	task -> shareAt = task -> run -> shared;
+	greenEnqueue(task -> run, task, task -> run -> now);
+}
+
+// Function: greenFeed
+// Description: Adds a value to the end of a task's input, waking it if it was waiting for one.
+// Params: Task, value.
+// Returns: None.
+// Modifies: Task, run queue.
+static void greenFeed(greenTaskType* task, wicInt value)
+{
+	if (task -> head == task -> count)
+		task -> head = task -> count = 0;
+	if (task -> count == task -> capacity)
+	{
+		task -> capacity = task -> capacity > 0 ? task -> capacity * 2 : 64;
+		task -> values = (wicInt*) realloc(task -> values, task -> capacity * sizeof(wicInt));
+		if (task -> values == NULL)
+		{
+			printf("Out of memory feeding a program!\n");
+			exit(5);
+		}
+	}
+	task -> values[task -> count++] = value;
+	greenWake(task);
+}
+
+// Function: greenAppend
+// Description: Adds text to what a task will print once the run is over.
+// Params: Task, text, its length.
+// Returns: None.
+// Modifies: Task.
+static void greenAppend(greenTaskType* task, const char* text, int length)
+{
+	if (task -> outputUsed + length + 1 > task -> outputCapacity)
+	{
+		while (task -> outputUsed + length + 1 > task -> outputCapacity)
+			task -> outputCapacity = task -> outputCapacity > 0 ? task -> outputCapacity * 2 : 256;
+		task -> output = (char*) realloc(task -> output, task -> outputCapacity);
+		if (task -> output == NULL)
+		{
+			printf("Out of memory keeping a program's output!\n");
+			exit(5);
+		}
+	}
+	memcpy(task -> output + task -> outputUsed, text, length);
+	task -> outputUsed += length;
+	task -> output[task -> outputUsed] = '\0';
+}
+
+// Function: greenGet
+// Description: Get callback of every task - takes the oldest value waiting, or parks the task until one comes.
+// Params: Task, variable name, where to put the value.
+// Returns: 0 with the value, -1 at the end of the input, 1 to park.
+// Modifies: Value, task.
+static int greenGet(void* context, const char* name, wicInt* value)
+{
+	greenTaskType* task = (greenTaskType*) context;
+	(void) name;
+	if (task -> head < task -> count)
+	{
+		*value = task -> values[task -> head++];
+		return 0;
+	}
+	return task -> closed ? -1 : 1;
+}
+
+// Function: greenPut
+// Description: Put callback of every task - hands the value to the task reading this one's output, or prints it as the
+//                interpreter would.
+// Params: Task, variable name, value.
+// Returns: None.
+// Modifies: Task, or its consumer.
+static void greenPut(void* context, const char* name, wicInt value)
+{
+	greenTaskType* task = (greenTaskType*) context;
+	char line[GREEN_LINE];
+	if (task -> consumer != NULL)
+	{
+		greenFeed(task -> consumer, value);
+		return;
+	}
+	sprintf(line, "%.*s = " WIC_INT_FORMAT "\n", GREEN_LINE - 32, name, value);
+	greenAppend(task, line, (int) strlen(line));
+}
+
+// Function: greenReadInput
+// Description: Reads every value in an input file into a task's input, which is then closed - like the interpreter's
+//                '--input', values are integers separated by spaces, commas or new lines.
+// Params: Task, with its input file named.
+// Returns: 0 on success, -1 if the file could not be read or holds something other than numbers.
+// Modifies: Task.
+static int greenReadInput(greenTaskType* task)
+{
+	FILE* file = fopen(task -> input, "r");
+	char word[GREEN_LINE];
+	int c, length;
+	if (file == NULL)
+		return -1;
+	for (;;)
+	{
+		char* end;
+		long long value;
+		while ((c = fgetc(file)) != EOF && (isspace(c) || c == ','))
+			;
+		if (c == EOF)
+			break;
+		length = 0;
+		while (c != EOF && !isspace(c) && c != ',' && length < GREEN_LINE - 1)
+		{
+			word[length++] = (char) c;
+			c = fgetc(file);
+		}
+		word[length] = '\0';
+		value = strtoll(word, &end, 10);
+		if (end == word || *end != '\0')
+		{
+			printf("Error in %s: '%s' is not a number!\n", task -> input, word);
+			fclose(file);
+			return -1;
+		}
+		greenFeed(task, value < WIC_INT_MIN ? WIC_INT_MIN : value > WIC_INT_MAX ? WIC_INT_MAX : (wicInt) value);
+	}
+	fclose(file);
+	task -> closed = 1;
+	return 0;
+}
+
+// Function: greenCompile
+// Description: Reads a program file and compiles it for the library.
+// Params: File name, optimization level, where to put the program.
+// Returns: 0 on success, otherwise the interpreter's exit code: 2 if the file could not be read, 3 if the program did not
+//            load (the reason is printed either way).
+// Modifies: Program.
+static int greenCompile(char* fileName, int optLevel, wicProgramType** program)
+{
+	FILE* file = fopen(fileName, "rb");
+	char* source = NULL;
+	size_t length = 0, capacity = 0, got;
+	if (file == NULL)
+	{
+		printf("The file could not be loaded - please check the name!\n");
+		return 2;
+	}
+	do
+	{
+		if (length == capacity)
+		{
+			capacity = capacity > 0 ? capacity * 2 : 4096;
+			source = (char*) realloc(source, capacity);
+			if (source == NULL)
+			{
+				printf("Out of memory reading %s!\n", fileName);
+				exit(5);
+			}
+		}
+		got = fread(source + length, 1, capacity - length, file);
+		length += got;
+	} while (got > 0);
+	fclose(file);
+	*program = wicCompile(source, length, optLevel);
+	free(source);
+	if (*program == NULL)
+	{
+		printf("%s\n", wicLastError());
+		return 3;
+	}
+	return 0;
+}
+
+// Function: greenSchedule
+// Description: Runs every task in the run queue a quantum at a time, round robin, until none can run. A task whose 'get'
+//                has no value yet is parked, and rejoins the back of the queue when its producer puts one or finishes.
+//                Keeps a clock of the time in the VM each runnable task was owed, as in fair queueing: every slice adds its
+//                length over the number of tasks that were runnable for it.
+// Params: Scheduler, quantum.
+// Returns: None.
+// Modifies: Tasks, scheduler.
+static void greenSchedule(greenRunType* run, long long quantum)
+{
+	greenTaskType* task;
+	greenTaskType* last;
+	greenTaskType* woken;
+	wicStatusType status;
+	double t1, wait, slice, share;
+	int competing;
+	while ((task = run -> head) != NULL)
+	{
+		run -> head = task -> next;
+		if (run -> head == NULL)
+			run -> tail = NULL;
+		run -> queued--;
+		last = run -> tail;
+		competing = run -> queued + 1;
+		run -> now = wallSeconds();
+		wait = run -> now - task -> queuedAt;
+		run -> totalWait += wait;
+		if (wait > run -> maxWait)
+			run -> maxWait = wait;
+		status = wicRun(task -> instance, quantum);
+		t1 = wallSeconds();
+		slice = t1 - run -> now;
+		share = slice / competing;
+		run -> inVm += slice;
+		run -> shared += share;
+		// Tasks woken during the slice were not owed any of it.
+		for (woken = last != NULL ? last -> next : run -> head; woken != NULL; woken = woken -> next)
+			woken -> shareAt += share;
+		run -> switches++;
+		task -> slices++;
+		task -> ran += slice;
+		if (status != WIC_BUDGET)
+			task -> fairShare += run -> shared - task -> shareAt;
+		if (status == WIC_BUDGET)
+			greenEnqueue(run, task, t1);
+		else if (status == WIC_BLOCKED)
+		{
+			task -> parked = 1;
+			task -> parks++;
+			run -> parked++;
+		}
+		else
+		{
+			task -> status = status;
+			if (status == WIC_ERROR)
+			{
+				greenAppend(task, wicErrorMessage(task -> instance), (int) strlen(wicErrorMessage(task -> instance)));
+				greenAppend(task, "\n", 1);
+			}
+			if (task -> consumer != NULL)
+			{
+				task -> consumer -> closed = 1;
+				run -> now = t1;
+				greenWake(task -> consumer);
+			}
+		}
+	}
+}
+
+// Function: jainIndex
+// Description: Jain's fairness index of the time each task spent in the VM over its fair share of it: 1.0 when every task
+//                got just what it was owed, down to 1/n when one task got everything.
+// Params: Tasks, how many there are.
+// Returns: The index, 1.0 if no task ran.
+// Modifies: None.
+static double jainIndex(greenTaskType* tasks, int taskCount)
+{
+	double sum = 0.0, squares = 0.0, rate;
+	int i, n = 0;
+	for (i = 0; i < taskCount; i++)
+	{
+		if (tasks[i].fairShare <= 0.0)
+			continue;
+		rate = tasks[i].ran / tasks[i].fairShare;
+		sum += rate;
+		squares += rate * rate;
+		n++;
+	}
+	return n > 0 && squares > 0.0 ? sum * sum / (n * squares) : 1.0;
+}
+
+// Function: runGreen
+// Description: Runs a list of programs together on the calling thread, each as a green thread that gets a quantum of
+//                instructions at a time. A program whose input is '@' reads the 'put' values of the program before it in
+//                the list, parking whenever it has caught up, and sees the end of its input once that program finishes.
+//                Prints every program's output in the order given, then what the scheduling cost and how fairly the
+//                programs were served. Programs always run on the switch engine, trapping overflow unless wrapping was
+//                asked for.
+// Params: Specs ('program.wic', 'program.wic,input' or 'program.wic,@'), how many there are, quantum (0 for the default),
+//           times to repeat the list, optimization level.
+// Returns: 0 if every program and input file loaded, otherwise the exit code of the first that did not.
+// Modifies: None.
+int runGreen(char** specs, int specCount, long long quantum, int repeat, int optLevel)
+{
+	greenRunType run;
+	greenTaskType* tasks;
+	wicProgramType** programs;
+	overflowModeType overflowMode = currentVm -> overflowMode == OVERFLOW_WRAP ? OVERFLOW_WRAP : OVERFLOW_TRAP;
+	double t0, seconds, overhead;
+	long long instructions = 0;
+	int taskCount, i;
+	int status = 0;
+	if (quantum <= 0)
+		quantum = GREEN_QUANTUM;
+	if (repeat <= 0)
+		repeat = 1;
+	taskCount = specCount * repeat;
+	tasks = (greenTaskType*) calloc(taskCount > 0 ? taskCount : 1, sizeof(greenTaskType));
+	programs = (wicProgramType**) calloc(specCount > 0 ? specCount : 1, sizeof(wicProgramType*));
+	if (tasks == NULL || programs == NULL)
+	{
+		printf("Out of memory starting the green threads!\n");
+		exit(5);
+	}
+	memset(&run, 0, sizeof(run));
+	for (i = 0; i < specCount && status == 0; i++)
+	{
+		char* comma = strchr(specs[i], ',');
+		tasks[i].program = specs[i];
+		if (comma != NULL)
+		{
+			*comma = '\0';
+			tasks[i].input = comma + 1;
+		}
+		if (tasks[i].input != NULL && strcmp(tasks[i].input, "@") == 0 && i == 0)
+		{
+			printf("The first program has no program before it to read from!\n");
+			status = 4;
+		}
+		else
+			status = greenCompile(tasks[i].program, optLevel, &programs[i]);
+	}
+	if (status != 0)
+	{
+		for (i = 0; i < specCount; i++)
+			wicFreeProgram(programs[i]);
+		free(programs);
+		free(tasks);
+		return status;
+	}
+
+	// Copies share their program; only the instances are per task.
+	for (i = 0; i < taskCount; i++)
+	{
+		greenTaskType* task = &tasks[i];
+		if (i >= specCount)
+		{
+			task -> program = tasks[i - specCount].program;
+			task -> input = tasks[i - specCount].input;
+		}
+		task -> run = &run;
+		task -> status = -1;
+		task -> instance = wicCreateInstance(programs[i % specCount]);
+		wicSetCallbacks(task -> instance, greenGet, greenPut, task);
+		wicSetOverflowMode(task -> instance, overflowMode);
+		if (task -> input == NULL)
+			task -> closed = 1;
+		else if (strcmp(task -> input, "@") == 0)
+			tasks[i - 1].consumer = task;
+		else if (greenReadInput(task) != 0)
+		{
+			greenAppend(task, "The input file could not be read!\n", 34);
+			task -> status = WIC_ERROR;
+			if (status == 0)
+				status = 2;
+			continue;
+		}
+		greenEnqueue(&run, task, 0.0);
+	}
+	// A program that never starts puts nothing, so whatever reads from it sees the end of its input straight away.
+	for (i = 0; i < taskCount; i++)
+		if (tasks[i].status == WIC_ERROR && tasks[i].consumer != NULL)
+			tasks[i].consumer -> closed = 1;
+
+	t0 = wallSeconds();
+	for (i = 0; i < taskCount; i++)
+		tasks[i].queuedAt = t0;
+	greenSchedule(&run, quantum);
+	seconds = wallSeconds() - t0;
+	if (seconds <= 0)
+		seconds = 1e-9;
+
+	for (i = 0; i < taskCount; i++)
+	{
+		greenTaskType* task = &tasks[i];
+		if (task -> input != NULL && strcmp(task -> input, "@") == 0)
+			printf("==> %s < %s\n", task -> program, tasks[i - 1].program);
+		else if (task -> input != NULL)
+			printf("==> %s < %s\n", task -> program, task -> input);
+		else
+			printf("==> %s\n", task -> program);
+		if (task -> output != NULL)
+			fputs(task -> output, stdout);
+		if (task -> status == WIC_HALTED)
+			printf("\nFinished: %lld instructions in %lld slices, parked %lld times\n\n",
+				wicInstructionCount(task -> instance), task -> slices, task -> parks);
+		else if (task -> status == WIC_ERROR)
+			printf("\nFailed after %lld instructions\n\n", wicInstructionCount(task -> instance));
+		else
+			printf("\nStill waiting for input after %lld instructions\n\n", wicInstructionCount(task -> instance));
+		instructions += wicInstructionCount(task -> instance);
+	}
+	overhead = seconds - run.inVm;
+	printf("%d programs on 1 thread in %f seconds: %.0f instructions/s, quantum %lld\n", taskCount, seconds,
+		instructions / seconds, quantum);
+	printf("%lld switches, %.1f ns each outside the VM (%.1f%% of the time), %lld parked and woken\n", run.switches,
+		run.switches > 0 ? overhead * 1e9 / run.switches : 0.0, overhead * 100.0 / seconds, run.wakes);
+	printf("Fairness %.3f (Jain's index of VM time over fair share), wait for a turn %.1f us on average, %.1f us at "
+		"most\n", jainIndex(tasks, taskCount), run.switches > 0 ? run.totalWait * 1e6 / run.switches : 0.0,
+		run.maxWait * 1e6);
+	fflush(stdout);
+
+	for (i = 0; i < taskCount; i++)
+	{
+		wicDestroyInstance(tasks[i].instance);
+		free(tasks[i].values);
+		free(tasks[i].output);
+	}
+	for (i = 0; i < specCount; i++)
+		wicFreeProgram(programs[i]);
+	free(programs);
+	free(tasks);
+	return status;
+}
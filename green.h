@@ -0,0 +1,8 @@
+#ifndef GREEN_H
+#define GREEN_H
+
+// Green-thread scheduler - time-slices many WIC programs on the calling thread, each as a library instance (see libwic.h)
+// run a quantum of instructions at a time. Programs waiting on input from another are parked until it arrives.
+int runGreen(char** specs, int specCount, long long quantum, int repeat, int optLevel);
+
+#endif
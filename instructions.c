@@ -6,430 +6,540 @@
 #include <time.h>
 #include "instructions.h"
 #include "stack.h"
+#include "jit.h"
+#include "regvm.h"
+#include "trace.h"
+#include "engine.h"
+#include "profiler.h"
+#include "bigint.h"
+#include "checkpoint.h"
+#include "tasks.h"
 
-// Typedef definitions of the instructionTable and the instructionType's contained within.
-typedef struct
-{
-	// Limit the opcode to 5 char's and the operand to 20 (including the '\0')
-	char opcode[6];
-	char operand[21];
-} instructionType;
-
-typedef struct
-{
-	instructionType instructions[1024];
-	int instructionCount;
-} instructionTable;
-
-// Opcodes that require operands
-char* opCodes[6] = {"get", "put", "push", "pop", "jf", "j"};
-
-// Instruction table, cannot be accessed outside of this file.
-static instructionTable instTab;
-
-// WIC commands
-int get(int pc);
-int halt();
-int push(int pc);
-int pop(int pc);
-int put(int pc);
-int add(int pc);
-int sub(int pc);
-int mult(int pc);
-int divi(int pc);
-int and(int pc);
-int or(int pc);
-int not(int pc);
-int tsteq(int pc);
-int tstne(int pc);
-int tstlt(int pc);
-int tstle(int pc);
-int tstgt(int pc);
-int tstge(int pc);
-int j(int pc);
-int jf(int pc);
+// Opcode names, indexed by opcodeType. Used to decode the text opcodes at load time and to print them back out.
+static const char* opNames[OP_COUNT] = {"", "nop", "label", "get", "put", "push", "push", "pop", "add", "sub", "mult",
+	"div", "and", "or", "not", "tsteq", "tstne", "tstlt", "tstle", "tstgt", "tstge", "j", "jf", "spawn", "join", "chan",
+	"send", "recv", "array", "aload", "astore", "alen", "asum", "amin", "amax", "adot", "aadd", "amult", "acounteq",
+	"acountne", "acountlt", "acountle", "acountgt", "acountge", "halt", "move", "addv", "subv", "multv", "jfeq", "jfne",
+	"jflt", "jfle", "jfgt", "jfge"};
+
+// Engine used by runInterpreter. The portable switch loop is the default.
+#define vmEngine (currentVm -> engine)
+
+// Set by setQuiet: 'put' output and the tables printed on halt are suppressed.
+#define vmQuiet (currentVm -> quiet)
+
+// Execution engines
+static void runSwitch(int pc);
+static void runThreaded(int pc);
+
+// The switch engine, without profiling hooks.
+#define SWITCH_ENGINE static void runSwitch
+#define SWITCH_STEP()
+#define SWITCH_BRANCH()
+#define SWITCH_DONE()
+#include "switchEngine.h"
 
 // Function: runInterpreter
-// Description: engine that executes the actual method calling from the parsed WIC code
+// Description: Times and runs the parsed WIC code on whichever execution engine was selected with setEngine, followed by the
+//                profile report if it was the profiling engine.
 // Params: None
 // Returns: None
 // Modifies: None
 void runInterpreter()
 {
 	clock_t c0, c1;
-	// Set PC to zero
-	int pc = 0;
 	c0 = clock();
-	while (pc != -1)
-	{
-		// Captures the current Opcode at the PC address
-		char* curOp = fetchOpcode(pc);
-		// Test found Opcode against our 21 working WIC instructions
-		if (strcmp(curOp, "get") == 0)
-			pc = get(pc);
-		else if (strcmp(curOp, "halt") == 0)
-			pc = halt();
-		else if (strcmp(curOp, "push") == 0)
-			pc = push(pc);
-		else if (strcmp(curOp, "put") == 0)
-			pc = put(pc);
-		else if (strcmp(curOp, "pop") == 0)
-			pc = pop(pc);
-		else if (strcmp(curOp, "label") == 0)
-			pc++;
-		else if (strcmp(curOp, "add") == 0)
-			pc = add(pc);
-		else if (strcmp(curOp, "sub") == 0)
-			pc = sub(pc);
-		else if (strcmp(curOp, "mult") == 0)
-			pc = mult(pc);
-		else if (strcmp(curOp, "div") == 0)
-			pc = divi(pc);
-		else if (strcmp(curOp, "and") == 0)
-			pc = and(pc);
-		else if (strcmp(curOp, "or") == 0)
-			pc = or(pc);
-		else if (strcmp(curOp, "not") == 0)
-			pc = not(pc);
-		else if (strcmp(curOp, "tsteq") == 0)
-			pc = tsteq(pc);
-		else if (strcmp(curOp, "tstne") == 0)
-			pc = tstne(pc);
-		else if (strcmp(curOp, "tstlt") == 0)
-			pc = tstlt(pc);
-		else if (strcmp(curOp, "tstle") == 0)
-			pc = tstle(pc);
-		else if (strcmp(curOp, "tstgt") == 0)
-			pc = tstgt(pc);
-		else if (strcmp(curOp, "tstge") == 0)
-			pc = tstge(pc);
-		else if (strcmp(curOp, "j") == 0)
-			pc = j(pc);
-		else if (strcmp(curOp, "jf") == 0)
-			pc = jf(pc);
-		else if (strcmp(curOp, "nop") == 0)
-			pc++;
-		else if (strlen(curOp) > 0)
-		{
-			// If line does not contain a valid WIC Opcode and is not blank (or only comments),
-			//   the line is un-interpretable and causes the interpreter to exit.
-			printf("Error on line %d!\n", pc);
-			break;
-		}
-		else
-		{
-			// If the end of instructions are reached and no halt is found, restart the program from the
-			//   beginning.
-			pc = 0;
-		}
-	}
+	runEngine();
 	c1 = clock();
-	printf ("\nElapsed Time:        %f\n", (float) (c1 - c0)/CLOCKS_PER_SEC);
+	vmPrintf("\nElapsed Time:        %f\n", (float) (c1 - c0)/CLOCKS_PER_SEC);
+	if (vmEngine == ENGINE_PROFILE && !vmQuiet)
+		printProfile();
+	if (vmEngine == ENGINE_TRACE && !vmQuiet)
+		printTraceReport();
+	vmFlush();
 	return;
 }
 
-// Function: jf
-// Description: If value on the top of the stack is false(0), jump to specified address.
-// Params:	PC
-// Returns: Incremented PC or address of specified jump address.
-// Modifies: None.
-int jf(int pc)
+// Function: runEngine
+// Description: Runs the parsed WIC code on whichever execution engine was selected with setEngine, from the current stack.
+//                The JIT and the register VM hand back to the threaded engine if they cannot take the program, or have to
+//                leave it part way through. An engine that stops in front of an arithmetic overflow is followed by the
+//                overflow error, or by the rest of the run on arbitrary-precision values (see setOverflowMode). Buffered
+//                output is written out when the engine stops. A checkpointed program runs on the checkpointing engine
+//                whichever is selected (see setCheckpoint), and a resumed one starts where its checkpoint left off - on the
+//                threaded engine, if the JIT or the register VM was selected, as they only start at the beginning. A program
+//                with task instructions always runs on the task runtime (see tasks.c), from the beginning and without
+//                checkpoints.
+// Params: None
+// Returns: None
+// Modifies: Stack, variables.
+void runEngine()
 {
-	int tst = stackPop();
-	if (tst == 0)
-		// If value on top of stack is false, look up operand in jumpTable and set PC to that address.
-		return retrieve(&jumpTable, instTab.instructions[pc].operand);
+	int pc = currentVm -> checkpoint.resumePc;
+	currentVm -> checkpoint.resumePc = 0;
+	currentVm -> overflowPc = -1;
+	if (taskInstruction() >= 0)
+	{
+		runTasks();
+		vmFlush();
+		return;
+	}
+	if (currentVm -> checkpoint.fileName != NULL)
+		runCheckpointed(pc);
+	else if ((vmEngine == ENGINE_JIT || vmEngine == ENGINE_REGISTER) && pc == 0)
+	{
+		pc = vmEngine == ENGINE_JIT ? runJit() : runRegisterVm();
+		if (pc >= 0)
+			runThreaded(pc);
+	}
+	else if (vmEngine == ENGINE_THREADED || vmEngine == ENGINE_JIT || vmEngine == ENGINE_REGISTER)
+		runThreaded(pc);
+	else if (vmEngine == ENGINE_PROFILE)
+		runProfiled(pc);
+	else if (vmEngine == ENGINE_TRACE)
+		runTraced(pc);
 	else
-		return pc + 1;
+		runSwitch(pc);
+	if (currentVm -> overflowPc >= 0)
+	{
+		if (currentVm -> overflowMode == OVERFLOW_PROMOTE)
+			runPromoted(currentVm -> overflowPc);
+		else
+			vmPrintf("\nInteger overflow on line %d!\n", vmCodeTab.instructions[currentVm -> overflowPc].line);
+	}
+	vmFlush();
 }
 
-// Function: j
-// Description: Jump to the address specified by the symbol specified in the operand
-// Params:	PC
-// Returns: PC address of specified label from the jump table. 
-// Modifies: None.
-int j(int pc)
+// Function: runThreaded
+// Description: Direct-threaded engine. Every instruction is translated up front into the address of its handler label, and
+//                each handler jumps straight to the next one instead of returning to a central loop, which gives the branch
+//                predictor one indirect jump per handler to learn. Needs GCC/Clang labels-as-values; other compilers fall back
+//                to runSwitch.
+// Params: Address to start at.
+// Returns: None
+// Modifies: Stack, variables.
+static void runThreaded(int pc)
 {
-	int temp = atoi(instTab.instructions[pc].operand);
-	return retrieve(&jumpTable, instTab.instructions[pc].operand);
-}
+#if defined(__GNUC__)
+	// Handler labels, indexed by opcodeType.
+	static void* handlers[OP_COUNT] = {&&do_end, &&do_next, &&do_next, &&do_get, &&do_put, &&do_push, &&do_pushi, &&do_pop,
+		&&do_add, &&do_sub, &&do_mult, &&do_div, &&do_and, &&do_or, &&do_not, &&do_tsteq, &&do_tstne, &&do_tstlt,
+		&&do_tstle, &&do_tstgt, &&do_tstge, &&do_j, &&do_jf, &&do_task, &&do_task, &&do_task, &&do_task, &&do_task,
+		&&do_array, &&do_aload, &&do_astore, &&do_alen, &&do_asum, &&do_amin, &&do_amax, &&do_adot, &&do_aadd, &&do_amult,
+		&&do_acounteq, &&do_acountne, &&do_acountlt, &&do_acountle, &&do_acountgt, &&do_acountge, &&do_halt, &&do_move,
+		&&do_addv, &&do_subv, &&do_multv, &&do_jfeq, &&do_jfne, &&do_jflt, &&do_jfle, &&do_jfgt, &&do_jfge};
+	void** code;
+	instructionType* insts;
+	wicInt* vars;
+	int i;
+	wicInt tos;
+	wicInt* sp;
+	wicInt* limit;
+	wicInt result;
+	// One extra slot so that running off the end of the program lands on do_end.
+	code = (void**) malloc(sizeof(void*) * (vmCodeTab.instructionCount + 1));
+	if (code == NULL)
+	{
+		printf("Out of memory starting the threaded engine!\n");
+		exit(5);
+	}
+	for (i = 0; i < vmCodeTab.instructionCount; i++)
+		code[i] = handlers[vmCodeTab.instructions[i].op];
+	code[vmCodeTab.instructionCount] = &&do_end;
+	LOAD_STACK();
 
-// Function: tsteq
-// Description: If value on top of the stack is zero, push '1' on the stack.
-// Params:	PC
-// Returns: Incremented PC
-// Modifies: None.
-int tsteq(int pc)
-{
-	int tst = stackPop();
-	if (tst == 0)
-		stackPush(1);
-	else
-		stackPush(0);
-	return pc + 1;
+	#define DISPATCH() goto *code[pc]
+	DISPATCH();
+do_end:
+	// No halt found - restart the program from the beginning, as runSwitch does.
+	pc = 0;
+	DISPATCH();
+do_next:
+	pc++;
+	DISPATCH();
+do_get:
+	DO_GET();
+	DISPATCH();
+do_put:
+	DO_PUT();
+	DISPATCH();
+do_push:
+	DO_PUSH();
+	DISPATCH();
+do_pushi:
+	DO_PUSHI();
+	DISPATCH();
+do_pop:
+	DO_POP();
+	DISPATCH();
+do_add:
+	DO_ADD();
+	DISPATCH();
+do_sub:
+	DO_SUB();
+	DISPATCH();
+do_mult:
+	DO_MULT();
+	DISPATCH();
+do_div:
+	DO_DIV();
+	DISPATCH();
+do_and:
+	DO_AND();
+	DISPATCH();
+do_or:
+	DO_OR();
+	DISPATCH();
+do_not:
+	DO_NOT();
+	DISPATCH();
+do_tsteq:
+	DO_TSTEQ();
+	DISPATCH();
+do_tstne:
+	DO_TSTNE();
+	DISPATCH();
+do_tstlt:
+	DO_TSTLT();
+	DISPATCH();
+do_tstle:
+	DO_TSTLE();
+	DISPATCH();
+do_tstgt:
+	DO_TSTGT();
+	DISPATCH();
+do_tstge:
+	DO_TSTGE();
+	DISPATCH();
+do_j:
+	DO_J();
+	DISPATCH();
+do_jf:
+	DO_JF();
+	DISPATCH();
+do_move:
+	DO_MOVE();
+	DISPATCH();
+do_addv:
+	DO_ADDV();
+	DISPATCH();
+do_subv:
+	DO_SUBV();
+	DISPATCH();
+do_multv:
+	DO_MULTV();
+	DISPATCH();
+do_jfeq:
+	DO_JFCMP(==);
+	DISPATCH();
+do_jfne:
+	DO_JFCMP(!=);
+	DISPATCH();
+do_jflt:
+	DO_JFCMP(<);
+	DISPATCH();
+do_jfle:
+	DO_JFCMP(<=);
+	DISPATCH();
+do_jfgt:
+	DO_JFCMP(>);
+	DISPATCH();
+do_jfge:
+	DO_JFCMP(>=);
+	DISPATCH();
+do_task:
+	taskUnsupported(INST.line);
+	goto halted;
+do_array:
+	DO_ARRAY();
+	DISPATCH();
+do_aload:
+	DO_ALOAD();
+	DISPATCH();
+do_astore:
+	DO_ASTORE();
+	DISPATCH();
+do_alen:
+	DO_ALEN();
+	DISPATCH();
+do_asum:
+	DO_ASUM();
+	DISPATCH();
+do_amin:
+	DO_AMIN();
+	DISPATCH();
+do_amax:
+	DO_AMAX();
+	DISPATCH();
+do_adot:
+	DO_ADOT();
+	DISPATCH();
+do_aadd:
+	DO_AADD();
+	DISPATCH();
+do_amult:
+	DO_AMULT();
+	DISPATCH();
+do_acounteq:
+	DO_ACOUNT(0);
+	DISPATCH();
+do_acountne:
+	DO_ACOUNT(1);
+	DISPATCH();
+do_acountlt:
+	DO_ACOUNT(2);
+	DISPATCH();
+do_acountle:
+	DO_ACOUNT(3);
+	DISPATCH();
+do_acountgt:
+	DO_ACOUNT(4);
+	DISPATCH();
+do_acountge:
+	DO_ACOUNT(5);
+	DISPATCH();
+do_halt:
+	halt();
+	goto halted;
+	#undef DISPATCH
+	ENGINE_ERRORS();
+halted:
+	SAVE_STACK();
+	free(code);
+#else
+	runSwitch(pc);
+#endif
 }
 
-// Function: tstne
-// Description: If value on the top of the stack not equal to zero, push '1' on the stack.
-// Params:	PC
-// Returns: Incremented PC
-// Modifies: None.
-int tstne(int pc)
+// Function: setEngine
+// Description: Selects the execution engine used by runInterpreter.
+// Params: Engine to use.
+// Returns: None
+// Modifies: Selected engine.
+void setEngine(engineType e)
 {
-	int tst = stackPop();
-	if (tst != 0)
-		stackPush(1);
-	else
-		stackPush(0);
-	return pc + 1;
+	vmEngine = e;
 }
 
-// Function: tstlt
-// Description: If value on the top of the stack is less than zero, push '1' on the stack.
-// Params:	PC
-// Returns: Incremented PC
-// Modifies: None.
-int tstlt(int pc)
+// Function: setQuiet
+// Description: Turns quiet mode on or off. When quiet, 'put' prints nothing and neither do the tables on halt; prompts and
+//                errors are still printed.
+// Params: 1 for quiet, 0 for normal output.
+// Returns: None
+// Modifies: Quiet mode.
+void setQuiet(int q)
 {
-	int tst = stackPop();
-	if (tst < 0)
-		stackPush(1);
-	else
-		stackPush(0);
-	return pc + 1;
+	vmQuiet = q;
 }
 
-// Function: tstle
-// Description: If value on the top of the stack is less than or equal to zero, push '1' on the stack.
-// Params:	PC
-// Returns: Incremented PC
-// Modifies: None.
-int tstle(int pc)
+// Function: setOverflowMode
+// Description: Selects what add, sub, mult and div do when the result does not fit in a wicInt: stop with an error
+//                (OVERFLOW_TRAP, the default), wrap around (OVERFLOW_WRAP), or carry on with arbitrary-precision values
+//                (OVERFLOW_PROMOTE). The interpreters check every operation whichever is selected and only skip acting on it
+//                when wrapping; the JIT leaves the checks out of code compiled for wrapping.
+// Params: Overflow mode.
+// Returns: None
+// Modifies: Overflow mode.
+void setOverflowMode(overflowModeType mode)
 {
-	int tst = stackPop();
-	if (tst <= 0)
-		stackPush(1);
-	else
-		stackPush(0);
-	return pc + 1;
+	currentVm -> overflowMode = mode;
 }
 
-// Function: tstgt
-// Description: If value on the top of the stack is greater than zero, push '1' on the stack.
-// Params:	PC
-// Returns: Incremented PC
+// Function: overflowModeFromName
+// Description: Maps an overflow mode given on the command line onto its overflowModeType.
+// Params: Mode name ("trap", "wrap" or "promote").
+// Returns: Matching overflowModeType, or -1 if the name is not recognised.
 // Modifies: None.
-int tstgt(int pc)
+int overflowModeFromName(char* name)
 {
-	int tst = stackPop();
-	if (tst > 0)
-		stackPush(1);
-	else
-		stackPush(0);
-	return pc + 1;
+	if (strcmp(name, "trap") == 0)
+		return OVERFLOW_TRAP;
+	if (strcmp(name, "wrap") == 0)
+		return OVERFLOW_WRAP;
+	if (strcmp(name, "promote") == 0)
+		return OVERFLOW_PROMOTE;
+	return -1;
 }
 
-// Function: tstge
-// Description: If value on the top of the stack is greater than or equal to zero, push '1' on the stack.
-// Params:	PC
-// Returns: Incremented PC
+// Function: currentEngine
+// Description: Reports the execution engine runInterpreter will use.
+// Params: None.
+// Returns: Selected engine.
 // Modifies: None.
-int tstge(int pc)
+engineType currentEngine()
 {
-	int tst = stackPop();
-	if (tst >= 0)
-		stackPush(1);
-	else
-		stackPush(0);
-	return pc + 1;
+	return vmEngine;
 }
 
-// Function: and
-// Description: pop two values off the stack. If both are non-zero, push '1' on the stack. Otherwise, push '0'
-// Params:	PC
-// Returns: Incremented PC
+// Function: engineFromName
+// Description: Maps an engine name given on the command line onto its engineType.
+// Params: Engine name ("switch", "threaded", "jit", "register" or "trace").
+// Returns: Matching engineType, or -1 if the name is not recognised.
 // Modifies: None.
-int and(int pc)
+int engineFromName(char* name)
 {
-	int x = stackPop();
-	int y = stackPop();
-	if (x > 0 && y > 0)
-		stackPush(1);
-	else
-		stackPush(0);
-	return pc + 1;
+	if (strcmp(name, "switch") == 0)
+		return ENGINE_SWITCH;
+	if (strcmp(name, "threaded") == 0)
+		return ENGINE_THREADED;
+	if (strcmp(name, "jit") == 0)
+		return ENGINE_JIT;
+	if (strcmp(name, "register") == 0)
+		return ENGINE_REGISTER;
+	if (strcmp(name, "trace") == 0)
+		return ENGINE_TRACE;
+	return -1;
 }
 
-// Function: not
-// Description: Pop value off the stack. If it is '0', push '1', otherwise push '0'.
-// Params:	PC
-// Returns: Incremented PC
+// Function: halt
+// Description: Prints 'Halted!' and the final tables, unless quiet, and writes out the buffered output. The engines stop
+//                running once it returns.
+// Params:	None
+// Returns: None
 // Modifies: None.
-int not(int pc)
+void halt()
 {
-	int x = stackPop();
-	if (x == 0)
-		x = 1;
-	else
-		x = 0;
-	stackPush(x);
-	return pc + 1;
+	if (!vmQuiet)
+	{
+		vmPrintf("\nHalted!\n");
+		printTables();
+	}
+	vmFlush();
 }
 
-// Function: or
-// Description: Pop two values off the stack. If either is non-zero, push a '1' on the stack.
-// Params:	PC
-// Returns: Incremented PC
-// Modifies: None.
-int or(int pc)
+// Function: inputVariable
+// Description: Runtime side of 'get' - prompts for a value, unless prompts are off, and reads it into the instruction's
+//                variable slot (see vmReadInt), or asks the VM's get callback for it. The slot is left alone once the input
+//                runs out, or if the callback has no value yet.
+// Params:	The get instruction.
+// Returns: None
+// Modifies: variables.
+void inputVariable(instructionType* inst)
 {
-	int x = stackPop();
-	int y = stackPop();
-	if (x != 0 || y != 0)
-		stackPush(1);
-	else
-		stackPush(0);
-	return pc + 1;
+	if (currentVm -> getCallback != NULL)
+	{
+		if (currentVm -> getCallback(currentVm -> callbackContext, inst -> operand, &vmVariables[inst -> arg.slot]) > 0)
+			currentVm -> inputBlocked = 1;
+		return;
+	}
+	if (!currentVm -> noPrompts)
+	{
+		vmPrintf("Enter %s > ", inst -> operand);
+		vmFlush();
+	}
+	vmReadInt(&vmVariables[inst -> arg.slot]);
 }
 
-// Function: mult
-// Description: Pop the top two values off the stack and multiply them together. Push the product back onto the stack.
-// Params:	PC
-// Returns: Incremented PC
+// Function: outputVariable
+// Description: Runtime side of 'put' - display(print) the value of the instruction's variable to the screen, unless quiet,
+//                or hand it to the VM's put callback.
+// Params:	The put instruction.
+// Returns: None
 // Modifies: None.
-int mult(int pc)
+void outputVariable(instructionType* inst)
 {
-	int rop = stackPop();
-	int lop = stackPop();
-	stackPush(rop * lop);
-	return pc + 1;
+	if (currentVm -> putCallback != NULL)
+	{
+		currentVm -> putCallback(currentVm -> callbackContext, inst -> operand, vmVariables[inst -> arg.slot]);
+		return;
+	}
+	if (vmQuiet)
+		return;
+	vmWrite(inst -> operand, (int) strlen(inst -> operand));
+	vmWrite(" = ", 3);
+	vmWriteInt(vmVariables[inst -> arg.slot]);
+	vmWrite("\n", 1);
 }
 
-// Function: divi
-// Description: Pop the top two values off the stack and divide the first by the second. Make sure the divisor does not equal zero
-//                before performing the operation, and push the resulting quotient bakc onto the stack. 
-// Params:	PC
-// Returns: Incremented PC
+// Function: findInstruction
+// Description: Finds the first instruction in the executed program whose opcode is in a range.
+// Params: First and last opcode of the range.
+// Returns: Its address, or -1 if there is none.
 // Modifies: None.
-int divi(int pc)
+static int findInstruction(opcodeType first, opcodeType last)
 {
-	int rop = stackPop();
-	int lop = stackPop();
-	if (lop != 0)
-		stackPush(lop / rop);
-	else
-		printf("\nDivide by Zero error on line %d\n", pc);
-	return pc + 1;
+	int i;
+	for (i = 0; i < vmCodeTab.instructionCount; i++)
+	{
+		if (vmCodeTab.instructions[i].op >= first && vmCodeTab.instructions[i].op <= last)
+			return i;
+	}
+	return -1;
 }
 
-// Function: sub
-// Description: Pop the top two values off the stack. Subtract the second from the first and push the result back onto the stack.
-// Params:	PC
-// Returns: Incremented PC
+// Function: taskInstruction
+// Description: Finds the first task instruction (spawn, join, chan, send or recv) in the executed program. A program with any
+//                runs on the task runtime rather than the selected engine (see runEngine).
+// Params: None.
+// Returns: Its address, or -1 if there is none.
 // Modifies: None.
-int sub(int pc)
+int taskInstruction()
 {
-	int rop = stackPop();
-	int lop = stackPop();
-	stackPush(lop - rop);
-	return pc + 1;
+	return findInstruction(OP_SPAWN, OP_RECV);
 }
 
-// Function: add
-// Description: Pop the top two values off of the stack. Add them together and push this sum back onto the stack.
-// Params:	PC
-// Returns: Incremented PC
+// Function: arrayInstruction
+// Description: Finds the first array instruction in the executed program. Engines that compile the program (the JIT, the
+//                register VM and the tracing engine's traces) leave programs with any to the interpreter.
+// Params: None.
+// Returns: Its address, or -1 if there is none.
 // Modifies: None.
-int add(int pc)
+int arrayInstruction()
 {
-	int rop = stackPop();
-	int lop = stackPop();
-	stackPush(rop + lop);
-	return pc + 1;
+	return findInstruction(OP_ARRAY, OP_ACOUNTGE);
 }
 
-// Function: halt
-// Description: Prints 'Halted!', return pc value to halt program execution.
-// Params:	PC
-// Returns: -1;
+// Function: taskUnsupported
+// Description: Reports a task instruction reached by an engine other than the task runtime's - through the library, say. The
+//                engine stops once it returns.
+// Params: Source line of the instruction.
+// Returns: None
 // Modifies: None.
-int halt()
+void taskUnsupported(int line)
 {
-	printf("\nHalted!\n");
-	printTables();
-	return -1;
+	vmPrintf("\nThe task instruction on line %d can only run on the task runtime!\n", line);
 }
 
-// Function: push
-// Description: Look up operand in symbol table, push it's value onto the stack. If operand is an immediate value (integer), go
-//                ahead and push it onto the stack. 
-// Params:	PC
-// Returns: Incremented PC
-// Modifies: stack.
-int push(int pc)
-{
-	char* pushed = instTab.instructions[pc].operand;
-	int val;
-	// 
-	if (isdigit(pushed[0]))
-	{
-		int temp = atoi(instTab.instructions[pc].operand);
-		stackPush(temp);
-		return pc + 1;
-	}
-	val = retrieve(&symbolTable, pushed);
-	stackPush(val);
-	return pc + 1;
-}
-
-// Function: pop
-// Description: Pop top value off of the stack, save this value to specified operand in the symbol table.
-// Params:	PC
-// Returns: Incremented PC
-// Modifies: stack, symbol table. 
-int pop(int pc)
-{
-	int popped = stackPop();
-	store(&symbolTable, popped, instTab.instructions[pc].operand);
-	return pc + 1;
-}
-
-// Function: put
-// Description: Look up operand in symbol table, display(print) its value to the screen.
-// Params:	PC
-// Returns: Incremented PC
+// Function: divideByZero
+// Description: Reports a 'div' whose divisor was zero. The engine stops once it returns.
+// Params:	Source line of the div.
+// Returns: None
 // Modifies: None.
-int put(int pc)
+void divideByZero(int line)
 {
-	printf("%s = %d\n", instTab.instructions[pc].operand, retrieve(&symbolTable, instTab.instructions[pc].operand));
-	return pc + 1;
+	vmPrintf("\nDivide by Zero error on line %d\n", line);
 }
 
-// Function: get
-// Description: Capture user input and save it to the specified symbol table key.
-// Params:	PC
-// Returns: Incremented PC
-// Modifies: Symbol table.
-int get(int pc)
-{
-	int user;
-	printf("Enter %s > ", instTab.instructions[pc].operand);
-	scanf("%d", &user);
-	store(&symbolTable, user, instTab.instructions[pc].operand);
-	return pc + 1;
-}
 
 // Function: Initialize
 // Description: Set up the stack, jump/symbol tables before beginning program execution.
 // Params: None
 // Returns: None
-// Modifies: Stack, Symbol/Jump tables.
+// Modifies: Stack, Symbol/Jump tables, the bytecode cache.
 void initialize()
 {
-	instTab.instructionCount = 0;
-	initStack();
-	initializeTable(&jumpTable);
-	initializeTable(&symbolTable);
+	free(vmInstTab.instructions);
+	vmInstTab.instructions = NULL;
+	vmInstTab.instructionCount = 0;
+	vmInstTab.capacity = 0;
+	free(vmInstTab.depths);
+	vmInstTab.depths = NULL;
+	vmInstTab.maxDepth = -1;
+	setCode(NULL, 0);
+	free(vmVariables);
+	vmVariables = NULL;
+	vmVariableCount = 0;
+	clearConstants(0);
+	initStack(0);
+	releaseArrays();
+	freeTable(&vmJumpTable);
+	freeTable(&vmSymbolTable);
+	freeTable(&vmArrayTable);
+	initializeTable(&vmJumpTable);
+	initializeTable(&vmSymbolTable);
+	initializeTable(&vmArrayTable);
+	// Nothing points into the last program's bytecode cache any more.
+	releaseSource(&currentVm -> cache);
 }
 
 // Function: printInstTable
@@ -441,13 +551,28 @@ void initialize()
 void printInstTable()
 {
 	int i;
-	for (i = 0; i < instTab.instructionCount; i++)
+	for (i = 0; i < vmInstTab.instructionCount; i++)
 	{
-		printf("(%d) %s (%s) \n", i, instTab.instructions[i].opcode, instTab.instructions[i].operand);
+		printf("(%d) %s (%s) \n", i, opNames[vmInstTab.instructions[i].op], vmInstTab.instructions[i].operand);
 	}
 	printf("\n");
 }
 
+// Function: printJumpTable
+// Description: Prints out the jump table, displaying its contents.
+// Params: None.
+// Returns: None.
+// Modifies: None.
+void printJumpTable()
+{
+	int i;
+	vmPrintf("\nJump Tables Values: \n");
+	for(i = 0; i < vmJumpTable.size; i++)
+	{
+		vmPrintf("Label: <%s>, Address: <%d>\n", vmJumpTable.entries[i].key, vmJumpTable.entries[i].value);
+	}
+}
+
 // Function: printTables
 // Description: Prints out the jump/symbol tables, displaying their contents.
 // Params: None.
@@ -456,58 +581,535 @@ void printInstTable()
 void printTables()
 {
 	int i;
-	printf("\nJump Tables Values: \n");
-	for(i = 0; i < jumpTable.size; i++)
+	printJumpTable();
+	vmPrintf("\nSymbol Table Values: \n");
+	for (i = 0; i < vmSymbolTable.size; i++)
 	{
-		printf("Label: <%s>, Address: <%d>\n", jumpTable.entries[i].key, jumpTable.entries[i].value);
+		vmPrintf("Symbol: <%s>, Value: <" WIC_INT_FORMAT ">\n", vmSymbolTable.entries[i].key,
+			vmVariables[vmSymbolTable.entries[i].value]);
 	}
-	printf("\nSymbol Table Values: \n");
-	for (i = 0; i < symbolTable.size; i++)
+	printArrays();
+}
+
+// Function: hasOperand
+// Description: Checks a decoded opcode against the operations that do need an operand. If an operand is needed for that
+//                 instruction the function returns 1. Otherwise it returns 0.
+// Params: Decoded opcode.
+// Returns: '1' or '0' depending on whether the opcode has an operand.
+// Modifies: None.
+int hasOperand(opcodeType op)
+{
+	switch (op)
 	{
-		printf("Symbol: <%s>, Value: <%d>\n", symbolTable.entries[i].key, symbolTable.entries[i].value);
+	case OP_GET:
+	case OP_PUT:
+	case OP_PUSH:
+	case OP_PUSHI:
+	case OP_POP:
+	case OP_JF:
+	case OP_J:
+	case OP_SPAWN:
+		return 1;
+	default:
+		return op >= OP_ARRAY && op <= OP_ACOUNTGE;
 	}
 }
 
-// Function: hasOperand
-// Description: Checks input string against the 6 operations that do need an operand. If an operand is needed for that instruction
-//                 the function returns 1. Otherwise it returns 0.
-// Params: String opcode.
-// Returns: '1' or '0' depending on whether the parameter string opcode has an operand.
+// Function: decodeOpcode
+// Description: Maps a text opcode onto its opcodeType. 'push' is decoded to OP_PUSH here; insertInstruction narrows it to
+//                OP_PUSHI once it has seen the operand. The text does not need to be '\0' terminated.
+// Params: Opcode text, its length.
+// Returns: Matching opcodeType, or OP_END if the text is not a WIC opcode.
 // Modifies: None.
-int hasOperand(char * opcode)
+opcodeType decodeOpcode(char* op, int length)
 {
 	int i;
-	for (i = 0; i < 6; i++)
+	// Skip OP_END, whose name is the empty string, OP_PUSHI, which shares its name with OP_PUSH, and the superinstructions
+	// after OP_HALT, which cannot be written in source.
+	for (i = OP_NOP; i <= OP_HALT; i++)
 	{
-		if(strcmp(opcode, opCodes[i]) == 0)
+		if (i != OP_PUSHI && strncmp(op, opNames[i], length) == 0 && opNames[i][length] == '\0')
 		{
-			return 1;
+			return (opcodeType) i;
 		}
 	}
-	return 0;
+	return OP_END;
 }
 
 // Function: insertInstruction
-// Description: Given an address, opcode, and operand, this function inserts the resulting WIC instruction into the instruction table.
-// Params: Address of instruction, Opcode, Operand
-// Returns: None.
-// Modifies: None.
-void insertInstruction(int address, char* op, char* ope)
+// Description: Given an address, opcode, and operand, this function decodes the resulting WIC instruction and inserts it into the
+//                instruction table, growing the table as needed. Immediate 'push' operands are converted to integers here so the
+//                interpreter never has to, and other operands are interned. Neither string needs to be '\0' terminated, so the
+//                loader can pass pointers straight into the source text.
+// Params: Address of instruction, Opcode text and length, Operand text and length.
+// Returns: 0 on success, -1 if the opcode is not a WIC opcode, -2 if a required operand is missing, -3 if an immediate is
+//            too large for a wicInt.
+// Modifies: Instruction table.
+int insertInstruction(int address, char* op, int opLength, char* ope, int opeLength)
 {
 	instructionType inst;
-	strcpy(inst.opcode, op);
-	strcpy(inst.operand, ope);
-	instTab.instructions[address] = inst;
-	instTab.instructionCount++;
-	return;
+	inst.op = decodeOpcode(op, opLength);
+	if (inst.op == OP_END)
+		return -1;
+	if (hasOperand(inst.op) && opeLength == 0)
+		return -2;
+	inst.arg.immediate = 0;
+	inst.a = 0;
+	inst.b = 0;
+	inst.line = address;
+	inst.operand = internToken(ope, opeLength);
+	if (inst.op == OP_PUSH && isdigit(ope[0]))
+	{
+		// Same as atoi: leading digits only, anything after them is ignored. Unlike atoi, a value that does not fit is an
+		// error rather than whatever the digits wrap around to.
+		int i;
+		inst.op = OP_PUSHI;
+		for (i = 0; i < opeLength && isdigit(ope[i]); i++)
+		{
+			if (inst.arg.immediate > (WIC_INT_MAX - (ope[i] - '0')) / 10)
+				return -3;
+			inst.arg.immediate = inst.arg.immediate * 10 + (ope[i] - '0');
+		}
+	}
+	// Keep room for this instruction plus the OP_END past the end of the program.
+	if (address + 1 >= vmInstTab.capacity)
+	{
+		int newCapacity = vmInstTab.capacity < 1024 ? 1024 : vmInstTab.capacity * 2;
+		instructionType* grown;
+		while (address + 1 >= newCapacity)
+			newCapacity *= 2;
+		grown = (instructionType*) realloc(vmInstTab.instructions, newCapacity * sizeof(instructionType));
+		if (grown == NULL)
+			vmOutOfMemory("Out of memory loading instruction %d!\n", address);
+		vmInstTab.instructions = grown;
+		vmInstTab.capacity = newCapacity;
+	}
+	vmInstTab.instructions[address] = inst;
+	vmInstTab.instructions[address + 1].op = OP_END;
+	vmInstTab.instructions[address + 1].line = address + 1;
+	vmInstTab.instructions[address + 1].operand = "";
+	vmInstTab.instructionCount = address + 1;
+	return 0;
+}
+
+// Function: stackEffect
+// Description: Gives the number of values an instruction needs on the stack, and how it changes the depth.
+// Params: Decoded opcode, where to put the number of values it needs.
+// Returns: Change in stack depth.
+// Modifies: Needed.
+int stackEffect(opcodeType op, int* needed)
+{
+	switch (op)
+	{
+	case OP_PUSH:
+	case OP_PUSHI:
+		*needed = 0;
+		return 1;
+	case OP_POP:
+	case OP_JF:
+		*needed = 1;
+		return -1;
+	case OP_SEND:
+	case OP_ASTORE:
+		*needed = 2;
+		return -2;
+	case OP_ARRAY:
+		*needed = 1;
+		return -1;
+	case OP_ALEN:
+	case OP_ASUM:
+	case OP_AMIN:
+	case OP_AMAX:
+	case OP_ADOT:
+		*needed = 0;
+		return 1;
+	case OP_ADD:
+	case OP_SUB:
+	case OP_MULT:
+	case OP_DIV:
+	case OP_AND:
+	case OP_OR:
+		*needed = 2;
+		return -1;
+	case OP_NOT:
+	case OP_TSTEQ:
+	case OP_TSTNE:
+	case OP_TSTLT:
+	case OP_TSTLE:
+	case OP_TSTGT:
+	case OP_TSTGE:
+	case OP_SPAWN:
+	case OP_JOIN:
+	case OP_CHAN:
+	case OP_RECV:
+	case OP_ALOAD:
+	case OP_ACOUNTEQ:
+	case OP_ACOUNTNE:
+	case OP_ACOUNTLT:
+	case OP_ACOUNTLE:
+	case OP_ACOUNTGT:
+	case OP_ACOUNTGE:
+		*needed = 1;
+		return 0;
+	default:
+		*needed = 0;
+		return 0;
+	}
+}
+
+// Function: analyzeStack
+// Description: Static stack-depth analysis. Follows every path from address 0 (including the restart when a program runs off
+//                its end, and the start of each spawned task, with its argument on an otherwise empty stack) and records the
+//                depth on entry to each instruction. If two paths reach an instruction at different depths, or some path
+//                would pop an empty stack, the depths are not static and everything is marked unknown; the engines check
+//                and grow the stack at run time regardless, this only lets them skip growing.
+// Params: Instruction table to analyze - the loaded program or the optimized one.
+// Returns: None.
+// Modifies: The table's depths and maxDepth.
+void analyzeStack(instructionTable* table)
+{
+	int count = table -> instructionCount;
+	// Each address is queued at most once - when its depth is first set.
+	int* work = (int*) malloc((count + 1) * sizeof(int));
+	int top = 0;
+	int unknown = 0;
+	int i;
+	free(table -> depths);
+	table -> depths = (int*) malloc((count + 1) * sizeof(int));
+	if (work == NULL || table -> depths == NULL)
+	{
+		free(work);
+		vmOutOfMemory("Out of memory analyzing the stack!\n");
+	}
+	for (i = 0; i <= count; i++)
+		table -> depths[i] = -1;
+	table -> maxDepth = 0;
+	table -> depths[0] = 0;
+	work[top++] = 0;
+	while (top > 0 && !unknown)
+	{
+		int pc = work[--top];
+		opcodeType op = pc < count ? table -> instructions[pc].op : OP_END;
+		int needed;
+		int after = table -> depths[pc] + stackEffect(op, &needed);
+		int next[2];
+		int nextDepth[2];
+		int nextCount = 0;
+		if (table -> depths[pc] < needed)
+			unknown = 1;
+		if (after > table -> maxDepth)
+			table -> maxDepth = after;
+		// Successors: jump targets, the restart at 0 after running off the end, and the next address for everything else.
+		if (op == OP_J || op == OP_JF || op == OP_SPAWN || (op >= OP_JFEQ && op <= OP_JFGE))
+		{
+			nextDepth[nextCount] = op == OP_SPAWN ? 1 : after;
+			next[nextCount++] = table -> instructions[pc].arg.target;
+		}
+		if (op == OP_END)
+		{
+			nextDepth[nextCount] = after;
+			next[nextCount++] = 0;
+		}
+		else if (op != OP_J && op != OP_HALT)
+		{
+			nextDepth[nextCount] = after;
+			next[nextCount++] = pc + 1;
+		}
+		for (i = 0; i < nextCount; i++)
+		{
+			if (table -> depths[next[i]] == -1)
+			{
+				table -> depths[next[i]] = nextDepth[i];
+				work[top++] = next[i];
+			}
+			else if (table -> depths[next[i]] != nextDepth[i])
+			{
+				unknown = 1;
+			}
+		}
+	}
+	if (unknown)
+	{
+		for (i = 0; i <= count; i++)
+			table -> depths[i] = -1;
+		table -> maxDepth = -1;
+	}
+	free(work);
+}
+
+// Function: arrayNumber
+// Description: Gives the number of a named array, numbering it if this is the first time it is named.
+// Params: Interned array name.
+// Returns: Array number.
+// Modifies: arrayTable, arrayCount.
+static int arrayNumber(char* name)
+{
+	int array = retrieve(&vmArrayTable, name);
+	if (array < 0)
+	{
+		array = currentVm -> arrayCount++;
+		store(&vmArrayTable, array, name);
+	}
+	return array;
+}
+
+// Function: resolveArrays
+// Description: Turns an array instruction's operand into array numbers - one name, or two as 'a,b' for adot, aadd and amult.
+// Params: Instruction, its address.
+// Returns: 0 on success, -1 if the operand names the wrong number of arrays.
+// Modifies: The instruction, arrayTable, arrayCount.
+static int resolveArrays(instructionType* inst, int address)
+{
+	char* comma = strchr(inst->operand, ',');
+	int pair = inst->op == OP_ADOT || inst->op == OP_AADD || inst->op == OP_AMULT;
+	if (!pair)
+	{
+		if (comma != NULL)
+		{
+			vmReport("Error on line %d: '%s' takes one array!\n", address, opNames[inst->op]);
+			return -1;
+		}
+		inst->arg.slot = arrayNumber(inst->operand);
+		return 0;
+	}
+	if (comma == NULL || comma == inst->operand || comma[1] == '\0' || strchr(comma + 1, ',') != NULL)
+	{
+		vmReport("Error on line %d: '%s' needs two arrays, as 'a,b'!\n", address, opNames[inst->op]);
+		return -1;
+	}
+	inst->arg.slot = arrayNumber(internToken(inst->operand, (int) (comma - inst->operand)));
+	inst->a = arrayNumber(internString(comma + 1));
+	return 0;
+}
+
+// Function: resolveProgram
+// Description: Resolver pass run once the whole file has been loaded. Every label operand is turned into the address of its
+//                'label' line (so forward references work) and every variable operand into a slot in the flat variables array,
+//                so nothing is looked up by name while the program runs. Variables start out as zero. Array operands are
+//                numbered the same way, and arrays start out empty.
+// Params: None.
+//                Finishes with analyzeStack, sizes the operand stack from its result, and sets the loaded program up to be run.
+// Returns: 0 on success, -1 if the program is empty, a jump names a label that is never defined or an array instruction
+//            names the wrong number of arrays.
+// Modifies: Instruction table, symbol table, array table, variables, arrays, stack.
+int resolveProgram()
+{
+	int i;
+	if (vmInstTab.instructionCount == 0)
+	{
+		vmReport("Error: the program is empty!\n");
+		return -1;
+	}
+	for (i = 0; i < vmInstTab.instructionCount; i++)
+	{
+		instructionType* inst = &vmInstTab.instructions[i];
+		switch (inst->op)
+		{
+		case OP_J:
+		case OP_JF:
+		case OP_SPAWN:
+			inst->arg.target = retrieve(&vmJumpTable, inst->operand);
+			if (inst->arg.target < 0)
+			{
+				vmReport("Error on line %d: label '%s' is never defined!\n", i, inst->operand);
+				return -1;
+			}
+			break;
+		case OP_GET:
+		case OP_PUT:
+		case OP_PUSH:
+		case OP_POP:
+			inst->arg.slot = retrieve(&vmSymbolTable, inst->operand);
+			if (inst->arg.slot < 0)
+			{
+				inst->arg.slot = vmVariableCount++;
+				store(&vmSymbolTable, inst->arg.slot, inst->operand);
+			}
+			break;
+		default:
+			if (inst->op >= OP_ARRAY && inst->op <= OP_ACOUNTGE && resolveArrays(inst, i) != 0)
+				return -1;
+			break;
+		}
+	}
+	vmVariables = (wicInt*) calloc(vmVariableCount > 0 ? vmVariableCount : 1, sizeof(wicInt));
+	currentVm -> arrays = (arrayType*) calloc(currentVm -> arrayCount > 0 ? currentVm -> arrayCount : 1, sizeof(arrayType));
+	if (vmVariables == NULL || currentVm -> arrays == NULL)
+		vmOutOfMemory("Out of memory resolving the program!\n");
+	clearConstants(vmVariableCount > 0 ? vmVariableCount : 1);
+	// If the deepest the stack can get is known, allocate exactly that up front so it never has to grow while running.
+	analyzeStack(&vmInstTab);
+	if (vmInstTab.maxDepth >= 0)
+		initStack(vmInstTab.maxDepth);
+	// Until the optimizer says otherwise, the engines run the program exactly as loaded.
+	setCode(NULL, 0);
+	return 0;
 }
 
 // Function: fetchOpcode
 // Description: Given an address passed in, this function returns the corresponding opcode found at that address in the instruction table.
 // Params: Address.
-// Returns: String opcode.
+// Returns: Decoded opcode.
+// Modifies: None.
+opcodeType fetchOpcode(int address)
+{
+	return vmInstTab.instructions[address].op;
+}
+
+// Function: stackDepthAt
+// Description: Gives the stack depth on entry to an instruction, as worked out by the static analysis in resolveProgram.
+// Params: Address.
+// Returns: Depth, or -1 if it is not known statically.
 // Modifies: None.
-char* fetchOpcode(int address)
+int stackDepthAt(int address)
 {
-	return instTab.instructions[address].opcode;
-}
\ No newline at end of file
+	return vmInstTab.depths[address];
+}
+
+// Function: maxStackDepth
+// Description: Gives the deepest the stack can get, as worked out by the static analysis in resolveProgram.
+// Params: None.
+// Returns: Maximum depth, or -1 if it is not known statically.
+// Modifies: None.
+int maxStackDepth()
+{
+	return vmInstTab.maxDepth;
+}
+
+// Function: opcodeName
+// Description: Gives the name an opcode is written (or, for superinstructions, printed) as.
+// Params: Decoded opcode.
+// Returns: Opcode name.
+// Modifies: None.
+const char* opcodeName(opcodeType op)
+{
+	return opNames[op];
+}
+
+// Function: hashConstant
+// Description: Fibonacci hash of a constant, for the constant index.
+// Params: Constant value.
+// Returns: 32 bit hash of the value.
+// Modifies: None.
+static unsigned int hashConstant(wicInt value)
+{
+	return (unsigned int) (((unsigned long long) value * 11400714819323198485ull) >> 32);
+}
+
+// Function: placeConstant
+// Description: Puts a constant slot in the first free bucket of the constant index from its value's hash.
+// Params: Slot holding the constant.
+// Returns: None.
+// Modifies: constantBuckets.
+static void placeConstant(int slot)
+{
+	unsigned int mask = (unsigned int) currentVm -> constantBucketCount - 1;
+	unsigned int b;
+	for (b = hashConstant(vmVariables[slot]) & mask; currentVm -> constantBuckets[b] != 0; b = (b + 1) & mask)
+		;
+	currentVm -> constantBuckets[b] = slot + 1;
+}
+
+// Function: indexConstant
+// Description: Adds a new constant slot to the constant index, doubling the index first if it would get more than half full.
+// Params: Slot holding the constant (slotCount, before it is counted).
+// Returns: None.
+// Modifies: constantBuckets, constantBucketCount.
+static void indexConstant(int slot)
+{
+	if ((slot - vmVariableCount + 1) * 2 > currentVm -> constantBucketCount)
+	{
+		int count = currentVm -> constantBucketCount > 0 ? currentVm -> constantBucketCount * 2 : 64;
+		int* buckets = (int*) calloc(count, sizeof(int));
+		int i;
+		if (buckets == NULL)
+			vmOutOfMemory("Out of memory allocating a constant!\n");
+		free(currentVm -> constantBuckets);
+		currentVm -> constantBuckets = buckets;
+		currentVm -> constantBucketCount = count;
+		for (i = vmVariableCount; i < slot; i++)
+			placeConstant(i);
+	}
+	placeConstant(slot);
+}
+
+// Function: constantSlot
+// Description: Gives a variable slot that always holds the passed in value, so superinstructions can treat immediates and
+//                variables alike. Constant slots sit after the program's variables and are shared between equal values, found
+//                through the constant index; the variables array grows by doubling to make room for them.
+// Params: Constant value.
+// Returns: Slot holding the value.
+// Modifies: variables, slotCount, slotCapacity, the constant index.
+int constantSlot(wicInt value)
+{
+	if (currentVm -> constantBucketCount > 0)
+	{
+		unsigned int mask = (unsigned int) currentVm -> constantBucketCount - 1;
+		unsigned int b;
+		for (b = hashConstant(value) & mask; currentVm -> constantBuckets[b] != 0; b = (b + 1) & mask)
+		{
+			if (vmVariables[currentVm -> constantBuckets[b] - 1] == value)
+				return currentVm -> constantBuckets[b] - 1;
+		}
+	}
+	if (vmSlotCount == currentVm -> slotCapacity)
+	{
+		int capacity = currentVm -> slotCapacity > 8 ? currentVm -> slotCapacity * 2 : 16;
+		wicInt* grown = (wicInt*) realloc(vmVariables, capacity * sizeof(wicInt));
+		if (grown == NULL)
+			vmOutOfMemory("Out of memory allocating a constant!\n");
+		vmVariables = grown;
+		currentVm -> slotCapacity = capacity;
+	}
+	vmVariables[vmSlotCount] = value;
+	indexConstant(vmSlotCount);
+	return vmSlotCount++;
+}
+
+// Function: clearConstants
+// Description: Drops every constant slot. Used whenever the variables array is replaced with one holding just the program's
+//                variables.
+// Params: How many slots the new variables array has room for.
+// Returns: None.
+// Modifies: slotCount, slotCapacity, the constant index.
+void clearConstants(int capacity)
+{
+	vmSlotCount = vmVariableCount;
+	currentVm -> slotCapacity = capacity;
+	free(currentVm -> constantBuckets);
+	currentVm -> constantBuckets = NULL;
+	currentVm -> constantBucketCount = 0;
+}
+
+// Function: setCode
+// Description: Replaces the program the engines execute. Passing NULL makes it a copy of the loaded program again.
+// Params: malloc'd instructions (the table takes ownership; there must be room for an OP_END after the last one), count.
+// Returns: None.
+// Modifies: codeTab.
+void setCode(instructionType* code, int count)
+{
+	free(vmCodeTab.instructions);
+	vmCodeTab.instructions = NULL;
+	free(vmCodeTab.depths);
+	vmCodeTab.depths = NULL;
+	vmCodeTab.maxDepth = -1;
+	if (code == NULL && vmInstTab.instructions != NULL)
+	{
+		count = vmInstTab.instructionCount;
+		code = (instructionType*) malloc((count + 1) * sizeof(instructionType));
+		if (code == NULL)
+			vmOutOfMemory("Out of memory copying the program!\n");
+		memcpy(code, vmInstTab.instructions, (count + 1) * sizeof(instructionType));
+	}
+	vmCodeTab.instructions = code;
+	vmCodeTab.instructionCount = count;
+	vmCodeTab.capacity = count + 1;
+	if (code != NULL)
+	{
+		code[count].op = OP_END;
+		code[count].operand = "";
+		// The restart past the end is reported as the line after the last one.
+		code[count].line = vmInstTab.instructionCount;
+		analyzeStack(&vmCodeTab);
+	}
+}
@@ -3,13 +3,160 @@
 #include "table.h"
 #include "stack.h"
 
+// Decoded WIC opcodes. OP_END is deliberately zero so that empty (never inserted) instruction slots decode to it.
+// OP_PUSHI is the immediate form of 'push' - it is never written in WIC source, insertInstruction produces it.
+// Everything after OP_HALT is a superinstruction produced by the optimizer (see optimizer.c); they have no source form.
+typedef enum
+{
+	OP_END = 0,
+	OP_NOP,
+	OP_LABEL,
+	OP_GET,
+	OP_PUT,
+	OP_PUSH,
+	OP_PUSHI,
+	OP_POP,
+	OP_ADD,
+	OP_SUB,
+	OP_MULT,
+	OP_DIV,
+	OP_AND,
+	OP_OR,
+	OP_NOT,
+	OP_TSTEQ,
+	OP_TSTNE,
+	OP_TSTLT,
+	OP_TSTLE,
+	OP_TSTGT,
+	OP_TSTGE,
+	OP_J,
+	OP_JF,
+	// Task instructions, only run by the task runtime (see tasks.c)
+	OP_SPAWN,
+	OP_JOIN,
+	OP_CHAN,
+	OP_SEND,
+	OP_RECV,
+	// Array instructions (see array.c). The operand names an array, or two as 'a,b' for adot, aadd and amult.
+	OP_ARRAY,
+	OP_ALOAD,
+	OP_ASTORE,
+	OP_ALEN,
+	OP_ASUM,
+	OP_AMIN,
+	OP_AMAX,
+	OP_ADOT,
+	OP_AADD,
+	OP_AMULT,
+	OP_ACOUNTEQ,
+	OP_ACOUNTNE,
+	OP_ACOUNTLT,
+	OP_ACOUNTLE,
+	OP_ACOUNTGT,
+	OP_ACOUNTGE,
+	OP_HALT,
+	// a -> slot
+	OP_MOVE,
+	// a op b -> slot
+	OP_ADDV,
+	OP_SUBV,
+	OP_MULTV,
+	// 'push a; push b; sub; tstXX; jf target' - jump unless (a - b) passes tstXX
+	OP_JFEQ,
+	OP_JFNE,
+	OP_JFLT,
+	OP_JFLE,
+	OP_JFGT,
+	OP_JFGE,
+	OP_COUNT
+} opcodeType;
+
+// Typedef definitions of the instructionTable and the instructionType's contained within.
+typedef struct
+{
+	// Opcode decoded at load time, so the interpreter never has to compare strings while running.
+	opcodeType op;
+	// Operand decoded to an integer: the value of an immediate ('push 5'), the variable slot of a symbol operand, the number
+	// of an array operand, or the instruction address of a jump target. Immediates are filled in by insertInstruction,
+	// slots, arrays and targets by resolveProgram.
+	union
+	{
+		wicInt immediate;
+		int slot;
+		int target;
+	} arg;
+	// Source variable slots of a superinstruction. Immediates are given constant slots (see constantSlot). For an array
+	// instruction with two arrays, a is the number of the second.
+	int a;
+	int b;
+	// Address of the source line this instruction came from. Differs from its own address once the optimizer has run.
+	int line;
+	// Interned operand text (see internString), "" if there is none. Only kept for display and for 'get'/'put' prompts.
+	char* operand;
+} instructionType;
+
+typedef struct
+{
+	// Grown by insertInstruction. There is always room for one instruction past the end, and it is kept as OP_END.
+	instructionType* instructions;
+	int instructionCount;
+	int capacity;
+	// Stack depth on entry to each instruction, from analyzeStack. -1 where it is not known statically.
+	int* depths;
+	int maxDepth;
+} instructionTable;
+
+// Execution engines runInterpreter can dispatch to. ENGINE_THREADED needs a compiler with labels-as-values (GCC/Clang);
+// elsewhere it quietly runs the switch engine instead. ENGINE_JIT needs x86-64 with mmap (see jit.c) and falls back to
+// the threaded engine elsewhere. ENGINE_REGISTER translates the program to register code first (see regvm.c) and falls back
+// to the threaded engine when the stack depths are not static. ENGINE_PROFILE is the switch engine with profiling (see
+// profiler.c). ENGINE_TRACE is the switch engine running hot loops as compiled traces (see trace.c); without the JIT it
+// only interprets.
+typedef enum
+{
+	ENGINE_SWITCH = 0,
+	ENGINE_THREADED,
+	ENGINE_JIT,
+	ENGINE_REGISTER,
+	ENGINE_PROFILE,
+	ENGINE_TRACE
+} engineType;
+
 // Outside accessible functions in instructions.c
 void runInterpreter();
+void runEngine();
+void setQuiet(int q);
+void setEngine(engineType e);
+void setOverflowMode(overflowModeType mode);
+int overflowModeFromName(char* name);
+engineType currentEngine();
+int engineFromName(char* name);
 void printTables();
+void printJumpTable();
 void printInstTable();
 void initialize();
-int hasOperand(char * opcode);
-void insertInstruction(int address, char* opcode, char* operand);
-char* fetchOpcode(int address);
+int hasOperand(opcodeType op);
+opcodeType decodeOpcode(char* op, int length);
+int insertInstruction(int address, char* opcode, int opcodeLength, char* operand, int operandLength);
+int resolveProgram();
+opcodeType fetchOpcode(int address);
+int stackDepthAt(int address);
+int maxStackDepth();
+const char* opcodeName(opcodeType op);
+int constantSlot(wicInt value);
+void clearConstants(int capacity);
+int stackEffect(opcodeType op, int* needed);
+void analyzeStack(instructionTable* table);
+void setCode(instructionType* code, int count);
+void halt();
+void inputVariable(instructionType* inst);
+void outputVariable(instructionType* inst);
+void divideByZero(int line);
+int taskInstruction();
+int arrayInstruction();
+void taskUnsupported(int line);
+
+// The program tables, variables and stack above all belong to the current VM.
+#include "vm.h"
 
 #endif
\ No newline at end of file
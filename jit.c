@@ -0,0 +1,1011 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "jit.h"
+#include "instructions.h"
+#include "stack.h"
+
+#if defined(__x86_64__) && !defined(_WIN32)
+#include <sys/mman.h>
+#define JIT_SUPPORTED 1
+#endif
+
+#if defined(JIT_SUPPORTED)
+
+// x86-64 register numbers. The generated code keeps the variables array in rbx, the operand stack in rbp, and up to four of
+// the most used variables in r12-r15. All of those are callee-saved, so calls back into C leave them alone. Values are
+// worked on in 32 bit registers, or 64 bit ones (every value instruction gets REX.W) when wicInt is 64 bits.
+#define RAX 0
+#define RCX 1
+#define RBX 3
+#define RBP 5
+#define JIT_REG_VARS 4
+static const int varRegisters[JIT_REG_VARS] = {12, 13, 14, 15};
+#define JIT_VALUE_SIZE ((int) sizeof(wicInt))
+#if defined(WIC_INT64)
+#define JIT_REX_W 0x48
+#else
+#define JIT_REX_W 0
+#endif
+
+// x86 condition codes, as used by jcc and setcc.
+#define CC_O 0x0
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_L 0xC
+#define CC_GE 0xD
+#define CC_LE 0xE
+#define CC_G 0xF
+
+// Conditions under which tsteq..tstge pass, indexed from OP_TSTEQ, and under which jfeq..jfge jump - the opposite of the
+// test passing.
+static const int testConditions[6] = {CC_E, CC_NE, CC_L, CC_LE, CC_G, CC_GE};
+static const int failConditions[6] = {CC_NE, CC_E, CC_GE, CC_G, CC_LE, CC_L};
+
+// Most bytes a single WIC instruction can compile to (a call with every register variable saved and reloaded), with room
+// to spare, and the fixed size of the prologue/epilogue.
+#define JIT_BYTES_PER_INST 160
+#define JIT_BYTES_FIXED 512
+
+// Where an instruction operand lives: a register, memory at [base + offset], or an immediate.
+typedef enum
+{
+	OPND_REG,
+	OPND_MEM,
+	OPND_IMM
+} operandKind;
+
+typedef struct
+{
+	operandKind kind;
+	int reg;
+	int value;
+} jitOperand;
+
+// Two-operand ALU instructions the compiler uses. Each has a 'reg, r/m' opcode and an '81 /ext' immediate form
+// (imul uses '69 /r' instead).
+typedef enum
+{
+	ALU_ADD,
+	ALU_SUB,
+	ALU_IMUL,
+	ALU_CMP,
+	ALU_OR
+} aluType;
+static const int aluOpcodes[5] = {0x03, 0x2B, 0x0FAF, 0x3B, 0x0B};
+static const int aluImmediateExt[5] = {0, 5, -1, 7, 1};
+
+// Signature of the generated code (see compileProgram).
+typedef int (*jitFunction)(wicInt* vars, wicInt* stack, int* depth);
+
+// A jump whose 32 bit displacement is filled in once every instruction has an address.
+typedef struct
+{
+	int offset;
+	int target;
+} jitFixup;
+
+// A jump taken when arithmetic overflows, to an exit that leaves at the given stack depth for the given address.
+typedef struct
+{
+	int offset;
+	int depth;
+	int resume;
+} jitOverflowExit;
+
+// Code being generated.
+typedef struct
+{
+	unsigned char* code;
+	int size;
+	int capacity;
+	// Native offset of each WIC instruction, plus one for the OP_END past the last.
+	int* address;
+	jitFixup* fixups;
+	int fixupCount;
+	// One per instruction at most; the exits themselves go after the code (see emitOverflowExits).
+	jitOverflowExit* overflowExits;
+	int overflowExitCount;
+	int epilogue;
+	// Register holding each variable slot, or -1 if it lives in memory.
+	int* slotRegister;
+	int registerSlots[JIT_REG_VARS];
+	int registerCount;
+} jitBuffer;
+
+// Function: emitByte
+// Description: Appends one byte of machine code. Running out of room is caught once, after compiling.
+// Params: Buffer, byte.
+// Returns: None.
+// Modifies: Buffer.
+static void emitByte(jitBuffer* b, int x)
+{
+	if (b -> size < b -> capacity)
+		b -> code[b -> size] = (unsigned char) x;
+	b -> size++;
+}
+
+// Function: emitInt
+// Description: Appends a little-endian 32 bit value.
+// Params: Buffer, value.
+// Returns: None.
+// Modifies: Buffer.
+static void emitInt(jitBuffer* b, int x)
+{
+	unsigned int u = (unsigned int) x;
+	emitByte(b, u & 0xFF);
+	emitByte(b, (u >> 8) & 0xFF);
+	emitByte(b, (u >> 16) & 0xFF);
+	emitByte(b, (u >> 24) & 0xFF);
+}
+
+// Function: emitPointer
+// Description: Appends a little-endian 64 bit pointer.
+// Params: Buffer, pointer.
+// Returns: None.
+// Modifies: Buffer.
+static void emitPointer(jitBuffer* b, void* p)
+{
+	unsigned long long u = (unsigned long long) (size_t) p;
+	int i;
+	for (i = 0; i < 8; i++)
+		emitByte(b, (int) ((u >> (8 * i)) & 0xFF));
+}
+
+// Function: reg
+// Description: Builds a register operand.
+// Params: Register number.
+// Returns: Operand.
+// Modifies: None.
+static jitOperand reg(int r)
+{
+	jitOperand o;
+	o.kind = OPND_REG;
+	o.reg = r;
+	o.value = 0;
+	return o;
+}
+
+// Function: immediate
+// Description: Builds an immediate operand.
+// Params: Value.
+// Returns: Operand.
+// Modifies: None.
+static jitOperand immediate(int value)
+{
+	jitOperand o;
+	o.kind = OPND_IMM;
+	o.reg = 0;
+	o.value = value;
+	return o;
+}
+
+// Function: mem
+// Description: Builds a memory operand, [base + offset].
+// Params: Base register (rbx or rbp), byte offset.
+// Returns: Operand.
+// Modifies: None.
+static jitOperand mem(int base, int offset)
+{
+	jitOperand o;
+	o.kind = OPND_MEM;
+	o.reg = base;
+	o.value = offset;
+	return o;
+}
+
+// Function: emitRM
+// Description: Appends an instruction with a ModRM byte: optional REX prefix, one or two opcode bytes, then either a
+//                register operand or [base + disp32].
+// Params: Buffer, opcode (two byte opcodes as 0x0Fxx), value of the ModRM reg field, r/m operand.
+// Returns: None.
+// Modifies: Buffer.
+static void emitRM(jitBuffer* b, int opcode, int regField, jitOperand rm)
+{
+	int rex = JIT_REX_W;
+	if (regField & 8)
+		rex |= 0x44;
+	if (rm.reg & 8)
+		rex |= 0x41;
+	if (rex)
+		emitByte(b, rex);
+	if (opcode > 0xFF)
+		emitByte(b, opcode >> 8);
+	emitByte(b, opcode & 0xFF);
+	if (rm.kind == OPND_REG)
+	{
+		emitByte(b, 0xC0 | ((regField & 7) << 3) | (rm.reg & 7));
+	}
+	else
+	{
+		emitByte(b, 0x80 | ((regField & 7) << 3) | (rm.reg & 7));
+		emitInt(b, rm.value);
+	}
+}
+
+// Function: emitLoad
+// Description: mov r32, operand (r64 for 64 bit values, with immediates sign-extended).
+// Params: Buffer, destination register, source operand.
+// Returns: None.
+// Modifies: Buffer.
+static void emitLoad(jitBuffer* b, int r, jitOperand src)
+{
+	if (src.kind == OPND_IMM && JIT_REX_W)
+	{
+		emitRM(b, 0xC7, 0, reg(r));
+		emitInt(b, src.value);
+	}
+	else if (src.kind == OPND_IMM)
+	{
+		if (r & 8)
+			emitByte(b, 0x41);
+		emitByte(b, 0xB8 + (r & 7));
+		emitInt(b, src.value);
+	}
+	else if (src.kind != OPND_REG || src.reg != r)
+	{
+		emitRM(b, 0x8B, r, src);
+	}
+}
+
+// Function: emitStore
+// Description: mov operand, r32.
+// Params: Buffer, destination operand, source register.
+// Returns: None.
+// Modifies: Buffer.
+static void emitStore(jitBuffer* b, jitOperand dst, int r)
+{
+	if (dst.kind != OPND_REG || dst.reg != r)
+		emitRM(b, 0x89, r, dst);
+}
+
+// Function: emitMove
+// Description: Copies one operand to another, through eax if both are in memory.
+// Params: Buffer, destination operand (register or memory), source operand.
+// Returns: None.
+// Modifies: Buffer.
+static void emitMove(jitBuffer* b, jitOperand dst, jitOperand src)
+{
+	if (dst.kind == OPND_REG)
+	{
+		emitLoad(b, dst.reg, src);
+	}
+	else if (src.kind == OPND_IMM)
+	{
+		emitRM(b, 0xC7, 0, dst);
+		emitInt(b, src.value);
+	}
+	else if (src.kind == OPND_REG)
+	{
+		emitStore(b, dst, src.reg);
+	}
+	else
+	{
+		emitLoad(b, RAX, src);
+		emitStore(b, dst, RAX);
+	}
+}
+
+// Function: emitAlu
+// Description: r32 = r32 op operand.
+// Params: Buffer, operation, register, source operand.
+// Returns: None.
+// Modifies: Buffer.
+static void emitAlu(jitBuffer* b, aluType op, int r, jitOperand src)
+{
+	if (src.kind != OPND_IMM)
+	{
+		emitRM(b, aluOpcodes[op], r, src);
+	}
+	else if (op == ALU_IMUL)
+	{
+		emitRM(b, 0x69, r, reg(r));
+		emitInt(b, src.value);
+	}
+	else
+	{
+		emitRM(b, 0x81, aluImmediateExt[op], reg(r));
+		emitInt(b, src.value);
+	}
+}
+
+// Function: emitTest
+// Description: test r32, r32.
+// Params: Buffer, register.
+// Returns: None.
+// Modifies: Buffer.
+static void emitTest(jitBuffer* b, int r)
+{
+	emitRM(b, 0x85, r, reg(r));
+}
+
+// Function: emitSetcc
+// Description: Sets a register to 1 if a condition holds and 0 otherwise (setcc r8; movzx r32, r8). Only for eax/ecx.
+// Params: Buffer, condition code, register.
+// Returns: None.
+// Modifies: Buffer.
+static void emitSetcc(jitBuffer* b, int cc, int r)
+{
+	emitByte(b, 0x0F);
+	emitByte(b, 0x90 | cc);
+	emitByte(b, 0xC0 | r);
+	emitByte(b, 0x0F);
+	emitByte(b, 0xB6);
+	emitByte(b, 0xC0 | (r << 3) | r);
+}
+
+// Function: emitBranch
+// Description: Jumps to a WIC instruction, conditionally or not. The displacement is patched in by finishCode.
+// Params: Buffer, condition code or -1 for an unconditional jump, target address in codeTab.
+// Returns: None.
+// Modifies: Buffer.
+static void emitBranch(jitBuffer* b, int cc, int target)
+{
+	if (cc < 0)
+	{
+		emitByte(b, 0xE9);
+	}
+	else
+	{
+		emitByte(b, 0x0F);
+		emitByte(b, 0x80 | cc);
+	}
+	b -> fixups[b -> fixupCount].offset = b -> size;
+	b -> fixups[b -> fixupCount].target = target;
+	b -> fixupCount++;
+	emitInt(b, 0);
+}
+
+// Function: emitSaveRegisters
+// Description: Writes the variables kept in registers back to the variables array, or reloads them from it.
+// Params: Buffer, 1 to save or 0 to reload.
+// Returns: None.
+// Modifies: Buffer.
+static void emitSaveRegisters(jitBuffer* b, int save)
+{
+	int i;
+	for (i = 0; i < b -> registerCount; i++)
+		emitRM(b, save ? 0x89 : 0x8B, varRegisters[i], mem(RBX, JIT_VALUE_SIZE * b -> registerSlots[i]));
+}
+
+// Function: emitCall
+// Description: Calls back into the C runtime with one argument. Register variables are saved first, so the callee sees every
+//                variable's current value, and reloaded afterwards in case it changed one ('get').
+// Params: Buffer, function, argument (pointer or int).
+// Returns: None.
+// Modifies: Buffer.
+static void emitCall(jitBuffer* b, void* function, void* argument)
+{
+	emitSaveRegisters(b, 1);
+	// mov rdi, imm64; mov rax, imm64; call rax
+	emitByte(b, 0x48);
+	emitByte(b, 0xBF);
+	emitPointer(b, argument);
+	emitByte(b, 0x48);
+	emitByte(b, 0xB8);
+	emitPointer(b, function);
+	emitByte(b, 0xFF);
+	emitByte(b, 0xD0);
+	emitSaveRegisters(b, 0);
+}
+
+// Function: emitExit
+// Description: Leaves the compiled code: records the stack depth for the interpreter and returns the address it should carry
+//                on from (-1 once the program has halted).
+// Params: Buffer, stack depth at this point, address to resume at.
+// Returns: None.
+// Modifies: Buffer.
+static void emitExit(jitBuffer* b, int depth, int resume)
+{
+	// mov rcx, [rsp]; mov dword [rcx], depth; mov eax, resume; jmp epilogue
+	emitByte(b, 0x48);
+	emitByte(b, 0x8B);
+	emitByte(b, 0x0C);
+	emitByte(b, 0x24);
+	emitByte(b, 0xC7);
+	emitByte(b, 0x01);
+	emitInt(b, depth);
+	emitByte(b, 0xB8);
+	emitInt(b, resume);
+	emitByte(b, 0xE9);
+	emitInt(b, b -> epilogue - (b -> size + 4));
+}
+
+// Function: emitSkip
+// Description: Jumps forward over code that is about to be emitted, conditionally or not. The displacement is filled in by
+//                patchSkip once the code is there.
+// Params: Buffer, condition code or -1 for an unconditional jump.
+// Returns: Offset of the displacement, for patchSkip.
+// Modifies: Buffer.
+static int emitSkip(jitBuffer* b, int cc)
+{
+	int offset;
+	if (cc < 0)
+	{
+		emitByte(b, 0xE9);
+	}
+	else
+	{
+		emitByte(b, 0x0F);
+		emitByte(b, 0x80 | cc);
+	}
+	offset = b -> size;
+	emitInt(b, 0);
+	return offset;
+}
+
+// Function: patchSkip
+// Description: Makes a jump from emitSkip land at the current end of the code.
+// Params: Buffer, offset emitSkip returned.
+// Returns: None.
+// Modifies: Buffer.
+static void patchSkip(jitBuffer* b, int offset)
+{
+	int rel = b -> size - (offset + 4);
+	if (offset + 4 <= b -> capacity)
+		memcpy(b -> code + offset, &rel, 4);
+}
+
+// Function: emitOverflowCheck
+// Description: Follows an add, sub or imul: if it overflowed, leaves the compiled code with the stack as it was before the
+//                instruction, and the interpreter runs the instruction again and deals with the overflow. Nothing is emitted
+//                when overflow just wraps around.
+// Params: Buffer, stack depth on entry to the instruction, its address.
+// Returns: None.
+// Modifies: Buffer.
+static void emitOverflowCheck(jitBuffer* b, int depth, int pc)
+{
+	jitOverflowExit* exit = &b -> overflowExits[b -> overflowExitCount];
+	if (currentVm -> overflowMode == OVERFLOW_WRAP)
+		return;
+	emitByte(b, 0x0F);
+	emitByte(b, 0x80 | CC_O);
+	exit -> offset = b -> size;
+	exit -> depth = depth;
+	exit -> resume = pc;
+	b -> overflowExitCount++;
+	emitInt(b, 0);
+}
+
+// Function: emitOverflowExits
+// Description: Emits the exits the overflow checks jump to, out of line after the code so the checks fall straight through.
+// Params: Buffer.
+// Returns: None.
+// Modifies: Buffer.
+static void emitOverflowExits(jitBuffer* b)
+{
+	int i;
+	for (i = 0; i < b -> overflowExitCount; i++)
+	{
+		patchSkip(b, b -> overflowExits[i].offset);
+		emitExit(b, b -> overflowExits[i].depth, b -> overflowExits[i].resume);
+	}
+}
+
+// Function: slotOperand
+// Description: Where a variable slot lives in the compiled code: its register, an immediate for constant slots that fit in 32
+//                bits, or memory.
+// Params: Buffer, slot.
+// Returns: Operand.
+// Modifies: None.
+static jitOperand slotOperand(jitBuffer* b, int slot)
+{
+	if (b -> slotRegister[slot] >= 0)
+		return reg(b -> slotRegister[slot]);
+	if (slot >= vmVariableCount && vmVariables[slot] >= INT_MIN && vmVariables[slot] <= INT_MAX)
+		return immediate((int) vmVariables[slot]);
+	return mem(RBX, JIT_VALUE_SIZE * slot);
+}
+
+// Function: stackOperand
+// Description: Memory holding the stack value at a depth. Depths are static, so each one is a fixed offset from rbp.
+// Params: Depth (1 = bottom).
+// Returns: Operand.
+// Modifies: None.
+static jitOperand stackOperand(int depth)
+{
+	return mem(RBP, JIT_VALUE_SIZE * depth);
+}
+
+// Function: allocateRegisters
+// Description: Gives the variables used by the most instructions a register each, up to JIT_REG_VARS of them.
+// Params: Buffer, addresses of the instructions being compiled (NULL for all of codeTab), how many there are.
+// Returns: None.
+// Modifies: Buffer register assignments.
+static void allocateRegisters(jitBuffer* b, int* pcs, int length)
+{
+	int* uses = (int*) calloc(vmSlotCount + 1, sizeof(int));
+	int i;
+	for (i = 0; i < vmSlotCount; i++)
+		b -> slotRegister[i] = -1;
+	for (i = 0; i < length; i++)
+	{
+		instructionType* inst = &vmCodeTab.instructions[pcs != NULL ? pcs[i] : i];
+		switch (inst -> op)
+		{
+		case OP_GET:
+		case OP_PUT:
+		case OP_PUSH:
+		case OP_POP:
+			uses[inst -> arg.slot]++;
+			break;
+		case OP_ADDV:
+		case OP_SUBV:
+		case OP_MULTV:
+			uses[inst -> arg.slot]++;
+			uses[inst -> b]++;
+			uses[inst -> a]++;
+			break;
+		case OP_MOVE:
+			uses[inst -> arg.slot]++;
+			uses[inst -> a]++;
+			break;
+		case OP_JFEQ:
+		case OP_JFNE:
+		case OP_JFLT:
+		case OP_JFLE:
+		case OP_JFGT:
+		case OP_JFGE:
+			uses[inst -> a]++;
+			uses[inst -> b]++;
+			break;
+		default:
+			break;
+		}
+	}
+	b -> registerCount = 0;
+	while (b -> registerCount < JIT_REG_VARS)
+	{
+		int best = -1;
+		// Constant slots become immediates, so only real variables compete for registers.
+		for (i = 0; i < vmVariableCount; i++)
+		{
+			if (b -> slotRegister[i] < 0 && uses[i] > 0 && (best < 0 || uses[i] > uses[best]))
+				best = i;
+		}
+		if (best < 0)
+			break;
+		b -> slotRegister[best] = varRegisters[b -> registerCount];
+		b -> registerSlots[b -> registerCount++] = best;
+	}
+	free(uses);
+}
+
+// Function: compileInstruction
+// Description: Emits the machine code for one WIC instruction. Stack values live at fixed offsets from rbp because the depth
+//                at every instruction is known statically; arithmetic goes through eax/ecx.
+// Params: Buffer, address in codeTab, stack depth on entry to it.
+// Returns: None.
+// Modifies: Buffer.
+static void compileInstruction(jitBuffer* b, int pc, int d)
+{
+	instructionType* inst = &vmCodeTab.instructions[pc];
+	int skip, done;
+	if (d < 0)
+		return;
+	switch (inst -> op)
+	{
+	case OP_GET:
+		emitCall(b, (void*) inputVariable, inst);
+		break;
+	case OP_PUT:
+		emitCall(b, (void*) outputVariable, inst);
+		break;
+	case OP_PUSH:
+		emitMove(b, stackOperand(d + 1), slotOperand(b, inst -> arg.slot));
+		break;
+	case OP_PUSHI:
+		if (inst -> arg.immediate >= INT_MIN && inst -> arg.immediate <= INT_MAX)
+		{
+			emitRM(b, 0xC7, 0, stackOperand(d + 1));
+			emitInt(b, (int) inst -> arg.immediate);
+		}
+		else
+		{
+			// mov rax, imm64
+			emitByte(b, 0x48);
+			emitByte(b, 0xB8);
+			emitPointer(b, (void*) (size_t) inst -> arg.immediate);
+			emitStore(b, stackOperand(d + 1), RAX);
+		}
+		break;
+	case OP_POP:
+		emitMove(b, slotOperand(b, inst -> arg.slot), stackOperand(d));
+		break;
+	case OP_ADD:
+	case OP_SUB:
+	case OP_MULT:
+		emitLoad(b, RAX, stackOperand(d - 1));
+		emitAlu(b, inst -> op == OP_ADD ? ALU_ADD : inst -> op == OP_SUB ? ALU_SUB : ALU_IMUL, RAX, stackOperand(d));
+		emitOverflowCheck(b, d, pc);
+		emitStore(b, stackOperand(d - 1), RAX);
+		break;
+	case OP_DIV:
+		// A zero divisor reports the error and stops. A divisor of -1 is a negation instead, since idiv faults on the one
+		// quotient that overflows.
+		emitLoad(b, RCX, stackOperand(d));
+		emitTest(b, RCX);
+		skip = emitSkip(b, CC_NE);
+		emitCall(b, (void*) divideByZero, (void*) (size_t) inst -> line);
+		emitExit(b, d, -1);
+		patchSkip(b, skip);
+		emitLoad(b, RAX, stackOperand(d - 1));
+		emitAlu(b, ALU_CMP, RCX, immediate(-1));
+		skip = emitSkip(b, CC_NE);
+		// neg eax
+		emitRM(b, 0xF7, 3, reg(RAX));
+		emitOverflowCheck(b, d, pc);
+		done = emitSkip(b, -1);
+		patchSkip(b, skip);
+		// cdq (cqo); idiv ecx
+		if (JIT_REX_W)
+			emitByte(b, JIT_REX_W);
+		emitByte(b, 0x99);
+		emitRM(b, 0xF7, 7, reg(RCX));
+		patchSkip(b, done);
+		emitStore(b, stackOperand(d - 1), RAX);
+		break;
+	case OP_AND:
+		emitLoad(b, RAX, stackOperand(d));
+		emitTest(b, RAX);
+		emitSetcc(b, CC_G, RAX);
+		emitLoad(b, RCX, stackOperand(d - 1));
+		emitTest(b, RCX);
+		emitSetcc(b, CC_G, RCX);
+		// and eax, ecx
+		emitRM(b, 0x23, RAX, reg(RCX));
+		emitStore(b, stackOperand(d - 1), RAX);
+		break;
+	case OP_OR:
+		emitLoad(b, RAX, stackOperand(d));
+		emitAlu(b, ALU_OR, RAX, stackOperand(d - 1));
+		emitSetcc(b, CC_NE, RAX);
+		emitStore(b, stackOperand(d - 1), RAX);
+		break;
+	case OP_NOT:
+	case OP_TSTEQ:
+	case OP_TSTNE:
+	case OP_TSTLT:
+	case OP_TSTLE:
+	case OP_TSTGT:
+	case OP_TSTGE:
+		emitLoad(b, RAX, stackOperand(d));
+		emitTest(b, RAX);
+		emitSetcc(b, inst -> op == OP_NOT ? CC_E : testConditions[inst -> op - OP_TSTEQ], RAX);
+		emitStore(b, stackOperand(d), RAX);
+		break;
+	case OP_J:
+		emitBranch(b, -1, inst -> arg.target);
+		break;
+	case OP_JF:
+		emitLoad(b, RAX, stackOperand(d));
+		emitTest(b, RAX);
+		emitBranch(b, CC_E, inst -> arg.target);
+		break;
+	case OP_HALT:
+		emitCall(b, (void*) halt, NULL);
+		emitExit(b, d, -1);
+		break;
+	case OP_MOVE:
+		emitMove(b, slotOperand(b, inst -> arg.slot), slotOperand(b, inst -> a));
+		break;
+	case OP_ADDV:
+	case OP_SUBV:
+	case OP_MULTV:
+		emitLoad(b, RAX, slotOperand(b, inst -> a));
+		emitAlu(b, inst -> op == OP_ADDV ? ALU_ADD : inst -> op == OP_SUBV ? ALU_SUB : ALU_IMUL, RAX, slotOperand(b, inst -> b));
+		emitOverflowCheck(b, d, pc);
+		emitMove(b, slotOperand(b, inst -> arg.slot), reg(RAX));
+		break;
+	case OP_JFEQ:
+	case OP_JFNE:
+	case OP_JFLT:
+	case OP_JFLE:
+	case OP_JFGT:
+	case OP_JFGE:
+		// The test is on the difference, exactly as 'sub; tstXX' computes it (overflow checked, or wrapped around), so
+		// compare a - b against zero rather than a against b.
+		emitLoad(b, RAX, slotOperand(b, inst -> a));
+		if (slotOperand(b, inst -> b).kind != OPND_IMM || slotOperand(b, inst -> b).value != 0)
+		{
+			emitAlu(b, ALU_SUB, RAX, slotOperand(b, inst -> b));
+			emitOverflowCheck(b, d, pc);
+		}
+		emitTest(b, RAX);
+		emitBranch(b, failConditions[inst -> op - OP_JFEQ], inst -> arg.target);
+		break;
+	default:
+		// label, nop
+		break;
+	}
+}
+
+// Function: emitEntry
+// Description: Emits the code every compiled function starts with: the prologue, which takes the arguments and loads the
+//                register variables before jumping to the first instruction, and the shared epilogue the exits jump to, which
+//                saves the register variables and returns.
+// Params: Buffer, target of the jump to the first instruction (see emitBranch).
+// Returns: None.
+// Modifies: Buffer.
+static void emitEntry(jitBuffer* b, int start)
+{
+	static const unsigned char prologue[] = {
+		0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57,	// push rbx, rbp, r12, r13, r14, r15
+		0x48, 0x83, 0xEC, 0x08,		// sub rsp, 8 (keeps calls 16 byte aligned; the slot holds the depth pointer)
+		0x48, 0x89, 0x14, 0x24,		// mov [rsp], rdx
+		0x48, 0x89, 0xFB,			// mov rbx, rdi
+		0x48, 0x89, 0xF5};			// mov rbp, rsi
+	static const unsigned char epilogue[] = {
+		0x48, 0x83, 0xC4, 0x08,		// add rsp, 8
+		0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5D, 0x5B,	// pop r15, r14, r13, r12, rbp, rbx
+		0xC3};						// ret
+	int i;
+	for (i = 0; i < (int) sizeof(prologue); i++)
+		emitByte(b, prologue[i]);
+	emitSaveRegisters(b, 0);
+	emitBranch(b, -1, start);
+	b -> epilogue = b -> size;
+	emitSaveRegisters(b, 1);
+	for (i = 0; i < (int) sizeof(epilogue); i++)
+		emitByte(b, epilogue[i]);
+}
+
+// Function: patchBranches
+// Description: Fills in the displacement of every branch emitted with emitBranch, once all their targets have addresses.
+//                Nothing is patched if the code did not fit.
+// Params: Buffer.
+// Returns: None.
+// Modifies: Buffer.
+static void patchBranches(jitBuffer* b)
+{
+	int i;
+	for (i = 0; i < b -> fixupCount && b -> size <= b -> capacity; i++)
+	{
+		int rel = b -> address[b -> fixups[i].target] - (b -> fixups[i].offset + 4);
+		memcpy(b -> code + b -> fixups[i].offset, &rel, 4);
+	}
+}
+
+// Function: compileProgram
+// Description: Compiles the whole of codeTab. The generated function is int f(int* variables, int* stack, int* depth): it
+//                runs until the program halts or has to leave early, stores the stack depth through its third argument and
+//                returns the address the interpreter should carry on from, or -1 once the program has halted.
+// Params: Buffer, already allocated.
+// Returns: None.
+// Modifies: Buffer.
+static void compileProgram(jitBuffer* b)
+{
+	int i;
+	emitEntry(b, 0);
+	for (i = 0; i < vmCodeTab.instructionCount; i++)
+	{
+		b -> address[i] = b -> size;
+		compileInstruction(b, i, vmCodeTab.depths[i]);
+	}
+	// Running off the end restarts the program, as it does in the interpreter.
+	b -> address[vmCodeTab.instructionCount] = b -> size;
+	emitBranch(b, -1, 0);
+	emitOverflowExits(b);
+	patchBranches(b);
+}
+
+// Function: runJit
+// Description: Compiles the executed program to x86-64 machine code in an mmap'd buffer and runs it. Variables are kept in
+//                registers or in the variables array, stack values at fixed offsets in the stack, jumps become native
+//                branches, and get/put/halt call back into the C runtime. Needs the stack depth at every instruction to be
+//                known statically (see analyzeStack); programs where it is not, or that have array instructions, are left
+//                to the interpreter.
+// Params: None.
+// Returns: Address the interpreter should carry on from: 0 if nothing was compiled, the instruction that overflowed, or -1
+//            once the program has halted or stopped on a divide error.
+// Modifies: Stack, variables.
+int runJit()
+{
+	jitBuffer b;
+	void* memory;
+	int resume = 0;
+	int depth = 0;
+	if (vmCodeTab.maxDepth < 0 || vmCodeTab.instructionCount == 0 || vmStack.stackIndex != 0 || arrayInstruction() >= 0)
+		return 0;
+	if (vmStack.capacity < vmCodeTab.maxDepth + 2)
+		initStack(vmCodeTab.maxDepth);
+	memset(&b, 0, sizeof(b));
+	b.capacity = JIT_BYTES_FIXED + JIT_BYTES_PER_INST * (vmCodeTab.instructionCount + 1);
+	memory = mmap(NULL, b.capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED)
+		return 0;
+	b.code = (unsigned char*) memory;
+	b.address = (int*) malloc((vmCodeTab.instructionCount + 1) * sizeof(int));
+	b.fixups = (jitFixup*) malloc((vmCodeTab.instructionCount + 2) * sizeof(jitFixup));
+	b.overflowExits = (jitOverflowExit*) malloc((vmCodeTab.instructionCount + 1) * sizeof(jitOverflowExit));
+	b.slotRegister = (int*) malloc((vmSlotCount + 1) * sizeof(int));
+	allocateRegisters(&b, NULL, vmCodeTab.instructionCount);
+	compileProgram(&b);
+	if (b.size <= b.capacity && mprotect(memory, b.capacity, PROT_READ | PROT_EXEC) == 0)
+	{
+		jitFunction run = (jitFunction) memory;
+		resume = run(vmVariables, vmStack.theStack, &depth);
+		vmStack.stackIndex = depth;
+	}
+	munmap(memory, b.capacity);
+	free(b.address);
+	free(b.fixups);
+	free(b.overflowExits);
+	free(b.slotRegister);
+	return resume;
+}
+
+// Function: compileTrace
+// Description: Compiles a loop trace recorded by the tracing engine (see trace.c): the codeTab addresses one trip around the
+//                loop ran, and the stack depth on entry to each. The result is straight-line code that jumps back to its own
+//                start at the end, with the same signature as compileProgram's. j and the restart past the end compile to
+//                nothing, since the trace already carries on where they went. jf and jfXX become guards: when the branch goes
+//                the other way from when the trace was recorded, the code leaves through an exit that stores the stack depth
+//                and returns the address the branch went to, and the interpreter carries on from there. Everything else
+//                compiles as it does for runJit.
+// Params: Addresses, depths, length of the trace, trace to fill in.
+// Returns: 0 on success, -1 if the trace could not be compiled.
+// Modifies: Trace.
+int compileTrace(int* pcs, int* depths, int length, jitTraceType* trace)
+{
+	jitBuffer b;
+	void* memory;
+	// Where each guard leaves the trace to (-1 for instructions with no guard), and the stack depth it leaves at.
+	int* exitResume;
+	int* exitDepth;
+	int i;
+	memset(&b, 0, sizeof(b));
+	b.capacity = JIT_BYTES_FIXED + JIT_BYTES_PER_INST * (length + 1);
+	memory = mmap(NULL, b.capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED)
+		return -1;
+	b.code = (unsigned char*) memory;
+	// Branch targets (see emitBranch) are trace positions: the exit of the guard at each position, and the loop start.
+	b.address = (int*) malloc((length + 1) * sizeof(int));
+	b.fixups = (jitFixup*) malloc((length + 2) * sizeof(jitFixup));
+	b.overflowExits = (jitOverflowExit*) malloc((length + 1) * sizeof(jitOverflowExit));
+	b.slotRegister = (int*) malloc((vmSlotCount + 1) * sizeof(int));
+	exitResume = (int*) malloc(length * sizeof(int));
+	exitDepth = (int*) malloc(length * sizeof(int));
+	allocateRegisters(&b, pcs, length);
+	emitEntry(&b, length);
+	b.address[length] = b.size;
+	trace -> depth = depths[0];
+	trace -> maxDepth = 0;
+	for (i = 0; i < length; i++)
+	{
+		int pc = pcs[i];
+		int next = i + 1 < length ? pcs[i + 1] : pcs[0];
+		int d = depths[i];
+		opcodeType op = pc < vmCodeTab.instructionCount ? vmCodeTab.instructions[pc].op : OP_END;
+		int target = vmCodeTab.instructions[pc].arg.target;
+		exitResume[i] = -1;
+		if (d + 1 > trace -> maxDepth)
+			trace -> maxDepth = d + 1;
+		if ((op == OP_JF || (op >= OP_JFEQ && op <= OP_JFGE)) && target != pc + 1)
+		{
+			// Leave for wherever the branch goes when it does not go where it went while recording.
+			int taken = next == target;
+			exitResume[i] = taken ? pc + 1 : target;
+			if (op == OP_JF)
+			{
+				exitDepth[i] = d - 1;
+				emitLoad(&b, RAX, stackOperand(d));
+				emitTest(&b, RAX);
+				emitBranch(&b, taken ? CC_NE : CC_E, i);
+			}
+			else
+			{
+				exitDepth[i] = d;
+				emitLoad(&b, RAX, slotOperand(&b, vmCodeTab.instructions[pc].a));
+				if (slotOperand(&b, vmCodeTab.instructions[pc].b).kind != OPND_IMM
+					|| slotOperand(&b, vmCodeTab.instructions[pc].b).value != 0)
+				{
+					emitAlu(&b, ALU_SUB, RAX, slotOperand(&b, vmCodeTab.instructions[pc].b));
+					emitOverflowCheck(&b, d, pc);
+				}
+				emitTest(&b, RAX);
+				emitBranch(&b, taken ? testConditions[op - OP_JFEQ] : failConditions[op - OP_JFEQ], i);
+			}
+		}
+		else if (op != OP_J && op != OP_JF && op != OP_END)
+		{
+			compileInstruction(&b, pc, d);
+		}
+	}
+	emitBranch(&b, -1, length);
+	for (i = 0; i < length; i++)
+	{
+		if (exitResume[i] >= 0)
+		{
+			b.address[i] = b.size;
+			emitExit(&b, exitDepth[i], exitResume[i]);
+		}
+	}
+	emitOverflowExits(&b);
+	patchBranches(&b);
+	free(exitDepth);
+	free(exitResume);
+	free(b.address);
+	free(b.fixups);
+	free(b.overflowExits);
+	free(b.slotRegister);
+	if (b.size > b.capacity || mprotect(memory, b.capacity, PROT_READ | PROT_EXEC) != 0)
+	{
+		munmap(memory, b.capacity);
+		return -1;
+	}
+	trace -> code = memory;
+	trace -> size = b.capacity;
+	return 0;
+}
+
+// Function: runTrace
+// Description: Runs a compiled trace from the current stack, which must be at the depth it was recorded at, until one of its
+//                guards fails, an operation overflows or a division by zero is reported.
+// Params: Trace.
+// Returns: Address the interpreter should carry on from.
+// Modifies: Stack, variables.
+int runTrace(jitTraceType* trace)
+{
+	int depth = trace -> depth;
+	int resume = ((jitFunction) trace -> code)(vmVariables, vmStack.theStack, &depth);
+	vmStack.stackIndex = depth;
+	return resume;
+}
+
+// Function: freeTrace
+// Description: Releases a trace's machine code.
+// Params: Trace.
+// Returns: None.
+// Modifies: Trace.
+void freeTrace(jitTraceType* trace)
+{
+	if (trace -> code != NULL)
+		munmap(trace -> code, trace -> size);
+	trace -> code = NULL;
+}
+
+#else
+
+// Function: runJit
+// Description: No JIT on this platform - the interpreter runs the whole program.
+// Params: None.
+// Returns: 0, the address the interpreter should start from.
+// Modifies: None.
+int runJit()
+{
+	return 0;
+}
+
+// Function: compileTrace
+// Description: No JIT on this platform - traces are never compiled, and the tracing engine just interprets.
+// Params: Addresses, depths, length of the trace, trace to fill in.
+// Returns: -1.
+// Modifies: None.
+int compileTrace(int* pcs, int* depths, int length, jitTraceType* trace)
+{
+	return -1;
+}
+
+// Function: runTrace
+// Description: Never called, since no trace is ever compiled.
+// Params: Trace.
+// Returns: 0.
+// Modifies: None.
+int runTrace(jitTraceType* trace)
+{
+	return 0;
+}
+
+// Function: freeTrace
+// Description: Nothing to release, since no trace is ever compiled.
+// Params: Trace.
+// Returns: None.
+// Modifies: None.
+void freeTrace(jitTraceType* trace)
+{
+}
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef JIT_H
+#define JIT_H
+
+// Machine code for one loop trace recorded by the tracing engine (see trace.c).
+typedef struct
+{
+	void* code;
+	int size;
+	// Stack depth at the loop header when the trace was recorded - it is only ever entered at that depth - and the deepest
+	// stack slot it writes.
+	int depth;
+	int maxDepth;
+} jitTraceType;
+
+// x86-64 JIT compiler for the executed program (codeTab). Supported on x86-64 platforms with mmap (Linux, macOS, BSD).
+int runJit();
+int compileTrace(int* pcs, int* depths, int length, jitTraceType* trace);
+int runTrace(jitTraceType* trace);
+void freeTrace(jitTraceType* trace);
+
+#endif
@@ -0,0 +1,512 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "libwic.h"
+#include "engine.h"
+#include "loader.h"
+#include "optimizer.h"
+
+// Budget wicRun takes a budget of 0 as: more instructions than any run will get through.
+#define WIC_UNLIMITED 0x7fffffffffffffffLL
+
+// A compiled program: the VM it was loaded, resolved and optimized on. Instances share its code and tables and never change
+// them.
+struct wicProgram
+{
+	vmType* vm;
+};
+
+struct wicInstance
+{
+	// The instance's own VM. Its code and tables are the program's; the variables, stack and output buffer are its own.
+	vmType vm;
+	wicProgramType* program;
+	// Address the next run starts at, and how the last run ended, or -1 while the instance can still run.
+	int pc;
+	int status;
+	long long executed;
+	// Bound input and output arrays, and the embedder's callbacks, which take precedence when set.
+	const wicInt* inValues;
+	int inCount;
+	int inTaken;
+	wicInt* outValues;
+	int outCapacity;
+	int outCount;
+	wicGetCallbackType get;
+	wicPutCallbackType put;
+	void* context;
+	// What the engine printed about the error that stopped the last run.
+	char message[VM_PRINT_MAX];
+	int messageLength;
+};
+
+// Why the last wicCompile or wicCreateInstance on each thread failed: what the loader printed, or what ran out of memory
+// (see wicLastError).
+static VM_THREAD_LOCAL char compileMessage[VM_PRINT_MAX];
+static VM_THREAD_LOCAL int compileMessageLength;
+
+// The switch engine, with a budget: it stops in front of the instruction that would go over it, ready to carry on from
+// there, and leaves what is left of the budget and where it stopped in the VM. It also stops just past a 'get' the callback
+// had no value for.
+#define SWITCH_ENGINE static void runBudgeted
+#define SWITCH_LOCALS long long left = currentVm -> budget;
+#define SWITCH_STEP() if (--left < 0) goto halted
+#define SWITCH_BRANCH()
+#define SWITCH_INPUT() if (currentVm -> inputBlocked) goto halted
+#define SWITCH_DONE() currentVm -> budget = left; currentVm -> budgetPc = pc
+#include "switchEngine.h"
+
+// Function: instanceGet
+// Description: Get callback of every instance's VM - takes the value from the embedder's callback, or else the bound array.
+// Params: Instance, variable name, where to put the value.
+// Returns: 0 with the value, -1 at the end of the input, 1 if the embedder's callback has no value yet.
+// Modifies: Value, the instance's input position.
+static int instanceGet(void* context, const char* name, wicInt* value)
+{
+	wicInstanceType* instance = (wicInstanceType*) context;
+	if (instance -> get != NULL)
+		return instance -> get(instance -> context, name, value);
+	if (instance -> inTaken >= instance -> inCount)
+		return -1;
+	*value = instance -> inValues[instance -> inTaken++];
+	return 0;
+}
+
+// Function: instancePut
+// Description: Put callback of every instance's VM - hands the value to the embedder's callback, or else stores it in the
+//                bound array while there is room.
+// Params: Instance, variable name, value.
+// Returns: None.
+// Modifies: The instance's output.
+static void instancePut(void* context, const char* name, wicInt value)
+{
+	wicInstanceType* instance = (wicInstanceType*) context;
+	if (instance -> put != NULL)
+	{
+		instance -> put(instance -> context, name, value);
+		return;
+	}
+	if (instance -> outCount < instance -> outCapacity)
+		instance -> outValues[instance -> outCount] = value;
+	instance -> outCount++;
+}
+
+// Function: appendMessage
+// Description: Adds text to a message buffer of VM_PRINT_MAX bytes, dropping whatever does not fit.
+// Params: Message, its length, text, the text's length.
+// Returns: None.
+// Modifies: Message, length.
+static void appendMessage(char* message, int* used, const char* text, int length)
+{
+	int room = VM_PRINT_MAX - 1 - *used;
+	if (length > room)
+		length = room;
+	memcpy(message + *used, text, length);
+	*used += length;
+	message[*used] = '\0';
+}
+
+// Function: instanceText
+// Description: Text callback of every instance's VM - keeps what the engine prints (only ever error messages, as instances
+//                are quiet) for wicErrorMessage.
+// Params: Instance, text, its length.
+// Returns: None.
+// Modifies: The instance's message.
+static void instanceText(void* context, const char* text, int length)
+{
+	wicInstanceType* instance = (wicInstanceType*) context;
+	appendMessage(instance -> message, &instance -> messageLength, text, length);
+}
+
+// Function: compileText
+// Description: Text callback of a program's VM while it compiles - keeps what the loader prints (only ever the reason the
+//                source did not load) for wicLastError, instead of writing to the host's stdout.
+// Params: Unused context, text, its length.
+// Returns: None.
+// Modifies: This thread's compile message.
+static void compileText(void* context, const char* text, int length)
+{
+	(void) context;
+	appendMessage(compileMessage, &compileMessageLength, text, length);
+}
+
+// Function: trimMessage
+// Description: Strips the blank lines and spaces the interpreter puts around its messages.
+// Params: Message, its length.
+// Returns: The message from its first character that is not white space.
+// Modifies: Message, length.
+static const char* trimMessage(char* message, int* length)
+{
+	while (*length > 0 && isspace((unsigned char) message[*length - 1]))
+		message[--*length] = '\0';
+	while (isspace((unsigned char) *message))
+		message++;
+	return message;
+}
+
+// Function: failCall
+// Description: Sets the calling thread's last error, for a wicCompile or wicCreateInstance that is giving up.
+// Params: Message.
+// Returns: None.
+// Modifies: This thread's compile message.
+static void failCall(const char* message)
+{
+	compileMessageLength = 0;
+	compileMessage[0] = '\0';
+	appendMessage(compileMessage, &compileMessageLength, message, (int) strlen(message));
+}
+
+// Function: wicCompile
+// Description: Loads, resolves and optimizes a program from WIC source in memory, on a VM of its own. Problems with the
+//                source, and running out of memory, are kept for wicLastError rather than printed.
+// Params: Source text (need not be '\0' terminated), its length, optimization level (0 to OPT_LEVEL_MAX, see
+//           optimizeProgram).
+// Returns: The compiled program, or NULL if the source did not load or there was not the memory to compile it.
+// Modifies: None.
+wicProgramType* wicCompile(const char* source, size_t length, int optLevel)
+{
+	// volatile, as it is still needed after a longjmp back from running out of memory.
+	wicProgramType* volatile program = (wicProgramType*) calloc(1, sizeof(wicProgramType));
+	vmType* previous = currentVm;
+	vmRecoveryType recovery;
+	vmRecoveryType* outer;
+	int status;
+	if (program == NULL)
+	{
+		failCall("Out of memory compiling a program!");
+		return NULL;
+	}
+	compileMessageLength = 0;
+	compileMessage[0] = '\0';
+	outer = vmCatchOutOfMemory(&recovery);
+	if (setjmp(recovery.target) != 0)
+	{
+		// Something below ran out of memory; the half built program goes. If it was createVm, the VM it was making is
+		// still current.
+		vmCatchOutOfMemory(outer);
+		if (program -> vm == NULL && currentVm != previous)
+			program -> vm = currentVm;
+		useVm(previous);
+		destroyVm(program -> vm);
+		free(program);
+		failCall(recovery.message);
+		return NULL;
+	}
+	program -> vm = createVm();
+	useVm(program -> vm);
+	currentVm -> textCallback = compileText;
+	status = loadProgram((char*) source, length) == 0 && resolveProgram() == 0 ? 0 : -1;
+	if (status == 0)
+		optimizeProgram(optLevel < 0 ? 0 : optLevel > OPT_LEVEL_MAX ? OPT_LEVEL_MAX : optLevel);
+	vmFlush();
+	currentVm -> textCallback = NULL;
+	useVm(previous);
+	vmCatchOutOfMemory(outer);
+	if (status != 0)
+	{
+		destroyVm(program -> vm);
+		free(program);
+		return NULL;
+	}
+	return program;
+}
+
+// Function: wicFreeProgram
+// Description: Frees a compiled program. Every instance of it must have been destroyed first.
+// Params: Program, or NULL.
+// Returns: None.
+// Modifies: None.
+void wicFreeProgram(wicProgramType* program)
+{
+	if (program == NULL)
+		return;
+	destroyVm(program -> vm);
+	free(program);
+}
+
+// Function: wicCreateInstance
+// Description: Creates an instance of a compiled program, ready to run from the start with every variable zero and every
+//                array empty. Creating one costs an allocation for its variables, one for its arrays and one for its stack;
+//                nothing is copied from the program but its constants.
+// Params: Program.
+// Returns: The new instance, or NULL if there was not the memory for it (see wicLastError).
+// Modifies: None.
+wicInstanceType* wicCreateInstance(wicProgramType* program)
+{
+	// volatile, as it is still needed after a longjmp back from running out of memory.
+	wicInstanceType* volatile instance = (wicInstanceType*) calloc(1, sizeof(wicInstanceType));
+	instructionTable loaded, code;
+	tableType symbols, labels;
+	wicInt* constants;
+	int count, slots, depth, arrayCount;
+	vmType* previous = currentVm;
+	vmRecoveryType recovery;
+	vmRecoveryType* outer;
+	if (instance == NULL)
+	{
+		failCall("Out of memory creating an instance!");
+		return NULL;
+	}
+	compileMessageLength = 0;
+	compileMessage[0] = '\0';
+	outer = vmCatchOutOfMemory(&recovery);
+	if (setjmp(recovery.target) != 0)
+	{
+		vmCatchOutOfMemory(outer);
+		useVm(previous);
+		wicDestroyInstance(instance);
+		failCall(recovery.message);
+		return NULL;
+	}
+	useVm(program -> vm);
+	loaded = vmInstTab;
+	code = vmCodeTab;
+	symbols = vmSymbolTable;
+	labels = vmJumpTable;
+	constants = vmVariables;
+	count = vmVariableCount;
+	slots = vmSlotCount;
+	arrayCount = currentVm -> arrayCount;
+	depth = vmStack.capacity - 2;
+	useVm(&instance -> vm);
+	vmInstTab = loaded;
+	vmCodeTab = code;
+	vmSymbolTable = symbols;
+	vmJumpTable = labels;
+	vmVariableCount = count;
+	vmSlotCount = slots;
+	vmVariables = (wicInt*) malloc((slots > 0 ? slots : 1) * sizeof(wicInt));
+	currentVm -> arrayCount = arrayCount;
+	currentVm -> arrays = (arrayType*) calloc(arrayCount > 0 ? arrayCount : 1, sizeof(arrayType));
+	if (vmVariables == NULL || currentVm -> arrays == NULL)
+		vmOutOfMemory("Out of memory creating an instance!\n");
+	memcpy(vmVariables, constants, slots * sizeof(wicInt));
+	initStack(depth);
+	currentVm -> engine = ENGINE_SWITCH;
+	currentVm -> quiet = 1;
+	currentVm -> noPrompts = 1;
+	currentVm -> overflowMode = OVERFLOW_TRAP;
+	currentVm -> overflowPc = -1;
+	currentVm -> getCallback = instanceGet;
+	currentVm -> putCallback = instancePut;
+	currentVm -> textCallback = instanceText;
+	currentVm -> callbackContext = instance;
+	useVm(previous);
+	vmCatchOutOfMemory(outer);
+	instance -> program = program;
+	instance -> status = -1;
+	return instance;
+}
+
+// Function: wicDestroyInstance
+// Description: Frees an instance. The program is left alone.
+// Params: Instance, or NULL.
+// Returns: None.
+// Modifies: None.
+void wicDestroyInstance(wicInstanceType* instance)
+{
+	vmType* previous;
+	if (instance == NULL)
+		return;
+	previous = useVm(&instance -> vm);
+	free(vmVariables);
+	releaseArrays();
+	free(vmStack.theStack);
+	free(currentVm -> outBuffer);
+	useVm(previous);
+	free(instance);
+}
+
+// Function: wicReset
+// Description: Puts an instance back to the start of its program, with every variable zero, every array empty, the stack
+//                empty and the bound arrays taken from and filled in from their start again. Bindings and callbacks stay.
+//                Much cheaper than a new instance, for running one program many times over.
+// Params: Instance.
+// Returns: None.
+// Modifies: Instance.
+void wicReset(wicInstanceType* instance)
+{
+	vmType* previous = useVm(&instance -> vm);
+	memset(vmVariables, 0, vmVariableCount * sizeof(wicInt));
+	if (currentVm -> arrayCount > 0)
+		emptyArrays();
+	vmStack.stackIndex = 0;
+	useVm(previous);
+	instance -> pc = 0;
+	instance -> status = -1;
+	instance -> executed = 0;
+	instance -> inTaken = 0;
+	instance -> outCount = 0;
+	instance -> messageLength = 0;
+	instance -> message[0] = '\0';
+}
+
+// Function: wicBindInput
+// Description: Gives 'get' an array of values to take, in order; after the last one it sees the end of the input. The array
+//                is not copied and must outlast the runs.
+// Params: Instance, values, how many there are.
+// Returns: None.
+// Modifies: Instance.
+void wicBindInput(wicInstanceType* instance, const wicInt* values, int count)
+{
+	instance -> inValues = values;
+	instance -> inCount = count;
+	instance -> inTaken = 0;
+}
+
+// Function: wicBindOutput
+// Description: Gives 'put' an array to store its values in, in order. Values past its capacity are counted but not stored
+//                (see wicOutputCount).
+// Params: Instance, array, how many values it holds.
+// Returns: None.
+// Modifies: Instance.
+void wicBindOutput(wicInstanceType* instance, wicInt* values, int capacity)
+{
+	instance -> outValues = values;
+	instance -> outCapacity = capacity;
+	instance -> outCount = 0;
+}
+
+// Function: wicSetCallbacks
+// Description: Has 'get' and 'put' call the embedder instead of using the bound arrays. Either may be NULL to go on using the
+//                array for that side.
+// Params: Instance, get callback, put callback, context passed to both.
+// Returns: None.
+// Modifies: Instance.
+void wicSetCallbacks(wicInstanceType* instance, wicGetCallbackType get, wicPutCallbackType put, void* context)
+{
+	instance -> get = get;
+	instance -> put = put;
+	instance -> context = context;
+}
+
+// Function: wicSetOverflowMode
+// Description: Picks what arithmetic does in this instance when a result does not fit (see setOverflowMode). Instances trap
+//                unless told otherwise; promotion is not available to them, as it cannot be budgeted.
+// Params: Instance, OVERFLOW_TRAP or OVERFLOW_WRAP.
+// Returns: 0 on success, -1 if the mode is not available.
+// Modifies: Instance.
+int wicSetOverflowMode(wicInstanceType* instance, overflowModeType mode)
+{
+	if (mode != OVERFLOW_TRAP && mode != OVERFLOW_WRAP)
+		return -1;
+	instance -> vm.overflowMode = mode;
+	return 0;
+}
+
+// Function: wicRun
+// Description: Runs an instance until its program halts, fails, blocks on input, or has run as many instructions as the
+//                budget allows. Out of budget, it stops in front of the next instruction, and blocked in front of the 'get',
+//                and the next run carries on from there.
+// Params: Instance, most instructions to run, 0 for no limit.
+// Returns: How the run ended. An instance that has halted or failed just reports so again until it is reset.
+// Modifies: Instance.
+wicStatusType wicRun(wicInstanceType* instance, long long budget)
+{
+	long long limit = budget > 0 ? budget : WIC_UNLIMITED;
+	wicStatusType status;
+	vmType* previous;
+	if (instance -> status >= 0)
+		return (wicStatusType) instance -> status;
+	previous = useVm(&instance -> vm);
+	currentVm -> budget = limit;
+	currentVm -> overflowPc = -1;
+	runBudgeted(instance -> pc);
+	instance -> pc = currentVm -> budgetPc;
+	instance -> executed += currentVm -> budget < 0 ? limit : limit - currentVm -> budget;
+	if (currentVm -> inputBlocked)
+	{
+		// The 'get' did not happen, so it is neither counted nor skipped.
+		currentVm -> inputBlocked = 0;
+		instance -> pc--;
+		instance -> executed--;
+		status = WIC_BLOCKED;
+	}
+	else if (currentVm -> budget < 0)
+		status = WIC_BUDGET;
+	else if (currentVm -> overflowPc >= 0)
+	{
+		vmPrintf("\nInteger overflow on line %d!\n", vmCodeTab.instructions[currentVm -> overflowPc].line);
+		status = WIC_ERROR;
+	}
+	else
+		status = vmCodeTab.instructions[instance -> pc].op == OP_HALT ? WIC_HALTED : WIC_ERROR;
+	vmFlush();
+	useVm(previous);
+	if (status == WIC_HALTED || status == WIC_ERROR)
+		instance -> status = status;
+	return status;
+}
+
+// Function: wicOutputCount
+// Description: Reports how many values 'put' has output since the instance was reset or its output array bound - more than
+//                the array holds if it overflowed.
+// Params: Instance.
+// Returns: Number of values.
+// Modifies: None.
+int wicOutputCount(wicInstanceType* instance)
+{
+	return instance -> outCount;
+}
+
+// Function: wicInstructionCount
+// Description: Reports how many instructions the instance has run since it was created or reset.
+// Params: Instance.
+// Returns: Instruction count.
+// Modifies: None.
+long long wicInstructionCount(wicInstanceType* instance)
+{
+	return instance -> executed;
+}
+
+// Function: wicGetVariable
+// Description: Reads one of an instance's variables by name.
+// Params: Instance, variable name, where to put its value.
+// Returns: 0 on success, -1 if the program has no such variable.
+// Modifies: Value.
+int wicGetVariable(wicInstanceType* instance, const char* name, wicInt* value)
+{
+	vmType* previous = useVm(&instance -> vm);
+	int slot = retrieve(&vmSymbolTable, (char*) name);
+	if (slot >= 0)
+		*value = vmVariables[slot];
+	useVm(previous);
+	return slot >= 0 ? 0 : -1;
+}
+
+// Function: wicSetVariable
+// Description: Sets one of an instance's variables by name, as an alternative to binding input for 'get'.
+// Params: Instance, variable name, value.
+// Returns: 0 on success, -1 if the program has no such variable.
+// Modifies: Instance.
+int wicSetVariable(wicInstanceType* instance, const char* name, wicInt value)
+{
+	vmType* previous = useVm(&instance -> vm);
+	int slot = retrieve(&vmSymbolTable, (char*) name);
+	if (slot >= 0)
+		vmVariables[slot] = value;
+	useVm(previous);
+	return slot >= 0 ? 0 : -1;
+}
+
+// Function: wicErrorMessage
+// Description: Reports why the instance's last run failed, as the interpreter would have printed it.
+// Params: Instance.
+// Returns: The message, "" if there was no error.
+// Modifies: Trims the instance's message.
+const char* wicErrorMessage(wicInstanceType* instance)
+{
+	return trimMessage(instance -> message, &instance -> messageLength);
+}
+
+// Function: wicLastError
+// Description: Reports why the last wicCompile or wicCreateInstance on the calling thread failed, as the interpreter would
+//                have printed it.
+// Params: None.
+// Returns: The message, "" if it worked.
+// Modifies: Trims the thread's compile message.
+const char* wicLastError()
+{
+	return trimMessage(compileMessage, &compileMessageLength);
+}
@@ -0,0 +1,64 @@
+#ifndef LIBWIC_H
+#define LIBWIC_H
+#include <stddef.h>
+#include "value.h"
+
+// libwic - the interpreter as a library, for running WIC programs inside another C or C++ program. A program is compiled
+// once into an immutable handle, which any number of instances then run, each with variables, a stack and inputs and
+// outputs of its own. Instances of one program may run on different threads at once; a single instance may not. Embedders
+// must build with the same WIC_INT64 setting as the library, since wicInt follows it.
+//
+//     wicProgramType* program = wicCompile(source, length, 3);      (NULL if it did not load - see wicLastError)
+//     wicInstanceType* instance = wicCreateInstance(program);      (NULL if out of memory - see wicLastError)
+//     wicBindInput(instance, inputs, 2);
+//     wicBindOutput(instance, outputs, 1);
+//     if (wicRun(instance, 0) == WIC_HALTED) ... outputs[0] ...
+//     wicReset(instance);      (and bind and run again, as often as needed)
+//     wicDestroyInstance(instance);
+//     wicFreeProgram(program);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct wicProgram wicProgramType;
+typedef struct wicInstance wicInstanceType;
+
+// How a run ended. An instance that is out of budget or blocked on input carries on from where it stopped when it is run
+// again; one that has halted or failed has to be reset first.
+typedef enum
+{
+	WIC_HALTED = 0,
+	WIC_BUDGET,
+	WIC_ERROR,
+	WIC_BLOCKED
+} wicStatusType;
+
+// Called for each 'get' with the variable's name; returns 0 with the value, -1 at the end of the input (the variable is
+// left alone), or 1 if the value is not there yet - the run then stops in front of the 'get' with WIC_BLOCKED, and the next
+// run asks again. Called for each 'put' with the variable's name and value.
+typedef int (*wicGetCallbackType)(void* context, const char* name, wicInt* value);
+typedef void (*wicPutCallbackType)(void* context, const char* name, wicInt value);
+
+wicProgramType* wicCompile(const char* source, size_t length, int optLevel);
+void wicFreeProgram(wicProgramType* program);
+wicInstanceType* wicCreateInstance(wicProgramType* program);
+void wicDestroyInstance(wicInstanceType* instance);
+void wicReset(wicInstanceType* instance);
+void wicBindInput(wicInstanceType* instance, const wicInt* values, int count);
+void wicBindOutput(wicInstanceType* instance, wicInt* values, int capacity);
+void wicSetCallbacks(wicInstanceType* instance, wicGetCallbackType get, wicPutCallbackType put, void* context);
+int wicSetOverflowMode(wicInstanceType* instance, overflowModeType mode);
+wicStatusType wicRun(wicInstanceType* instance, long long budget);
+int wicOutputCount(wicInstanceType* instance);
+long long wicInstructionCount(wicInstanceType* instance);
+int wicGetVariable(wicInstanceType* instance, const char* name, wicInt* value);
+int wicSetVariable(wicInstanceType* instance, const char* name, wicInt value);
+const char* wicErrorMessage(wicInstanceType* instance);
+const char* wicLastError();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,267 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "loader.h"
+#include "instructions.h"
+#include "table.h"
+#include "vm.h"
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Size of each read when the file cannot be mapped.
+#define LOADER_READ_CHUNK (1 << 20)
+
+// The current VM's copy of the source text (see keptSourceType).
+#define vmKeptEnabled (currentVm -> keptSource.keeping)
+#define vmKeptText (currentVm -> keptSource.text)
+#define vmKeptLines (currentVm -> keptSource.lines)
+#define vmKeptLineCount (currentVm -> keptSource.lineCount)
+#define vmKeptCapacity (currentVm -> keptSource.capacity)
+
+// Function: isWordEnd
+// Description: Checks whether a character ends a word of WIC source: whitespace, end of line, or the start of a '|' comment.
+// Params: Character.
+// Returns: 1 if the character ends a word, 0 otherwise.
+// Modifies: None.
+static int isWordEnd(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '|';
+}
+
+// Function: readWord
+// Description: Skips blanks and returns the next word on the current line, without copying it or modifying the text.
+// Params: Cursor into the text (advanced past the word), end of the line, where to put the word's length.
+// Returns: Start of the word. The length is 0 if the line has no more words.
+// Modifies: Cursor, length.
+static char* readWord(char** cursor, char* lineEnd, int* length)
+{
+	char* p = *cursor;
+	char* start;
+	while (p < lineEnd && (*p == ' ' || *p == '\t'))
+		p++;
+	start = p;
+	while (p < lineEnd && !isWordEnd(*p))
+		p++;
+	*length = (int) (p - start);
+	*cursor = p;
+	return start;
+}
+
+// Function: keepSource
+// Description: Asks the loader to keep a copy of the next program's source text, so it can be shown line by line later.
+// Params: 1 to keep the source, 0 not to.
+// Returns: None.
+// Modifies: Loader settings.
+void keepSource(int keep)
+{
+	vmKeptEnabled = keep;
+}
+
+// Function: sourceLine
+// Description: Looks up a line of the kept source text (see keepSource).
+// Params: Line number (the address of the instruction it holds), where to put the start of the text.
+// Returns: Length of the line without its line ending, or -1 if the source was not kept or there is no such line. The text
+//            is not '\0' terminated.
+// Modifies: Text.
+int sourceLine(int address, char** text)
+{
+	if (vmKeptText == NULL || address < 0 || address >= vmKeptLineCount)
+		return -1;
+	*text = vmKeptText + vmKeptLines[address].start;
+	return vmKeptLines[address].length;
+}
+
+// Function: keepLine
+// Description: Records where a line starts and ends in the kept source text.
+// Params: Line start and end (exclusive, without the newline), as offsets into the text.
+// Returns: None.
+// Modifies: Kept source lines.
+static void keepLine(int start, int end)
+{
+	if (vmKeptLineCount == vmKeptCapacity)
+	{
+		vmKeptCapacity = vmKeptCapacity < 1024 ? 1024 : vmKeptCapacity * 2;
+		vmKeptLines = (sourceLineType*) realloc(vmKeptLines, vmKeptCapacity * sizeof(sourceLineType));
+		if (vmKeptLines == NULL)
+			vmOutOfMemory("Out of memory keeping the program source!\n");
+	}
+	if (end > start && vmKeptText[end - 1] == '\r')
+		end--;
+	vmKeptLines[vmKeptLineCount].start = start;
+	vmKeptLines[vmKeptLineCount].length = end - start;
+	vmKeptLineCount++;
+}
+
+// Function: loadProgram
+// Description: Tokenizes WIC source in place, one line per instruction address, and passes each instruction off to be added to
+//                the instruction table. Words are handed over as pointers and lengths into the text, so nothing is copied
+//                per line and the text is never modified (it may be a read-only mapping).
+// Params: Source text, its length in bytes. The text does not need to be '\0' terminated.
+// Returns: 0 on success, -1 if a line does not decode to a valid WIC instruction.
+// Modifies: jumpTable, instTable, the kept source text.
+int loadProgram(char* text, size_t length)
+{
+	char* end = text + length;
+	char* line = text;
+	int address = 0;
+	free(vmKeptText);
+	vmKeptText = NULL;
+	vmKeptLineCount = 0;
+	if (vmKeptEnabled)
+	{
+		vmKeptText = (char*) malloc(length + 1);
+		if (vmKeptText == NULL)
+			vmOutOfMemory("Out of memory keeping the program source!\n");
+		memcpy(vmKeptText, text, length);
+	}
+	while (line < end)
+	{
+		char* lineEnd = (char*) memchr(line, '\n', end - line);
+		char* cursor = line;
+		char* op;
+		char* operand;
+		int opLength, operandLength;
+		int status;
+		if (lineEnd == NULL)
+			lineEnd = end;
+		if (vmKeptText != NULL)
+			keepLine((int) (line - text), (int) (lineEnd - text));
+		// Op = first word, Operand = the word after it. Anything after a '|' is a comment.
+		op = readWord(&cursor, lineEnd, &opLength);
+		operandLength = 0;
+		operand = cursor;
+		if (cursor < lineEnd && *cursor != '|')
+			operand = readWord(&cursor, lineEnd, &operandLength);
+		if (hasOperand(decodeOpcode(op, opLength)))
+		{
+			status = insertInstruction(address, op, opLength, operand, operandLength);
+		}
+		else if (operandLength == 5 && strncmp(operand, "label", 5) == 0)
+		{
+			status = insertInstruction(address, "label", 5, op, opLength);
+			// Insert the op (operand when we display) into the jumpTable
+			store(&vmJumpTable, address, internToken(op, opLength));
+		}
+		else if (opLength == 0)
+		{
+			// If there is nothing found on a line, address is a no-op, but shouldn't crash
+			status = insertInstruction(address, "nop", 3, "", 0);
+		}
+		else
+		{
+			status = insertInstruction(address, op, opLength, "", 0);
+		}
+		// Bad opcodes are caught here, before anything runs, rather than halfway through execution.
+		if (status == -1)
+		{
+			vmReport("Error on line %d: '%.*s' is not a WIC opcode!\n", address, opLength, op);
+			return -1;
+		}
+		else if (status == -2)
+		{
+			vmReport("Error on line %d: '%.*s' requires an operand!\n", address, opLength, op);
+			return -1;
+		}
+		else if (status == -3)
+		{
+			vmReport("Error on line %d: %.*s is too large a number!\n", address, operandLength, operand);
+			return -1;
+		}
+		address++;
+		line = lineEnd + 1;
+	}
+	return 0;
+}
+
+// Function: readWholeFile
+// Description: Reads the rest of a file into one buffer using large reads. Used when the file cannot be mapped (pipes, or
+//                platforms without mmap).
+// Params: File pointer, where to put the number of bytes read.
+// Returns: malloc'd buffer holding the file contents.
+// Modifies: Length.
+static char* readWholeFile(FILE* file, size_t* length)
+{
+	size_t capacity = LOADER_READ_CHUNK;
+	size_t used = 0;
+	size_t got;
+	char* buffer = (char*) malloc(capacity);
+	while (buffer != NULL && (got = fread(buffer + used, 1, capacity - used, file)) > 0)
+	{
+		used += got;
+		if (used == capacity)
+		{
+			char* grown = (char*) realloc(buffer, capacity * 2);
+			if (grown == NULL)
+				free(buffer);
+			buffer = grown;
+			capacity *= 2;
+		}
+	}
+	if (buffer == NULL)
+		vmOutOfMemory("Out of memory reading the program!\n");
+	*length = used;
+	return buffer;
+}
+
+// Function: readSource
+// Description: Gets the whole of a file into memory. Regular files are mapped read-only; anything else is read in large
+//                chunks. Either way the text stays valid until releaseSource.
+// Params: pointer to file (FILE* file), where to put the text.
+// Returns: None.
+// Modifies: Source.
+void readSource(FILE* file, sourceTextType* source)
+{
+#if !defined(_WIN32)
+	struct stat info;
+	if (fstat(fileno(file), &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+	{
+		source -> length = (size_t) info.st_size;
+		source -> text = (char*) mmap(NULL, source -> length, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+		if (source -> text != MAP_FAILED)
+		{
+			madvise(source -> text, source -> length, MADV_SEQUENTIAL);
+			source -> mapped = 1;
+			return;
+		}
+	}
+#endif
+	source -> text = readWholeFile(file, &source -> length);
+	source -> mapped = 0;
+}
+
+// Function: releaseSource
+// Description: Unmaps or frees text from readSource. Does nothing to a source that holds no text.
+// Params: Source.
+// Returns: None.
+// Modifies: Source.
+void releaseSource(sourceTextType* source)
+{
+#if !defined(_WIN32)
+	if (source -> mapped)
+		munmap(source -> text, source -> length);
+	else
+#endif
+		free(source -> text);
+	source -> text = NULL;
+	source -> length = 0;
+	source -> mapped = 0;
+}
+
+// Function: loadFile
+// Description: Loads the WIC program in the passed in file. Regular files are mapped into memory and tokenized straight out of
+//                the mapping; anything else is read in large chunks first.
+// Params: pointer to file (FILE* file)
+// Returns: 0 on success, -1 if a line does not decode to a valid WIC instruction.
+// Modifies: jumpTable, instTable.
+int loadFile(FILE* file)
+{
+	sourceTextType source;
+	int status;
+	readSource(file, &source);
+	status = loadProgram(source.text, source.length);
+	releaseSource(&source);
+	return status;
+}
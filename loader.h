@@ -0,0 +1,39 @@
+#ifndef LOADER_H
+#define LOADER_H
+#include <stdio.h>
+#include <stddef.h>
+
+// Where a line starts in the kept source text, and its length without the newline.
+typedef struct
+{
+	int start;
+	int length;
+} sourceLineType;
+
+// A whole file in memory (see readSource): mapped read-only where possible, otherwise read into a malloc'd buffer.
+typedef struct
+{
+	char* text;
+	size_t length;
+	int mapped;
+} sourceTextType;
+
+// Copy of the source text and where each line starts in it, kept for the profiler's report when keepSource asks for it.
+typedef struct
+{
+	int keeping;
+	char* text;
+	sourceLineType* lines;
+	int lineCount;
+	int capacity;
+} keptSourceType;
+
+// Program loading - turns WIC source text into the instruction and jump tables.
+int loadFile(FILE* file);
+void readSource(FILE* file, sourceTextType* source);
+void releaseSource(sourceTextType* source);
+int loadProgram(char* text, size_t length);
+void keepSource(int keep);
+int sourceLine(int address, char** text);
+
+#endif
@@ -0,0 +1,745 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include "lockstep.h"
+#include "instructions.h"
+#include "vm.h"
+
+// Instances run side by side, one per lane. Every value is held for all the lanes together - LOCKSTEP_LANES wicInts in a
+// row - and each instruction is a loop over the lanes with no branches in it, which the compiler turns into vector
+// instructions: with AVX2, two vectors of 32 bit values or four of 64 bit ones.
+#define LOCKSTEP_LANES 16
+// Lanes whose instance has stopped are only given new instances once this many are idle, so the new ones start together
+// and stay together, rather than each running its way to the main loop alone.
+#define LOCKSTEP_REFILL (LOCKSTEP_LANES / 4)
+// Address of a lane with no instance. It is never the lowest, so the lane never runs.
+#define LANE_IDLE INT_MAX
+// Size the input file's line buffer starts at. It grows to fit longer lines.
+#define LOCKSTEP_LINE 65536
+
+// Runs the statement after it for every lane, with l the lane.
+#define EACH_LANE for (l = 0; l < LOCKSTEP_LANES; l++)
+// Lane-wise select: x where the mask is all ones, y where it is all zeros.
+#define BLEND(mask, x, y) (((x) & (mask)) | ((y) & ~(mask)))
+// All ones if the condition holds, otherwise all zeros.
+#define ALL(cond) (-(wicInt) (cond))
+// Every lane's value of a variable slot.
+#define SLOT(s) (lanes -> vars + (s) * LOCKSTEP_LANES)
+
+// How an instance stopped, and its name in the output file.
+typedef enum
+{
+	LANE_HALTED,
+	LANE_OVERFLOWED,
+	LANE_DIVIDED_BY_ZERO
+} laneStatusType;
+static const char* statusNames[3] = {"halt", "overflow", "divzero"};
+
+// Names of the engines, for the report.
+static const char* engineNames[6] = {"switch", "threaded", "jit", "register", "profile", "trace"};
+
+// The instances - their input, one per row of the input file, and their results.
+typedef struct
+{
+	// Value c of instance i is columns[c * instanceCount + i], for the first counts[i] columns. The gets an instance runs
+	// take its values in order.
+	wicInt* columns;
+	int* counts;
+	int columnCount;
+	int instanceCount;
+	// Variables of instance i once it stopped, from results[i * variableCount], and how it stopped.
+	wicInt* results;
+	unsigned char* status;
+} lockstepDataType;
+
+// The lanes and where each one has got to.
+typedef struct
+{
+	// Slot s of lane l is vars[s * LOCKSTEP_LANES + l], stack entry d of lane l is stack[d * LOCKSTEP_LANES + l].
+	wicInt* vars;
+	wicInt* stack;
+	// Address each lane is at, the instance it is running (-1 when idle) and the next input column its get takes.
+	int pcs[LOCKSTEP_LANES];
+	int instance[LOCKSTEP_LANES];
+	int column[LOCKSTEP_LANES];
+	int idle;
+	// Scratch for pickAddress: how many lanes are at each address. All zero in between.
+	int* waiting;
+	// Next instance to start.
+	int next;
+	// Instructions run, and the lanes that ran them.
+	long long steps;
+	long long laneSteps;
+} lanesType;
+
+// Function: readRow
+// Description: Reads the next line of the input file, however long it is, growing the line buffer until it fits.
+// Params: File, its name, line buffer (may be moved), its size.
+// Returns: 0, or -1 at the end of the file.
+// Modifies: Line buffer, its size.
+static int readRow(FILE* file, char* name, char** line, int* size)
+{
+	int length = 0;
+	for (;;)
+	{
+		char* grown;
+		if (fgets(*line + length, *size - length, file) == NULL)
+			return length > 0 ? 0 : -1;
+		length += (int) strlen(*line + length);
+		// Stopped short of a full buffer: the line ended, or the file did.
+		if ((*line)[length - 1] == '\n' || length < *size - 1)
+			return 0;
+		grown = (char*) realloc(*line, (size_t) *size * 2);
+		if (grown == NULL)
+		{
+			printf("Out of memory reading %s!\n", name);
+			exit(5);
+		}
+		*line = grown;
+		*size *= 2;
+	}
+}
+
+// Function: readInstances
+// Description: Reads the input file: one row per instance, holding the values its gets take, in order, separated by spaces,
+//                tabs or commas. Blank lines and lines starting with '#' (a header naming the columns, say) are skipped. A
+//                row may be shorter than the others; its instance then runs out of input early, as 'get' does at the end of
+//                a file.
+// Params: File name, instances to fill in.
+// Returns: 0 on success, -1 if the file could not be read.
+// Modifies: Instances.
+static int readInstances(char* name, lockstepDataType* data)
+{
+	FILE* file = fopen(name, "r");
+	char* line = (char*) malloc(LOCKSTEP_LINE);
+	wicInt* rows = NULL;
+	int* starts = NULL;
+	int used = 0, capacity = 0, rowCapacity = 0;
+	int lineSize = LOCKSTEP_LINE;
+	int lineNumber = 0;
+	int i, c;
+	memset(data, 0, sizeof(*data));
+	if (file == NULL || line == NULL)
+	{
+		printf("The input file %s could not be opened!\n", name);
+		free(line);
+		return -1;
+	}
+	while (readRow(file, name, &line, &lineSize) == 0)
+	{
+		char* p = line;
+		int count = 0;
+		lineNumber++;
+		while (isspace((unsigned char) *p))
+			p++;
+		if (*p == '\0' || *p == '#')
+			continue;
+		if (data -> instanceCount + 1 >= rowCapacity)
+		{
+			int* grownStarts;
+			rowCapacity = rowCapacity > 0 ? rowCapacity * 2 : 1024;
+			grownStarts = (int*) realloc(starts, (rowCapacity + 1) * sizeof(int));
+			if (grownStarts == NULL)
+			{
+				printf("Out of memory reading %s!\n", name);
+				exit(5);
+			}
+			starts = grownStarts;
+		}
+		starts[data -> instanceCount] = used;
+		while (*p != '\0')
+		{
+			char* end;
+			long long value;
+			while (isspace((unsigned char) *p) || *p == ',')
+				p++;
+			if (*p == '\0')
+				break;
+			value = strtoll(p, &end, 10);
+			if (end == p)
+			{
+				printf("Error in %s on line %d: '%.20s' is not a number!\n", name, lineNumber, p);
+				fclose(file);
+				free(line);
+				free(rows);
+				free(starts);
+				return -1;
+			}
+			if (used == capacity)
+			{
+				wicInt* grownRows;
+				capacity = capacity > 0 ? capacity * 2 : 4096;
+				grownRows = (wicInt*) realloc(rows, capacity * sizeof(wicInt));
+				if (grownRows == NULL)
+				{
+					printf("Out of memory reading %s!\n", name);
+					exit(5);
+				}
+				rows = grownRows;
+			}
+			rows[used++] = value < WIC_INT_MIN ? WIC_INT_MIN : value > WIC_INT_MAX ? WIC_INT_MAX : (wicInt) value;
+			count++;
+			p = end;
+		}
+		if (count > data -> columnCount)
+			data -> columnCount = count;
+		data -> instanceCount++;
+	}
+	fclose(file);
+	free(line);
+	if (starts != NULL)
+		starts[data -> instanceCount] = used;
+
+	// Turn the rows into columns.
+	data -> columns = (wicInt*) calloc((size_t) data -> columnCount * data -> instanceCount + 1, sizeof(wicInt));
+	data -> counts = (int*) malloc((data -> instanceCount + 1) * sizeof(int));
+	data -> results = (wicInt*) calloc((size_t) data -> instanceCount * vmVariableCount + 1, sizeof(wicInt));
+	data -> status = (unsigned char*) calloc(data -> instanceCount + 1, 1);
+	if (data -> columns == NULL || data -> counts == NULL || data -> results == NULL || data -> status == NULL)
+	{
+		printf("Out of memory reading %s!\n", name);
+		exit(5);
+	}
+	for (i = 0; i < data -> instanceCount; i++)
+	{
+		data -> counts[i] = starts[i + 1] - starts[i];
+		for (c = 0; c < data -> counts[i]; c++)
+			data -> columns[(size_t) c * data -> instanceCount + i] = rows[starts[i] + c];
+	}
+	free(rows);
+	free(starts);
+	return 0;
+}
+
+// Function: writeResults
+// Description: Writes the results the same way the input is read: a '#' header naming the columns, then one row per
+//                instance, in input order, with the value of every variable and how the instance stopped.
+// Params: Output file, instances.
+// Returns: None.
+// Modifies: Output file.
+static void writeResults(FILE* out, lockstepDataType* data)
+{
+	char** names = (char**) calloc(vmVariableCount + 1, sizeof(char*));
+	int i, s;
+	for (i = 0; i < vmSymbolTable.size; i++)
+		names[vmSymbolTable.entries[i].value] = vmSymbolTable.entries[i].key;
+	fprintf(out, "#");
+	for (s = 0; s < vmVariableCount; s++)
+		fprintf(out, " %s", names[s]);
+	fprintf(out, " status\n");
+	for (i = 0; i < data -> instanceCount; i++)
+	{
+		wicInt* result = data -> results + (size_t) i * vmVariableCount;
+		for (s = 0; s < vmVariableCount; s++)
+			fprintf(out, WIC_INT_FORMAT " ", result[s]);
+		fprintf(out, "%s\n", statusNames[data -> status[i]]);
+	}
+	free(names);
+}
+
+// Function: startLane
+// Description: Starts the next instance in an idle lane, from address 0 with every variable zero.
+// Params: Lanes, lane.
+// Returns: None.
+// Modifies: Lanes.
+static void startLane(lanesType* lanes, int l)
+{
+	int s;
+	for (s = 0; s < vmVariableCount; s++)
+		lanes -> vars[s * LOCKSTEP_LANES + l] = 0;
+	lanes -> instance[l] = lanes -> next++;
+	lanes -> column[l] = 0;
+	lanes -> pcs[l] = 0;
+	lanes -> idle--;
+}
+
+// Function: refillLanes
+// Description: Starts new instances in the idle lanes once there are enough of them (LOCKSTEP_REFILL) - as many as there are
+//                lanes for, or instances left.
+// Params: Lanes, instances.
+// Returns: None.
+// Modifies: Lanes.
+static void refillLanes(lanesType* lanes, lockstepDataType* data)
+{
+	int l;
+	if (lanes -> idle < LOCKSTEP_REFILL)
+		return;
+	for (l = 0; l < LOCKSTEP_LANES && lanes -> next < data -> instanceCount; l++)
+		if (lanes -> instance[l] < 0)
+			startLane(lanes, l);
+}
+
+// Function: stopLanes
+// Description: Stops the instances in the lanes a mask picks out, keeping their variables as their results, and refills.
+// Params: Lanes, instances, mask (all ones for the lanes to stop), how they stopped.
+// Returns: 1 if any lane stopped, otherwise 0.
+// Modifies: Lanes, instances.
+static int stopLanes(lanesType* lanes, lockstepDataType* data, wicInt* mask, laneStatusType status)
+{
+	int l, s;
+	wicInt any = 0;
+	EACH_LANE
+		any |= mask[l];
+	if (any == 0)
+		return 0;
+	EACH_LANE
+	{
+		int instance = lanes -> instance[l];
+		if (mask[l] == 0)
+			continue;
+		for (s = 0; s < vmVariableCount; s++)
+			data -> results[(size_t) instance * vmVariableCount + s] = lanes -> vars[s * LOCKSTEP_LANES + l];
+		data -> status[instance] = (unsigned char) status;
+		lanes -> instance[l] = -1;
+		lanes -> pcs[l] = LANE_IDLE;
+		lanes -> idle++;
+	}
+	refillLanes(lanes, data);
+	return 1;
+}
+
+// Function: pickAddress
+// Description: Picks the address to run next when the lanes have gone their separate ways: the one most lanes are at, and
+//                of those the lowest.
+// Params: Lanes.
+// Returns: Address, or LANE_IDLE if every lane is idle.
+// Modifies: None.
+static int pickAddress(lanesType* lanes)
+{
+	int pc = LANE_IDLE;
+	int most = 0;
+	int l;
+	EACH_LANE
+		if (lanes -> pcs[l] != LANE_IDLE)
+			lanes -> waiting[lanes -> pcs[l]]++;
+	EACH_LANE
+	{
+		int at = lanes -> pcs[l];
+		if (at != LANE_IDLE && (lanes -> waiting[at] > most || (lanes -> waiting[at] == most && at < pc)))
+		{
+			most = lanes -> waiting[at];
+			pc = at;
+		}
+	}
+	EACH_LANE
+		if (lanes -> pcs[l] != LANE_IDLE)
+			lanes -> waiting[lanes -> pcs[l]] = 0;
+	return pc;
+}
+
+// Lanes that ran the instruction move on to the next one.
+#define NEXT() EACH_LANE lanes -> pcs[l] = on[l] ? pc + 1 : lanes -> pcs[l]
+// Lanes that ran the instruction jump to the target where cond holds, and move on to the next one elsewhere. If they all
+// went the same way they carry on together; otherwise the next address has to be picked.
+#define BRANCH(cond) \
+	taken = 0; \
+	EACH_LANE \
+	{ \
+		go[l] = on[l] & ~stop[l] & ALL(cond); \
+		taken -= (int) go[l]; \
+		lanes -> pcs[l] = on[l] & ~stop[l] ? (go[l] ? target : pc + 1) : lanes -> pcs[l]; \
+	} \
+	next = taken == 0 ? pc + 1 : taken == active ? target : -1
+// Wrapped result of x op y in r, and in stop the lanes that ran the instruction where it overflowed, unless wrapping. The
+// add and sub checks are written out rather than left to the compiler builtins, which do not vectorize.
+#define LANE_ADD(x, y) \
+	r[l] = (wicInt) ((wicUnsigned) (x) + (wicUnsigned) (y)); \
+	stop[l] = on[l] & trap & ALL((((x) ^ r[l]) & ((y) ^ r[l])) < 0)
+#define LANE_SUB(x, y) \
+	r[l] = (wicInt) ((wicUnsigned) (x) - (wicUnsigned) (y)); \
+	stop[l] = on[l] & trap & ALL((((x) ^ (y)) & ((x) ^ r[l])) < 0)
+#define LANE_MULT(x, y) stop[l] = on[l] & trap & ALL(MULT_OVERFLOWS(x, y, &r[l]))
+// add, sub, mult on the top two stack entries, and addv, subv, multv on variable slots. The results go through r so the
+// loops still vectorize when the destination is one of the operands (as in 'n = n - m').
+#define STACK_ARITHMETIC(operation) \
+	EACH_LANE \
+	{ \
+		operation(top[l - LOCKSTEP_LANES], top[l]); \
+	} \
+	EACH_LANE \
+		top[l - LOCKSTEP_LANES] = BLEND(on[l] & ~stop[l], r[l], top[l - LOCKSTEP_LANES]); \
+	NEXT(); \
+	checked = 1
+#define SLOT_ARITHMETIC(operation) \
+	x = SLOT(inst -> a); \
+	y = SLOT(inst -> b); \
+	EACH_LANE \
+	{ \
+		operation(x[l], y[l]); \
+	} \
+	x = SLOT(inst -> arg.slot); \
+	EACH_LANE \
+		x[l] = BLEND(on[l] & ~stop[l], r[l], x[l]); \
+	NEXT(); \
+	checked = 1
+// jfeq..jfge: the sub is checked like any other, and the lanes where it did not overflow branch on its result.
+#define JFCMP(cmp) \
+	x = SLOT(inst -> a); \
+	y = SLOT(inst -> b); \
+	target = inst -> arg.target; \
+	EACH_LANE \
+	{ \
+		LANE_SUB(x[l], y[l]); \
+	} \
+	BRANCH(!(r[l] cmp 0)); \
+	checked = 1
+// not, tsteq..tstge: the top entry becomes 1 where it passes the test against zero, otherwise 0.
+#define LANE_TEST(cond) \
+	EACH_LANE \
+		top[l] = BLEND(on[l], (wicInt) (cond), top[l]); \
+	NEXT()
+
+// Function: runLanes
+// Description: Runs every instance to the end on the lanes. Each step runs one instruction for every lane at one address,
+//                masking off the rest. The lanes running carry on together, picking up any lanes waiting where they get to,
+//                until a branch splits them or some stop; then the address most lanes are at runs next (see pickAddress).
+//                Lanes that branch apart come back together that way: the smaller group waits while the larger one runs, and
+//                the lanes merge again wherever their paths meet. Since the stack depth at an address is static, every lane
+//                running an instruction has its stack at the same depth.
+// Params: Lanes, instances.
+// Returns: None.
+// Modifies: Lanes, instances.
+static void runLanes(lanesType* lanes, lockstepDataType* data)
+{
+	wicInt on[LOCKSTEP_LANES];
+	wicInt stop[LOCKSTEP_LANES];
+	wicInt go[LOCKSTEP_LANES];
+	wicInt r[LOCKSTEP_LANES];
+	wicInt trap = ALL(currentVm -> overflowMode != OVERFLOW_WRAP);
+	int pc = -1;
+	int active = 0;
+	int together = 0;
+	int l;
+	refillLanes(lanes, data);
+	for (;;)
+	{
+		instructionType* inst;
+		wicInt* top;
+		wicInt* x;
+		wicInt* y;
+		wicInt immediate;
+		int target;
+		int checked = 0;
+		int taken;
+		int next;
+		if (pc < 0)
+		{
+			pc = pickAddress(lanes);
+			together = 0;
+		}
+		if (pc == LANE_IDLE)
+			break;
+		if (!together)
+		{
+			active = 0;
+			EACH_LANE
+			{
+				on[l] = ALL(lanes -> pcs[l] == pc);
+				active -= (int) on[l];
+			}
+			// With every busy lane running there are none left to pick up, so the mask holds until they split or stop.
+			together = active == LOCKSTEP_LANES - lanes -> idle;
+		}
+		EACH_LANE
+			stop[l] = 0;
+		next = pc + 1;
+		lanes -> steps++;
+		lanes -> laneSteps += active;
+		inst = &vmCodeTab.instructions[pc];
+		top = lanes -> stack + vmCodeTab.depths[pc] * LOCKSTEP_LANES;
+		switch (inst -> op)
+		{
+		case OP_GET:
+			x = SLOT(inst -> arg.slot);
+			EACH_LANE
+				if (on[l] && lanes -> column[l] < data -> counts[lanes -> instance[l]])
+					x[l] = data -> columns[(size_t) lanes -> column[l]++ * data -> instanceCount + lanes -> instance[l]];
+			NEXT();
+			break;
+		case OP_HALT:
+			stopLanes(lanes, data, on, LANE_HALTED);
+			next = -1;
+			break;
+		case OP_PUSH:
+			x = SLOT(inst -> arg.slot);
+			EACH_LANE
+				top[l + LOCKSTEP_LANES] = BLEND(on[l], x[l], top[l + LOCKSTEP_LANES]);
+			NEXT();
+			break;
+		case OP_PUSHI:
+			immediate = inst -> arg.immediate;
+			EACH_LANE
+				top[l + LOCKSTEP_LANES] = BLEND(on[l], immediate, top[l + LOCKSTEP_LANES]);
+			NEXT();
+			break;
+		case OP_POP:
+			x = SLOT(inst -> arg.slot);
+			EACH_LANE
+				x[l] = BLEND(on[l], top[l], x[l]);
+			NEXT();
+			break;
+		case OP_ADD:
+			STACK_ARITHMETIC(LANE_ADD);
+			break;
+		case OP_SUB:
+			STACK_ARITHMETIC(LANE_SUB);
+			break;
+		case OP_MULT:
+			STACK_ARITHMETIC(LANE_MULT);
+			break;
+		case OP_DIV:
+			// There is no vector divide, so this one goes a lane at a time.
+			EACH_LANE
+			{
+				wicInt* dividend = &top[l - LOCKSTEP_LANES];
+				r[l] = on[l] & ALL(top[l] == 0);
+				stop[l] = on[l] & ~r[l] & trap & ALL(DIV_OVERFLOWS(*dividend, top[l]));
+				if (on[l] && !r[l] && !stop[l])
+					*dividend = WRAPPED_DIV(*dividend, top[l]);
+			}
+			NEXT();
+			if (stopLanes(lanes, data, r, LANE_DIVIDED_BY_ZERO))
+				next = -1;
+			checked = 1;
+			break;
+		case OP_AND:
+			EACH_LANE
+				top[l - LOCKSTEP_LANES] = BLEND(on[l], (wicInt) (top[l] > 0 && top[l - LOCKSTEP_LANES] > 0),
+					top[l - LOCKSTEP_LANES]);
+			NEXT();
+			break;
+		case OP_OR:
+			EACH_LANE
+				top[l - LOCKSTEP_LANES] = BLEND(on[l], (wicInt) (top[l] != 0 || top[l - LOCKSTEP_LANES] != 0),
+					top[l - LOCKSTEP_LANES]);
+			NEXT();
+			break;
+		case OP_NOT:
+		case OP_TSTEQ:
+			LANE_TEST(top[l] == 0);
+			break;
+		case OP_TSTNE:
+			LANE_TEST(top[l] != 0);
+			break;
+		case OP_TSTLT:
+			LANE_TEST(top[l] < 0);
+			break;
+		case OP_TSTLE:
+			LANE_TEST(top[l] <= 0);
+			break;
+		case OP_TSTGT:
+			LANE_TEST(top[l] > 0);
+			break;
+		case OP_TSTGE:
+			LANE_TEST(top[l] >= 0);
+			break;
+		case OP_J:
+			target = inst -> arg.target;
+			EACH_LANE
+				lanes -> pcs[l] = on[l] ? target : lanes -> pcs[l];
+			next = target;
+			break;
+		case OP_JF:
+			target = inst -> arg.target;
+			BRANCH(top[l] == 0);
+			break;
+		case OP_MOVE:
+			x = SLOT(inst -> a);
+			y = SLOT(inst -> arg.slot);
+			EACH_LANE
+				y[l] = BLEND(on[l], x[l], y[l]);
+			NEXT();
+			break;
+		case OP_ADDV:
+			SLOT_ARITHMETIC(LANE_ADD);
+			break;
+		case OP_SUBV:
+			SLOT_ARITHMETIC(LANE_SUB);
+			break;
+		case OP_MULTV:
+			SLOT_ARITHMETIC(LANE_MULT);
+			break;
+		case OP_JFEQ:
+			JFCMP(==);
+			break;
+		case OP_JFNE:
+			JFCMP(!=);
+			break;
+		case OP_JFLT:
+			JFCMP(<);
+			break;
+		case OP_JFLE:
+			JFCMP(<=);
+			break;
+		case OP_JFGT:
+			JFCMP(>);
+			break;
+		case OP_JFGE:
+			JFCMP(>=);
+			break;
+		case OP_PUT:
+		case OP_LABEL:
+		case OP_NOP:
+			// Instances print nothing - their results are their variables.
+			NEXT();
+			break;
+		default:
+			// Running off the end restarts the program, as it does in the engines.
+			EACH_LANE
+				lanes -> pcs[l] = on[l] ? 0 : lanes -> pcs[l];
+			next = 0;
+			break;
+		}
+		if (checked && stopLanes(lanes, data, stop, LANE_OVERFLOWED))
+			next = -1;
+		pc = next;
+	}
+}
+
+#undef NEXT
+#undef BRANCH
+#undef LANE_ADD
+#undef LANE_SUB
+#undef LANE_MULT
+#undef STACK_ARITHMETIC
+#undef SLOT_ARITHMETIC
+#undef JFCMP
+#undef LANE_TEST
+
+// Function: runScalar
+// Description: Runs every instance one after another on the selected engine, for comparison, quietly and with the
+//                program's output thrown away.
+// Params: Instances, where to put each one's variables once it has stopped.
+// Returns: Seconds taken.
+// Modifies: Results, variables, stack.
+static double runScalar(lockstepDataType* data, wicInt* results)
+{
+	wicInt* row = (wicInt*) malloc((data -> columnCount + 1) * sizeof(wicInt));
+	FILE* sink = tmpfile();
+	FILE* input = currentVm -> input;
+	FILE* output = currentVm -> output;
+	double t0;
+	int i, c;
+	setVmFiles(NULL, sink);
+	setQuiet(1);
+	setPrompts(0);
+	t0 = wallSeconds();
+	for (i = 0; i < data -> instanceCount; i++)
+	{
+		for (c = 0; c < data -> counts[i]; c++)
+			row[c] = data -> columns[(size_t) c * data -> instanceCount + i];
+		memset(vmVariables, 0, vmVariableCount * sizeof(wicInt));
+		vmStack.stackIndex = 0;
+		setInputValues(row, data -> counts[i]);
+		runEngine();
+		memcpy(results + (size_t) i * vmVariableCount, vmVariables, vmVariableCount * sizeof(wicInt));
+	}
+	t0 = wallSeconds() - t0;
+	setInputValues(NULL, 0);
+	setVmFiles(input, output);
+	if (sink != NULL)
+		fclose(sink);
+	free(row);
+	return t0;
+}
+
+// Function: runLockstep
+// Description: Runs the loaded program once per row of an input file, LOCKSTEP_LANES instances at a time in lockstep (see
+//                runLanes), and writes each instance's final variables to the output file. Every instance is then run again
+//                on the selected engine, and the two are compared for speed and results. 'put' prints nothing. Promoting
+//                overflow is treated as trapping - lanes cannot hold anything wider than a wicInt.
+// Params: Input file name, output file name ("-" for stdout, NULL for none).
+// Returns: 0 on success, 2 if a file could not be opened, 3 if the program cannot run in lockstep (its stack depth is not
+//            static, or it has task or array instructions).
+// Modifies: Variables, stack.
+int runLockstep(char* inputName, char* outputName)
+{
+	lockstepDataType data;
+	lanesType lanes;
+	wicInt* scalarResults;
+	double lockstepSeconds, scalarSeconds;
+	int differ = 0;
+	int i, s, l;
+	if (vmCodeTab.maxDepth < 0)
+	{
+		printf("The program's stack depth is not static, so it cannot run in lockstep!\n");
+		return 3;
+	}
+	if (taskInstruction() >= 0)
+	{
+		printf("The program has task instructions, so it cannot run in lockstep!\n");
+		return 3;
+	}
+	if (arrayInstruction() >= 0)
+	{
+		printf("The program has array instructions, so it cannot run in lockstep!\n");
+		return 3;
+	}
+	if (readInstances(inputName, &data) != 0)
+		return 2;
+	if (currentVm -> overflowMode == OVERFLOW_PROMOTE)
+		setOverflowMode(OVERFLOW_TRAP);
+
+	memset(&lanes, 0, sizeof(lanes));
+	lanes.vars = (wicInt*) malloc(((size_t) vmSlotCount + 1) * LOCKSTEP_LANES * sizeof(wicInt));
+	lanes.stack = (wicInt*) calloc((size_t) vmCodeTab.maxDepth + 2, LOCKSTEP_LANES * sizeof(wicInt));
+	lanes.waiting = (int*) calloc(vmCodeTab.instructionCount + 1, sizeof(int));
+	scalarResults = (wicInt*) malloc(((size_t) data.instanceCount * vmVariableCount + 1) * sizeof(wicInt));
+	if (lanes.vars == NULL || lanes.stack == NULL || lanes.waiting == NULL || scalarResults == NULL)
+	{
+		printf("Out of memory starting the lanes!\n");
+		exit(5);
+	}
+	for (s = vmVariableCount; s < vmSlotCount; s++)
+		EACH_LANE
+			lanes.vars[s * LOCKSTEP_LANES + l] = vmVariables[s];
+	EACH_LANE
+	{
+		lanes.pcs[l] = LANE_IDLE;
+		lanes.instance[l] = -1;
+	}
+	lanes.idle = LOCKSTEP_LANES;
+
+	lockstepSeconds = wallSeconds();
+	runLanes(&lanes, &data);
+	lockstepSeconds = wallSeconds() - lockstepSeconds;
+	scalarSeconds = runScalar(&data, scalarResults);
+	for (i = 0; i < data.instanceCount; i++)
+		differ += memcmp(data.results + (size_t) i * vmVariableCount, scalarResults + (size_t) i * vmVariableCount,
+			vmVariableCount * sizeof(wicInt)) != 0;
+
+	if (outputName != NULL)
+	{
+		FILE* out = strcmp(outputName, "-") == 0 ? stdout : fopen(outputName, "w");
+		if (out == NULL)
+		{
+			printf("Could not write %s!\n", outputName);
+			exit(2);
+		}
+		writeResults(out, &data);
+		if (out != stdout)
+			fclose(out);
+	}
+	printf("\nLockstep: %d instances on %d lanes, %.1f%% of lanes busy\n", data.instanceCount, LOCKSTEP_LANES,
+		lanes.steps > 0 ? 100.0 * lanes.laneSteps / ((double) lanes.steps * LOCKSTEP_LANES) : 0.0);
+	printf("%-10s %12s %14s\n", "Engine", "Seconds", "Instances/s");
+	printf("%-10s %12f %14.0f\n", "lockstep", lockstepSeconds,
+		lockstepSeconds > 0 ? data.instanceCount / lockstepSeconds : 0.0);
+	printf("%-10s %12f %14.0f\n", engineNames[currentEngine()], scalarSeconds,
+		scalarSeconds > 0 ? data.instanceCount / scalarSeconds : 0.0);
+	printf("Speedup: %.2fx\n", lockstepSeconds > 0 ? scalarSeconds / lockstepSeconds : 0.0);
+	if (differ > 0)
+		printf("%d instances finished with different variables on the two engines!\n", differ);
+
+	free(lanes.vars);
+	free(lanes.stack);
+	free(lanes.waiting);
+	free(scalarResults);
+	free(data.columns);
+	free(data.counts);
+	free(data.results);
+	free(data.status);
+	return 0;
+}
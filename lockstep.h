@@ -0,0 +1,7 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+// Lockstep engine - runs one program over many sets of 'get' input at once, each instance in a vector lane (see lockstep.c).
+int runLockstep(char* inputName, char* outputName);
+
+#endif
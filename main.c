@@ -1,144 +1,416 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include "instructions.h"
 #include "stack.h"
 #include "table.h"
+#include "bench.h"
+#include "loader.h"
+#include "optimizer.h"
+#include "wicc.h"
+#include "regvm.h"
+#include "batch.h"
+#include "vm.h"
+#include "cache.h"
+#include "dataflow.h"
+#include "lockstep.h"
+#include "checkpoint.h"
+#include "green.h"
+#include "tasks.h"
+#include "array.h"
+#include "daemon.h"
 
-FILE* getFile(char* extension, char* input);
-void getInstFromFile(FILE* file);
-void printPreProcessed();
-char* discardLine(char * line);
+char* getFile(int quiet);
+FILE* openProgram(char* fileName);
+void printPreProcessed(int optLevel);
+void emitProgram(char* fileName);
 
 // Function: Main program fucntion
 // Description: Macro-level control function for the WIC interpreter.
-// Params: None
+// Params: Command line arguments. 'PROGRAM.wic' names the program to run; without it the program is asked for.
+//           '--input=FILE' reads the values for 'get' from a file rather than stdin;
+//           '--quiet' leaves out the banner, the listing of the program and the 'get' prompts;
+//           '--cache' loads the program from its bytecode cache (PROGRAM.wicb, see cache.c), building it first if it is
+//           missing or out of date;
+//           '--array=NAME=FILE' (any number of times) starts the program's array NAME off with the values in FILE, mapped
+//           rather than read where possible (see array.c);
+//           '--engine=switch' (default), 'threaded', 'jit', 'register' or 'trace' picks the execution engine;
+//           '--opt-level=N' (0-3, default 3) picks how hard the optimizer works on the program before it runs;
+//           '--overflow=trap' (default), 'wrap' or 'promote' picks what arithmetic does when a result does not fit (see
+//           setOverflowMode);
+//           '--profile' runs on the profiling engine and reports per-instruction counts and time after the program halts;
+//           '--checkpoint=FILE[,N]' writes the program's state to FILE every N instructions, and on SIGUSR1, or on SIGINT or
+//           SIGTERM and stops (see checkpoint.c); '--resume=FILE' carries on from such a checkpoint;
+//           '--emit-c=FILE' writes the program out as C (see wicc.c) instead of running it;
+//           '--lockstep=INPUT[,OUTPUT]' runs the program once per row of INPUT, many at a time in lockstep (see
+//           lockstep.c), writes their results to OUTPUT ('-' for stdout) and compares the speed with the selected engine;
+//           '--bench-table', '--bench-load' and '--bench-cache' run the symbol table, loader and bytecode cache startup
+//           benchmarks instead of a program, '--bench-embed' the cost of a run through the library (see libwic.c),
+//           '--bench-arrays' the bulk array instructions against the equivalent WIC loops,
+//           '--bench-suite[=csv|json]' runs the scaling benchmark suite on every engine, and
+//           '--batch' runs every program named after it at once on a pool of threads (see batch.c), each as 'file.wic' or
+//           'file.wic,input' to read its 'get' values from a file; '--batch-threads=N' (default one per processor),
+//           '--batch-repeat=N' and '--batch-scale' (throughput on 1, 2, 4... threads) must come before it;
+//           '--green' runs every program named after it together on this thread as green threads (see green.c), each as
+//           'file.wic', 'file.wic,input' or 'file.wic,@' to read the 'put' values of the program before it;
+//           '--green-quantum=N' (instructions per turn) and '--green-repeat=N' must come before it;
+//           '--task-threads=N' (default one per processor) picks how many threads a program with task instructions runs
+//           on (see tasks.c), and '--task-scale' times it on 1, 2, 4... threads instead of running it once;
+//           '--daemon=SOCKET' serves programs sent to a Unix domain socket until stopped, keeping them compiled between runs
+//           (see daemon.c); '--daemon-threads=N' (default one per processor), '--daemon-cache=N' (programs kept, default
+//           64) and '--daemon-budget=N' (instructions a request may run, default 1000000000) must come before it;
+//           '--load=SOCKET,PROGRAM.wic[,INPUT]' times a daemon running the program over and over, reporting requests per
+//           second and latency percentiles; '--load-clients=N' (default one per processor) and '--load-requests=N'
+//           (default 1000) must come before it.
 // Returns: 0 upon successful completion.
 // Modifies: None.
-int main()
+int main(int argc, char* argv[])
 {
-    // Char pointer passed into function, otherwise local variable allocation on the stack gets messed
-	// up by the various outside function calls - strtok, strcmp, printf, etc. Could make them const, extern, or m/calloc -
-	// but this is easier.
-	char* a;
-	char* b;
-	FILE* file = getFile(a, b);
+	FILE* file;
+	char* programName = NULL;
+	int useCache = 0;
+	FILE* input = NULL;
+	int quiet = 0;
+	int i;
+	int optLevel = OPT_LEVEL_MAX;
+	char* emitName = NULL;
+	char* lockstepName = NULL;
+	char* lockstepOutput = NULL;
+	char* resumeName = NULL;
+	int batchThreads = 0;
+	int batchRepeat = 1;
+	int batchScale = 0;
+	long long greenQuantum = 0;
+	int greenRepeat = 1;
+	int taskScale = 0;
+	int daemonThreads = 0;
+	int daemonCache = 64;
+	long long daemonBudget = 0;
+	int loadClients = 0;
+	int loadRequests = 1000;
+	// Each '--array=' argument, split into the array's name and its file.
+	char** arrayFiles = (char**) calloc(argc, sizeof(char*));
+	int arrayFileCount = 0;
+	if (arrayFiles == NULL)
+	{
+		printf("Out of memory reading the options!\n");
+		exit(5);
+	}
+	for (i = 1; i < argc; i++)
+	{
+		if (strncmp(argv[i], "--engine=", 9) == 0 && engineFromName(argv[i] + 9) >= 0)
+		{
+			setEngine((engineType) engineFromName(argv[i] + 9));
+		}
+		else if (strncmp(argv[i], "--opt-level=", 12) == 0 && argv[i][12] >= '0' && argv[i][12] <= '0' + OPT_LEVEL_MAX
+			&& argv[i][13] == '\0')
+		{
+			optLevel = argv[i][12] - '0';
+		}
+		else if (strncmp(argv[i], "--overflow=", 11) == 0 && overflowModeFromName(argv[i] + 11) >= 0)
+		{
+			setOverflowMode((overflowModeType) overflowModeFromName(argv[i] + 11));
+		}
+		else if (strcmp(argv[i], "--profile") == 0)
+		{
+			setEngine(ENGINE_PROFILE);
+			keepSource(1);
+		}
+		else if (strncmp(argv[i], "--checkpoint=", 13) == 0 && argv[i][13] != '\0')
+		{
+			char* interval = strchr(argv[i] + 13, ',');
+			if (interval != NULL)
+				*interval++ = '\0';
+			setCheckpoint(argv[i] + 13, interval != NULL ? strtoll(interval, NULL, 10) : 0);
+		}
+		else if (strncmp(argv[i], "--resume=", 9) == 0 && argv[i][9] != '\0')
+		{
+			resumeName = argv[i] + 9;
+		}
+		else if (strncmp(argv[i], "--emit-c=", 9) == 0 && argv[i][9] != '\0')
+		{
+			emitName = argv[i] + 9;
+		}
+		else if (strncmp(argv[i], "--lockstep=", 11) == 0 && argv[i][11] != '\0')
+		{
+			lockstepName = argv[i] + 11;
+			lockstepOutput = strchr(lockstepName, ',');
+			if (lockstepOutput != NULL)
+				*lockstepOutput++ = '\0';
+		}
+		else if (strcmp(argv[i], "--bench-table") == 0)
+		{
+			benchTable();
+			return 0;
+		}
+		else if (strcmp(argv[i], "--bench-load") == 0)
+		{
+			benchLoad();
+			return 0;
+		}
+		else if (strcmp(argv[i], "--bench-cache") == 0)
+		{
+			benchCache();
+			return 0;
+		}
+		else if (strcmp(argv[i], "--bench-embed") == 0)
+		{
+			benchEmbed();
+			return 0;
+		}
+		else if (strcmp(argv[i], "--bench-arrays") == 0)
+		{
+			benchArrays();
+			return 0;
+		}
+		else if (strcmp(argv[i], "--bench-suite") == 0 || strcmp(argv[i], "--bench-suite=csv") == 0
+			|| strcmp(argv[i], "--bench-suite=json") == 0)
+		{
+			benchSuite(strcmp(argv[i], "--bench-suite=json") == 0);
+			return 0;
+		}
+		else if (strncmp(argv[i], "--batch-threads=", 16) == 0 && atoi(argv[i] + 16) > 0)
+		{
+			batchThreads = atoi(argv[i] + 16);
+		}
+		else if (strncmp(argv[i], "--batch-repeat=", 15) == 0 && atoi(argv[i] + 15) > 0)
+		{
+			batchRepeat = atoi(argv[i] + 15);
+		}
+		else if (strcmp(argv[i], "--batch-scale") == 0)
+		{
+			batchScale = 1;
+		}
+		else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+		{
+			return runBatch(argv + i + 1, argc - i - 1, batchThreads, batchRepeat, batchScale, optLevel);
+		}
+		else if (strncmp(argv[i], "--green-quantum=", 16) == 0 && atoll(argv[i] + 16) > 0)
+		{
+			greenQuantum = atoll(argv[i] + 16);
+		}
+		else if (strncmp(argv[i], "--green-repeat=", 15) == 0 && atoi(argv[i] + 15) > 0)
+		{
+			greenRepeat = atoi(argv[i] + 15);
+		}
+		else if (strcmp(argv[i], "--green") == 0 && i + 1 < argc)
+		{
+			return runGreen(argv + i + 1, argc - i - 1, greenQuantum, greenRepeat, optLevel);
+		}
+		else if (strncmp(argv[i], "--daemon-threads=", 17) == 0 && atoi(argv[i] + 17) > 0)
+		{
+			daemonThreads = atoi(argv[i] + 17);
+		}
+		else if (strncmp(argv[i], "--daemon-cache=", 15) == 0 && atoi(argv[i] + 15) > 0)
+		{
+			daemonCache = atoi(argv[i] + 15);
+		}
+		else if (strncmp(argv[i], "--daemon-budget=", 16) == 0 && atoll(argv[i] + 16) > 0)
+		{
+			daemonBudget = atoll(argv[i] + 16);
+		}
+		else if (strncmp(argv[i], "--daemon=", 9) == 0 && argv[i][9] != '\0')
+		{
+			return runDaemon(argv[i] + 9, daemonThreads, daemonCache, daemonBudget, optLevel);
+		}
+		else if (strncmp(argv[i], "--load-clients=", 15) == 0 && atoi(argv[i] + 15) > 0)
+		{
+			loadClients = atoi(argv[i] + 15);
+		}
+		else if (strncmp(argv[i], "--load-requests=", 16) == 0 && atoi(argv[i] + 16) > 0)
+		{
+			loadRequests = atoi(argv[i] + 16);
+		}
+		else if (strncmp(argv[i], "--load=", 7) == 0 && strchr(argv[i] + 7, ',') != NULL)
+		{
+			return runLoad(argv[i] + 7, loadClients, loadRequests);
+		}
+		else if (strncmp(argv[i], "--task-threads=", 15) == 0 && atoi(argv[i] + 15) > 0)
+		{
+			setTaskThreads(atoi(argv[i] + 15));
+		}
+		else if (strcmp(argv[i], "--task-scale") == 0)
+		{
+			taskScale = 1;
+		}
+		else if (strcmp(argv[i], "--quiet") == 0)
+		{
+			quiet = 1;
+		}
+		else if (strncmp(argv[i], "--input=", 8) == 0 && argv[i][8] != '\0' && input == NULL)
+		{
+			input = strcmp(argv[i] + 8, "-") == 0 ? stdin : fopen(argv[i] + 8, "r");
+			if (input == NULL)
+			{
+				printf("The input file %s could not be opened!\n", argv[i] + 8);
+				exit(2);
+			}
+		}
+		else if (strcmp(argv[i], "--cache") == 0)
+		{
+			useCache = 1;
+		}
+		else if (strncmp(argv[i], "--array=", 8) == 0 && strchr(argv[i] + 8, '=') != NULL && argv[i][8] != '=')
+		{
+			arrayFiles[arrayFileCount++] = argv[i] + 8;
+		}
+		else if (strncmp(argv[i], "--", 2) != 0 && programName == NULL)
+		{
+			programName = argv[i];
+		}
+		else
+		{
+			printf("Usage: %s [options] [PROGRAM.wic] [--input=FILE|-] [--quiet] [--cache]\n", argv[0]);
+			printf("Options: [--engine=switch|threaded|jit|register|trace] [--opt-level=0|1|2|3] [--overflow=trap|wrap|promote] [--profile] [--checkpoint=FILE[,N]] [--resume=FILE] [--emit-c=FILE] [--lockstep=INPUT[,OUTPUT]] [--bench-table] [--bench-load] [--bench-cache] [--bench-embed] [--bench-arrays] [--bench-suite[=csv|json]] [--task-threads=N] [--task-scale] [--array=NAME=FILE]...\n");
+			printf("       %s [--engine=...] [--opt-level=...] [--overflow=...] [--batch-threads=N] [--batch-repeat=N] [--batch-scale] --batch PROGRAM.wic[,INPUT]...\n", argv[0]);
+			printf("       %s [--opt-level=...] [--overflow=trap|wrap] [--green-quantum=N] [--green-repeat=N] --green PROGRAM.wic[,INPUT|,@]...\n", argv[0]);
+			printf("       %s [--opt-level=...] [--overflow=trap|wrap] [--daemon-threads=N] [--daemon-cache=N] [--daemon-budget=N] --daemon=SOCKET\n", argv[0]);
+			printf("       %s [--load-clients=N] [--load-requests=N] --load=SOCKET,PROGRAM.wic[,INPUT]\n", argv[0]);
+			exit(4);
+		}
+	}
+	if (programName == NULL)
+		programName = getFile(quiet);
+	file = openProgram(programName);
+	// 'get' reads from the input file, and prompts only when someone is there to see them
+	setVmFiles(input, NULL);
+	setPrompts(!quiet);
 	// Initialize tables.
 	initialize();
-	// Open file, parse WIC code
-	getInstFromFile(file);
+	// Map the up to date bytecode cache if asked to, otherwise parse the WIC code and turn labels and variable names into
+	// addresses and slots - and cache the result for next time.
+	if (!useCache || loadProgramCache(programName, file) != 0)
+	{
+		if (loadFile(file) != 0 || resolveProgram() != 0)
+			exit(3);
+		if (useCache)
+			saveProgramCache(programName, file);
+	}
+	fclose(file);
+	// Give arrays their starting values
+	for (i = 0; i < arrayFileCount; i++)
+	{
+		char* fileName = strchr(arrayFiles[i], '=');
+		int status;
+		*fileName++ = '\0';
+		status = mapArrayFile(arrayFiles[i], fileName);
+		if (status != 0)
+			exit(status);
+	}
+	free(arrayFiles);
+	// Build the program the engines actually run
+	optimizeProgram(optLevel);
+	// Translate to C rather than run
+	if (emitName != NULL)
+	{
+		emitProgram(emitName);
+		return 0;
+	}
+	// Run it over every row of the lockstep input rather than once
+	if (lockstepName != NULL)
+		return runLockstep(lockstepName, lockstepOutput);
+	// Time it on more and more task threads rather than run it once
+	if (taskScale)
+		return runTaskScale(currentVm -> taskThreads);
+	// Carry on from a checkpoint rather than from the start
+	if (resumeName != NULL)
+		resumeCheckpoint(resumeName);
 	// Print out after pre-processing
-	printPreProcessed();
+	if (!quiet)
+		printPreProcessed(optLevel);
 	// Run the WIC code
 	runInterpreter();
 	return 0;
 }
 
 // Function: PrintPreProcessed - prints the pre-processed WIC.
-// Description: Calls functions in instructions.c to print the Instruction table as well as the jump/symbol
-//                tables afterwards.
-// Params: None
+// Description: Calls functions in instructions.c to print the Instruction table, followed by the optimized program
+//                if the optimizer changed it, and the register code when the register VM will run it.
+// Params: Optimization level the program was built with.
 // Returns: None
 // Modifies: None
-void printPreProcessed()
+void printPreProcessed(int optLevel)
 {
 	printInstTable();
+	if (optLevel >= 3)
+		printFoldReport();
+	if (optLevel > 0)
+		printCodeTable();
+	if (currentEngine() == ENGINE_REGISTER && translateRegisters() >= 0)
+		printRegisterCode();
 }
 
-// Function: getInstFromFile
-// Description: Opens the passed in file pointer, captures each line of WIC commands and passes the corresponding
-//                instruction off to be added to the instruction table.
-// Params: pointer to file (FILE* file)
-// Returns: None.
-// Modifies: jumpTable, instTable
-void getInstFromFile(FILE* file)
+// Function: emitProgram
+// Description: Writes the optimized program out as a standalone C program, to be built with the system C compiler. Programs
+//                with task instructions cannot be, as they need the task runtime, and nor can programs with array
+//                instructions.
+// Params: Name of the C file to write.
+// Returns: None
+// Modifies: None
+void emitProgram(char* fileName)
 {
-	static char* op;
-	static char* operand;
-	char currentLine[120];
-	int address = 0;
-	while (fgets(currentLine, 120, file) != NULL)
+	FILE* out;
+	if (taskInstruction() >= 0)
 	{
-		// Make sure to reset the op/operand strings on every newline
-		op = "";
-		operand = "";
-		// Op = first word before ' ' 
-		op = strtok(currentLine, " ");
-		op = discardLine(op);
-		// Operand = word after ' '
-		operand = strtok(NULL, " ");
-		// If operand doesn't exist, don't pass in NULL
-		if (operand == NULL)
-		{
-			operand = "";
-		}
-		if (hasOperand(op) == 1)
-		{
-			operand = discardLine(operand);
-			insertInstruction(address, op, operand);
-		}
-		// Strncmp must be used rather than strcmp to avoid buffer overflow errors
-		else if (strncmp(operand, "label", 5) == 0)
-		{
-			insertInstruction(address, "label", op);
-			// Insert the op (operand when we display) into the jumpTable
-			store(&jumpTable, address, op);
-		}
-		else if (strcmp(op, "") == 0)
-		{
-			// If there is nothing found on a line, address is a no-op, but shouldn't crash
-			insertInstruction(address, "nop", op);
-		}
-		else
-		{
-			operand = "";
-			insertInstruction(address, op, operand);
-		}
-		address++;
+		printf("The program has task instructions, so it cannot be written out as C!\n");
+		exit(3);
 	}
-	fflush(file);
+	if (arrayInstruction() >= 0)
+	{
+		printf("The program has array instructions, so it cannot be written out as C!\n");
+		exit(3);
+	}
+	out = fopen(fileName, "w");
+	if (out == NULL)
+	{
+		printf("Could not write %s!\n", fileName);
+		exit(2);
+	}
+	transpileProgram(out);
+	fclose(out);
+	printf("Wrote %s\n", fileName);
 }
 
-// Function: discardLine
-// Description: trims the inputted code line down, removing unnecessary comments and whitespace.
-// Params: String line (char* line)
-// Returns: String line (char* line) - after trimming
+// Function: getFile
+// Description: Prompts for the name of the .wic file to interpret, when none was given on the command line.
+// Params: 1 to leave out the banner.
+// Returns: The name entered.
 // Modifies: None
-char* discardLine(char * line)
+char* getFile(int quiet)
 {
-	// No need for interpreted code to display end of line comments, etc.
-	// So get rid of it and also trim out the useless whitespace.
-	int length = strlen(line);
-	int i = 0;
-	while (i < length && line[i] != ' ' && line[i] != '\n' && line[i] != '|')
+	static char fileName[FILENAME_MAX];
+	size_t length;
+	if (!quiet)
 	{
-		line[i] = line[i];
-		i++;
+		printf("***     Welcome to Michael Kepple's WREN Interpreter    ***\n");
+		printf("*** Please enter the name of the .wic file to interpret ***\n");
 	}
-	line[i] = '\0';
-	return line;
+	printf("> ");
+	fflush(stdout);
+	if (fgets(fileName, sizeof(fileName), stdin) == NULL)
+	{
+		printf("No file name was entered!\n");
+		exit(1);
+	}
+	// Drop the newline, and any other trailing white space
+	length = strlen(fileName);
+	while (length > 0 && isspace((unsigned char) fileName[length - 1]))
+		fileName[--length] = '\0';
+	return fileName;
 }
 
-// Function: getFile
-// Description: prompts for user input, tests for correct '.wic' extension, attempts to open file and establish file pointer.
-// Params: Two empty string inputs for modifying.
-// Returns: File pointer to user-inputted file (FILE* file)
-// Modifies: Two passed in strings
-FILE* getFile(char* extension, char* input)
+// Function: openProgram
+// Description: Tests for the correct '.wic' extension and attempts to open the file.
+// Params: Name of the file.
+// Returns: File pointer to the program.
+// Modifies: None
+FILE* openProgram(char* fileName)
 {
 	FILE *file;
-	// Need to malloc fileName memory so it also doesn't get wiped during all the coming outside function calls.
-	char* fileName = (char*) malloc(sizeof(char) * 30);
-	printf("***     Welcome to Michael Kepple's WREN Interpreter    ***\n");
-	printf("*** Please enter the name of the .wic file to interpret ***\n");
-	printf("> ");
-	scanf("%s", input); 
-	// Copy user input over to the allocated char* string to use later
-	memcpy(fileName, input, sizeof(char) * 30);
-	input = strtok(input, ".");
-	extension = strtok(NULL, ".");
+	char* extension = strrchr(fileName, '.');
 	// Check to ensure extension is .wic
-	if (strcmp(extension, "wic") != 0)
+	if (extension == NULL || strcmp(extension, ".wic") != 0)
 	{
 		printf("You have entered an invalid filename - WIC files must end in '.wic'!\n");
 		exit(1);
@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "optimizer.h"
+#include "instructions.h"
+#include "table.h"
+#include "dataflow.h"
+
+// Longest run of source instructions a single superinstruction replaces.
+#define MAX_PATTERN 5
+
+// Function: gather
+// Description: Collects the addresses of the next few instructions starting at an address, skipping nops. Stops early at a
+//                label, since a jump could land there and nothing after it may be fused with what came before.
+// Params: Program being optimized, starting address, how many instructions to collect, where to put their addresses.
+// Returns: Number of addresses collected.
+// Modifies: Addresses.
+static int gather(instructionType* source, int address, int wanted, int* addresses)
+{
+	int found = 0;
+	while (found < wanted && address < vmInstTab.instructionCount)
+	{
+		opcodeType op = source[address].op;
+		if (op == OP_LABEL && found > 0)
+			break;
+		if (op != OP_NOP && op != OP_LABEL)
+			addresses[found++] = address;
+		address++;
+	}
+	return found;
+}
+
+// Function: pushedSlot
+// Description: Gives the slot whose value a 'push' puts on the stack - the variable's slot, or a constant slot for an immediate.
+// Params: Program being optimized, address of a push instruction.
+// Returns: Slot, or -1 if the instruction is not a push.
+// Modifies: variables (may add a constant slot).
+static int pushedSlot(instructionType* source, int address)
+{
+	instructionType* inst = &source[address];
+	if (inst -> op == OP_PUSH)
+		return inst -> arg.slot;
+	if (inst -> op == OP_PUSHI)
+		return constantSlot(inst -> arg.immediate);
+	return -1;
+}
+
+// Function: isPush
+// Description: Checks whether the instruction at an address pushes a variable or an immediate.
+// Params: Program being optimized, address.
+// Returns: 1 if it is a push, 0 otherwise.
+// Modifies: None.
+static int isPush(instructionType* source, int address)
+{
+	return source[address].op == OP_PUSH || source[address].op == OP_PUSHI;
+}
+
+// Function: fuse
+// Description: Tries to replace the instructions starting at an address with a single superinstruction. Recognised idioms:
+//                  push a; push b; sub; tstXX; jf L    ->  jfXX a, b, L
+//                  push a; tstXX; jf L                 ->  jfXX a, 0, L
+//                  push a; push b; add|sub|mult; pop c ->  addv|subv|multv a, b, c
+//                  push a; pop c                       ->  move a, c
+//                A superinstruction takes the line of the operation in it that can fail (the add, sub or mult), so a
+//                runtime error reports the same line at every optimization level.
+// Params: Program being optimized, starting address, where to put the superinstruction.
+// Returns: Address of the last source instruction replaced, or -1 if nothing matched.
+// Modifies: Superinstruction.
+static int fuse(instructionType* source, int address, instructionType* super)
+{
+	int at[MAX_PATTERN];
+	int n = gather(source, address, MAX_PATTERN, at);
+	opcodeType op[MAX_PATTERN];
+	int i;
+	for (i = 0; i < n; i++)
+		op[i] = source[at[i]].op;
+	*super = source[address];
+	if (n < 2 || !isPush(source, at[0]))
+		return -1;
+	if (n >= 5 && isPush(source, at[1]) && op[2] == OP_SUB && op[3] >= OP_TSTEQ && op[3] <= OP_TSTGE && op[4] == OP_JF)
+	{
+		super -> op = (opcodeType) (OP_JFEQ + (op[3] - OP_TSTEQ));
+		super -> a = pushedSlot(source, at[0]);
+		super -> b = pushedSlot(source, at[1]);
+		super -> arg.target = source[at[4]].arg.target;
+		super -> operand = source[at[4]].operand;
+		super -> line = source[at[2]].line;
+		return at[4];
+	}
+	if (n >= 3 && op[1] >= OP_TSTEQ && op[1] <= OP_TSTGE && op[2] == OP_JF)
+	{
+		super -> op = (opcodeType) (OP_JFEQ + (op[1] - OP_TSTEQ));
+		super -> a = pushedSlot(source, at[0]);
+		super -> b = constantSlot(0);
+		super -> arg.target = source[at[2]].arg.target;
+		super -> operand = source[at[2]].operand;
+		return at[2];
+	}
+	if (n >= 4 && isPush(source, at[1]) && (op[2] == OP_ADD || op[2] == OP_SUB || op[2] == OP_MULT) && op[3] == OP_POP)
+	{
+		super -> op = op[2] == OP_ADD ? OP_ADDV : op[2] == OP_SUB ? OP_SUBV : OP_MULTV;
+		super -> a = pushedSlot(source, at[0]);
+		super -> b = pushedSlot(source, at[1]);
+		super -> arg.slot = source[at[3]].arg.slot;
+		super -> operand = source[at[3]].operand;
+		super -> line = source[at[2]].line;
+		return at[3];
+	}
+	if (op[1] == OP_POP)
+	{
+		super -> op = OP_MOVE;
+		super -> a = pushedSlot(source, at[0]);
+		super -> arg.slot = source[at[1]].arg.slot;
+		super -> operand = source[at[1]].operand;
+		return at[1];
+	}
+	return -1;
+}
+
+// Function: isBranch
+// Description: Checks whether an opcode carries a jump target ('spawn' carries the address its task starts at).
+// Params: Opcode.
+// Returns: 1 if it jumps, 0 otherwise.
+// Modifies: None.
+static int isBranch(opcodeType op)
+{
+	return op == OP_J || op == OP_JF || op == OP_SPAWN || (op >= OP_JFEQ && op <= OP_JFGE);
+}
+
+// Function: buildCode
+// Description: Does optimizeProgram's work on buffers it has allocated: folds the copy of the loaded program at level 3,
+//                then builds the executed program from it and remaps the jump targets.
+// Params: Optimization level, program to build from (the loaded one, or a copy of it at level 3), where to build the
+//           executed program, where to put each source address's new address.
+// Returns: Number of instructions in the executed program.
+// Modifies: Source (at level 3), code, new addresses, variables (constant slots).
+static int buildCode(int level, instructionType* source, instructionType* code, int* newAddress)
+{
+	int count = vmInstTab.instructionCount;
+	int codeCount = 0;
+	int i;
+	if (level >= 3)
+	{
+		memcpy(source, vmInstTab.instructions, (count + 1) * sizeof(instructionType));
+		foldProgram(source);
+	}
+	i = 0;
+	while (i < count)
+	{
+		instructionType* inst = &source[i];
+		int last = -1;
+		if (inst -> op == OP_LABEL || inst -> op == OP_NOP)
+		{
+			newAddress[i++] = codeCount;
+			continue;
+		}
+		if (level >= 2)
+			last = fuse(source, i, &code[codeCount]);
+		if (last < 0)
+		{
+			code[codeCount] = *inst;
+			last = i;
+		}
+		for (; i <= last; i++)
+			newAddress[i] = codeCount;
+		codeCount++;
+	}
+	newAddress[count] = codeCount;
+	for (i = 0; i < codeCount; i++)
+	{
+		if (isBranch(code[i].op))
+			code[i].arg.target = newAddress[code[i].arg.target];
+	}
+	return codeCount;
+}
+
+// Function: optimizeProgram
+// Description: Optimization pass between loading and execution. Builds the executed program from the loaded one:
+//                level 0 - run the program exactly as loaded.
+//                level 1 - drop 'label' and 'nop' entries, which do nothing but cost a dispatch.
+//                level 2 - also fuse the common WIC idioms into superinstructions (see fuse).
+//                level 3 - first fold constants and remove unreachable code (see foldProgram), then as level 2.
+//                Jump targets are remapped onto the new addresses, and every executed instruction keeps the address of the
+//                source line it came from for error messages.
+// Params: Optimization level.
+// Returns: None.
+// Modifies: codeTab, variables (constant slots).
+void optimizeProgram(int level)
+{
+	int count = vmInstTab.instructionCount;
+	// Address in the executed program that each source address ends up at. Dropped entries map to whatever follows them.
+	int* newAddress;
+	// Program the executed one is built from: the loaded program, or a folded copy of it at level 3.
+	instructionType* source;
+	instructionType* code;
+	int codeCount;
+	vmRecoveryType recovery;
+	vmRecoveryType* outer;
+	if (level <= 0)
+	{
+		setCode(NULL, 0);
+		return;
+	}
+	newAddress = (int*) malloc((count + 1) * sizeof(int));
+	code = (instructionType*) malloc((count + 1) * sizeof(instructionType));
+	source = level >= 3 ? (instructionType*) malloc((count + 1) * sizeof(instructionType)) : vmInstTab.instructions;
+	if (newAddress == NULL || code == NULL || source == NULL)
+	{
+		free(newAddress);
+		free(code);
+		free(source != vmInstTab.instructions ? source : NULL);
+		vmOutOfMemory("Out of memory optimizing the program!\n");
+	}
+	// Folding and the constants the superinstructions take can run out of memory too; the buffers go before that is
+	// passed on.
+	outer = vmCatchOutOfMemory(&recovery);
+	if (setjmp(recovery.target) != 0)
+	{
+		vmCatchOutOfMemory(outer);
+		free(newAddress);
+		free(code);
+		free(source != vmInstTab.instructions ? source : NULL);
+		vmOutOfMemory("%s", recovery.message);
+	}
+	codeCount = buildCode(level, source, code, newAddress);
+	vmCatchOutOfMemory(outer);
+	if (source != vmInstTab.instructions)
+		free(source);
+	free(newAddress);
+	setCode(code, codeCount);
+}
+
+// Function: printSlot
+// Description: Prints a variable slot by name, or by value if it is a constant slot.
+// Params: Slot.
+// Returns: None.
+// Modifies: None.
+static void printSlot(int slot)
+{
+	if (slot < vmVariableCount)
+		printf("%s", vmSymbolTable.entries[slot].key);
+	else
+		printf(WIC_INT_FORMAT, vmVariables[slot]);
+}
+
+// Function: printCodeTable
+// Description: Prints the executed program, in the same style as printInstTable. Number in parentheses is the address of
+//                the instruction, followed by the opcode, its operands, and the source line it came from.
+// Params: None.
+// Returns: None.
+// Modifies: None.
+void printCodeTable()
+{
+	int i;
+	printf("Optimized program (%d instructions from %d lines):\n", vmCodeTab.instructionCount, vmInstTab.instructionCount);
+	for (i = 0; i < vmCodeTab.instructionCount; i++)
+	{
+		instructionType* inst = &vmCodeTab.instructions[i];
+		printf("(%d) %s (", i, opcodeName(inst -> op));
+		switch (inst -> op)
+		{
+		case OP_MOVE:
+			printSlot(inst -> a);
+			printf(" -> %s", inst -> operand);
+			break;
+		case OP_ADDV:
+		case OP_SUBV:
+		case OP_MULTV:
+			printSlot(inst -> a);
+			printf(", ");
+			printSlot(inst -> b);
+			printf(" -> %s", inst -> operand);
+			break;
+		case OP_JFEQ:
+		case OP_JFNE:
+		case OP_JFLT:
+		case OP_JFLE:
+		case OP_JFGT:
+		case OP_JFGE:
+			printSlot(inst -> a);
+			printf(", ");
+			printSlot(inst -> b);
+			printf(" -> %s @%d", inst -> operand, inst -> arg.target);
+			break;
+		case OP_J:
+		case OP_JF:
+		case OP_SPAWN:
+			printf("%s @%d", inst -> operand, inst -> arg.target);
+			break;
+		case OP_PUSHI:
+			printf(WIC_INT_FORMAT, inst -> arg.immediate);
+			break;
+		default:
+			printf("%s", inst -> operand);
+			break;
+		}
+		printf(") [line %d]\n", inst -> line);
+	}
+	printf("\n");
+}
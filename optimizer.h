@@ -0,0 +1,11 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+// Highest optimization level, and the one used unless the command line says otherwise.
+#define OPT_LEVEL_MAX 3
+
+// Peephole optimizer, with a dataflow pass in front of it at the highest level (see dataflow.h) - builds the executed program (codeTab) from the loaded one (instTab).
+void optimizeProgram(int level);
+void printCodeTable();
+
+#endif
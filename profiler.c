@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "engine.h"
+#include "profiler.h"
+#include "loader.h"
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define PROFILE_TSC 1
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define PROFILE_TSC 1
+#endif
+
+// Number of instructions listed as hot spots.
+#define PROFILE_HOT_SPOTS 5
+
+// The current VM's counters (see profileType).
+#define vmProfile (currentVm -> profiler.entries)
+#define vmProfileSize (currentVm -> profiler.size)
+#define vmLastPc (currentVm -> profiler.lastPc)
+#define vmLastStamp (currentVm -> profiler.lastStamp)
+#define vmExecuted (currentVm -> profiler.executed)
+
+// Function: readCycles
+// Description: Reads the CPU time stamp counter, or a nanosecond clock where there is none.
+// Params: None.
+// Returns: Current count.
+// Modifies: None.
+static unsigned long long readCycles()
+{
+#if defined(PROFILE_TSC)
+	return __rdtsc();
+#elif !defined(_WIN32)
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (unsigned long long) t.tv_sec * 1000000000ULL + t.tv_nsec;
+#else
+	return (unsigned long long) clock();
+#endif
+}
+
+// Function: profileStart
+// Description: Clears the counters for a new run of codeTab.
+// Params: None.
+// Returns: None.
+// Modifies: Profile.
+static void profileStart()
+{
+	free(vmProfile);
+	vmProfileSize = vmCodeTab.instructionCount + 1;
+	vmProfile = (profileEntry*) calloc(vmProfileSize, sizeof(profileEntry));
+	if (vmProfile == NULL)
+	{
+		printf("Out of memory profiling!\n");
+		exit(5);
+	}
+	vmLastPc = -1;
+	vmExecuted = 0;
+}
+
+// Function: profileStep
+// Description: Hook run before each instruction. Charges the time since the last step to the previous instruction, records
+//                which way it went if it was a conditional jump, and counts the new one.
+// Params: Address about to run.
+// Returns: None.
+// Modifies: Profile.
+static void profileStep(int pc)
+{
+	unsigned long long now = readCycles();
+	if (vmLastPc >= 0)
+	{
+		instructionType* last = &vmCodeTab.instructions[vmLastPc];
+		vmProfile[vmLastPc].cycles += now - vmLastStamp;
+		if (last -> op == OP_JF || (last -> op >= OP_JFEQ && last -> op <= OP_JFGE))
+		{
+			if (pc == last -> arg.target)
+				vmProfile[vmLastPc].taken++;
+			else
+				vmProfile[vmLastPc].notTaken++;
+		}
+	}
+	vmProfile[pc].count++;
+	vmExecuted++;
+	vmLastPc = pc;
+	// Read the clock again so the bookkeeping above is not charged to the instruction.
+	vmLastStamp = readCycles();
+}
+
+// Function: profileDone
+// Description: Hook run when the engine stops - charges the last instruction.
+// Params: None.
+// Returns: None.
+// Modifies: Profile.
+static void profileDone()
+{
+	if (vmLastPc >= 0)
+		vmProfile[vmLastPc].cycles += readCycles() - vmLastStamp;
+}
+
+// The switch engine, with the profiling hooks.
+#define SWITCH_ENGINE static void runProfiledEngine
+#define SWITCH_STEP() profileStep(pc)
+#define SWITCH_BRANCH()
+#define SWITCH_DONE() profileDone()
+#include "switchEngine.h"
+
+// Function: runProfiled
+// Description: Runs codeTab on the profiling engine, recording execution counts, time and branch directions per address.
+// Params: Address to start at.
+// Returns: None.
+// Modifies: Stack, variables, profile.
+void runProfiled(int pc)
+{
+	profileStart();
+	runProfiledEngine(pc);
+}
+
+// Function: profiledInstructions
+// Description: Reports how many instructions the last profiled run executed.
+// Params: None.
+// Returns: Instruction count.
+// Modifies: None.
+long long profiledInstructions()
+{
+	return vmExecuted;
+}
+
+// Function: printSource
+// Description: Prints the source line an instruction came from, comments included, or the instruction itself if the source
+//                was not kept (see keepSource).
+// Params: Instruction.
+// Returns: None.
+// Modifies: None.
+static void printSource(instructionType* inst)
+{
+	char* text;
+	int length = sourceLine(inst -> line, &text);
+	if (length >= 0)
+		vmWrite(text, length);
+	else
+		vmPrintf("%s %s", opcodeName(inst -> op), inst -> operand);
+}
+
+// Function: printProfile
+// Description: Prints the report for the last profiled run: every executed instruction with its count, time, share of the
+//                total and jump directions, annotated with its source line; totals per opcode; and the hottest instructions.
+//                Time is in CPU cycles where a cycle counter is available, nanoseconds otherwise.
+// Params: None.
+// Returns: None.
+// Modifies: None.
+void printProfile()
+{
+	long long opCounts[OP_COUNT];
+	unsigned long long opCycles[OP_COUNT];
+	int hot[PROFILE_HOT_SPOTS];
+	unsigned long long total = 0;
+	int i, j;
+#if defined(PROFILE_TSC)
+	const char* unit = "cycles";
+#else
+	const char* unit = "ns";
+#endif
+	if (vmProfile == NULL)
+		return;
+	memset(opCounts, 0, sizeof(opCounts));
+	memset(opCycles, 0, sizeof(opCycles));
+	for (i = 0; i < vmProfileSize; i++)
+	{
+		opCounts[vmCodeTab.instructions[i].op] += vmProfile[i].count;
+		opCycles[vmCodeTab.instructions[i].op] += vmProfile[i].cycles;
+		total += vmProfile[i].cycles;
+	}
+	if (total == 0)
+		total = 1;
+
+	vmPrintf("\nProfile (%lld instructions executed, %s):\n", vmExecuted, unit);
+	vmPrintf("%6s %6s %14s %16s %6s %21s  %s\n", "Addr", "Line", "Count", unit, "%", "Taken/Not taken", "Source");
+	for (i = 0; i < vmProfileSize; i++)
+	{
+		instructionType* inst = &vmCodeTab.instructions[i];
+		char branch[48] = "";
+		if (vmProfile[i].count == 0)
+			continue;
+		if (vmProfile[i].taken + vmProfile[i].notTaken > 0)
+			sprintf(branch, "%lld/%lld", vmProfile[i].taken, vmProfile[i].notTaken);
+		vmPrintf("%6d %6d %14lld %16llu %6.2f %21s  ", i, inst -> line, vmProfile[i].count, vmProfile[i].cycles,
+			100.0 * vmProfile[i].cycles / total, branch);
+		if (i == vmCodeTab.instructionCount)
+			vmPrintf("(end of program - restart)");
+		else
+			printSource(inst);
+		vmPrintf("\n");
+	}
+
+	vmPrintf("\nBy opcode:\n%-8s %14s %16s %6s %10s\n", "Opcode", "Count", unit, "%", "Per inst");
+	for (i = 0; i < OP_COUNT; i++)
+	{
+		if (opCounts[i] == 0)
+			continue;
+		// pushi shares its source name with push.
+		vmPrintf("%-8s %14lld %16llu %6.2f %10.1f\n", i == OP_END ? "(end)" : i == OP_PUSHI ? "pushi" : opcodeName((opcodeType) i),
+			opCounts[i], opCycles[i], 100.0 * opCycles[i] / total, (double) opCycles[i] / opCounts[i]);
+	}
+
+	// Hottest addresses by time, by insertion into a short sorted list.
+	for (j = 0; j < PROFILE_HOT_SPOTS; j++)
+		hot[j] = -1;
+	for (i = 0; i < vmProfileSize; i++)
+	{
+		if (vmProfile[i].count == 0)
+			continue;
+		for (j = PROFILE_HOT_SPOTS - 1; j >= 0 && (hot[j] < 0 || vmProfile[hot[j]].cycles < vmProfile[i].cycles); j--)
+		{
+			if (j + 1 < PROFILE_HOT_SPOTS)
+				hot[j + 1] = hot[j];
+			hot[j] = i;
+		}
+	}
+	vmPrintf("\nHot spots:\n");
+	for (j = 0; j < PROFILE_HOT_SPOTS && hot[j] >= 0; j++)
+	{
+		vmPrintf("%6.2f%%  line %d: ", 100.0 * vmProfile[hot[j]].cycles / total, vmCodeTab.instructions[hot[j]].line);
+		if (hot[j] == vmCodeTab.instructionCount)
+			vmPrintf("(end of program - restart)");
+		else
+			printSource(&vmCodeTab.instructions[hot[j]]);
+		vmPrintf("\n");
+	}
+}
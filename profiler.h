@@ -0,0 +1,31 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+// What the profiler records for one address in codeTab.
+typedef struct
+{
+	long long count;
+	unsigned long long cycles;
+	// jf and jfXX only: times the jump was taken, and times execution fell through.
+	long long taken;
+	long long notTaken;
+} profileEntry;
+
+// Counters for the last profiled run: one entry per codeTab address, plus the OP_END past the end.
+typedef struct
+{
+	profileEntry* entries;
+	int size;
+	// Instruction being timed, and when it started.
+	int lastPc;
+	unsigned long long lastStamp;
+	long long executed;
+} profileType;
+
+// Profiling engine - the switch engine compiled a second time with hooks that count and time every instruction (see
+// switchEngine.h), so the other engines carry no profiling code at all.
+void runProfiled(int pc);
+void printProfile();
+long long profiledInstructions();
+
+#endif
@@ -0,0 +1,509 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "regvm.h"
+#include "instructions.h"
+#include "stack.h"
+#include "engine.h"
+
+// The current VM's register code (see registerProgramType).
+#define vmRegisterCode (currentVm -> registerProgram.code)
+#define vmRegisterCount (currentVm -> registerProgram.count)
+#define vmTempBase (currentVm -> registerProgram.tempBase)
+
+static const char* registerOpNames[R_COUNT] = {"move", "add", "sub", "mult", "div", "and", "or", "tsteq", "tstne", "tstlt",
+	"tstle", "tstgt", "tstge", "j", "jf", "jfeq", "jfne", "jflt", "jfle", "jfgt", "jfge", "get", "put", "halt"};
+
+// Translation state: the register currently holding the value at each stack depth. Pushing a variable or a constant does not
+// copy it anywhere - the depth just names the variable's register until something forces the value into the depth's own
+// register (a jump, a join point, or a write to the variable).
+typedef struct
+{
+	int* holder;
+	int blockStart;
+} translationState;
+
+// Function: emit
+// Description: Appends an instruction to the register code.
+// Params: Operation, destination, sources, jump target (a codeTab address until translateRegisters maps it), codeTab address,
+//           stack depth there.
+// Returns: None.
+// Modifies: Register code.
+static void emit(registerOpType op, int dst, int a, int b, int target, int source, int depth)
+{
+	registerInstructionType* inst = &vmRegisterCode[vmRegisterCount++];
+	inst -> op = op;
+	inst -> dst = dst;
+	inst -> a = a;
+	inst -> b = b;
+	inst -> target = target;
+	inst -> source = source;
+	inst -> depth = depth;
+}
+
+// Function: settle
+// Description: Copies the values at depths 1..depth into their own registers, so code reached from more than one place (or the
+//                stack engine, after an overflow) finds them where it expects.
+// Params: Translation state, deepest depth to settle, codeTab address.
+// Returns: None.
+// Modifies: Register code, translation state.
+static void settle(translationState* state, int depth, int pc)
+{
+	int k;
+	for (k = 1; k <= depth; k++)
+	{
+		if (state -> holder[k] != vmTempBase + k - 1)
+		{
+			emit(R_MOVE, vmTempBase + k - 1, state -> holder[k], 0, 0, pc, depth);
+			state -> holder[k] = vmTempBase + k - 1;
+		}
+	}
+}
+
+// Function: beforeWrite
+// Description: Called before an instruction writes a variable: any stack depth still naming the variable's register gets its
+//                own copy of the old value first.
+// Params: Translation state, variable slot, current stack depth, codeTab address.
+// Returns: None.
+// Modifies: Register code, translation state.
+static void beforeWrite(translationState* state, int slot, int depth, int pc)
+{
+	int k;
+	for (k = 1; k <= depth; k++)
+	{
+		if (state -> holder[k] == slot)
+		{
+			emit(R_MOVE, vmTempBase + k - 1, slot, 0, 0, pc, depth);
+			state -> holder[k] = vmTempBase + k - 1;
+		}
+	}
+}
+
+// Function: translateRegisters
+// Description: Translates the stack code in codeTab into three-address register code. Needs the stack depth at every
+//                instruction (see analyzeStack), which turns each stack position into a fixed register. Within a basic block
+//                pushes only rename values, so 'push a; push b; add; pop c' becomes the single instruction 'c = a + b'.
+// Params: None.
+// Returns: Number of register instructions, or -1 if the stack depths are not known statically, or the program has task
+//            instructions, which only the task runtime runs, or array instructions, which are left to the interpreter.
+// Modifies: Register code, variables (grown to hold the stack registers, plus a constant slot for each immediate).
+int translateRegisters()
+{
+	int count = vmCodeTab.instructionCount;
+	int* address;
+	int* immediateSlot;
+	char* joins;
+	translationState state;
+	int fallsThrough = 0;
+	int pc, i;
+	free(vmRegisterCode);
+	vmRegisterCode = NULL;
+	vmRegisterCount = 0;
+	if (vmCodeTab.maxDepth < 0 || taskInstruction() >= 0 || arrayInstruction() >= 0)
+		return -1;
+
+	// Immediates become constant slots. Done first, so the stack registers can go after every slot.
+	immediateSlot = (int*) malloc((count + 1) * sizeof(int));
+	for (pc = 0; pc < count; pc++)
+		immediateSlot[pc] = vmCodeTab.instructions[pc].op == OP_PUSHI
+			? constantSlot(vmCodeTab.instructions[pc].arg.immediate) : 0;
+	vmTempBase = vmSlotCount;
+	vmVariables = (wicInt*) realloc(vmVariables, (vmSlotCount + vmCodeTab.maxDepth + 1) * sizeof(wicInt));
+	if (vmVariables == NULL)
+	{
+		printf("Out of memory translating to registers!\n");
+		exit(5);
+	}
+	currentVm -> slotCapacity = vmSlotCount + vmCodeTab.maxDepth + 1;
+
+	// Jump targets (and the start, where a program that runs off its end restarts) are where blocks join.
+	joins = (char*) calloc(count + 1, 1);
+	joins[0] = 1;
+	for (pc = 0; pc < count; pc++)
+	{
+		opcodeType op = vmCodeTab.instructions[pc].op;
+		if (op == OP_J || op == OP_JF || (op >= OP_JFEQ && op <= OP_JFGE))
+			joins[vmCodeTab.instructions[pc].arg.target] = 1;
+	}
+
+	// Each stack instruction becomes at most one register instruction, plus a copy per stack depth when values settle.
+	vmRegisterCode = (registerInstructionType*) malloc((count + 1) * (vmCodeTab.maxDepth + 2)
+		* sizeof(registerInstructionType));
+	address = (int*) malloc((count + 1) * sizeof(int));
+	state.holder = (int*) malloc((vmCodeTab.maxDepth + 2) * sizeof(int));
+	state.blockStart = 0;
+	for (pc = 0; pc <= count; pc++)
+	{
+		instructionType* inst = &vmCodeTab.instructions[pc];
+		opcodeType op = pc < count ? inst -> op : OP_END;
+		int d = vmCodeTab.depths[pc];
+		if (joins[pc] && d >= 0)
+		{
+			if (fallsThrough)
+				settle(&state, d, pc);
+			for (i = 1; i <= d; i++)
+				state.holder[i] = vmTempBase + i - 1;
+			state.blockStart = vmRegisterCount;
+		}
+		address[pc] = vmRegisterCount;
+		fallsThrough = d >= 0 && op != OP_J && op != OP_HALT && op != OP_END;
+		if (d < 0)
+			continue;
+		switch (op)
+		{
+		case OP_GET:
+			beforeWrite(&state, inst -> arg.slot, d, pc);
+			emit(R_GET, inst -> arg.slot, 0, 0, 0, pc, d);
+			break;
+		case OP_PUT:
+			emit(R_PUT, inst -> arg.slot, 0, 0, 0, pc, d);
+			break;
+		case OP_PUSH:
+			state.holder[d + 1] = inst -> arg.slot;
+			break;
+		case OP_PUSHI:
+			state.holder[d + 1] = immediateSlot[pc];
+			break;
+		case OP_POP:
+			beforeWrite(&state, inst -> arg.slot, d - 1, pc);
+			if (state.holder[d] == vmTempBase + d - 1 && vmRegisterCount > state.blockStart
+				&& vmRegisterCode[vmRegisterCount - 1].dst == vmTempBase + d - 1
+				&& vmRegisterCode[vmRegisterCount - 1].op <= R_TSTGE)
+			{
+				// The value was computed by the last instruction and is popped straight away - compute it into the
+				// variable instead.
+				vmRegisterCode[vmRegisterCount - 1].dst = inst -> arg.slot;
+			}
+			else if (state.holder[d] != inst -> arg.slot)
+			{
+				emit(R_MOVE, inst -> arg.slot, state.holder[d], 0, 0, pc, d);
+			}
+			break;
+		case OP_ADD:
+		case OP_SUB:
+		case OP_MULT:
+		case OP_DIV:
+			// An overflow hands the rest of the run to the stack engine, which needs the values below the operands (the
+			// operands themselves are still in a and b).
+			settle(&state, d - 2, pc);
+			emit((registerOpType) (R_ADD + op - OP_ADD), vmTempBase + d - 2, state.holder[d - 1], state.holder[d], 0, pc, d);
+			state.holder[d - 1] = vmTempBase + d - 2;
+			break;
+		case OP_AND:
+		case OP_OR:
+			emit(op == OP_AND ? R_AND : R_OR, vmTempBase + d - 2, state.holder[d - 1], state.holder[d], 0, pc, d);
+			state.holder[d - 1] = vmTempBase + d - 2;
+			break;
+		case OP_NOT:
+		case OP_TSTEQ:
+		case OP_TSTNE:
+		case OP_TSTLT:
+		case OP_TSTLE:
+		case OP_TSTGT:
+		case OP_TSTGE:
+			emit(op == OP_NOT ? R_TSTEQ : (registerOpType) (R_TSTEQ + op - OP_TSTEQ), vmTempBase + d - 1,
+				state.holder[d], 0, 0, pc, d);
+			state.holder[d] = vmTempBase + d - 1;
+			break;
+		case OP_J:
+			settle(&state, d, pc);
+			emit(R_J, 0, 0, 0, inst -> arg.target, pc, d);
+			break;
+		case OP_JF:
+			settle(&state, d - 1, pc);
+			emit(R_JF, 0, state.holder[d], 0, inst -> arg.target, pc, d);
+			break;
+		case OP_HALT:
+			emit(R_HALT, 0, 0, 0, 0, pc, d);
+			break;
+		case OP_MOVE:
+			beforeWrite(&state, inst -> arg.slot, d, pc);
+			emit(R_MOVE, inst -> arg.slot, inst -> a, 0, 0, pc, d);
+			break;
+		case OP_ADDV:
+		case OP_SUBV:
+		case OP_MULTV:
+			beforeWrite(&state, inst -> arg.slot, d, pc);
+			settle(&state, d, pc);
+			emit((registerOpType) (R_ADD + op - OP_ADDV), inst -> arg.slot, inst -> a, inst -> b, 0, pc, d);
+			break;
+		case OP_JFEQ:
+		case OP_JFNE:
+		case OP_JFLT:
+		case OP_JFLE:
+		case OP_JFGT:
+		case OP_JFGE:
+			settle(&state, d, pc);
+			emit((registerOpType) (R_JFEQ + op - OP_JFEQ), 0, inst -> a, inst -> b, inst -> arg.target, pc, d);
+			break;
+		case OP_END:
+			// Running off the end restarts the program.
+			settle(&state, d, pc);
+			emit(R_J, 0, 0, 0, 0, pc, d);
+			break;
+		default:
+			// label, nop
+			break;
+		}
+	}
+	for (i = 0; i < vmRegisterCount; i++)
+	{
+		if (vmRegisterCode[i].op == R_J || vmRegisterCode[i].op == R_JF
+			|| (vmRegisterCode[i].op >= R_JFEQ && vmRegisterCode[i].op <= R_JFGE))
+			vmRegisterCode[i].target = address[vmRegisterCode[i].target];
+	}
+	free(address);
+	free(immediateSlot);
+	free(joins);
+	free(state.holder);
+	return vmRegisterCount;
+}
+
+// Function: printRegister
+// Description: Prints a register operand: a variable by name, a constant by value, or a stack register as sN.
+// Params: Register.
+// Returns: None.
+// Modifies: None.
+static void printRegister(int r)
+{
+	int i;
+	if (r >= vmTempBase)
+	{
+		printf("s%d", r - vmTempBase + 1);
+		return;
+	}
+	if (r >= vmVariableCount)
+	{
+		printf(WIC_INT_FORMAT, vmVariables[r]);
+		return;
+	}
+	for (i = 0; i < vmSymbolTable.size; i++)
+	{
+		if (vmSymbolTable.entries[i].value == r)
+		{
+			printf("%s", vmSymbolTable.entries[i].key);
+			return;
+		}
+	}
+	printf("r%d", r);
+}
+
+// Function: printRegisterCode
+// Description: Prints the register code, with the source line each instruction came from.
+// Params: None.
+// Returns: None.
+// Modifies: None.
+void printRegisterCode()
+{
+	int i;
+	printf("Register program (%d instructions from %d stack instructions):\n", vmRegisterCount, vmCodeTab.instructionCount);
+	for (i = 0; i < vmRegisterCount; i++)
+	{
+		registerInstructionType* inst = &vmRegisterCode[i];
+		printf("(%d) %s ", i, registerOpNames[inst -> op]);
+		if (inst -> op <= R_TSTGE)
+		{
+			// dst = a, or dst = a op b
+			printRegister(inst -> dst);
+			printf(" = ");
+			printRegister(inst -> a);
+			if (inst -> op >= R_ADD && inst -> op <= R_OR)
+			{
+				printf(", ");
+				printRegister(inst -> b);
+			}
+		}
+		else if (inst -> op == R_GET || inst -> op == R_PUT)
+		{
+			printRegister(inst -> dst);
+		}
+		else if (inst -> op == R_JF)
+		{
+			printRegister(inst -> a);
+			printf(" ");
+		}
+		else if (inst -> op >= R_JFEQ && inst -> op <= R_JFGE)
+		{
+			printRegister(inst -> a);
+			printf(", ");
+			printRegister(inst -> b);
+			printf(" ");
+		}
+		if (inst -> op >= R_J && inst -> op <= R_JFGE)
+			printf("-> %d", inst -> target);
+		printf(" [line %d]\n", vmCodeTab.instructions[inst -> source].line);
+	}
+	printf("\n");
+}
+
+// Function: leaveRegisterVm
+// Description: Writes the stack back as it was on entry to the stack instruction a register instruction came from, so the
+//                stack engine can run that instruction again. The values below the operands were settled into their own
+//                registers by translateRegisters; a binary stack instruction's operands are still in its a and b.
+// Params: Register instruction.
+// Returns: Its address in codeTab.
+// Modifies: Stack.
+static int leaveRegisterVm(registerInstructionType* ip)
+{
+	opcodeType op = vmCodeTab.instructions[ip -> source].op;
+	int k;
+	for (k = 1; k <= ip -> depth; k++)
+		vmStack.theStack[k] = vmVariables[vmTempBase + k - 1];
+	if (op >= OP_ADD && op <= OP_DIV)
+	{
+		vmStack.theStack[ip -> depth - 1] = vmVariables[ip -> a];
+		vmStack.theStack[ip -> depth] = vmVariables[ip -> b];
+	}
+	vmStack.stackIndex = ip -> depth;
+	return ip -> source;
+}
+
+// Function: runRegisterVm
+// Description: Translates codeTab to register code and runs it. Variables, constants and stack values all live in the
+//                variables array, so every instruction is a single fetch and dispatch with its operands as indices. Arithmetic
+//                is checked as in the stack engines; unless overflow wraps around, an overflow leaves the rest of the run to
+//                the stack engine, starting with the instruction that overflowed.
+// Params: None.
+// Returns: Address the stack engine should carry on from: 0 if the program could not be translated, the instruction that
+//            overflowed, or -1 once the program has halted or stopped on a divide error.
+// Modifies: Stack, variables.
+int runRegisterVm()
+{
+	registerInstructionType* ip;
+	wicInt* r;
+	wicInt result;
+	if (vmStack.stackIndex != 0 || translateRegisters() < 0)
+		return 0;
+	r = vmVariables;
+	ip = vmRegisterCode;
+	// jfeq..jfge: the sub is checked like any other.
+	#define JFCMP(cmp) \
+		if (SUB_OVERFLOWS(r[ip -> a], r[ip -> b], &result) && !WRAPS()) \
+			return leaveRegisterVm(ip); \
+		ip = result cmp 0 ? ip + 1 : vmRegisterCode + ip -> target
+#if defined(__GNUC__)
+	{
+	static void* handlers[R_COUNT] = {&&R_MOVE, &&R_ADD, &&R_SUB, &&R_MULT, &&R_DIV, &&R_AND, &&R_OR, &&R_TSTEQ, &&R_TSTNE,
+		&&R_TSTLT, &&R_TSTLE, &&R_TSTGT, &&R_TSTGE, &&R_J, &&R_JF, &&R_JFEQ, &&R_JFNE, &&R_JFLT, &&R_JFLE, &&R_JFGT, &&R_JFGE,
+		&&R_GET, &&R_PUT, &&R_HALT};
+	#define CASE(op) op
+	#define NEXT() goto *handlers[ip -> op]
+	NEXT();
+#else
+	#define CASE(op) case op
+	#define NEXT() continue
+	for (;;)
+	switch (ip -> op)
+	{
+#endif
+	CASE(R_MOVE):
+		r[ip -> dst] = r[ip -> a];
+		ip++;
+		NEXT();
+	CASE(R_ADD):
+		// Nothing is stored if it has to leave, as dst may be one of the operands.
+		if (ADD_OVERFLOWS(r[ip -> a], r[ip -> b], &result) && !WRAPS())
+			return leaveRegisterVm(ip);
+		r[ip -> dst] = result;
+		ip++;
+		NEXT();
+	CASE(R_SUB):
+		if (SUB_OVERFLOWS(r[ip -> a], r[ip -> b], &result) && !WRAPS())
+			return leaveRegisterVm(ip);
+		r[ip -> dst] = result;
+		ip++;
+		NEXT();
+	CASE(R_MULT):
+		if (MULT_OVERFLOWS(r[ip -> a], r[ip -> b], &result) && !WRAPS())
+			return leaveRegisterVm(ip);
+		r[ip -> dst] = result;
+		ip++;
+		NEXT();
+	CASE(R_DIV):
+		if (r[ip -> b] == 0)
+		{
+			leaveRegisterVm(ip);
+			divideByZero(vmCodeTab.instructions[ip -> source].line);
+			return -1;
+		}
+		if (DIV_OVERFLOWS(r[ip -> a], r[ip -> b]) && !WRAPS())
+			return leaveRegisterVm(ip);
+		r[ip -> dst] = WRAPPED_DIV(r[ip -> a], r[ip -> b]);
+		ip++;
+		NEXT();
+	CASE(R_AND):
+		r[ip -> dst] = r[ip -> b] > 0 && r[ip -> a] > 0;
+		ip++;
+		NEXT();
+	CASE(R_OR):
+		r[ip -> dst] = r[ip -> b] != 0 || r[ip -> a] != 0;
+		ip++;
+		NEXT();
+	CASE(R_TSTEQ):
+		r[ip -> dst] = r[ip -> a] == 0;
+		ip++;
+		NEXT();
+	CASE(R_TSTNE):
+		r[ip -> dst] = r[ip -> a] != 0;
+		ip++;
+		NEXT();
+	CASE(R_TSTLT):
+		r[ip -> dst] = r[ip -> a] < 0;
+		ip++;
+		NEXT();
+	CASE(R_TSTLE):
+		r[ip -> dst] = r[ip -> a] <= 0;
+		ip++;
+		NEXT();
+	CASE(R_TSTGT):
+		r[ip -> dst] = r[ip -> a] > 0;
+		ip++;
+		NEXT();
+	CASE(R_TSTGE):
+		r[ip -> dst] = r[ip -> a] >= 0;
+		ip++;
+		NEXT();
+	CASE(R_J):
+		ip = vmRegisterCode + ip -> target;
+		NEXT();
+	CASE(R_JF):
+		ip = r[ip -> a] == 0 ? vmRegisterCode + ip -> target : ip + 1;
+		NEXT();
+	CASE(R_JFEQ):
+		JFCMP(==);
+		NEXT();
+	CASE(R_JFNE):
+		JFCMP(!=);
+		NEXT();
+	CASE(R_JFLT):
+		JFCMP(<);
+		NEXT();
+	CASE(R_JFLE):
+		JFCMP(<=);
+		NEXT();
+	CASE(R_JFGT):
+		JFCMP(>);
+		NEXT();
+	CASE(R_JFGE):
+		JFCMP(>=);
+		NEXT();
+	CASE(R_GET):
+		inputVariable(&vmCodeTab.instructions[ip -> source]);
+		ip++;
+		NEXT();
+	CASE(R_PUT):
+		outputVariable(&vmCodeTab.instructions[ip -> source]);
+		ip++;
+		NEXT();
+	CASE(R_HALT):
+		halt();
+		return -1;
+#if !defined(__GNUC__)
+	default:
+		return -1;
+#endif
+	}
+	#undef CASE
+	#undef NEXT
+	#undef JFCMP
+}
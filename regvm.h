@@ -0,0 +1,69 @@
+#ifndef REGVM_H
+#define REGVM_H
+
+// Register IR operations. Operands are register numbers: registers below slotCount are the variable and constant slots, and
+// each stack depth the program reaches gets a register of its own after them (see translateRegisters).
+typedef enum
+{
+	// dst = a
+	R_MOVE = 0,
+	// dst = a op b
+	R_ADD,
+	R_SUB,
+	R_MULT,
+	R_DIV,
+	R_AND,
+	R_OR,
+	// dst = a tested against zero, as tsteq..tstge (not is tsteq)
+	R_TSTEQ,
+	R_TSTNE,
+	R_TSTLT,
+	R_TSTLE,
+	R_TSTGT,
+	R_TSTGE,
+	// goto target
+	R_J,
+	// goto target if a is false(0)
+	R_JF,
+	// goto target unless (a - b) passes the test
+	R_JFEQ,
+	R_JFNE,
+	R_JFLT,
+	R_JFLE,
+	R_JFGT,
+	R_JFGE,
+	// get/put the variable in register dst
+	R_GET,
+	R_PUT,
+	R_HALT,
+	R_COUNT
+} registerOpType;
+
+typedef struct
+{
+	registerOpType op;
+	int dst;
+	int a;
+	int b;
+	// Jump target, as an index into the register code.
+	int target;
+	// Address in codeTab this came from, and the stack depth there (needed to leave the register VM after an overflow).
+	int source;
+	int depth;
+} registerInstructionType;
+
+// Register code built by translateRegisters.
+typedef struct
+{
+	registerInstructionType* code;
+	int count;
+	// Register holding stack depth 1; depth n is in register tempBase + n - 1.
+	int tempBase;
+} registerProgramType;
+
+// Stack-to-register translation of codeTab, and the VM that runs it.
+int translateRegisters();
+void printRegisterCode();
+int runRegisterVm();
+
+#endif
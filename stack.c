@@ -1,46 +1,72 @@
+#include <stdlib.h>
 #include "stack.h"
+#include "vm.h"
 
-// Typedef definition of the stack struct. Since no other files need access to this data type, this struct definition
-// is not needed in the header.
-typedef struct
-{
-	int theStack[20];
-	int stackIndex;
-} stack;
-
-// The stack we'll use
-stack Stack;
+// Depth the stack is allocated for when the caller has no better idea.
+#define STACK_DEFAULT_DEPTH 64
 
-void initStack()
+// Function: initStack
+// Description: Empties the stack and allocates room for the given depth. The stack still grows past it if it has to.
+// Params: Depth to allocate for, or 0 for the default.
+// Returns: None.
+// Modifies: Stack.
+void initStack(int depth)
 {
-	// Initialize stack index to -1 so that first push will increment it to zero. It also prevents pop from
+	if (depth <= 0)
+		depth = STACK_DEFAULT_DEPTH;
+	free(vmStack.theStack);
+	// One for the spare slot, and one so the engines' push never has to grow when the analysis says depth is enough.
+	vmStack.capacity = depth + 2;
+	vmStack.theStack = (wicInt*) malloc(vmStack.capacity * sizeof(wicInt));
+	if (vmStack.theStack == NULL)
+	{
+		vmStack.capacity = 0;
+		vmOutOfMemory("Out of memory allocating the stack!\n");
+	}
+	// Initialize stack index to 0 so that first push will increment it to one. It also prevents pop from
 	// popping anything off until something is pushed on initially.
-	Stack.stackIndex = -1;
+	vmStack.stackIndex = 0;
+}
+
+// Function: stackGrow
+// Description: Doubles the room allocated for the stack, keeping its contents.
+// Params: None.
+// Returns: 0 on success, -1 if the memory could not be allocated (stack overflow).
+// Modifies: Stack.
+int stackGrow()
+{
+	wicInt* grown = (wicInt*) realloc(vmStack.theStack, vmStack.capacity * 2 * sizeof(wicInt));
+	if (grown == NULL)
+		return -1;
+	vmStack.theStack = grown;
+	vmStack.capacity *= 2;
+	return 0;
 }
 
 // Function: stackPush
-// Description: Pushes the passed in parameter onto the stack.
+// Description: Pushes the passed in parameter onto the stack, growing it if it is full.
 // Params: Value to be pushed onto the stack.
-// Returns: None.
+// Returns: 0 on success, -1 on stack overflow.
 // Modifies: Stack.
-void stackPush(int x)
+int stackPush(wicInt x)
 {
-	Stack.stackIndex++;
-	Stack.theStack[Stack.stackIndex] = x;
+	if (vmStack.stackIndex + 1 >= vmStack.capacity && stackGrow() != 0)
+		return -1;
+	vmStack.stackIndex++;
+	vmStack.theStack[vmStack.stackIndex] = x;
+	return 0;
 }
 
 // Function: stackPop
-// Description: Pop's the top value off of the stack and returns it.
-// Params: None.
-// Returns: Top value on the stack.
-// Modifies: Stack.
-int stackPop()
+// Description: Pop's the top value off of the stack.
+// Params: Where to put the popped value.
+// Returns: 0 on success, -1 on stack underflow (x is left alone).
+// Modifies: Stack, x.
+int stackPop(wicInt* x)
 {
-	int temp;
-	if (Stack.stackIndex >= 0)
-	{
-		temp = Stack.theStack[Stack.stackIndex];
-		Stack.stackIndex--;
-	}
-	return temp;
-}
\ No newline at end of file
+	if (vmStack.stackIndex <= 0)
+		return -1;
+	*x = vmStack.theStack[vmStack.stackIndex];
+	vmStack.stackIndex--;
+	return 0;
+}
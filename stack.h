@@ -1,8 +1,24 @@
 #ifndef STACK_H
 #define STACK_H
+#include "value.h"
 
-// Only stack functionality needed to outside callers.
-void stackPush(int x);
-int stackPop();
+// Typedef definition of the stack struct. The interpreter engines work on it directly, so it lives in the header.
+// theStack[0] is a spare slot that is never part of the stack: the value at depth d (1 = bottom) is kept in theStack[d],
+// so stackIndex is both the depth and the index of the top value. The spare slot lets an engine keep the top value in a
+// local and spill it on every push without first checking whether the stack is empty.
+typedef struct
+{
+	wicInt* theStack;
+	int stackIndex;
+	// Number of values allocated for theStack, spare slot included.
+	int capacity;
+} stack;
 
-#endif
\ No newline at end of file
+// The stack we'll use belongs to the current VM (see vm.h).
+
+void initStack(int depth);
+int stackGrow();
+int stackPush(wicInt x);
+int stackPop(wicInt* x);
+
+#endif
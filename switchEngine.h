@@ -0,0 +1,231 @@
+// Switch engine template - deliberately not include-guarded. instructions.c compiles it as runSwitch with empty hooks,
+// profiler.c compiles it again as runProfiled with hooks that record every step, and trace.c as runTraced with hooks that
+// find hot loops and run their compiled traces, so neither costs the normal engines anything. The includer defines, and
+// this file undefines:
+//   SWITCH_ENGINE          storage class, return type and name of the function
+//   SWITCH_STEP()          run before each instruction, with pc set to its address
+//   SWITCH_BRANCH()        run after each j, jf and jfXX, with pc set to where it went
+//   SWITCH_DONE()          run once the engine has stopped (halt or error)
+// and may define SWITCH_LOCALS, declarations of any locals the hooks keep, SWITCH_INPUT(), run after each get, and
+// SWITCH_TASK(body), which runs the task instructions - by default they stop the engine (see taskUnsupported), and the task
+// runtime's engine has it run 'body()'. engine.h must be included first.
+#if !defined(SWITCH_LOCALS)
+#define SWITCH_LOCALS
+#endif
+#if !defined(SWITCH_INPUT)
+#define SWITCH_INPUT()
+#endif
+#if !defined(SWITCH_TASK)
+#define SWITCH_TASK(body) taskUnsupported(INST.line); goto halted
+#endif
+
+// Function: runSwitch / runProfiled / runTraced
+// Description: Portable engine - a central loop that fetches each opcode and runs its body through a switch.
+// Params: Address to start at.
+// Returns: None
+// Modifies: Stack, variables.
+SWITCH_ENGINE(int pc)
+{
+	instructionType* insts;
+	wicInt* vars;
+	wicInt tos;
+	wicInt* sp;
+	wicInt* limit;
+	wicInt result;
+	SWITCH_LOCALS
+	LOAD_STACK();
+	for (;;)
+	{
+		SWITCH_STEP();
+		// Opcodes were decoded when the program was loaded, so dispatch is a single switch on an integer.
+		switch (INST.op)
+		{
+		case OP_GET:
+			DO_GET();
+			SWITCH_INPUT();
+			break;
+		case OP_HALT:
+			halt();
+			goto halted;
+		case OP_PUSH:
+			DO_PUSH();
+			break;
+		case OP_PUSHI:
+			DO_PUSHI();
+			break;
+		case OP_PUT:
+			DO_PUT();
+			break;
+		case OP_POP:
+			DO_POP();
+			break;
+		case OP_ADD:
+			DO_ADD();
+			break;
+		case OP_SUB:
+			DO_SUB();
+			break;
+		case OP_MULT:
+			DO_MULT();
+			break;
+		case OP_DIV:
+			DO_DIV();
+			break;
+		case OP_AND:
+			DO_AND();
+			break;
+		case OP_OR:
+			DO_OR();
+			break;
+		case OP_NOT:
+			DO_NOT();
+			break;
+		case OP_TSTEQ:
+			DO_TSTEQ();
+			break;
+		case OP_TSTNE:
+			DO_TSTNE();
+			break;
+		case OP_TSTLT:
+			DO_TSTLT();
+			break;
+		case OP_TSTLE:
+			DO_TSTLE();
+			break;
+		case OP_TSTGT:
+			DO_TSTGT();
+			break;
+		case OP_TSTGE:
+			DO_TSTGE();
+			break;
+		case OP_J:
+			DO_J();
+			SWITCH_BRANCH();
+			break;
+		case OP_JF:
+			DO_JF();
+			SWITCH_BRANCH();
+			break;
+		case OP_SPAWN:
+			SWITCH_TASK(DO_SPAWN);
+			break;
+		case OP_JOIN:
+			SWITCH_TASK(DO_JOIN);
+			break;
+		case OP_CHAN:
+			SWITCH_TASK(DO_CHAN);
+			break;
+		case OP_SEND:
+			SWITCH_TASK(DO_SEND);
+			break;
+		case OP_RECV:
+			SWITCH_TASK(DO_RECV);
+			break;
+		case OP_ARRAY:
+			DO_ARRAY();
+			break;
+		case OP_ALOAD:
+			DO_ALOAD();
+			break;
+		case OP_ASTORE:
+			DO_ASTORE();
+			break;
+		case OP_ALEN:
+			DO_ALEN();
+			break;
+		case OP_ASUM:
+			DO_ASUM();
+			break;
+		case OP_AMIN:
+			DO_AMIN();
+			break;
+		case OP_AMAX:
+			DO_AMAX();
+			break;
+		case OP_ADOT:
+			DO_ADOT();
+			break;
+		case OP_AADD:
+			DO_AADD();
+			break;
+		case OP_AMULT:
+			DO_AMULT();
+			break;
+		case OP_ACOUNTEQ:
+			DO_ACOUNT(0);
+			break;
+		case OP_ACOUNTNE:
+			DO_ACOUNT(1);
+			break;
+		case OP_ACOUNTLT:
+			DO_ACOUNT(2);
+			break;
+		case OP_ACOUNTLE:
+			DO_ACOUNT(3);
+			break;
+		case OP_ACOUNTGT:
+			DO_ACOUNT(4);
+			break;
+		case OP_ACOUNTGE:
+			DO_ACOUNT(5);
+			break;
+		case OP_MOVE:
+			DO_MOVE();
+			break;
+		case OP_ADDV:
+			DO_ADDV();
+			break;
+		case OP_SUBV:
+			DO_SUBV();
+			break;
+		case OP_MULTV:
+			DO_MULTV();
+			break;
+		case OP_JFEQ:
+			DO_JFCMP(==);
+			SWITCH_BRANCH();
+			break;
+		case OP_JFNE:
+			DO_JFCMP(!=);
+			SWITCH_BRANCH();
+			break;
+		case OP_JFLT:
+			DO_JFCMP(<);
+			SWITCH_BRANCH();
+			break;
+		case OP_JFLE:
+			DO_JFCMP(<=);
+			SWITCH_BRANCH();
+			break;
+		case OP_JFGT:
+			DO_JFCMP(>);
+			SWITCH_BRANCH();
+			break;
+		case OP_JFGE:
+			DO_JFCMP(>=);
+			SWITCH_BRANCH();
+			break;
+		case OP_LABEL:
+		case OP_NOP:
+			pc++;
+			break;
+		default:
+			// If the end of instructions are reached and no halt is found, restart the program from the
+			//   beginning. Unknown opcodes never get this far - they are rejected by insertInstruction.
+			pc = 0;
+			break;
+		}
+	}
+	ENGINE_ERRORS();
+halted:
+	SAVE_STACK();
+	SWITCH_DONE();
+}
+
+#undef SWITCH_ENGINE
+#undef SWITCH_STEP
+#undef SWITCH_BRANCH
+#undef SWITCH_DONE
+#undef SWITCH_LOCALS
+#undef SWITCH_INPUT
+#undef SWITCH_TASK
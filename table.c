@@ -2,65 +2,319 @@
 #include <string.h>
 #include <stdlib.h>
 #include "table.h"
+#include "vm.h"
 
+// Starting number of buckets in a table. Must be a power of two.
+#define TABLE_INITIAL_BUCKETS 16
+
+// Block of the current VM's string pool (see internPoolType). Strings are carved out of large blocks rather than malloc'd one
+// at a time, and the pool is an open-addressing set of pointers into those blocks.
+typedef struct stringBlock
+{
+	struct stringBlock* next;
+	size_t used;
+	size_t size;
+	char text[1];
+} stringBlock;
+
+#define vmInternBlocks (currentVm -> internPool.blocks)
+#define vmInternSet (currentVm -> internPool.set)
+#define vmInternHashes (currentVm -> internPool.hashes)
+#define vmInternCount (currentVm -> internPool.count)
+#define vmInternBuckets (currentVm -> internPool.buckets)
+
+// Function: hashKey
+// Description: FNV-1a hash of a key.
+// Params: Key string.
+// Returns: 32 bit hash of the key.
+// Modifies: None.
+static unsigned int hashKey(const char* k)
+{
+	unsigned int h = 2166136261u;
+	while (*k)
+	{
+		h ^= (unsigned char) *k++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+// Function: hashToken
+// Description: FNV-1a hash of a string that is not '\0' terminated. Gives the same result as hashKey on the same text.
+// Params: Text, its length.
+// Returns: 32 bit hash of the text.
+// Modifies: None.
+static unsigned int hashToken(const char* k, int length)
+{
+	unsigned int h = 2166136261u;
+	int i;
+	for (i = 0; i < length; i++)
+	{
+		h ^= (unsigned char) k[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+// Function: copyToPool
+// Description: Copies a string into the current intern block, starting a new block if it does not fit.
+// Params: String to copy, its length.
+// Returns: Pointer to the pooled copy.
+// Modifies: Intern blocks.
+static char* copyToPool(const char* s, size_t length)
+{
+	char* copy;
+	if (vmInternBlocks == NULL || vmInternBlocks -> used + length + 1 > vmInternBlocks -> size)
+	{
+		size_t size = length + 1 > 65536 ? length + 1 : 65536;
+		stringBlock* block = (stringBlock*) malloc(sizeof(stringBlock) + size);
+		if (block == NULL)
+			vmOutOfMemory("Out of memory in the string pool!\n");
+		block -> next = vmInternBlocks;
+		block -> used = 0;
+		block -> size = size;
+		vmInternBlocks = block;
+	}
+	copy = vmInternBlocks -> text + vmInternBlocks -> used;
+	memcpy(copy, s, length);
+	copy[length] = '\0';
+	vmInternBlocks -> used += length + 1;
+	return copy;
+}
+
+// Function: growInternSet
+// Description: Doubles the number of buckets in the intern set and re-inserts every interned string.
+// Params: None.
+// Returns: None.
+// Modifies: Intern set.
+static void growInternSet()
+{
+	int newBuckets = vmInternBuckets == 0 ? 256 : vmInternBuckets * 2;
+	char** newSet = (char**) calloc(newBuckets, sizeof(char*));
+	unsigned int* newHashes = (unsigned int*) calloc(newBuckets, sizeof(unsigned int));
+	int i;
+	if (newSet == NULL || newHashes == NULL)
+	{
+		free(newSet);
+		free(newHashes);
+		vmOutOfMemory("Out of memory growing the string pool!\n");
+	}
+	for (i = 0; i < vmInternBuckets; i++)
+	{
+		if (vmInternSet[i] != NULL)
+		{
+			int b = vmInternHashes[i] & (newBuckets - 1);
+			while (newSet[b] != NULL)
+				b = (b + 1) & (newBuckets - 1);
+			newSet[b] = vmInternSet[i];
+			newHashes[b] = vmInternHashes[i];
+		}
+	}
+	free(vmInternSet);
+	free(vmInternHashes);
+	vmInternSet = newSet;
+	vmInternHashes = newHashes;
+	vmInternBuckets = newBuckets;
+}
+
+// Function: internString
+// Description: Returns the single pooled copy of a string, adding it to the pool the first time it is seen. Interned strings
+//                live for the rest of the run, so callers may keep the pointer instead of copying the text.
+// Params: String to intern.
+// Returns: Pooled copy of the string.
+// Modifies: String pool.
+char* internString(char* s)
+{
+	return internToken(s, (int) strlen(s));
+}
+
+// Function: internToken
+// Description: internString for text that is not '\0' terminated, such as a word in the middle of a loaded source file.
+// Params: Text, its length.
+// Returns: Pooled, '\0' terminated copy of the text.
+// Modifies: String pool.
+char* internToken(char* s, int length)
+{
+	unsigned int h = hashToken(s, length);
+	int b;
+	if ((vmInternCount + 1) * 2 > vmInternBuckets)
+		growInternSet();
+	b = h & (vmInternBuckets - 1);
+	while (vmInternSet[b] != NULL)
+	{
+		if (vmInternHashes[b] == h && strncmp(vmInternSet[b], s, length) == 0 && vmInternSet[b][length] == '\0')
+			return vmInternSet[b];
+		b = (b + 1) & (vmInternBuckets - 1);
+	}
+	vmInternSet[b] = copyToPool(s, length);
+	vmInternHashes[b] = h;
+	vmInternCount++;
+	return vmInternSet[b];
+}
+
+// Function: freeInternPool
+// Description: Frees a string pool and every string in it. Nothing interned in it may be used afterwards.
+// Params: Pool to free.
+// Returns: None.
+// Modifies: Pool passed in.
+void freeInternPool(internPoolType* pool)
+{
+	while (pool -> blocks != NULL)
+	{
+		stringBlock* next = pool -> blocks -> next;
+		free(pool -> blocks);
+		pool -> blocks = next;
+	}
+	free(pool -> set);
+	free(pool -> hashes);
+	pool -> set = NULL;
+	pool -> hashes = NULL;
+	pool -> count = 0;
+	pool -> buckets = 0;
+}
+
+// Function: initializeTable
+// Description: Sets up an empty table. Must be called before a table is used, and only on a table that is not already
+//                holding storage (use freeTable first to reuse one).
+// Params: Table to initialize.
+// Returns: None.
+// Modifies: Table passed in.
 void initializeTable(tableType *Xtable)
 {
-	// Just initializes the table size to zero upon intial creation (in main).
 	Xtable -> size = 0;
+	Xtable -> capacity = 0;
+	Xtable -> entries = NULL;
+	Xtable -> bucketCount = TABLE_INITIAL_BUCKETS;
+	Xtable -> buckets = (int*) calloc(TABLE_INITIAL_BUCKETS, sizeof(int));
+	if (Xtable -> buckets == NULL)
+		vmOutOfMemory("Out of memory creating a label/symbol table!\n");
 }
 
-// Function: store
-// Description: Saves a passed in key and value to the passed in table.
-// Params: Table to store to, value to store, key to store at.
+// Function: freeTable
+// Description: Releases the storage held by a table. The interned keys stay in the string pool.
+// Params: Table to free.
 // Returns: None.
 // Modifies: Table passed in.
-void store(tableType *Xtable, int val, char *k)
+void freeTable(tableType *Xtable)
+{
+	free(Xtable -> entries);
+	free(Xtable -> buckets);
+	Xtable -> entries = NULL;
+	Xtable -> buckets = NULL;
+	Xtable -> size = 0;
+	Xtable -> capacity = 0;
+	Xtable -> bucketCount = 0;
+}
+
+// Function: findBucket
+// Description: Probes a table for a key.
+// Params: Table to search, key to look for, hash of the key.
+// Returns: Bucket holding the key, or the empty bucket where it would be inserted.
+// Modifies: None.
+static int findBucket(tableType *Xtable, char* k, unsigned int h)
+{
+	int mask = Xtable -> bucketCount - 1;
+	int b = h & mask;
+	while (Xtable -> buckets[b] != 0)
+	{
+		tableEntry* e = &Xtable -> entries[Xtable -> buckets[b] - 1];
+		// Interned keys usually match on the pointer alone; the hash check keeps strcmp off the probe path otherwise.
+		if (e -> key == k || (e -> hash == h && strcmp(e -> key, k) == 0))
+			return b;
+		b = (b + 1) & mask;
+	}
+	return b;
+}
+
+// Function: growTable
+// Description: Doubles the bucket array of a table and rebuilds the index from the entries.
+// Params: Table to grow.
+// Returns: None.
+// Modifies: Table passed in.
+static void growTable(tableType *Xtable)
+{
+	int i;
+	int newCount = Xtable -> bucketCount * 2;
+	int* newBuckets = (int*) calloc(newCount, sizeof(int));
+	if (newBuckets == NULL)
+		vmOutOfMemory("Out of memory growing a label/symbol table!\n");
+	free(Xtable -> buckets);
+	Xtable -> buckets = newBuckets;
+	Xtable -> bucketCount = newCount;
+	for (i = 0; i < Xtable -> size; i++)
+	{
+		int b = Xtable -> entries[i].hash & (newCount - 1);
+		while (newBuckets[b] != 0)
+			b = (b + 1) & (newCount - 1);
+		newBuckets[b] = i + 1;
+	}
+}
+
+// Function: storeEntry
+// Description: Saves a key and value to a table, replacing the value if the key is already present.
+// Params: Table to store to, value to store, key to store at, 1 to intern the key.
+// Returns: None.
+// Modifies: Table passed in.
+static void storeEntry(tableType *Xtable, int val, char *k, int intern)
 {
+	unsigned int h = hashKey(k);
+	int b = findBucket(Xtable, k, h);
 	// If the specified key is already present in the table, modify
 	// its value instead of creating a duplicate.
-	if (retrieve(Xtable, k) >= 0)
+	if (Xtable -> buckets[b] != 0)
 	{
-		int i;
-		for (i = 0; i < Xtable -> size; i++)
-		{
-			if (strncmp(Xtable -> entries[i].key, k, 2) == 0)
-			{
-				Xtable -> entries[i].value = val;
-			}
-		}
+		Xtable -> entries[Xtable -> buckets[b] - 1].value = val;
 		return;
 	}
-	// Otherwise store whole entry in the specified table
+	// Otherwise store whole entry in the specified table, growing the entry array and the index as needed.
+	if (Xtable -> size == Xtable -> capacity)
 	{
-		// Create temporary tableEntry given parameter data
-		tableEntry temp;
-		// Must always use char arrays vs. pointers - those are immutable in C. 
-		strcpy(temp.key, k);
-		temp.value = val;
-		Xtable -> entries[Xtable -> size] = temp;
-		Xtable -> size++;
-		return;
+		int newCapacity = Xtable -> capacity == 0 ? TABLE_INITIAL_BUCKETS : Xtable -> capacity * 2;
+		tableEntry* newEntries = (tableEntry*) realloc(Xtable -> entries, newCapacity * sizeof(tableEntry));
+		if (newEntries == NULL)
+			vmOutOfMemory("Out of memory storing '%s'!\n", k);
+		Xtable -> entries = newEntries;
+		Xtable -> capacity = newCapacity;
 	}
-	
+	Xtable -> entries[Xtable -> size].key = intern ? internString(k) : k;
+	Xtable -> entries[Xtable -> size].hash = h;
+	Xtable -> entries[Xtable -> size].value = val;
+	Xtable -> size++;
+	Xtable -> buckets[b] = Xtable -> size;
+	if (Xtable -> size * 2 > Xtable -> bucketCount)
+		growTable(Xtable);
+}
+
+// Function: store
+// Description: Saves a passed in key and value to the passed in table. If the key is already present its value is replaced.
+// Params: Table to store to, value to store, key to store at.
+// Returns: None.
+// Modifies: Table passed in.
+void store(tableType *Xtable, int val, char *k)
+{
+	storeEntry(Xtable, val, k, 1);
+}
+
+// Function: storeKey
+// Description: store for a key that is already guaranteed to outlive the table, such as a name in a mapped bytecode cache
+//                (see cache.c). The key is kept as it is rather than copied into the string pool.
+// Params: Table to store to, value to store, key to store at.
+// Returns: None.
+// Modifies: Table passed in.
+void storeKey(tableType *Xtable, int val, char *k)
+{
+	storeEntry(Xtable, val, k, 0);
 }
 
 // Function: retrieve
 // Description: Retrieves the value in the passed in table corresponding to the passed in key.
 // Params: Table to search, key to look for.
 // Returns: Value of key if found, -1 otherwise.
-// Modifies: Passed in table.
+// Modifies: None.
 int retrieve(tableType *Xtable, char* k)
 {
-	int i;
-	int ret;
-	ret = -1;
-	// Loop to check if key already exists 
-	for (i = 0; i < Xtable -> size; i++)
-	{
-		if (strncmp(Xtable -> entries[i].key, k, 3) == 0)
-		{
-			ret = Xtable -> entries[i].value;
-		}
-	}
-	return ret;
-}
\ No newline at end of file
+	int b = findBucket(Xtable, k, hashKey(k));
+	if (Xtable -> buckets[b] == 0)
+		return -1;
+	return Xtable -> entries[Xtable -> buckets[b] - 1].value;
+}
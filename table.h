@@ -3,23 +3,46 @@
 
 typedef struct 
 {
-	char key[6];
+	// Interned key - see internString. Any length.
+	char* key;
+	unsigned int hash;
 	int value;
 } tableEntry;
 
 typedef struct 
 {
-	// Limit table entries to 20
-	tableEntry entries[20];
+	// Entries in insertion order, so the tables print in the order the program defined them. Grows as needed.
+	tableEntry* entries;
 	int size;
+	int capacity;
+	// Open-addressing (linear probing) index over entries. Each bucket holds an entry index + 1, or 0 if empty.
+	// bucketCount is always a power of two and is doubled before the table gets more than half full.
+	int* buckets;
+	int bucketCount;
 } tableType;
 
-// Declaration of the jump/symbol tables
-const tableType symbolTable;
-const tableType jumpTable;
+// Pool of interned strings (see internString). Every key stored in any table is copied in here once, so a name used as
+// both a label and a variable, or stored many times, only ever has one copy. Each VM has a pool of its own.
+typedef struct
+{
+	// Large blocks the strings are carved out of, newest first.
+	struct stringBlock* blocks;
+	// Open-addressing set of pointers into the blocks, with the hash of each.
+	char** set;
+	unsigned int* hashes;
+	int count;
+	int buckets;
+} internPoolType;
+
+// The jump and symbol tables belong to the current VM (see vm.h). Symbol table values are variable slots, not variable values.
 
 void initializeTable(tableType *Xtable);
+void freeTable(tableType *Xtable);
 void store(tableType *Xtable, int val, char* k);
+void storeKey(tableType *Xtable, int val, char* k);
 int retrieve(tableType *Xtable, char* key);
+char* internString(char* s);
+char* internToken(char* s, int length);
+void freeInternPool(internPoolType* pool);
 
 #endif
@@ -0,0 +1,1011 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tasks.h"
+#include "batch.h"
+#include "engine.h"
+#include "vm.h"
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Instructions a task runs before it goes to the back of its worker's queue, so that a task that never waits cannot keep
+// the others on its worker from running.
+#define TASK_QUANTUM 100000
+// Handles are given out in chunks, so a handle's task or channel never moves once it has one.
+#define TASK_CHUNK 1024
+#define TASK_CHUNKS 4096
+// Starting room in a worker's queue. It doubles whenever it fills up.
+#define TASK_QUEUE 256
+// Times a queue can double - the room for over 2^40 queued tasks.
+#define TASK_QUEUE_GROWTH 32
+
+// Lock guarding a channel's values and the tasks waiting on a channel or a join.
+#if defined(_WIN32)
+typedef CRITICAL_SECTION taskLockType;
+#define LOCK_INIT(l) InitializeCriticalSection(l)
+#define LOCK_FREE(l) DeleteCriticalSection(l)
+#define LOCK(l) EnterCriticalSection(l)
+#define UNLOCK(l) LeaveCriticalSection(l)
+#else
+typedef pthread_mutex_t taskLockType;
+#define LOCK_INIT(l) pthread_mutex_init(l, NULL)
+#define LOCK_FREE(l) pthread_mutex_destroy(l)
+#define LOCK(l) pthread_mutex_lock(l)
+#define UNLOCK(l) pthread_mutex_unlock(l)
+#endif
+
+// Sequentially consistent atomics on long longs and pointers, for the queues, task states and counters.
+#if defined(_MSC_VER)
+#define ATOMIC_LOAD(p) InterlockedOr64((volatile LONG64*) (p), 0)
+#define ATOMIC_STORE(p, v) InterlockedExchange64((volatile LONG64*) (p), (v))
+#define ATOMIC_ADD(p, v) InterlockedExchangeAdd64((volatile LONG64*) (p), (v))
+#define ATOMIC_EXCHANGE(p, v) InterlockedExchange64((volatile LONG64*) (p), (v))
+#define ATOMIC_CAS(p, expected, desired) \
+	(InterlockedCompareExchange64((volatile LONG64*) (p), (desired), (expected)) == (expected))
+#define ATOMIC_LOAD_POINTER(p) InterlockedCompareExchangePointer((PVOID volatile*) (p), NULL, NULL)
+#define ATOMIC_STORE_POINTER(p, v) InterlockedExchangePointer((PVOID volatile*) (p), (v))
+#define FENCE() MemoryBarrier()
+#define YIELD() SwitchToThread()
+#else
+#define ATOMIC_LOAD(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define ATOMIC_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define ATOMIC_ADD(p, v) __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define ATOMIC_EXCHANGE(p, v) __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define ATOMIC_CAS(p, expected, desired) atomicCas((p), (expected), (desired))
+#define ATOMIC_LOAD_POINTER(p) __atomic_load_n((p), __ATOMIC_SEQ_CST)
+#define ATOMIC_STORE_POINTER(p, v) __atomic_store_n((p), (v), __ATOMIC_SEQ_CST)
+#define FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define YIELD() sched_yield()
+
+static int atomicCas(volatile long long* p, long long expected, long long desired)
+{
+	return __atomic_compare_exchange_n(p, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+#endif
+
+// Where a task is. A task that has to wait is marked blocking while its worker is still stopping it, and only parked once
+// it has stopped; waking a blocking task leaves it woken, which tells its worker to run it again rather than park it.
+typedef enum
+{
+	TASK_RUNNING = 0,
+	TASK_BLOCKING,
+	TASK_PARKED,
+	TASK_WOKEN
+} taskStateType;
+
+typedef struct task
+{
+	int pc;
+	wicInt* vars;
+	stack stack;
+	volatile long long state;
+	// Guards done, result and joiners.
+	taskLockType lock;
+	int done;
+	// Top of the stack when the task halted, or 0 if the stack was empty; what 'join' gives back.
+	wicInt result;
+	// Tasks waiting to join this one, and the next task on whatever list this one is waiting on.
+	struct task* joiners;
+	struct task* nextWaiting;
+} taskType;
+
+// A bounded channel: a ring of values, and the tasks waiting to receive from it while it is empty or to send to it while
+// it is full, oldest first.
+typedef struct
+{
+	taskLockType lock;
+	wicInt* values;
+	int capacity;
+	int head;
+	int count;
+	taskType* receivers;
+	taskType* senders;
+} channelType;
+
+// Every task or channel a run has made, by handle.
+typedef struct
+{
+	void** volatile chunks[TASK_CHUNKS];
+	volatile long long count;
+	taskLockType lock;
+} registryType;
+
+// A worker's queue of runnable tasks (Chase and Lev's work-stealing deque). The worker pushes and takes at the bottom
+// without locking; thieves take from the top, and only contend with the owner, through a compare-and-swap on top, when a
+// single task is left.
+typedef struct
+{
+	long long size;
+	taskType** slots;
+} taskRingType;
+
+typedef struct
+{
+	volatile long long top;
+	volatile long long bottom;
+	taskRingType* volatile ring;
+	// Rings outgrown, kept until the run is over as a thief may still be reading one.
+	taskRingType* retired[TASK_QUEUE_GROWTH];
+	int retiredCount;
+} taskQueueType;
+
+typedef struct taskRun taskRunType;
+
+typedef struct
+{
+	taskRunType* run;
+	int id;
+	// VM the worker runs tasks on: the program's code and tables, with the running task's variables and stack swapped in.
+	vmType vm;
+	taskQueueType queue;
+	taskType* current;
+	// Set by the engine when the instruction it stopped in front of has to wait.
+	int waited;
+	unsigned int seed;
+	long long slices;
+	long long stolen;
+	long long parked;
+} taskWorkerType;
+
+struct taskRun
+{
+	vmType* program;
+	taskWorkerType* workers;
+	int workerCount;
+	long long quantum;
+	// Depth every task's stack starts with room for.
+	int depth;
+	registryType tasks;
+	registryType channels;
+	// Tasks runnable or running. Nothing can make progress once it is zero.
+	volatile long long active;
+	// Set once the main task has halted, or anything has failed, to stop every worker.
+	volatile long long finished;
+	int failed;
+	// Guards the main VM's input and output, which every task shares.
+	taskLockType ioLock;
+};
+
+// Worker the calling thread is, while it runs tasks.
+static VM_THREAD_LOCAL taskWorkerType* currentWorker;
+
+static int spawnTask(int target, wicInt* value, int line);
+static int joinTask(wicInt* value, int line);
+static int createChannel(wicInt* value, int line);
+static int sendValue(wicInt handle, wicInt value, int line);
+static int receiveValue(wicInt* value, int line);
+
+// Task instructions, on the engine's locals. Those that have to wait leave the stack and pc alone, and the instruction runs
+// again once the task is woken.
+// spawn: pop the argument and push the handle of a new task that starts at the operand's label with it on its stack.
+#define DO_SPAWN() NEED(1); if (spawnTask(INST.arg.target, &tos, INST.line) != 0) goto halted; pc++
+// join: replace a task handle with the top of that task's stack once it halts.
+#define DO_JOIN() NEED(1); TASK_WAIT(joinTask(&tos, INST.line)); pc++
+// chan: replace a capacity with the handle of a new channel holding up to that many values.
+#define DO_CHAN() NEED(1); if (createChannel(&tos, INST.line) != 0) goto halted; pc++
+// send: pop a value, then a channel handle, and send the value, waiting while the channel is full.
+#define DO_SEND() NEED(2); TASK_WAIT(sendValue(SECOND, tos, INST.line)); DROP(); DROP(); pc++
+// recv: replace a channel handle with the oldest value sent to it, waiting while there is none.
+#define DO_RECV() NEED(1); TASK_WAIT(receiveValue(&tos, INST.line)); pc++
+#define TASK_WAIT(outcome) \
+	taskOutcome = (outcome); \
+	if (taskOutcome > 0) \
+		waited = 1; \
+	if (taskOutcome != 0) \
+		goto halted
+
+// The switch engine with a budget, as libwic's, running the task instructions.
+#define SWITCH_ENGINE static void runTaskSlice
+#define SWITCH_LOCALS long long left = currentVm -> budget; int waited = 0; int taskOutcome;
+#define SWITCH_STEP() if (--left < 0) goto halted
+#define SWITCH_BRANCH()
+#define SWITCH_TASK(body) body()
+#define SWITCH_DONE() currentVm -> budget = left; currentVm -> budgetPc = pc; currentWorker -> waited = waited
+#include "switchEngine.h"
+
+// Function: atomic registry functions - registerItem, lookupItem
+// Description: Gives an item the next handle, and finds the item a handle stands for. Lookups never lock; registering only
+//                locks to add a chunk.
+// Params: Registry, item / handle.
+// Returns: The handle, -1 if there are too many / the item, NULL if there is no such handle.
+// Modifies: Registry.
+static int registerItem(registryType* registry, void* item)
+{
+	long long handle = ATOMIC_ADD(&registry -> count, 1);
+	long long chunk = handle / TASK_CHUNK;
+	void** slots;
+	if (chunk >= TASK_CHUNKS)
+		return -1;
+	slots = (void**) ATOMIC_LOAD_POINTER(&registry -> chunks[chunk]);
+	if (slots == NULL)
+	{
+		LOCK(&registry -> lock);
+		slots = registry -> chunks[chunk];
+		if (slots == NULL)
+		{
+			slots = (void**) calloc(TASK_CHUNK, sizeof(void*));
+			if (slots == NULL)
+			{
+				printf("Out of memory starting a task!\n");
+				exit(5);
+			}
+			ATOMIC_STORE_POINTER(&registry -> chunks[chunk], slots);
+		}
+		UNLOCK(&registry -> lock);
+	}
+	ATOMIC_STORE_POINTER(&slots[handle % TASK_CHUNK], item);
+	return (int) handle;
+}
+
+static void* lookupItem(registryType* registry, wicInt handle)
+{
+	void** slots;
+	if (handle < 0 || handle >= ATOMIC_LOAD(&registry -> count) || handle / TASK_CHUNK >= TASK_CHUNKS)
+		return NULL;
+	slots = (void**) ATOMIC_LOAD_POINTER(&registry -> chunks[handle / TASK_CHUNK]);
+	return slots != NULL ? ATOMIC_LOAD_POINTER(&slots[handle % TASK_CHUNK]) : NULL;
+}
+
+// Function: pushTask
+// Description: Puts a runnable task at the bottom of the calling worker's own queue, doubling the queue if it is full.
+// Params: Queue, task.
+// Returns: None.
+// Modifies: Queue.
+static void pushTask(taskQueueType* queue, taskType* task)
+{
+	long long bottom = ATOMIC_LOAD(&queue -> bottom);
+	long long top = ATOMIC_LOAD(&queue -> top);
+	taskRingType* ring = (taskRingType*) ATOMIC_LOAD_POINTER(&queue -> ring);
+	if (bottom - top >= ring -> size)
+	{
+		taskRingType* grown = (taskRingType*) malloc(sizeof(taskRingType));
+		long long i;
+		if (grown == NULL || queue -> retiredCount == TASK_QUEUE_GROWTH)
+		{
+			printf("Out of memory queueing a task!\n");
+			exit(5);
+		}
+		grown -> size = ring -> size * 2;
+		grown -> slots = (taskType**) malloc(grown -> size * sizeof(taskType*));
+		if (grown -> slots == NULL)
+		{
+			printf("Out of memory queueing a task!\n");
+			exit(5);
+		}
+		for (i = top; i < bottom; i++)
+			grown -> slots[i & (grown -> size - 1)] = ring -> slots[i & (ring -> size - 1)];
+		queue -> retired[queue -> retiredCount++] = ring;
+		ATOMIC_STORE_POINTER(&queue -> ring, grown);
+		ring = grown;
+	}
+	ATOMIC_STORE_POINTER(&ring -> slots[bottom & (ring -> size - 1)], task);
+	ATOMIC_STORE(&queue -> bottom, bottom + 1);
+}
+
+// Function: takeTask
+// Description: Takes the task most recently pushed onto the calling worker's own queue.
+// Params: Queue.
+// Returns: The task, or NULL if the queue is empty (or a thief got the last one).
+// Modifies: Queue.
+static taskType* takeTask(taskQueueType* queue)
+{
+	long long bottom = ATOMIC_LOAD(&queue -> bottom) - 1;
+	taskRingType* ring = (taskRingType*) ATOMIC_LOAD_POINTER(&queue -> ring);
+	long long top;
+	taskType* task;
+	ATOMIC_STORE(&queue -> bottom, bottom);
+	FENCE();
+	top = ATOMIC_LOAD(&queue -> top);
+	if (top > bottom)
+	{
+		ATOMIC_STORE(&queue -> bottom, bottom + 1);
+		return NULL;
+	}
+	task = (taskType*) ATOMIC_LOAD_POINTER(&ring -> slots[bottom & (ring -> size - 1)]);
+	if (top == bottom)
+	{
+		// The last task: whoever moves top first has it.
+		if (!ATOMIC_CAS(&queue -> top, top, top + 1))
+			task = NULL;
+		ATOMIC_STORE(&queue -> bottom, bottom + 1);
+	}
+	return task;
+}
+
+// Function: stealTask
+// Description: Takes the oldest task in another worker's queue.
+// Params: Queue.
+// Returns: The task, or NULL if the queue is empty or another thief or the owner got there first.
+// Modifies: Queue.
+static taskType* stealTask(taskQueueType* queue)
+{
+	long long top = ATOMIC_LOAD(&queue -> top);
+	long long bottom;
+	taskRingType* ring;
+	taskType* task;
+	FENCE();
+	bottom = ATOMIC_LOAD(&queue -> bottom);
+	if (top >= bottom)
+		return NULL;
+	ring = (taskRingType*) ATOMIC_LOAD_POINTER(&queue -> ring);
+	task = (taskType*) ATOMIC_LOAD_POINTER(&ring -> slots[top & (ring -> size - 1)]);
+	if (!ATOMIC_CAS(&queue -> top, top, top + 1))
+		return NULL;
+	return task;
+}
+
+// Function: wakeTask
+// Description: Makes a task that was waiting runnable again, on the calling worker's queue. If its worker has not finished
+//                stopping it yet, just marks it woken for that worker to see. The task was taken off its wait list under the
+//                list's lock, so it is only ever woken once.
+// Params: Task.
+// Returns: None.
+// Modifies: Task, queue.
+static void wakeTask(taskType* task)
+{
+	if (ATOMIC_EXCHANGE(&task -> state, TASK_WOKEN) == TASK_PARKED)
+	{
+		ATOMIC_STORE(&task -> state, TASK_RUNNING);
+		ATOMIC_ADD(&currentWorker -> run -> active, 1);
+		pushTask(&currentWorker -> queue, task);
+	}
+}
+
+// Function: waitOn
+// Description: Adds the running task to the end of a wait list, to be woken from it later. Called with the list's lock held.
+// Params: Wait list.
+// Returns: 1, for the engine to stop in front of the instruction.
+// Modifies: Wait list, the running task.
+static int waitOn(taskType** list)
+{
+	taskType* task = currentWorker -> current;
+	ATOMIC_STORE(&task -> state, TASK_BLOCKING);
+	task -> nextWaiting = NULL;
+	while (*list != NULL)
+		list = &(*list) -> nextWaiting;
+	*list = task;
+	return 1;
+}
+
+// Function: wakeFirst
+// Description: Wakes the task at the front of a wait list, if there is one. Called with the list's lock held.
+// Params: Wait list.
+// Returns: None.
+// Modifies: Wait list, queue.
+static void wakeFirst(taskType** list)
+{
+	taskType* task = *list;
+	if (task == NULL)
+		return;
+	*list = task -> nextWaiting;
+	wakeTask(task);
+}
+
+// Function: newTask
+// Description: Creates a task at an address, with a copy of the given variables and a stack holding its argument, and
+//                queues it on the calling worker.
+// Params: Run, address, variables to copy, argument (NULL for an empty stack).
+// Returns: The task's handle, or -1 if there are too many tasks.
+// Modifies: Run, queue.
+static int newTask(taskRunType* run, int pc, wicInt* vars, wicInt* argument)
+{
+	taskType* task = (taskType*) calloc(1, sizeof(taskType));
+	int handle;
+	if (task == NULL)
+	{
+		printf("Out of memory starting a task!\n");
+		exit(5);
+	}
+	task -> pc = pc;
+	task -> vars = (wicInt*) malloc((vmSlotCount > 0 ? vmSlotCount : 1) * sizeof(wicInt));
+	task -> stack.capacity = run -> depth + 2;
+	task -> stack.theStack = (wicInt*) malloc(task -> stack.capacity * sizeof(wicInt));
+	if (task -> vars == NULL || task -> stack.theStack == NULL)
+	{
+		printf("Out of memory starting a task!\n");
+		exit(5);
+	}
+	memcpy(task -> vars, vars, vmSlotCount * sizeof(wicInt));
+	if (argument != NULL)
+		task -> stack.theStack[++task -> stack.stackIndex] = *argument;
+	LOCK_INIT(&task -> lock);
+	handle = registerItem(&run -> tasks, task);
+	if (handle < 0)
+	{
+		LOCK_FREE(&task -> lock);
+		free(task -> stack.theStack);
+		free(task -> vars);
+		free(task);
+		return -1;
+	}
+	ATOMIC_ADD(&run -> active, 1);
+	pushTask(&currentWorker -> queue, task);
+	return handle;
+}
+
+// Function: spawnTask
+// Description: Runtime side of 'spawn' - starts a task at the target with the running task's variables as they are now and
+//                the argument on its stack.
+// Params: Target address, the argument (replaced with the new task's handle), source line.
+// Returns: 0, or -1 with an error printed if there are too many tasks.
+// Modifies: Value, run, queue.
+static int spawnTask(int target, wicInt* value, int line)
+{
+	int handle = newTask(currentWorker -> run, target, vmVariables, value);
+	if (handle < 0)
+	{
+		vmPrintf("\nToo many tasks on line %d!\n", line);
+		return -1;
+	}
+	*value = handle;
+	return 0;
+}
+
+// Function: joinTask
+// Description: Runtime side of 'join' - gives back what a task left on top of its stack when it halted, or waits for it to.
+// Params: The task's handle (replaced with the result), source line.
+// Returns: 0 with the result, 1 to wait, -1 with an error printed if there is no such task.
+// Modifies: Value, the task's joiners.
+static int joinTask(wicInt* value, int line)
+{
+	taskType* task = (taskType*) lookupItem(&currentWorker -> run -> tasks, *value);
+	int outcome = 0;
+	if (task == NULL)
+	{
+		vmPrintf("\nNo task " WIC_INT_FORMAT " to join on line %d!\n", *value, line);
+		return -1;
+	}
+	LOCK(&task -> lock);
+	if (task -> done)
+		*value = task -> result;
+	else
+		outcome = waitOn(&task -> joiners);
+	UNLOCK(&task -> lock);
+	return outcome;
+}
+
+// Function: createChannel
+// Description: Runtime side of 'chan' - makes a channel holding up to the given number of values (at least one).
+// Params: Capacity (replaced with the channel's handle), source line.
+// Returns: 0, or -1 with an error printed if there are too many channels.
+// Modifies: Value, run.
+static int createChannel(wicInt* value, int line)
+{
+	channelType* channel = (channelType*) calloc(1, sizeof(channelType));
+	int handle;
+	if (channel == NULL)
+	{
+		printf("Out of memory making a channel!\n");
+		exit(5);
+	}
+	channel -> capacity = *value > 1 ? (*value < TASK_CHUNK * TASK_CHUNK ? (int) *value : TASK_CHUNK * TASK_CHUNK) : 1;
+	channel -> values = (wicInt*) malloc(channel -> capacity * sizeof(wicInt));
+	if (channel -> values == NULL)
+	{
+		printf("Out of memory making a channel!\n");
+		exit(5);
+	}
+	LOCK_INIT(&channel -> lock);
+	handle = registerItem(&currentWorker -> run -> channels, channel);
+	if (handle < 0)
+	{
+		LOCK_FREE(&channel -> lock);
+		free(channel -> values);
+		free(channel);
+		vmPrintf("\nToo many channels on line %d!\n", line);
+		return -1;
+	}
+	*value = handle;
+	return 0;
+}
+
+// Function: sendValue
+// Description: Runtime side of 'send' - adds a value to a channel, waking a task waiting to receive, or waits while the
+//                channel is full.
+// Params: Channel handle, value, source line.
+// Returns: 0 once sent, 1 to wait, -1 with an error printed if there is no such channel.
+// Modifies: Channel.
+static int sendValue(wicInt handle, wicInt value, int line)
+{
+	channelType* channel = (channelType*) lookupItem(&currentWorker -> run -> channels, handle);
+	int outcome = 0;
+	if (channel == NULL)
+	{
+		vmPrintf("\nNo channel " WIC_INT_FORMAT " to send to on line %d!\n", handle, line);
+		return -1;
+	}
+	LOCK(&channel -> lock);
+	if (channel -> count == channel -> capacity)
+		outcome = waitOn(&channel -> senders);
+	else
+	{
+		channel -> values[(channel -> head + channel -> count++) % channel -> capacity] = value;
+		wakeFirst(&channel -> receivers);
+	}
+	UNLOCK(&channel -> lock);
+	return outcome;
+}
+
+// Function: receiveValue
+// Description: Runtime side of 'recv' - takes the oldest value in a channel, waking a task waiting to send, or waits while
+//                the channel is empty.
+// Params: Channel handle (replaced with the value), source line.
+// Returns: 0 with the value, 1 to wait, -1 with an error printed if there is no such channel.
+// Modifies: Value, channel.
+static int receiveValue(wicInt* value, int line)
+{
+	channelType* channel = (channelType*) lookupItem(&currentWorker -> run -> channels, *value);
+	int outcome = 0;
+	if (channel == NULL)
+	{
+		vmPrintf("\nNo channel " WIC_INT_FORMAT " to receive from on line %d!\n", *value, line);
+		return -1;
+	}
+	LOCK(&channel -> lock);
+	if (channel -> count == 0)
+		outcome = waitOn(&channel -> receivers);
+	else
+	{
+		*value = channel -> values[channel -> head];
+		channel -> head = (channel -> head + 1) % channel -> capacity;
+		channel -> count--;
+		wakeFirst(&channel -> senders);
+	}
+	UNLOCK(&channel -> lock);
+	return outcome;
+}
+
+// Function: taskGet
+// Description: Get callback of every worker's VM - reads the value from the program's input, one task at a time.
+// Params: Run, variable name, where to put the value.
+// Returns: 0 with the value, -1 at the end of the input.
+// Modifies: Value, the program's input.
+static int taskGet(void* context, const char* name, wicInt* value)
+{
+	taskRunType* run = (taskRunType*) context;
+	vmType* previous;
+	int outcome;
+	LOCK(&run -> ioLock);
+	previous = useVm(run -> program);
+	if (!currentVm -> noPrompts)
+	{
+		vmPrintf("Enter %s > ", name);
+		vmFlush();
+	}
+	outcome = vmReadInt(value);
+	useVm(previous);
+	UNLOCK(&run -> ioLock);
+	return outcome;
+}
+
+// Function: taskPut
+// Description: Put callback of every worker's VM - prints the value as the interpreter would, unless the program is quiet,
+//                on the program's output so that lines from different tasks never mix.
+// Params: Run, variable name, value.
+// Returns: None.
+// Modifies: The program's output.
+static void taskPut(void* context, const char* name, wicInt value)
+{
+	taskRunType* run = (taskRunType*) context;
+	vmType* previous;
+	LOCK(&run -> ioLock);
+	previous = useVm(run -> program);
+	if (!currentVm -> quiet)
+	{
+		vmWrite(name, (int) strlen(name));
+		vmWrite(" = ", 3);
+		vmWriteInt(value);
+		vmWrite("\n", 1);
+	}
+	useVm(previous);
+	UNLOCK(&run -> ioLock);
+}
+
+// Function: taskText
+// Description: Text callback of every worker's VM - passes error messages on to the program's output.
+// Params: Run, text, its length.
+// Returns: None.
+// Modifies: The program's output.
+static void taskText(void* context, const char* text, int length)
+{
+	taskRunType* run = (taskRunType*) context;
+	vmType* previous;
+	LOCK(&run -> ioLock);
+	previous = useVm(run -> program);
+	vmWrite(text, length);
+	useVm(previous);
+	UNLOCK(&run -> ioLock);
+}
+
+// Function: finishTask
+// Description: Records what a task that stopped left on top of its stack, and wakes every task waiting to join it. The run
+//                is over once the main task (handle 0) halts, or any task fails.
+// Params: Worker, task, 1 if it halted, 0 if it failed.
+// Returns: None.
+// Modifies: Task, run.
+static void finishTask(taskWorkerType* worker, taskType* task, int halted)
+{
+	taskRunType* run = worker -> run;
+	taskType* joiners;
+	LOCK(&task -> lock);
+	task -> done = 1;
+	task -> result = task -> stack.stackIndex > 0 ? task -> stack.theStack[task -> stack.stackIndex] : 0;
+	joiners = task -> joiners;
+	task -> joiners = NULL;
+	UNLOCK(&task -> lock);
+	while (joiners != NULL)
+	{
+		taskType* next = joiners -> nextWaiting;
+		wakeTask(joiners);
+		joiners = next;
+	}
+	if (!halted)
+		run -> failed = 1;
+	if (!halted || task == lookupItem(&run -> tasks, 0))
+		ATOMIC_STORE(&run -> finished, 1);
+	ATOMIC_ADD(&run -> active, -1);
+}
+
+// Function: runTask
+// Description: Runs a task for a quantum on the worker's VM, then queues it again, parks it, or finishes it, depending on
+//                how it stopped.
+// Params: Worker, task.
+// Returns: None.
+// Modifies: Task, run.
+static void runTask(taskWorkerType* worker, taskType* task)
+{
+	taskRunType* run = worker -> run;
+	int pc;
+	worker -> current = task;
+	worker -> waited = 0;
+	vmVariables = task -> vars;
+	vmStack = task -> stack;
+	currentVm -> budget = run -> quantum;
+	currentVm -> overflowPc = -1;
+	runTaskSlice(task -> pc);
+	task -> stack = vmStack;
+	task -> pc = pc = currentVm -> budgetPc;
+	worker -> slices++;
+	vmFlush();
+	if (worker -> waited)
+	{
+		if (ATOMIC_CAS(&task -> state, TASK_BLOCKING, TASK_PARKED))
+		{
+			worker -> parked++;
+			ATOMIC_ADD(&run -> active, -1);
+		}
+		else
+		{
+			// Woken while it was still stopping.
+			ATOMIC_STORE(&task -> state, TASK_RUNNING);
+			pushTask(&worker -> queue, task);
+		}
+	}
+	else if (currentVm -> budget < 0)
+		pushTask(&worker -> queue, task);
+	else if (currentVm -> overflowPc >= 0)
+	{
+		vmPrintf("\nInteger overflow on line %d!\n", vmCodeTab.instructions[currentVm -> overflowPc].line);
+		vmFlush();
+		finishTask(worker, task, 0);
+	}
+	else
+		finishTask(worker, task, vmCodeTab.instructions[pc].op == OP_HALT);
+}
+
+// Function: taskWorker
+// Description: Worker loop - runs tasks from its own queue, or stolen from another worker's, until the run is over. With
+//                nothing to run, and no task anywhere runnable, every task is waiting on another: a deadlock.
+// Params: Worker.
+// Returns: None.
+// Modifies: Tasks, run.
+static void taskWorker(taskWorkerType* worker)
+{
+	taskRunType* run = worker -> run;
+	taskType* task;
+	int i;
+	currentWorker = worker;
+	useVm(&worker -> vm);
+	while (!ATOMIC_LOAD(&run -> finished))
+	{
+		task = takeTask(&worker -> queue);
+		for (i = 0; task == NULL && i < run -> workerCount - 1; i++)
+		{
+			worker -> seed = worker -> seed * 1103515245 + 12345;
+			task = stealTask(&run -> workers[(worker -> id + 1 + (worker -> seed >> 16) % (run -> workerCount - 1))
+				% run -> workerCount].queue);
+			if (task != NULL)
+				worker -> stolen++;
+		}
+		if (task != NULL)
+			runTask(worker, task);
+		else if (ATOMIC_LOAD(&run -> active) == 0)
+		{
+			if (ATOMIC_CAS(&run -> finished, 0, 1))
+			{
+				vmPrintf("\nDeadlock: every task is waiting on a channel or a join!\n");
+				vmFlush();
+				run -> failed = 1;
+			}
+		}
+		else
+			YIELD();
+	}
+	useVm(NULL);
+	currentWorker = NULL;
+}
+
+#if defined(_WIN32)
+static DWORD WINAPI taskThread(LPVOID worker)
+{
+	taskWorker((taskWorkerType*) worker);
+	return 0;
+}
+#else
+static void* taskThread(void* worker)
+{
+	taskWorker((taskWorkerType*) worker);
+	return NULL;
+}
+#endif
+
+// Function: freeRegistry
+// Description: Frees every task or channel in a registry, and the registry's chunks.
+// Params: Registry, 1 for tasks, 0 for channels.
+// Returns: None.
+// Modifies: Registry.
+static void freeRegistry(registryType* registry, int tasks)
+{
+	long long i;
+	for (i = 0; i < registry -> count && i < (long long) TASK_CHUNK * TASK_CHUNKS; i++)
+	{
+		void* item = registry -> chunks[i / TASK_CHUNK][i % TASK_CHUNK];
+		if (item == NULL)
+			continue;
+		if (tasks)
+		{
+			taskType* task = (taskType*) item;
+			LOCK_FREE(&task -> lock);
+			free(task -> vars);
+			free(task -> stack.theStack);
+		}
+		else
+		{
+			channelType* channel = (channelType*) item;
+			LOCK_FREE(&channel -> lock);
+			free(channel -> values);
+		}
+		free(item);
+	}
+	for (i = 0; i < TASK_CHUNKS; i++)
+		free(registry -> chunks[i]);
+	LOCK_FREE(&registry -> lock);
+}
+
+// Function: runTaskPool
+// Description: Runs the current VM's program from the start as the main task, on the given number of worker threads, until
+//                the main task halts, a task fails, or every task is waiting on another. The calling thread works as worker
+//                0. The program's variables end up as the main task's were.
+// Params: Thread count, where to put the number of tasks, slices, tasks stolen and tasks parked.
+// Returns: 1 if the main task halted, 0 if the run failed.
+// Modifies: Variables, the program's output.
+static int runTaskPool(int threads, long long* counts)
+{
+	taskRunType run;
+	vmType* program = currentVm;
+	instructionTable loaded, code;
+	tableType symbols, labels;
+	wicInt* start;
+	taskType* first;
+	int count, slots, i, halted;
+#if defined(_WIN32)
+	HANDLE* handles;
+#else
+	pthread_t* handles;
+#endif
+	memset(&run, 0, sizeof(run));
+	run.program = program;
+	run.workerCount = threads;
+	run.quantum = TASK_QUANTUM;
+	run.depth = vmStack.capacity - 2;
+	run.workers = (taskWorkerType*) calloc(threads, sizeof(taskWorkerType));
+#if defined(_WIN32)
+	handles = (HANDLE*) malloc(threads * sizeof(HANDLE));
+#else
+	handles = (pthread_t*) malloc(threads * sizeof(pthread_t));
+#endif
+	if (run.workers == NULL || handles == NULL)
+	{
+		printf("Out of memory starting the tasks!\n");
+		exit(5);
+	}
+	LOCK_INIT(&run.ioLock);
+	LOCK_INIT(&run.tasks.lock);
+	LOCK_INIT(&run.channels.lock);
+	loaded = vmInstTab;
+	code = vmCodeTab;
+	symbols = vmSymbolTable;
+	labels = vmJumpTable;
+	start = vmVariables;
+	count = vmVariableCount;
+	slots = vmSlotCount;
+	for (i = 0; i < threads; i++)
+	{
+		taskWorkerType* worker = &run.workers[i];
+		worker -> run = &run;
+		worker -> id = i;
+		worker -> seed = (unsigned int) i * 2654435761u + 1;
+		worker -> queue.ring = (taskRingType*) malloc(sizeof(taskRingType));
+		if (worker -> queue.ring == NULL)
+		{
+			printf("Out of memory starting the tasks!\n");
+			exit(5);
+		}
+		worker -> queue.ring -> size = TASK_QUEUE;
+		worker -> queue.ring -> slots = (taskType**) malloc(TASK_QUEUE * sizeof(taskType*));
+		if (worker -> queue.ring -> slots == NULL)
+		{
+			printf("Out of memory starting the tasks!\n");
+			exit(5);
+		}
+		// Workers share the program's code, tables and arrays (which, unlike variables, are not copied per task), and stop
+		// on overflow unless it wraps - bignums cannot be budgeted.
+		useVm(&worker -> vm);
+		vmInstTab = loaded;
+		vmCodeTab = code;
+		vmSymbolTable = symbols;
+		vmJumpTable = labels;
+		vmVariableCount = count;
+		vmSlotCount = slots;
+		currentVm -> arrays = program -> arrays;
+		currentVm -> arrayCount = program -> arrayCount;
+		currentVm -> engine = ENGINE_SWITCH;
+		currentVm -> quiet = 1;
+		currentVm -> noPrompts = 1;
+		currentVm -> overflowMode = program -> overflowMode == OVERFLOW_WRAP ? OVERFLOW_WRAP : OVERFLOW_TRAP;
+		currentVm -> getCallback = taskGet;
+		currentVm -> putCallback = taskPut;
+		currentVm -> textCallback = taskText;
+		currentVm -> callbackContext = &run;
+	}
+
+	// The main task starts with the program's variables, on worker 0.
+	currentWorker = &run.workers[0];
+	newTask(&run, 0, start, NULL);
+	currentWorker = NULL;
+	useVm(program);
+	for (i = 1; i < threads; i++)
+	{
+#if defined(_WIN32)
+		handles[i] = CreateThread(NULL, 0, taskThread, &run.workers[i], 0, NULL);
+		if (handles[i] == NULL)
+#else
+		if (pthread_create(&handles[i], NULL, taskThread, &run.workers[i]) != 0)
+#endif
+		{
+			printf("Could not start task worker thread %d!\n", i);
+			exit(5);
+		}
+	}
+	taskWorker(&run.workers[0]);
+	for (i = 1; i < threads; i++)
+	{
+#if defined(_WIN32)
+		WaitForSingleObject(handles[i], INFINITE);
+		CloseHandle(handles[i]);
+#else
+		pthread_join(handles[i], NULL);
+#endif
+	}
+	useVm(program);
+
+	first = (taskType*) lookupItem(&run.tasks, 0);
+	memcpy(vmVariables, first -> vars, vmSlotCount * sizeof(wicInt));
+	halted = first -> done && !run.failed;
+	counts[0] = run.tasks.count;
+	counts[1] = counts[2] = counts[3] = 0;
+	for (i = 0; i < threads; i++)
+	{
+		taskWorkerType* worker = &run.workers[i];
+		int j;
+		counts[1] += worker -> slices;
+		counts[2] += worker -> stolen;
+		counts[3] += worker -> parked;
+		free(worker -> vm.outBuffer);
+		for (j = 0; j < worker -> queue.retiredCount; j++)
+		{
+			free(worker -> queue.retired[j] -> slots);
+			free(worker -> queue.retired[j]);
+		}
+		free(worker -> queue.ring -> slots);
+		free(worker -> queue.ring);
+	}
+	freeRegistry(&run.tasks, 1);
+	freeRegistry(&run.channels, 0);
+	LOCK_FREE(&run.ioLock);
+	free(handles);
+	free(run.workers);
+	return halted;
+}
+
+// Function: setTaskThreads
+// Description: Selects how many worker threads the task runtime runs programs on.
+// Params: Thread count, 0 for one per processor.
+// Returns: None.
+// Modifies: The current VM's task thread count.
+void setTaskThreads(int threads)
+{
+	currentVm -> taskThreads = threads > 0 ? threads : 0;
+}
+
+// Function: runTasks
+// Description: Runs the program on the task runtime, in place of an engine (see runEngine): the main task starts at address
+//                0 with the program's variables, and 'spawn' starts more, each with a copy of its spawner's variables and
+//                its argument on an otherwise empty stack. Every task runs on the switch engine a quantum at a time, and one
+//                that has to wait - to receive from an empty channel, send to a full one, or join a task still running -
+//                is parked until another task wakes it. The program is done when the main task halts, whatever the others
+//                are doing; an error in any task stops them all. Unless quiet, the final tables are the main task's, and
+//                are followed by how the tasks were scheduled.
+// Params: None.
+// Returns: None.
+// Modifies: Variables, the program's output.
+void runTasks()
+{
+	int threads = currentVm -> taskThreads > 0 ? currentVm -> taskThreads : batchCores();
+	long long counts[4];
+	if (runTaskPool(threads, counts) && !currentVm -> quiet)
+	{
+		halt();
+		vmPrintf("\nTasks: %lld on %d threads, %lld slices, %lld stolen, %lld parked\n", counts[0], threads, counts[1],
+			counts[2], counts[3]);
+	}
+	vmFlush();
+}
+
+// Function: runTaskScale
+// Description: Runs the program quietly on the task runtime with 1, 2, 4... threads up to the given count, from the same
+//                starting variables each time, and prints how long each took and the speedup over one thread.
+// Params: Most threads, 0 for one per processor.
+// Returns: 0 if every run halted, 3 if one failed.
+// Modifies: Variables.
+int runTaskScale(int threads)
+{
+	wicInt* start = (wicInt*) malloc((vmSlotCount > 0 ? vmSlotCount : 1) * sizeof(wicInt));
+	int wasQuiet = currentVm -> quiet;
+	double t0, seconds, base = 0.0;
+	long long counts[4];
+	int count, halted = 1;
+	if (start == NULL)
+	{
+		printf("Out of memory scaling the tasks!\n");
+		exit(5);
+	}
+	if (threads <= 0)
+		threads = batchCores();
+	memcpy(start, vmVariables, vmSlotCount * sizeof(wicInt));
+	currentVm -> quiet = 1;
+	printf("%8s %10s %8s %9s %9s %9s\n", "Threads", "Seconds", "Speedup", "Tasks", "Stolen", "Parked");
+	for (count = 1; halted; count = count * 2 < threads ? count * 2 : threads)
+	{
+		memcpy(vmVariables, start, vmSlotCount * sizeof(wicInt));
+		t0 = wallSeconds();
+		halted = runTaskPool(count, counts);
+		seconds = wallSeconds() - t0;
+		vmFlush();
+		if (seconds <= 0)
+			seconds = 1e-9;
+		if (base == 0.0)
+			base = seconds;
+		printf("%8d %10.4f %8.2f %9lld %9lld %9lld\n", count, seconds, base / seconds, counts[0], counts[2], counts[3]);
+		fflush(stdout);
+		if (count == threads)
+			break;
+	}
+	currentVm -> quiet = wasQuiet;
+	free(start);
+	return halted ? 0 : 3;
+}
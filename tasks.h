@@ -0,0 +1,10 @@
+#ifndef TASKS_H
+#define TASKS_H
+
+// Task runtime - runs a program with task instructions ('spawn', 'join', 'chan', 'send' and 'recv') as many tasks, each
+// with its own stack and variables, on a pool of worker threads that steal work from each other's lock-free queues.
+void runTasks();
+int runTaskScale(int threads);
+void setTaskThreads(int threads);
+
+#endif
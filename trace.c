@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "engine.h"
+#include "trace.h"
+#include "jit.h"
+
+// Times a loop header is jumped to before a trace is recorded for it.
+#define TRACE_HOT_LOOP 64
+// Longest trace recorded. Loops with more in one trip around, inner loops included, stay interpreted.
+#define TRACE_MAX_LENGTH 1024
+// Failed attempts after which a loop is left to the interpreter for good.
+#define TRACE_MAX_FAILURES 4
+
+// The current VM's tracing state (see tracerType).
+#define vmTraceLoopHeader (currentVm -> tracer.loopHeader)
+#define vmTraceLoopCounts (currentVm -> tracer.loopCounts)
+#define vmTraceFailures (currentVm -> tracer.failures)
+#define vmTraceCode (currentVm -> tracer.traces)
+#define vmTraceRecording (currentVm -> tracer.recording)
+#define vmTraceRecordPcs (currentVm -> tracer.recordPcs)
+#define vmTraceRecordDepths (currentVm -> tracer.recordDepths)
+#define vmTraceRecordLength (currentVm -> tracer.recordLength)
+
+// Function: stopRecording
+// Description: Stops recording a trace. If it failed, the loop waits as long again before the next attempt, and is given up
+//                on after TRACE_MAX_FAILURES of them.
+// Params: 1 if a trace was compiled, 0 if the attempt failed.
+// Returns: None.
+// Modifies: Tracing state.
+static void stopRecording(int compiled)
+{
+	if (compiled)
+	{
+		currentVm -> tracer.compiled++;
+	}
+	else
+	{
+		currentVm -> tracer.aborted++;
+		vmTraceLoopCounts[vmTraceRecording] = 0;
+		if (++vmTraceFailures[vmTraceRecording] >= TRACE_MAX_FAILURES)
+			vmTraceLoopHeader[vmTraceRecording] = 0;
+	}
+	vmTraceRecording = -1;
+}
+
+// Function: recordStep
+// Description: SWITCH_STEP hook while recording - adds the instruction about to run to the trace. Once execution is back at
+//                the loop header the trace is complete and is compiled. Recording is abandoned if the trace gets too long,
+//                reaches a halt, or the stack does not end up where the instructions say it should, or is deeper or shallower
+//                at the end of the loop than at the start.
+// Params: Address of the instruction about to run, current stack depth.
+// Returns: None.
+// Modifies: Tracing state, traces.
+static void recordStep(int pc, int depth)
+{
+	opcodeType op = pc < vmCodeTab.instructionCount ? vmCodeTab.instructions[pc].op : OP_END;
+	int needed;
+	if (vmTraceRecordLength > 0)
+	{
+		int last = vmTraceRecordPcs[vmTraceRecordLength - 1];
+		int expected = vmTraceRecordDepths[vmTraceRecordLength - 1] +
+			stackEffect(last < vmCodeTab.instructionCount ? vmCodeTab.instructions[last].op : OP_END, &needed);
+		if (depth != expected)
+		{
+			stopRecording(0);
+			return;
+		}
+	}
+	if (pc == vmTraceRecording && vmTraceRecordLength > 0)
+	{
+		stopRecording(depth == vmTraceRecordDepths[0]
+			&& compileTrace(vmTraceRecordPcs, vmTraceRecordDepths, vmTraceRecordLength, &vmTraceCode[pc]) == 0);
+		return;
+	}
+	// Array instructions are never compiled, so a loop that uses one is left to the interpreter.
+	if (op == OP_HALT || (op >= OP_ARRAY && op <= OP_ACOUNTGE) || vmTraceRecordLength == TRACE_MAX_LENGTH)
+	{
+		stopRecording(0);
+		return;
+	}
+	vmTraceRecordPcs[vmTraceRecordLength] = pc;
+	vmTraceRecordDepths[vmTraceRecordLength] = depth;
+	vmTraceRecordLength++;
+}
+
+// Function: loopBranch
+// Description: SWITCH_BRANCH hook - counts jumps to a loop header, and starts recording a trace once it is hot.
+// Params: Address jumped to, current stack depth.
+// Returns: 1 if the loop has a compiled trace that can be entered now, at this stack depth, otherwise 0.
+// Modifies: Tracing state.
+static int loopBranch(int pc, int depth)
+{
+	if (!vmTraceLoopHeader[pc] || vmTraceRecording >= 0)
+		return 0;
+	if (vmTraceCode[pc].code != NULL)
+		return vmTraceCode[pc].depth == depth && vmTraceCode[pc].maxDepth < vmStack.capacity;
+	if (++vmTraceLoopCounts[pc] >= TRACE_HOT_LOOP)
+	{
+		vmTraceRecording = pc;
+		vmTraceRecordLength = 0;
+	}
+	return 0;
+}
+
+// The switch engine, with the tracing hooks. A compiled trace runs until a guard fails or an operation overflows, then the
+// interpreter carries on from wherever the trace left off; a trace that stopped on a division by zero stops the engine.
+#define SWITCH_ENGINE static void runTraceEngine
+#define SWITCH_STEP() \
+	if (vmTraceRecording >= 0) \
+		recordStep(pc, (int) (sp - vmStack.theStack))
+#define SWITCH_BRANCH() \
+	if (loopBranch(pc, (int) (sp - vmStack.theStack))) \
+	{ \
+		SAVE_STACK(); \
+		currentVm -> tracer.entered++; \
+		pc = runTrace(&vmTraceCode[pc]); \
+		LOAD_STACK(); \
+		if (pc < 0) \
+			goto halted; \
+	}
+#define SWITCH_DONE()
+#include "switchEngine.h"
+
+// Function: runTraced
+// Description: Runs codeTab on the tracing engine. Every address a j, jf or jfXX jumps back to is a loop header; once a loop
+//                header has been jumped to TRACE_HOT_LOOP times, the instructions that run until it is reached again are
+//                recorded and compiled by the JIT (see compileTrace), which specializes them on the branch directions seen.
+//                From then on, jumps to the header run the trace instead. Traces are thrown away when the engine stops.
+// Params: Address to start at.
+// Returns: None.
+// Modifies: Stack, variables, tracing state.
+void runTraced(int pc)
+{
+	int count = vmCodeTab.instructionCount;
+	int i;
+	memset(&currentVm -> tracer, 0, sizeof(tracerType));
+	vmTraceLoopHeader = (char*) calloc(count + 1, 1);
+	vmTraceLoopCounts = (int*) calloc(count + 1, sizeof(int));
+	vmTraceFailures = (int*) calloc(count + 1, sizeof(int));
+	vmTraceCode = (jitTraceType*) calloc(count + 1, sizeof(jitTraceType));
+	vmTraceRecordPcs = (int*) malloc(TRACE_MAX_LENGTH * sizeof(int));
+	vmTraceRecordDepths = (int*) malloc(TRACE_MAX_LENGTH * sizeof(int));
+	if (vmTraceLoopHeader == NULL || vmTraceLoopCounts == NULL || vmTraceFailures == NULL || vmTraceCode == NULL
+		|| vmTraceRecordPcs == NULL || vmTraceRecordDepths == NULL)
+	{
+		printf("Out of memory starting the tracing engine!\n");
+		exit(5);
+	}
+	for (i = 0; i < count; i++)
+	{
+		opcodeType op = vmCodeTab.instructions[i].op;
+		if ((op == OP_J || op == OP_JF || (op >= OP_JFEQ && op <= OP_JFGE)) && vmCodeTab.instructions[i].arg.target <= i)
+			vmTraceLoopHeader[vmCodeTab.instructions[i].arg.target] = 1;
+	}
+	vmTraceRecording = -1;
+	runTraceEngine(pc);
+	for (i = 0; i <= count; i++)
+		freeTrace(&vmTraceCode[i]);
+	free(vmTraceLoopHeader);
+	free(vmTraceLoopCounts);
+	free(vmTraceFailures);
+	free(vmTraceCode);
+	free(vmTraceRecordPcs);
+	free(vmTraceRecordDepths);
+	vmTraceLoopHeader = NULL;
+	vmTraceLoopCounts = NULL;
+	vmTraceFailures = NULL;
+	vmTraceCode = NULL;
+	vmTraceRecordPcs = NULL;
+	vmTraceRecordDepths = NULL;
+}
+
+// Function: printTraceReport
+// Description: Prints how the last run on the tracing engine went.
+// Params: None.
+// Returns: None.
+// Modifies: None.
+void printTraceReport()
+{
+	vmPrintf("\nTraces: %d compiled, %d abandoned, entered %lld times\n", currentVm -> tracer.compiled,
+		currentVm -> tracer.aborted, currentVm -> tracer.entered);
+}
@@ -0,0 +1,31 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include "jit.h"
+
+// What the tracing engine keeps while it runs, one entry per codeTab address plus the OP_END past the end.
+typedef struct
+{
+	// 1 where a jump goes backwards - a loop header.
+	char* loopHeader;
+	// Times each loop header has been jumped to since its last trace attempt, and how many attempts have failed.
+	int* loopCounts;
+	int* failures;
+	// Compiled trace for each loop header, if it has one.
+	jitTraceType* traces;
+	// Loop header being recorded (-1 when not recording), and the addresses and stack depths recorded so far.
+	int recording;
+	int* recordPcs;
+	int* recordDepths;
+	int recordLength;
+	// Counters for the last run.
+	int compiled;
+	int aborted;
+	long long entered;
+} tracerType;
+
+// Tracing engine - the switch engine with hooks that find hot loops, record one trip around each and run it compiled by the
+// JIT from then on (see trace.c).
+void runTraced(int pc);
+void printTraceReport();
+
+#endif
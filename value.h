@@ -0,0 +1,67 @@
+#ifndef VALUE_H
+#define VALUE_H
+#include <limits.h>
+
+// Type of every WIC value - variables, the stack and immediates. 32 bits by default; building with WIC_INT64 defined makes
+// them 64 bits. Every engine, the JIT included, is specialized on the width, so it is a build option rather than a run time
+// one. wicUnsigned is the unsigned type of the same width, for arithmetic that has to wrap around without undefined
+// behaviour.
+#if defined(WIC_INT64)
+typedef long long wicInt;
+typedef unsigned long long wicUnsigned;
+#define WIC_INT_MIN LLONG_MIN
+#define WIC_INT_MAX LLONG_MAX
+#define WIC_INT_FORMAT "%lld"
+#else
+typedef int wicInt;
+typedef unsigned int wicUnsigned;
+#define WIC_INT_MIN INT_MIN
+#define WIC_INT_MAX INT_MAX
+#define WIC_INT_FORMAT "%d"
+#endif
+
+// What add, sub, mult and div do when the result does not fit in a wicInt (see setOverflowMode). Trapping is the default.
+typedef enum
+{
+	// Stop with an 'Integer overflow' error, as the engines do for stack underflow.
+	OVERFLOW_TRAP = 0,
+	// Wrap around, two's complement, as the engines always used to.
+	OVERFLOW_WRAP,
+	// Carry on from the instruction that overflowed with arbitrary-precision values (see bigint.c).
+	OVERFLOW_PROMOTE
+} overflowModeType;
+
+// Checked arithmetic: store the wrapped result of 'a op b' through r, and give 1 if it overflowed, 0 if it is exact. GCC
+// and Clang have builtins that compile to the operation plus a jump on the overflow flag; elsewhere the same is worked out
+// in portable C.
+#if defined(__GNUC__)
+#define ADD_OVERFLOWS(a, b, r) __builtin_add_overflow(a, b, r)
+#define SUB_OVERFLOWS(a, b, r) __builtin_sub_overflow(a, b, r)
+#define MULT_OVERFLOWS(a, b, r) __builtin_mul_overflow(a, b, r)
+#else
+static __inline int ADD_OVERFLOWS(wicInt a, wicInt b, wicInt* r)
+{
+	*r = (wicInt) ((wicUnsigned) a + (wicUnsigned) b);
+	return ((a ^ *r) & (b ^ *r)) < 0;
+}
+
+static __inline int SUB_OVERFLOWS(wicInt a, wicInt b, wicInt* r)
+{
+	*r = (wicInt) ((wicUnsigned) a - (wicUnsigned) b);
+	return ((a ^ b) & (a ^ *r)) < 0;
+}
+
+static __inline int MULT_OVERFLOWS(wicInt a, wicInt b, wicInt* r)
+{
+	*r = (wicInt) ((wicUnsigned) a * (wicUnsigned) b);
+	if ((a == -1 && b == WIC_INT_MIN) || (b == -1 && a == WIC_INT_MIN))
+		return 1;
+	return a != 0 && *r / a != b;
+}
+#endif
+// 'a / b' overflows only for the most negative value over -1. The caller has already ruled out b == 0.
+#define DIV_OVERFLOWS(a, b) ((b) == -1 && (a) == WIC_INT_MIN)
+// Quotient of a / b for b != 0, wrapping the one case that overflows instead of trapping on it as the hardware does.
+#define WRAPPED_DIV(a, b) ((b) == -1 ? (wicInt) (0 - (wicUnsigned) (a)) : (a) / (b))
+
+#endif
@@ -0,0 +1,421 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include "vm.h"
+
+// VM used by threads that never pick one.
+static vmType defaultVm;
+
+VM_THREAD_LOCAL vmType* currentVm = &defaultVm;
+
+// Where an allocation failure on this thread unwinds to, or NULL to exit (see vmCatchOutOfMemory).
+static VM_THREAD_LOCAL vmRecoveryType* recovery;
+
+// Function: createVm
+// Description: Allocates a VM with empty tables and an empty stack, ready for a program to be loaded into it. The calling
+//                thread stays on its current VM.
+// Params: None.
+// Returns: The new VM.
+// Modifies: None.
+vmType* createVm()
+{
+	vmType* vm = (vmType*) calloc(1, sizeof(vmType));
+	vmType* previous;
+	if (vm == NULL)
+		vmOutOfMemory("Out of memory creating a VM!\n");
+	vm -> engine = ENGINE_SWITCH;
+	vm -> overflowMode = OVERFLOW_TRAP;
+	vm -> overflowPc = -1;
+	previous = useVm(vm);
+	initialize();
+	useVm(previous);
+	return vm;
+}
+
+// Function: destroyVm
+// Description: Frees a VM and everything its program allocated. It must not be the current VM of any other thread. Files set
+//                with setVmFiles are left open.
+// Params: VM to free.
+// Returns: None.
+// Modifies: None.
+void destroyVm(vmType* vm)
+{
+	vmType* previous;
+	if (vm == NULL)
+		return;
+	previous = useVm(vm);
+	vmFlush();
+	free(vm -> outBuffer);
+	free(vmInstTab.instructions);
+	free(vmInstTab.depths);
+	free(vmCodeTab.instructions);
+	free(vmCodeTab.depths);
+	free(vmVariables);
+	free(vm -> constantBuckets);
+	releaseArrays();
+	free(vmStack.theStack);
+	freeTable(&vmSymbolTable);
+	freeTable(&vmJumpTable);
+	freeTable(&vmArrayTable);
+	freeInternPool(&vm -> internPool);
+	releaseSource(&vm -> cache);
+	free(vm -> keptSource.text);
+	free(vm -> keptSource.lines);
+	free(vm -> profiler.entries);
+	free(vm -> registerProgram.code);
+	// Destroying the calling thread's own VM leaves it on the default VM.
+	useVm(previous != vm ? previous : NULL);
+	free(vm);
+}
+
+// Function: useVm
+// Description: Makes a VM the calling thread's current VM. Everything the interpreter does on this thread from now on - loading,
+//                optimizing, running - works on it.
+// Params: VM to use, or NULL for the default VM.
+// Returns: The VM that was current before.
+// Modifies: The calling thread's current VM.
+vmType* useVm(vmType* vm)
+{
+	vmType* previous = currentVm;
+	currentVm = vm != NULL ? vm : &defaultVm;
+	return previous;
+}
+
+// Function: setVmFiles
+// Description: Points the current VM's 'get' input and program output at files instead of stdin/stdout. Output already
+//                buffered goes to the old file first.
+// Params: Input and output files, NULL for stdin/stdout.
+// Returns: None.
+// Modifies: Current VM.
+void setVmFiles(FILE* input, FILE* output)
+{
+	vmFlush();
+	if (input != currentVm -> input)
+	{
+		currentVm -> inCursor = NULL;
+		currentVm -> inCarryLength = 0;
+		currentVm -> inFailed = 0;
+	}
+	currentVm -> input = input;
+	currentVm -> output = output;
+}
+
+// Function: vmInput
+// Description: Reports where the current VM's 'get' reads from.
+// Params: None.
+// Returns: Input file.
+// Modifies: None.
+FILE* vmInput()
+{
+	return currentVm -> input != NULL ? currentVm -> input : stdin;
+}
+
+// Function: vmOutput
+// Description: Reports where the current VM's program output goes.
+// Params: None.
+// Returns: Output file.
+// Modifies: None.
+FILE* vmOutput()
+{
+	return currentVm -> output != NULL ? currentVm -> output : stdout;
+}
+
+// Function: setPrompts
+// Description: Turns the 'Enter X >' prompt printed before each 'get' on or off. It is on unless turned off.
+// Params: 1 to prompt, 0 not to.
+// Returns: None.
+// Modifies: Current VM.
+void setPrompts(int on)
+{
+	currentVm -> noPrompts = !on;
+}
+
+// Function: setInputValues
+// Description: Gives 'get' a list of values to take, in order, instead of reading them from the input. Once they run out
+//                'get' sees the end of the input.
+// Params: Values, how many there are. NULL goes back to reading the input.
+// Returns: None.
+// Modifies: Current VM.
+void setInputValues(wicInt* values, int count)
+{
+	currentVm -> inValues = values;
+	currentVm -> inValueCount = count;
+	currentVm -> inValuesTaken = 0;
+}
+
+// Function: vmWrite
+// Description: Adds text to the current VM's output buffer. Nothing reaches the output file until the buffer fills or vmFlush
+//                is called, so a program printing a value at a time costs a copy per 'put' rather than a trip through stdio.
+// Params: Text, its length.
+// Returns: None.
+// Modifies: Current VM's output buffer.
+void vmWrite(const char* text, int length)
+{
+	if (currentVm -> outBuffer == NULL)
+	{
+		currentVm -> outBuffer = (char*) malloc(VM_OUTPUT_BUFFER);
+		if (currentVm -> outBuffer == NULL)
+			vmOutOfMemory("Out of memory buffering output!\n");
+	}
+	if (currentVm -> outUsed + length > VM_OUTPUT_BUFFER)
+		vmFlush();
+	if (length > VM_OUTPUT_BUFFER)
+	{
+		if (currentVm -> textCallback != NULL)
+			currentVm -> textCallback(currentVm -> callbackContext, text, length);
+		else
+			fwrite(text, 1, length, vmOutput());
+		return;
+	}
+	memcpy(currentVm -> outBuffer + currentVm -> outUsed, text, length);
+	currentVm -> outUsed += length;
+}
+
+// Function: vmWriteInt
+// Description: Adds an integer, in decimal, to the current VM's output buffer without going through printf.
+// Params: Value.
+// Returns: None.
+// Modifies: Current VM's output buffer.
+void vmWriteInt(wicInt value)
+{
+	char digits[24];
+	char* p = digits + sizeof(digits);
+	// Negated as unsigned so the most negative value does not overflow.
+	wicUnsigned u = value < 0 ? 0u - (wicUnsigned) value : (wicUnsigned) value;
+	do
+	{
+		*--p = (char) ('0' + u % 10);
+		u /= 10;
+	} while (u != 0);
+	if (value < 0)
+		*--p = '-';
+	vmWrite(p, (int) (digits + sizeof(digits) - p));
+}
+
+// Function: vmPrintf
+// Description: printf into the current VM's output buffer. Lines longer than VM_PRINT_MAX are cut short; use vmWrite for text
+//                that may be long.
+// Params: Format and arguments, as printf.
+// Returns: None.
+// Modifies: Current VM's output buffer.
+void vmPrintf(const char* format, ...)
+{
+	char line[VM_PRINT_MAX];
+	int length;
+	va_list args;
+	va_start(args, format);
+	length = vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+	if (length < 0)
+		return;
+	if (length >= (int) sizeof(line))
+		length = sizeof(line) - 1;
+	vmWrite(line, length);
+}
+
+// Function: vmReport
+// Description: vmPrintf for problems found while loading a program, written out (or handed to the VM's text callback) at
+//                once, since the caller usually gives up straight after.
+// Params: Format and arguments, as printf.
+// Returns: None.
+// Modifies: Current VM's output buffer.
+void vmReport(const char* format, ...)
+{
+	char line[VM_PRINT_MAX];
+	int length;
+	va_list args;
+	va_start(args, format);
+	length = vsnprintf(line, sizeof(line), format, args);
+	va_end(args);
+	if (length < 0)
+		return;
+	if (length >= (int) sizeof(line))
+		length = sizeof(line) - 1;
+	vmWrite(line, length);
+	vmFlush();
+}
+
+// Function: vmFlush
+// Description: Writes out everything in the current VM's output buffer, or hands it to the VM's text callback. Called when
+//                the program halts or the engine stops, and before 'get' waits for input.
+// Params: None.
+// Returns: None.
+// Modifies: Current VM's output buffer.
+void vmFlush()
+{
+	if (currentVm -> textCallback != NULL)
+	{
+		if (currentVm -> outUsed > 0)
+			currentVm -> textCallback(currentVm -> callbackContext, currentVm -> outBuffer, currentVm -> outUsed);
+		currentVm -> outUsed = 0;
+		return;
+	}
+	if (currentVm -> outUsed > 0)
+		fwrite(currentVm -> outBuffer, 1, currentVm -> outUsed, vmOutput());
+	currentVm -> outUsed = 0;
+	fflush(vmOutput());
+}
+
+// Function: vmCatchOutOfMemory
+// Description: Has allocation failures on the calling thread longjmp to the recovery's target, with their message in it,
+//                instead of exiting. Whatever was being built is left half done, to be thrown away by the catcher.
+// Params: Recovery with its target set by setjmp, or NULL to go back to exiting.
+// Returns: The recovery that was in place before, for the catcher to put back when it is done.
+// Modifies: The calling thread's recovery.
+vmRecoveryType* vmCatchOutOfMemory(vmRecoveryType* caught)
+{
+	vmRecoveryType* previous = recovery;
+	recovery = caught;
+	return previous;
+}
+
+// Function: vmOutOfMemory
+// Description: Gives up on an allocation that failed. Unless the calling thread catches it (see vmCatchOutOfMemory), the
+//                message is printed and the process exits with code 5. Does not return.
+// Params: Message format and arguments, as printf.
+// Returns: None.
+// Modifies: Exits, or unwinds to the thread's recovery.
+void vmOutOfMemory(const char* format, ...)
+{
+	vmRecoveryType* caught = recovery;
+	va_list args;
+	va_start(args, format);
+	if (caught != NULL)
+	{
+		vsnprintf(caught -> message, sizeof(caught -> message), format, args);
+		va_end(args);
+		// Caught once: the catcher decides what happens to the next failure.
+		recovery = NULL;
+		longjmp(caught -> target, 1);
+	}
+	vprintf(format, args);
+	va_end(args);
+	exit(5);
+}
+
+// Function: isInputSeparator
+// Description: Checks whether a character separates values in 'get' input - white space or a comma.
+// Params: Character.
+// Returns: 1 if it does, 0 otherwise.
+// Modifies: None.
+static int isInputSeparator(char c)
+{
+	return isspace((unsigned char) c) || c == ',';
+}
+
+// Function: readInputChunk
+// Description: Reads the next line of the current VM's input into its input line - or as much of it as fits, after any word
+//                held back from the last chunk. When the chunk stops part way through a word, the word is held back in turn,
+//                so a value is never split in two.
+// Params: None.
+// Returns: 0, or -1 at the end of the input.
+// Modifies: The current VM's input line.
+static int readInputChunk()
+{
+	char* line = currentVm -> inLine;
+	int carried = currentVm -> inCarryLength;
+	int length, start;
+	if (carried > 0)
+	{
+		line[currentVm -> inCarryAt] = currentVm -> inCarryChar;
+		memmove(line, line + currentVm -> inCarryAt, carried);
+		currentVm -> inCarryLength = 0;
+	}
+	if (fgets(line + carried, VM_INPUT_LINE - carried, vmInput()) == NULL)
+	{
+		if (carried == 0)
+			return -1;
+		line[carried] = '\0';
+	}
+	currentVm -> inCursor = line;
+	length = carried + (int) strlen(line + carried);
+	if (length < VM_INPUT_LINE - 1 || line[length - 1] == '\n')
+		return 0;
+	for (start = length; start > 0 && !isInputSeparator(line[start - 1]); start--)
+		;
+	// A word filling the whole buffer is far too long to be a value, and is read as it is.
+	if (start > 0 && start < length)
+	{
+		currentVm -> inCarryAt = start;
+		currentVm -> inCarryLength = length - start;
+		currentVm -> inCarryChar = line[start];
+		line[start] = '\0';
+	}
+	return 0;
+}
+
+// Function: vmReadInt
+// Description: Reads the next integer from the current VM's input for 'get' - or takes it from the values given to
+//                setInputValues. Input is read a line at a time and values are picked out of the line, so any number of
+//                values may share a line, separated by white space or commas. A word that is not a number, or a number too
+//                large for a wicInt, is reported and ends the input: nothing more is read from it.
+// Params: Where to put the value.
+// Returns: 0 on success, -1 at the end of the input (the value is left alone).
+// Modifies: Value, the current VM's input line.
+int vmReadInt(wicInt* value)
+{
+	char* end;
+	char* wordEnd;
+	long long parsed;
+	if (currentVm -> inValues != NULL)
+	{
+		if (currentVm -> inValuesTaken == currentVm -> inValueCount)
+			return -1;
+		*value = currentVm -> inValues[currentVm -> inValuesTaken++];
+		return 0;
+	}
+	if (currentVm -> inFailed)
+		return -1;
+	for (;;)
+	{
+		char* p = currentVm -> inCursor;
+		while (p != NULL && isInputSeparator(*p))
+			p++;
+		if (p == NULL || *p == '\0')
+		{
+			if (readInputChunk() != 0)
+			{
+				currentVm -> inCursor = NULL;
+				return -1;
+			}
+			continue;
+		}
+		for (wordEnd = p; *wordEnd != '\0' && !isInputSeparator(*wordEnd); wordEnd++)
+			;
+		currentVm -> inCursor = wordEnd;
+		errno = 0;
+		parsed = strtoll(p, &end, 10);
+		if (end != wordEnd || errno == ERANGE || parsed < WIC_INT_MIN || parsed > WIC_INT_MAX)
+		{
+			vmPrintf("\nThe input '%.*s' is %s!\n", wordEnd - p > 32 ? 32 : (int) (wordEnd - p), p,
+				end != wordEnd ? "not a number" : "too large");
+			currentVm -> inFailed = 1;
+			currentVm -> inCursor = NULL;
+			return -1;
+		}
+		currentVm -> valuesRead++;
+		*value = (wicInt) parsed;
+		return 0;
+	}
+}
+
+// Function: wallSeconds
+// Description: Reads a monotonic wall clock.
+// Params: None.
+// Returns: Seconds since an arbitrary start.
+// Modifies: None.
+double wallSeconds()
+{
+#if !defined(_WIN32)
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+#else
+	// clock() measures wall time on Windows.
+	return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
@@ -0,0 +1,158 @@
+#ifndef VM_H
+#define VM_H
+#include <stdio.h>
+#include <setjmp.h>
+#include "instructions.h"
+#include "stack.h"
+#include "table.h"
+#include "loader.h"
+#include "profiler.h"
+#include "regvm.h"
+#include "dataflow.h"
+#include "trace.h"
+#include "checkpoint.h"
+#include "array.h"
+
+// Size of a VM's output buffer, the longest vmPrintf line, and the longest line of 'get' input.
+#define VM_OUTPUT_BUFFER (1 << 16)
+#define VM_PRINT_MAX 1024
+#define VM_INPUT_LINE 4096
+
+// Callbacks a VM's 'get', 'put' and other output can be handed to instead of its files (see libwic.c). A get callback
+// returns 0 with the value, -1 at the end of the input, or 1 if the value is not there yet (see inputBlocked).
+typedef int (*vmGetCallbackType)(void* context, const char* name, wicInt* value);
+typedef void (*vmPutCallbackType)(void* context, const char* name, wicInt value);
+typedef void (*vmTextCallbackType)(void* context, const char* text, int length);
+
+// Thread-local storage class for the current VM pointer.
+#if defined(_MSC_VER)
+#define VM_THREAD_LOCAL __declspec(thread)
+#else
+#define VM_THREAD_LOCAL __thread
+#endif
+
+// Where running out of memory on a thread goes instead of ending the process, and what was being allocated (see
+// vmOutOfMemory). An embedder's call into the interpreter catches it so that it fails rather than exiting the host.
+typedef struct
+{
+	jmp_buf target;
+	char message[VM_PRINT_MAX];
+} vmRecoveryType;
+
+// Everything one running WIC program owns. All of the interpreter works on the current VM of the calling thread (see useVm),
+// so any number of programs can be loaded and run at once, one per thread, without sharing anything.
+typedef struct
+{
+	// The program as loaded, one instruction per source line, and the program the engines actually execute. The optimizer
+	// builds codeTab from instTab; without it codeTab is a straight copy.
+	instructionTable instTab;
+	instructionTable codeTab;
+	// Variable storage. resolveProgram assigns every symbol a slot in this array; the symbol table maps names to slots.
+	// Slots from variableCount up to slotCount hold constants for superinstructions, and slotCapacity is how many the array
+	// has room for. constantBuckets indexes the constants by value (see constantSlot): open addressing with linear probing,
+	// each bucket holding a slot + 1, or 0 if empty. constantBucketCount is a power of two, kept more than twice the
+	// number of constants.
+	wicInt* variables;
+	int variableCount;
+	int slotCount;
+	int slotCapacity;
+	int* constantBuckets;
+	int constantBucketCount;
+	stack stack;
+	tableType symbolTable;
+	tableType jumpTable;
+	// Array variables, numbered by resolveProgram in the order the program first names them. The array table maps names to
+	// numbers (see array.c).
+	tableType arrayTable;
+	arrayType* arrays;
+	int arrayCount;
+	internPoolType internPool;
+	// Engine used by runInterpreter, and whether 'put' and the tables on halt are suppressed (see setQuiet).
+	engineType engine;
+	int quiet;
+	// Threads the task runtime runs a program with task instructions on, 0 for one per processor (see tasks.c).
+	int taskThreads;
+	// What arithmetic does when a result does not fit (see setOverflowMode), and the address of the instruction an engine
+	// stopped in front of because it overflowed, or -1.
+	overflowModeType overflowMode;
+	int overflowPc;
+	// Where 'get' reads and everything the program prints goes. NULL means stdin/stdout.
+	FILE* input;
+	FILE* output;
+	// Set by setPrompts(0): 'get' reads without printing 'Enter X >' first.
+	int noPrompts;
+	// Program output not yet written to the output file (see vmWrite), allocated on first use.
+	char* outBuffer;
+	int outUsed;
+	// Line of input 'get' is reading values from, and how far it has got. A line too long for the buffer is read in chunks,
+	// and a word cut off at the end of one is held back (its offset and length) to be joined with the start of the next.
+	// inFailed is set once the input held something that is not a value, and nothing more is read from it.
+	char inLine[VM_INPUT_LINE];
+	char* inCursor;
+	int inCarryAt;
+	int inCarryLength;
+	char inCarryChar;
+	int inFailed;
+	// Values 'get' takes instead of reading the input, when set (see setInputValues), and how many it has taken.
+	wicInt* inValues;
+	int inValueCount;
+	int inValuesTaken;
+	// Values 'get' has read from the input, so that a resumed run can skip them (see checkpoint.c).
+	long long valuesRead;
+	// When set, 'get' asks getCallback for its values, 'put' hands them to putCallback, and the rest of the output goes to
+	// textCallback whenever it would be written out, rather than anything touching the files.
+	vmGetCallbackType getCallback;
+	vmPutCallbackType putCallback;
+	vmTextCallbackType textCallback;
+	void* callbackContext;
+	// Instructions the budgeted engine may still run, and where it stopped (see libwic.c). inputBlocked is set when the get
+	// callback had no value yet, which stops the budgeted engine just past that 'get'.
+	long long budget;
+	int budgetPc;
+	int inputBlocked;
+	keptSourceType keptSource;
+	// Bytecode cache the program was loaded from (see cache.c). Operands and table keys point into it, so it stays mapped
+	// until the next program is loaded.
+	sourceTextType cache;
+	profileType profiler;
+	registerProgramType registerProgram;
+	tracerType tracer;
+	// What the dataflow optimizer did to the program (see dataflow.c).
+	foldReportType foldReport;
+	checkpointType checkpoint;
+} vmType;
+
+// VM the calling thread is working on. Every thread starts out on a shared default VM, which is all a single program needs.
+extern VM_THREAD_LOCAL vmType* currentVm;
+
+// The current VM's state. Every macro that stands for a field of currentVm, here and in the other files, starts with
+// vm so it cannot be mistaken for a global or shadowed by a local.
+#define vmInstTab (currentVm -> instTab)
+#define vmCodeTab (currentVm -> codeTab)
+#define vmVariables (currentVm -> variables)
+#define vmVariableCount (currentVm -> variableCount)
+#define vmSlotCount (currentVm -> slotCount)
+#define vmStack (currentVm -> stack)
+#define vmSymbolTable (currentVm -> symbolTable)
+#define vmJumpTable (currentVm -> jumpTable)
+#define vmArrayTable (currentVm -> arrayTable)
+
+vmType* createVm();
+void destroyVm(vmType* vm);
+vmType* useVm(vmType* vm);
+void setVmFiles(FILE* input, FILE* output);
+FILE* vmInput();
+FILE* vmOutput();
+void setPrompts(int on);
+void setInputValues(wicInt* values, int count);
+void vmWrite(const char* text, int length);
+void vmWriteInt(wicInt value);
+void vmPrintf(const char* format, ...);
+void vmReport(const char* format, ...);
+void vmFlush();
+vmRecoveryType* vmCatchOutOfMemory(vmRecoveryType* recovery);
+void vmOutOfMemory(const char* format, ...);
+int vmReadInt(wicInt* value);
+double wallSeconds();
+
+#endif
@@ -0,0 +1,397 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "wicc.h"
+#include "instructions.h"
+#include "table.h"
+
+// The C type, and the suffix for literals outside int range, of WIC values in the generated code - the same width as here.
+#if defined(WIC_INT64)
+#define VALUE_TYPE "long long"
+#define VALUE_SUFFIX "LL"
+#else
+#define VALUE_TYPE "int"
+#define VALUE_SUFFIX ""
+#endif
+
+// Arithmetic for the generated code, written ahead of main. ADD, SUB, MULT and DIV(r, a, b, line) set r to a op b, or
+// print the engines' error and stop. The checks are those of value.h; the wrapping versions follow.
+static const char* checkedArithmetic =
+	"#if defined(__GNUC__)\n"
+	"#define ADD_OVERFLOWS(a, b, r) __builtin_add_overflow(a, b, r)\n"
+	"#define SUB_OVERFLOWS(a, b, r) __builtin_sub_overflow(a, b, r)\n"
+	"#define MULT_OVERFLOWS(a, b, r) __builtin_mul_overflow(a, b, r)\n"
+	"#else\n"
+	"static int ADD_OVERFLOWS(wicInt a, wicInt b, wicInt* r)\n{\n"
+	"\t*r = (wicInt) ((wicUnsigned) a + (wicUnsigned) b);\n\treturn ((a ^ *r) & (b ^ *r)) < 0;\n}\n\n"
+	"static int SUB_OVERFLOWS(wicInt a, wicInt b, wicInt* r)\n{\n"
+	"\t*r = (wicInt) ((wicUnsigned) a - (wicUnsigned) b);\n\treturn ((a ^ b) & (a ^ *r)) < 0;\n}\n\n"
+	"static int MULT_OVERFLOWS(wicInt a, wicInt b, wicInt* r)\n{\n"
+	"\t*r = (wicInt) ((wicUnsigned) a * (wicUnsigned) b);\n"
+	"\tif ((a == -1 && b == WIC_MIN) || (b == -1 && a == WIC_MIN))\n\t\treturn 1;\n"
+	"\treturn a != 0 && *r / a != b;\n}\n"
+	"#endif\n"
+	"#define OVERFLOWED(line) { printf(\"\\nInteger overflow on line %d!\\n\", line); goto done; }\n"
+	"#define ADD(r, a, b, line) do { if (ADD_OVERFLOWS(a, b, &r)) OVERFLOWED(line) } while (0)\n"
+	"#define SUB(r, a, b, line) do { if (SUB_OVERFLOWS(a, b, &r)) OVERFLOWED(line) } while (0)\n"
+	"#define MULT(r, a, b, line) do { if (MULT_OVERFLOWS(a, b, &r)) OVERFLOWED(line) } while (0)\n"
+	"#define DIV(r, a, b, line) do { DIVISOR(b, line) if ((b) == -1 && (a) == WIC_MIN) OVERFLOWED(line) r = (a) / (b); } while (0)\n";
+static const char* wrappingArithmetic =
+	"#define ADD(r, a, b, line) r = (wicInt) ((wicUnsigned) (a) + (wicUnsigned) (b))\n"
+	"#define SUB(r, a, b, line) r = (wicInt) ((wicUnsigned) (a) - (wicUnsigned) (b))\n"
+	"#define MULT(r, a, b, line) r = (wicInt) ((wicUnsigned) (a) * (wicUnsigned) (b))\n"
+	"#define DIV(r, a, b, line) do { DIVISOR(b, line) r = (b) == -1 ? (wicInt) (0 - (wicUnsigned) (a)) : (a) / (b); } while (0)\n";
+
+// Function: writeString
+// Description: Writes text as a C string literal.
+// Params: Output file, text.
+// Returns: None.
+// Modifies: Output file.
+static void writeString(FILE* out, const char* text)
+{
+	fputc('"', out);
+	for (; *text != '\0'; text++)
+	{
+		if (*text == '"' || *text == '\\')
+			fputc('\\', out);
+		fputc(*text, out);
+	}
+	fputc('"', out);
+}
+
+// Function: writeValue
+// Description: Writes a value as a C constant of the generated program's wicInt type.
+// Params: Output file, value.
+// Returns: None.
+// Modifies: Output file.
+static void writeValue(FILE* out, wicInt value)
+{
+	if (value == WIC_INT_MIN)
+		fprintf(out, "WIC_MIN");
+	else if (value < 0)
+		fprintf(out, "(" WIC_INT_FORMAT "%s)", value, value < INT_MIN ? VALUE_SUFFIX : "");
+	else
+		fprintf(out, WIC_INT_FORMAT "%s", value, value > INT_MAX ? VALUE_SUFFIX : "");
+}
+
+// Function: writeSlot
+// Description: Writes the C expression for a variable slot: the local holding a variable, or the value of a constant slot.
+// Params: Output file, slot.
+// Returns: None.
+// Modifies: Output file.
+static void writeSlot(FILE* out, int slot)
+{
+	if (slot < vmVariableCount)
+		fprintf(out, "v%d", slot);
+	else
+		writeValue(out, vmVariables[slot]);
+}
+
+// Function: writeUnderflowCheck
+// Description: Writes the check a dynamic-stack instruction makes before popping, with the engines' error message.
+// Params: Output file, values needed, instruction.
+// Returns: None.
+// Modifies: Output file.
+static void writeUnderflowCheck(FILE* out, int n, instructionType* inst)
+{
+	fprintf(out, "\tif (depth < %d)\n\t{\n\t\tprintf(\"\\nStack underflow on line %%d!\\n\", %d);\n\t\tgoto done;\n\t}\n",
+		n, inst -> line);
+}
+
+// Function: writeCommon
+// Description: Writes the instructions that do not touch the stack, which are the same in both forms of the program.
+// Params: Output file, instruction, label prefix ('L' or 'D').
+// Returns: 1 if the instruction was written, 0 if it uses the stack.
+// Modifies: Output file.
+static int writeCommon(FILE* out, instructionType* inst, char prefix)
+{
+	static const char* comparisons[6] = {"==", "!=", "<", "<=", ">", ">="};
+	static const char* operators[3] = {"ADD", "SUB", "MULT"};
+	switch (inst -> op)
+	{
+	case OP_NOP:
+	case OP_LABEL:
+		return 1;
+	case OP_GET:
+		fprintf(out, "\tprintf(\"Enter %%s > \", ");
+		writeString(out, inst -> operand);
+		fprintf(out, ");\n\tscanf(WIC_FORMAT, &v%d);\n", inst -> arg.slot);
+		return 1;
+	case OP_PUT:
+		fprintf(out, "\tprintf(\"%%s = \" WIC_FORMAT \"\\n\", ");
+		writeString(out, inst -> operand);
+		fprintf(out, ", v%d);\n", inst -> arg.slot);
+		return 1;
+	case OP_J:
+		fprintf(out, "\tgoto %c%d;\n", prefix, inst -> arg.target);
+		return 1;
+	case OP_HALT:
+		fprintf(out, "\tgoto halt;\n");
+		return 1;
+	case OP_MOVE:
+		fprintf(out, "\tv%d = ", inst -> arg.slot);
+		writeSlot(out, inst -> a);
+		fprintf(out, ";\n");
+		return 1;
+	case OP_ADDV:
+	case OP_SUBV:
+	case OP_MULTV:
+		fprintf(out, "\t%s(v%d, ", operators[inst -> op - OP_ADDV], inst -> arg.slot);
+		writeSlot(out, inst -> a);
+		fprintf(out, ", ");
+		writeSlot(out, inst -> b);
+		fprintf(out, ", %d);\n", inst -> line);
+		return 1;
+	case OP_JFEQ:
+	case OP_JFNE:
+	case OP_JFLT:
+	case OP_JFLE:
+	case OP_JFGT:
+	case OP_JFGE:
+		fprintf(out, "\tSUB(t, ");
+		writeSlot(out, inst -> a);
+		fprintf(out, ", ");
+		writeSlot(out, inst -> b);
+		fprintf(out, ", %d);\n\tif (!(t %s 0))\n\t\tgoto %c%d;\n", inst -> line, comparisons[inst -> op - OP_JFEQ], prefix,
+			inst -> arg.target);
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+// Function: writeStatic
+// Description: Writes one instruction for the static form of the program, where the stack depth at every instruction is
+//                known and stack value n is the local sn.
+// Params: Output file, address in codeTab.
+// Returns: None.
+// Modifies: Output file.
+static void writeStatic(FILE* out, int pc)
+{
+	static const char* tests[7] = {"==", "==", "!=", "<", "<=", ">", ">="};
+	static const char* operators[4] = {"ADD", "SUB", "MULT", "DIV"};
+	instructionType* inst = &vmCodeTab.instructions[pc];
+	int d = vmCodeTab.depths[pc];
+	if (writeCommon(out, inst, 'L'))
+		return;
+	switch (inst -> op)
+	{
+	case OP_PUSH:
+		fprintf(out, "\ts%d = v%d;\n", d + 1, inst -> arg.slot);
+		break;
+	case OP_PUSHI:
+		fprintf(out, "\ts%d = ", d + 1);
+		writeValue(out, inst -> arg.immediate);
+		fprintf(out, ";\n");
+		break;
+	case OP_POP:
+		fprintf(out, "\tv%d = s%d;\n", inst -> arg.slot, d);
+		break;
+	case OP_ADD:
+	case OP_SUB:
+	case OP_MULT:
+	case OP_DIV:
+		fprintf(out, "\t%s(s%d, s%d, s%d, %d);\n", operators[inst -> op - OP_ADD], d - 1, d - 1, d, inst -> line);
+		break;
+	case OP_AND:
+		fprintf(out, "\ts%d = s%d > 0 && s%d > 0;\n", d - 1, d, d - 1);
+		break;
+	case OP_OR:
+		fprintf(out, "\ts%d = s%d != 0 || s%d != 0;\n", d - 1, d, d - 1);
+		break;
+	case OP_NOT:
+	case OP_TSTEQ:
+	case OP_TSTNE:
+	case OP_TSTLT:
+	case OP_TSTLE:
+	case OP_TSTGT:
+	case OP_TSTGE:
+		fprintf(out, "\ts%d = s%d %s 0;\n", d, d, tests[inst -> op - OP_NOT]);
+		break;
+	case OP_JF:
+		fprintf(out, "\tif (s%d == 0)\n\t\tgoto L%d;\n", d, inst -> arg.target);
+		break;
+	default:
+		// OP_END: running off the end restarts the program.
+		fprintf(out, "\tgoto L0;\n");
+		break;
+	}
+}
+
+// Function: writeDynamic
+// Description: Writes one instruction for the dynamic form of the program, which keeps the stack in a growable array and
+//                checks for underflow exactly as the engines do.
+// Params: Output file, address in codeTab.
+// Returns: None.
+// Modifies: Output file.
+static void writeDynamic(FILE* out, int pc)
+{
+	static const char* tests[7] = {"==", "==", "!=", "<", "<=", ">", ">="};
+	static const char* operators[4] = {"ADD", "SUB", "MULT", "DIV"};
+	instructionType* inst = &vmCodeTab.instructions[pc];
+	if (writeCommon(out, inst, 'D'))
+		return;
+	switch (inst -> op)
+	{
+	case OP_PUSH:
+		fprintf(out, "\tpush(v%d);\n", inst -> arg.slot);
+		break;
+	case OP_PUSHI:
+		fprintf(out, "\tpush(");
+		writeValue(out, inst -> arg.immediate);
+		fprintf(out, ");\n");
+		break;
+	case OP_POP:
+		writeUnderflowCheck(out, 1, inst);
+		fprintf(out, "\tv%d = stack[depth--];\n", inst -> arg.slot);
+		break;
+	case OP_ADD:
+	case OP_SUB:
+	case OP_MULT:
+	case OP_DIV:
+		writeUnderflowCheck(out, 2, inst);
+		fprintf(out, "\tdepth--;\n\t%s(stack[depth], stack[depth], stack[depth + 1], %d);\n", operators[inst -> op - OP_ADD],
+			inst -> line);
+		break;
+	case OP_AND:
+		writeUnderflowCheck(out, 2, inst);
+		fprintf(out, "\tdepth--;\n\tstack[depth] = stack[depth + 1] > 0 && stack[depth] > 0;\n");
+		break;
+	case OP_OR:
+		writeUnderflowCheck(out, 2, inst);
+		fprintf(out, "\tdepth--;\n\tstack[depth] = stack[depth + 1] != 0 || stack[depth] != 0;\n");
+		break;
+	case OP_NOT:
+	case OP_TSTEQ:
+	case OP_TSTNE:
+	case OP_TSTLT:
+	case OP_TSTLE:
+	case OP_TSTGT:
+	case OP_TSTGE:
+		writeUnderflowCheck(out, 1, inst);
+		fprintf(out, "\tstack[depth] = stack[depth] %s 0;\n", tests[inst -> op - OP_NOT]);
+		break;
+	case OP_JF:
+		writeUnderflowCheck(out, 1, inst);
+		fprintf(out, "\tif (stack[depth--] == 0)\n\t\tgoto D%d;\n", inst -> arg.target);
+		break;
+	default:
+		fprintf(out, "\tgoto D0;\n");
+		break;
+	}
+}
+
+// Function: transpileProgram
+// Description: Writes the executed program (codeTab) as a standalone C program with the same behaviour as the engines:
+//                the same prompts, output, error messages, final tables and timing line. Each jump target becomes a C label,
+//                each variable a local wicInt, and each stack depth a local too wherever analyzeStack knows the depth. Where
+//                it does not the program runs from a second copy that keeps the stack in an array. Arithmetic overflows as
+//                the current overflow mode says, except that promoting is treated as trapping - the generated program has
+//                no bignums to carry on with.
+// Params: Output file.
+// Returns: None.
+// Modifies: Output file.
+void transpileProgram(FILE* out)
+{
+	int count = vmCodeTab.instructionCount;
+	int useStatic = vmCodeTab.maxDepth >= 0;
+	int useDynamic = !useStatic;
+	int wraps = currentVm -> overflowMode == OVERFLOW_WRAP;
+	int hasHalt = 0;
+	int hasCompare = 0;
+	int hasErrors = useDynamic;
+	char* staticLabel = (char*) calloc(count + 1, 1);
+	char* dynamicLabel = (char*) calloc(count + 1, 1);
+	int i;
+	staticLabel[0] = 1;
+	dynamicLabel[0] = 1;
+	for (i = 0; i < count; i++)
+	{
+		instructionType* inst = &vmCodeTab.instructions[i];
+		if (inst -> op == OP_J || inst -> op == OP_JF || (inst -> op >= OP_JFEQ && inst -> op <= OP_JFGE))
+		{
+			staticLabel[inst -> arg.target] = 1;
+			dynamicLabel[inst -> arg.target] = 1;
+		}
+		if (inst -> op == OP_HALT)
+			hasHalt = 1;
+		if (inst -> op >= OP_JFEQ && inst -> op <= OP_JFGE)
+			hasCompare = 1;
+		if (inst -> op == OP_DIV || (!wraps && (inst -> op == OP_ADD || inst -> op == OP_SUB || inst -> op == OP_MULT ||
+			(inst -> op >= OP_ADDV && inst -> op <= OP_JFGE))))
+			hasErrors = 1;
+	}
+
+	fprintf(out, "// Generated by wicc - do not edit.\n");
+	fprintf(out, "#include <stdio.h>\n#include <stdlib.h>\n#include <time.h>\n\n");
+	fprintf(out, "typedef %s wicInt;\ntypedef unsigned %s wicUnsigned;\n", VALUE_TYPE, VALUE_TYPE);
+	fprintf(out, "#define WIC_FORMAT \"%s\"\n", WIC_INT_FORMAT);
+	fprintf(out, "#define WIC_MIN (-" WIC_INT_FORMAT "%s - 1)\n", WIC_INT_MAX, VALUE_SUFFIX);
+	fprintf(out, "#define DIVISOR(b, line) if ((b) == 0) { printf(\"\\nDivide by Zero error on line %%d\\n\", line); goto done; }\n");
+	fprintf(out, "%s\n", wraps ? wrappingArithmetic : checkedArithmetic);
+	if (useDynamic)
+	{
+		fprintf(out, "// Operand stack for code whose stack depth is not known statically. stack[0] is unused.\n");
+		fprintf(out, "static wicInt* stack;\nstatic int depth;\nstatic int capacity;\n\n");
+		fprintf(out, "static void push(wicInt x)\n{\n\tif (depth + 1 == capacity)\n\t{\n\t\tcapacity *= 2;\n");
+		fprintf(out, "\t\tstack = (wicInt*) realloc(stack, capacity * sizeof(wicInt));\n\t\tif (stack == NULL)\n\t\t{\n");
+		fprintf(out, "\t\t\tprintf(\"Out of memory!\\n\");\n\t\t\texit(5);\n\t\t}\n\t}\n\tstack[++depth] = x;\n}\n\n");
+	}
+	fprintf(out, "int main(void)\n{\n\tclock_t c0, c1;\n");
+	if (hasCompare)
+		fprintf(out, "\twicInt t;\n");
+	for (i = 0; i < vmSymbolTable.size; i++)
+		fprintf(out, "\twicInt v%d = 0; // %s\n", vmSymbolTable.entries[i].value, vmSymbolTable.entries[i].key);
+	for (i = 1; useStatic && i <= vmCodeTab.maxDepth; i++)
+		fprintf(out, "\twicInt s%d;\n", i);
+	if (useDynamic)
+	{
+		fprintf(out, "\tcapacity = %d;\n", vmCodeTab.maxDepth + 2 > 64 ? vmCodeTab.maxDepth + 2 : 64);
+		fprintf(out, "\tstack = (wicInt*) malloc(capacity * sizeof(wicInt));\n");
+	}
+	fprintf(out, "\tc0 = clock();\n");
+
+	if (useStatic)
+	{
+		for (i = 0; i <= count; i++)
+		{
+			if (staticLabel[i])
+				fprintf(out, "L%d:\n", i);
+			if (vmCodeTab.depths[i] >= 0 || i == count)
+				writeStatic(out, i);
+		}
+	}
+	if (useDynamic)
+	{
+		for (i = 0; i <= count; i++)
+		{
+			if (dynamicLabel[i])
+				fprintf(out, "D%d:\n", i);
+			writeDynamic(out, i);
+		}
+	}
+
+	if (hasHalt)
+	{
+		fprintf(out, "halt:\n\tprintf(\"\\nHalted!\\n\");\n\tprintf(\"\\nJump Tables Values: \\n\");\n");
+		for (i = 0; i < vmJumpTable.size; i++)
+		{
+			fprintf(out, "\tprintf(\"Label: <%%s>, Address: <%%d>\\n\", ");
+			writeString(out, vmJumpTable.entries[i].key);
+			fprintf(out, ", %d);\n", vmJumpTable.entries[i].value);
+		}
+		fprintf(out, "\tprintf(\"\\nSymbol Table Values: \\n\");\n");
+		for (i = 0; i < vmSymbolTable.size; i++)
+		{
+			fprintf(out, "\tprintf(\"Symbol: <%%s>, Value: <\" WIC_FORMAT \">\\n\", ");
+			writeString(out, vmSymbolTable.entries[i].key);
+			fprintf(out, ", v%d);\n", vmSymbolTable.entries[i].value);
+		}
+	}
+	if (hasErrors)
+		fprintf(out, "done:\n");
+	fprintf(out, "\tc1 = clock();\n\tprintf(\"\\nElapsed Time:        %%f\\n\", (float) (c1 - c0)/CLOCKS_PER_SEC);\n");
+	fprintf(out, "\treturn 0;\n}\n");
+	free(staticLabel);
+	free(dynamicLabel);
+}
@@ -0,0 +1,8 @@
+#ifndef WICC_H
+#define WICC_H
+#include <stdio.h>
+
+// wicc - ahead-of-time WIC to C translator. Writes the executed program (codeTab) out as a standalone C program.
+void transpileProgram(FILE* out);
+
+#endif